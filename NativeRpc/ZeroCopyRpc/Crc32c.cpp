@@ -0,0 +1,267 @@
+#include "Crc32c.h"
+
+#include <cstring>
+
+#if defined(__SSE4_2__)
+#include <immintrin.h>
+#define ZEROCOPYRPC_CRC32C_HW 1
+#if defined(__AVX512F__) && defined(__VPCLMULQDQ__)
+#define ZEROCOPYRPC_CRC32C_FOLD 1
+#endif
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define ZEROCOPYRPC_CRC32C_HW 1
+#endif
+
+namespace {
+    // Castagnoli polynomial, bit reflected.
+    constexpr uint32_t Poly = 0x82f63b78;
+    // The hardware loop runs three streams of this many bytes side by side, the CRC instruction has a latency of three
+    // cycles but issues every cycle. Short streams keep fragment sized buffers interleaved as well.
+    constexpr size_t LongStream = 8192;
+    constexpr size_t ShortStream = 256;
+
+    // a * b modulo Poly, where 0x80000000 stands for 1.
+    uint32_t MultModP(uint32_t a, uint32_t b)
+    {
+        uint32_t m = 1u << 31;
+        uint32_t p = 0;
+        for (;;) {
+            if (a & m) {
+                p ^= b;
+                if ((a & (m - 1)) == 0)
+                    break;
+            }
+            m >>= 1;
+            b = b & 1 ? (b >> 1) ^ Poly : b >> 1;
+        }
+        return p;
+    }
+
+    // x^n modulo Poly.
+    uint32_t PowerModP(size_t n)
+    {
+        uint32_t result = 1u << 31;
+        uint32_t power = 1u << 30; // x
+        for (; n != 0; n >>= 1) {
+            if (n & 1)
+                result = MultModP(power, result);
+            power = MultModP(power, power);
+        }
+        return result;
+    }
+
+    // The operator that appends n zero bytes to a CRC.
+    uint32_t ZeroBytes(size_t n)
+    {
+        return PowerModP(8 * n);
+    }
+
+    // Multipliers of the low and high half of a 16-byte block that carry it bytes forward, see Folded.
+    struct FoldConstant {
+        uint64_t Low;
+        uint64_t High;
+
+        static FoldConstant Of(size_t bytes) { return { PowerModP(8 * bytes + 31), PowerModP(8 * bytes - 33) }; }
+    };
+
+    struct Tables {
+        uint32_t Bytes[8][256];
+        // Append LongStream and ShortStream zero bytes to a CRC, a byte of the CRC at a time.
+        uint32_t Long[4][256];
+        uint32_t Short[4][256];
+        FoldConstant Fold256 = FoldConstant::Of(256);
+        FoldConstant Fold64 = FoldConstant::Of(64);
+        FoldConstant Fold48 = FoldConstant::Of(48);
+        FoldConstant Fold32 = FoldConstant::Of(32);
+        FoldConstant Fold16 = FoldConstant::Of(16);
+
+        Tables()
+        {
+            for (uint32_t n = 0; n < 256; n++) {
+                uint32_t c = n;
+                for (int k = 0; k < 8; k++)
+                    c = c & 1 ? (c >> 1) ^ Poly : c >> 1;
+                Bytes[0][n] = c;
+            }
+            for (uint32_t n = 0; n < 256; n++)
+                for (int k = 1; k < 8; k++)
+                    Bytes[k][n] = (Bytes[k - 1][n] >> 8) ^ Bytes[0][Bytes[k - 1][n] & 0xff];
+            Fill(Long, ZeroBytes(LongStream));
+            Fill(Short, ZeroBytes(ShortStream));
+        }
+
+        static void Fill(uint32_t (&table)[4][256], uint32_t op)
+        {
+            for (int k = 0; k < 4; k++)
+                for (uint32_t n = 0; n < 256; n++)
+                    table[k][n] = MultModP(op, n << (8 * k));
+        }
+    };
+
+    const Tables& GetTables()
+    {
+        static const Tables tables;
+        return tables;
+    }
+
+    inline uint32_t Shift(const uint32_t (&table)[4][256], uint32_t crc)
+    {
+        return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff] ^ table[2][(crc >> 16) & 0xff] ^ table[3][crc >> 24];
+    }
+
+#if defined(__SSE4_2__)
+    inline uint32_t Crc8(uint32_t crc, uint64_t v, const Tables&) { return static_cast<uint32_t>(_mm_crc32_u64(crc, v)); }
+    inline uint32_t Crc1(uint32_t crc, uint8_t v, const Tables&) { return _mm_crc32_u8(crc, v); }
+#elif defined(ZEROCOPYRPC_CRC32C_HW)
+    inline uint32_t Crc8(uint32_t crc, uint64_t v, const Tables&) { return __crc32cd(crc, v); }
+    inline uint32_t Crc1(uint32_t crc, uint8_t v, const Tables&) { return __crc32cb(crc, v); }
+#else
+    inline uint32_t Crc8(uint32_t crc, uint64_t v, const Tables& t)
+    {
+        crc ^= static_cast<uint32_t>(v);
+        uint32_t high = static_cast<uint32_t>(v >> 32);
+        return t.Bytes[7][crc & 0xff] ^ t.Bytes[6][(crc >> 8) & 0xff] ^ t.Bytes[5][(crc >> 16) & 0xff] ^ t.Bytes[4][crc >> 24]
+            ^ t.Bytes[3][high & 0xff] ^ t.Bytes[2][(high >> 8) & 0xff] ^ t.Bytes[1][(high >> 16) & 0xff] ^ t.Bytes[0][high >> 24];
+    }
+    inline uint32_t Crc1(uint32_t crc, uint8_t v, const Tables& t) { return (crc >> 8) ^ t.Bytes[0][(crc ^ v) & 0xff]; }
+#endif
+
+    // Loads 8 bytes at offset i and, when copying, stores them to dst.
+    template<bool Copy>
+    inline uint64_t Take(uint8_t* dst, const uint8_t* src, size_t i)
+    {
+        uint64_t v;
+        std::memcpy(&v, src + i, sizeof(v));
+        if constexpr (Copy)
+            std::memcpy(dst + i, &v, sizeof(v));
+        return v;
+    }
+
+#if defined(ZEROCOPYRPC_CRC32C_HW)
+    // Runs three streams of block bytes at a time from offset i, the CRCs of the later two are appended to the first.
+    template<bool Copy>
+    size_t Interleaved(uint32_t& crc, uint8_t* dst, const uint8_t* src, size_t i, size_t size, size_t block,
+        const uint32_t (&shift)[4][256], const Tables& t)
+    {
+        while (size - i >= 3 * block) {
+            uint32_t crc1 = 0;
+            uint32_t crc2 = 0;
+            for (const size_t end = i + block; i < end; i += 8) {
+                crc = Crc8(crc, Take<Copy>(dst, src, i), t);
+                crc1 = Crc8(crc1, Take<Copy>(dst, src, i + block), t);
+                crc2 = Crc8(crc2, Take<Copy>(dst, src, i + 2 * block), t);
+            }
+            crc = Shift(shift, crc) ^ crc1;
+            crc = Shift(shift, crc) ^ crc2;
+            i += 2 * block;
+        }
+        return i;
+    }
+#endif
+
+#if defined(ZEROCOPYRPC_CRC32C_FOLD)
+    inline __m128i Fold(__m128i x, const FoldConstant& k)
+    {
+        __m128i m = _mm_set_epi64x(static_cast<int64_t>(k.High), static_cast<int64_t>(k.Low));
+        return _mm_xor_si128(_mm_clmulepi64_si128(x, m, 0x00), _mm_clmulepi64_si128(x, m, 0x11));
+    }
+
+    inline __m512i Fold(__m512i x, __m512i k, __m512i data)
+    {
+        return _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x, k, 0x00), _mm512_clmulepi64_epi128(x, k, 0x11), data, 0x96);
+    }
+
+    inline __m512i Broadcast(const FoldConstant& k)
+    {
+        return _mm512_broadcast_i32x4(_mm_set_epi64x(static_cast<int64_t>(k.High), static_cast<int64_t>(k.Low)));
+    }
+
+    // Carry-less multiplication folds four 64-byte accumulators 256 bytes at a time; the CRC instruction only
+    // reduces what is left. Runs from offset i while at least 512 bytes remain.
+    template<bool Copy>
+    size_t Folded(uint32_t& crc, uint8_t* dst, const uint8_t* src, size_t i, size_t size, const Tables& t)
+    {
+        if (size - i < 512)
+            return i;
+        auto load = [&](size_t at) {
+            __m512i v = _mm512_loadu_si512(src + at);
+            if constexpr (Copy)
+                _mm512_storeu_si512(dst + at, v);
+            return v;
+        };
+        // The register is carried in by xoring it into the first bytes, folding then starts from 0.
+        __m512i x0 = _mm512_xor_si512(load(i), _mm512_zextsi128_si512(_mm_cvtsi32_si128(static_cast<int>(crc))));
+        __m512i x1 = load(i + 64);
+        __m512i x2 = load(i + 128);
+        __m512i x3 = load(i + 192);
+        i += 256;
+
+        const __m512i k256 = Broadcast(t.Fold256);
+        for (; size - i >= 256; i += 256) {
+            x0 = Fold(x0, k256, load(i));
+            x1 = Fold(x1, k256, load(i + 64));
+            x2 = Fold(x2, k256, load(i + 128));
+            x3 = Fold(x3, k256, load(i + 192));
+        }
+        const __m512i k64 = Broadcast(t.Fold64);
+        x1 = Fold(x0, k64, x1);
+        x2 = Fold(x1, k64, x2);
+        x3 = Fold(x2, k64, x3);
+
+        __m128i r = _mm_xor_si128(_mm512_extracti32x4_epi32(x3, 3), Fold(_mm512_extracti32x4_epi32(x3, 0), t.Fold48));
+        r = _mm_xor_si128(r, Fold(_mm512_extracti32x4_epi32(x3, 1), t.Fold32));
+        r = _mm_xor_si128(r, Fold(_mm512_extracti32x4_epi32(x3, 2), t.Fold16));
+        crc = static_cast<uint32_t>(_mm_crc32_u64(0, static_cast<uint64_t>(_mm_extract_epi64(r, 0))));
+        crc = static_cast<uint32_t>(_mm_crc32_u64(crc, static_cast<uint64_t>(_mm_extract_epi64(r, 1))));
+        return i;
+    }
+#endif
+
+    // crc is the register, without the final inversion.
+    template<bool Copy>
+    uint32_t Update(uint32_t crc, uint8_t* dst, const uint8_t* src, size_t size)
+    {
+        const auto& t = GetTables();
+        size_t i = 0;
+        for (; i < size && (reinterpret_cast<uintptr_t>(src + i) & 7) != 0; i++) {
+            if constexpr (Copy)
+                dst[i] = src[i];
+            crc = Crc1(crc, src[i], t);
+        }
+#if defined(ZEROCOPYRPC_CRC32C_FOLD)
+        i = Folded<Copy>(crc, dst, src, i, size, t);
+#endif
+#if defined(ZEROCOPYRPC_CRC32C_HW)
+        i = Interleaved<Copy>(crc, dst, src, i, size, LongStream, t.Long, t);
+        i = Interleaved<Copy>(crc, dst, src, i, size, ShortStream, t.Short, t);
+#endif
+        for (; i + 8 <= size; i += 8)
+            crc = Crc8(crc, Take<Copy>(dst, src, i), t);
+        for (; i < size; i++) {
+            if constexpr (Copy)
+                dst[i] = src[i];
+            crc = Crc1(crc, src[i], t);
+        }
+        return crc;
+    }
+}
+
+uint32_t Crc32c(const void* data, size_t size, uint32_t crc)
+{
+    return ~Update<false>(~crc, nullptr, static_cast<const uint8_t*>(data), size);
+}
+
+uint32_t Crc32cCopy(void* dst, const void* src, size_t size, uint32_t crc)
+{
+    return ~Update<true>(~crc, static_cast<uint8_t*>(dst), static_cast<const uint8_t*>(src), size);
+}
+
+bool IsCrc32cAccelerated()
+{
+#if defined(ZEROCOPYRPC_CRC32C_HW)
+    return true;
+#else
+    return false;
+#endif
+}
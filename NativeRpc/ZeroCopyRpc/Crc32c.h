@@ -0,0 +1,15 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "Export.h"
+
+// CRC32C (Castagnoli) of size bytes, continuing crc: Crc32c(b, n, Crc32c(a, m)) is the CRC of a followed by b.
+// Uses the SSE4.2 or ARMv8 CRC instructions when the build targets them (see IsCrc32cAccelerated), three
+// independent streams at a time, folded with VPCLMULQDQ on AVX-512 builds, and a slicing-by-8 table otherwise.
+EXPORT uint32_t Crc32c(const void* data, size_t size, uint32_t crc = 0);
+
+// Copies size bytes from src to dst and returns their CRC32C, so that src is read once.
+EXPORT uint32_t Crc32cCopy(void* dst, const void* src, size_t size, uint32_t crc = 0);
+
+EXPORT bool IsCrc32cAccelerated();
@@ -3,9 +3,12 @@
 #include "CyclicMemoryPool.hpp"
 #include "Export.h"
 #include <iostream>
+#include <algorithm>
 #include <boost/log/trivial.hpp>
 
 #include "ZeroCopyRpcException.h"
+#include "Crc32c.h"
+#include "PublishClock.h"
 
 
 class  CyclicBuffer
@@ -28,14 +31,30 @@ private:
 public:
     struct  Entry
     {
+        static constexpr uint32_t HasChecksum = 1;
+        // Bits of Flags that hold the TimestampClock of Timestamp, None when the entry has no timestamps.
+        static constexpr uint32_t ClockShift = 8;
+        static constexpr uint32_t ClockMask = 0xffu << ClockShift;
+
         size_t Size;
         ulong Type;
         size_t Offset;
+        // CRC32C of the message, valid when Flags has HasChecksum.
+        uint32_t Checksum;
+        uint32_t Flags;
+        // When the message was committed to this buffer, in the clock of Flags (see PublishClock).
+        ulong Timestamp;
+        // System clock ns of the original publish, carried over by replicators; equal to the commit where it was published.
+        ulong Origin;
+
+        TimestampClock Clock() const { return static_cast<TimestampClock>((Flags & ClockMask) >> ClockShift); }
     };
     struct  Accessor
     {
         Entry* Item = nullptr;
         CyclicBuffer* Buffer = nullptr;
+        // Position the item was written at, see CyclicBuffer::IsLive.
+        ulong Index = 0;
         template<typename T>
         T* As() const
         {
@@ -44,12 +63,25 @@ public:
         inline bool IsValid() { return Item != nullptr; }
         inline uint32_t Size() { return Item->Size; }
         inline uint64_t Type() { return Item->Type;  }
+        inline bool HasChecksum() { return (Item->Flags & Entry::HasChecksum) != 0; }
+        inline uint32_t Checksum() { return Item->Checksum; }
+        inline bool HasTimestamp() { return Item->Clock() != TimestampClock::None; }
+        inline TimestampClock Clock() { return Item->Clock(); }
+        inline ulong Timestamp() { return Item->Timestamp; }
+        inline ulong Origin() { return Item->Origin; }
+        // ns since the message was committed to this buffer, 0 when it has no timestamp.
+        ulong Age() { return HasTimestamp() ? PublishClock::Elapsed(Clock(), Item->Timestamp, PublishClock::Now(Clock())) : 0; }
+        // False only when the message has a checksum that does not match it.
+        bool Verify() { return !HasChecksum() || Crc32c(Get(), Size()) == Item->Checksum; }
+        // False once the writer wrapped over the message, see CyclicBuffer::IsLive. What was read from it before is
+        // whole only if it is still live after.
+        bool IsLive() { return Buffer != nullptr && Buffer->IsLive(Index); }
         Accessor() : Item(nullptr), Buffer(nullptr)
         {
 	        
         }
         Accessor(const Accessor&) = delete;
-        Accessor(Accessor&& other) noexcept : Item(other.Item), Buffer(other.Buffer) {
+        Accessor(Accessor&& other) noexcept : Item(other.Item), Buffer(other.Buffer), Index(other.Index) {
             other.Item = nullptr;
             other.Buffer = nullptr;
         }
@@ -57,14 +89,16 @@ public:
             if (this != &other) {
                 Item = other.Item;
                 Buffer = other.Buffer;
+                Index = other.Index;
                 other.Item = nullptr;
                 other.Buffer = nullptr;
             }
             return *this;
         }
-        Accessor(::CyclicBuffer::Entry* item, CyclicBuffer* buffer)
+        Accessor(::CyclicBuffer::Entry* item, CyclicBuffer* buffer, ulong index = 0)
             : Item(item),
-            Buffer(buffer)
+            Buffer(buffer),
+            Index(index)
         {
         }
 
@@ -74,6 +108,22 @@ public:
     {
         CyclicMemoryPool::Span Span;
         unsigned long Type;
+        // CRC32C of the committed bytes, stored with the entry when HasChecksum is set (see SetChecksum).
+        uint32_t Checksum = 0;
+        bool HasChecksum = false;
+        // The entry is stamped at commit in this clock (see Entry::Timestamp), Origin is kept when a replicator set it.
+        TimestampClock Clock = TimestampClock::None;
+        ulong Origin = 0;
+        void SetChecksum(uint32_t checksum)
+        {
+            Checksum = checksum;
+            HasChecksum = true;
+        }
+        void SetTimestamp(TimestampClock clock, ulong origin = 0)
+        {
+            Clock = clock;
+            Origin = origin;
+        }
         ~WriterScope()
         {
             auto written = Span.CommitedSize();
@@ -85,7 +135,15 @@ public:
 
                 long prvSize = nx >= capacity ? _parent->_items[(nx - capacity) % capacity].Size : 0;
                 _parent->_state->_currentSize.fetch_add(static_cast<int64_t>(written) - static_cast<int64_t>(prvSize));
-                _parent->_items[nx % capacity] = Entry{ written, Type, Span.StartOffset() };
+                uint32_t flags = (HasChecksum ? Entry::HasChecksum : 0u) | (static_cast<uint32_t>(Clock) << Entry::ClockShift);
+                ulong timestamp = 0;
+                if (Clock != TimestampClock::None)
+                {
+                    timestamp = PublishClock::Now(Clock);
+                    if (Origin == 0)
+                        Origin = PublishClock::SystemNow();
+                }
+                _parent->_items[nx % capacity] = Entry{ written, Type, Span.StartOffset(), Checksum, flags, timestamp, Origin };
                 auto prv = nxAtm->fetch_add(1);
                 BOOST_LOG_TRIVIAL(debug) << "WriteScope, next-index increased: " << prv << "->" << nxAtm->load();
             }
@@ -94,6 +152,10 @@ public:
         WriterScope(WriterScope&& other) noexcept
             : Span(std::move(other.Span)),
             Type(other.Type),
+            Checksum(other.Checksum),
+            HasChecksum(other.HasChecksum),
+            Clock(other.Clock),
+            Origin(other.Origin),
             _parent(other._parent)
         {
             other._parent = nullptr;
@@ -120,7 +182,7 @@ public:
         Accessor Data() const
         {
             auto item = &(_parent->_items[(Index) % *_parent->_capacity]);
-            return Accessor(item, _parent);
+            return Accessor(item, _parent, Index);
         }
         Cursor(ulong index, CyclicBuffer* parent)
             : Index(index),
@@ -175,20 +237,115 @@ public:
     {
         return Cursor(at-1, this);
     }
-    WriterScope WriteScope(ulong minSize, ulong type)
+    // Waits up to wait while another writer, of this or another process, holds the buffer.
+    WriterScope WriteScope(ulong minSize, ulong type, std::chrono::nanoseconds wait = std::chrono::nanoseconds::zero())
     {
-        auto span = _memory->GetWriteSpan(minSize);
+        auto span = _memory->GetWriteSpan(minSize, wait);
         return WriterScope(std::move(span), type, this); // Explicitly use std::move for the span
     }
     ulong NextIndex() const
     {
         return _nextIndex->load();
     }
+    // Number of item entries.
+    ulong Capacity() const
+    {
+        return *_capacity;
+    }
+    // Type of the item written at index, as long as its entry was not reused.
+    ulong TypeAt(ulong index) const
+    {
+        return _items[index % *_capacity].Type;
+    }
+    // The index, or the oldest index whose entry was not reused when it fell more than a lap behind; for readers that
+    // step over entries by TypeAt, which would otherwise see the types of newer items.
+    ulong WithinLap(ulong index) const
+    {
+        ulong next = _nextIndex->load();
+        unsigned long capacity = *_capacity;
+        return next - std::min(index, next) > capacity ? next - capacity : index;
+    }
+    const Entry& EntryAt(ulong index) const
+    {
+        return _items[index % *_capacity];
+    }
+    // True while the item written at index is still in the buffer: its entry was not reused, no later item was written
+    // over its bytes and the span of the writer in progress does not cover them. Readers that copy an item out call it
+    // afterwards, to know that the copy is whole.
+    bool IsLive(ulong index) const
+    {
+        // Orders the caller's reads of the item before the loads below. The span is loaded before the index: a writer
+        // records its item before it lets go of the span.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        size_t spanStart = 0, spanEnd = 0;
+        bool writing = _memory->OpenSpan(spanStart, spanEnd);
+        ulong next = _nextIndex->load();
+        unsigned long capacity = *_capacity;
+        if (index >= next || next - index >= capacity)
+            return false;
+
+        const Entry& item = _items[index % capacity];
+        size_t start = item.Offset, end = item.Offset + item.Size;
+        auto overlaps = [start, end](size_t from, size_t to) { return from < end && start < to; };
+        if (writing && overlaps(spanStart, spanEnd))
+            return false;
+        for (ulong i = index + 1; i < next; i++) {
+            const Entry& later = _items[i % capacity];
+            if (overlaps(later.Offset, later.Offset + later.Size))
+                return false;
+        }
+        // None of the entries was reused meanwhile.
+        return _nextIndex->load() - index < capacity;
+    }
+    // True when an item of size bytes can be written without overwriting the item at index keep or any later one.
+    // Exact for the memory pool, keeps one entry spare as IsLive does.
+    bool CanWrite(ulong size, ulong keep) const
+    {
+        ulong next = _nextIndex->load();
+        if (keep >= next)
+            return true;
+        if (next + 1 - keep >= *_capacity)
+            return false;
+
+        // Items [keep, next) occupy the pool from the start of keep up to the write offset, possibly wrapped.
+        size_t start = _items[keep % *_capacity].Offset;
+        size_t end = _memory->Offset();
+        size_t poolSize = _memory->Size();
+        if (end > start)
+            return size <= poolSize - end || size <= start;
+        return size <= poolSize - end && end + size <= start;
+    }
+    // Index of the oldest item that is still in the buffer, NextIndex when there is none. Newer items outlive older
+    // ones, so it is a binary search over IsLive.
+    ulong OldestLive() const
+    {
+        ulong next = _nextIndex->load();
+        unsigned long capacity = *_capacity;
+        ulong low = next >= capacity ? next - capacity + 1 : 0;
+        ulong high = next;
+        while (low < high)
+        {
+            ulong mid = low + (high - low) / 2;
+            if (IsLive(mid))
+                high = mid;
+            else
+                low = mid + 1;
+        }
+        return low;
+    }
 
     bool Unlock()
     {
         return _memory->Unlock();
     }
+    pid_t Writer() const
+    {
+        return _memory->Writer();
+    }
+    bool UnlockOwnedBy(pid_t pid)
+    {
+        return _memory->UnlockOwnedBy(pid);
+    }
    
     
 
@@ -1,5 +1,11 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
 #include "TypeDefs.h"
+#include "ProcessUtils.h"
 
 class CyclicMemoryPool
 {
@@ -11,7 +17,8 @@ private:
     bool _external;
     size_t *_offset;
     unsigned long* _size;
-    std::atomic<bool>* _inUse;
+    // Pid of the process that holds the write span, 0 when none does; writers of several processes take turns.
+    std::atomic<uint32_t>* _inUse;
 
     size_t Remaining() const { return *_size - *_offset; }
 
@@ -19,8 +26,11 @@ private:
     {
         size_t _offset;
         unsigned long _size;
-        std::atomic<bool> _inUse;
-        State(size_t size): _offset(0), _size(size), _inUse(false) {  }
+        std::atomic<uint32_t> _inUse;
+        // Bytes the holder of the lock may write, see OpenSpan.
+        size_t _spanStart;
+        size_t _spanEnd;
+        State(size_t size): _offset(0), _size(size), _inUse(0), _spanStart(0), _spanEnd(0) {  }
     };
 public:
 
@@ -53,10 +63,18 @@ public:
             _committed += size;
             (*_parent->_offset) += size;  // Move parent pointer forward
         }
+        // Ends the span size bytes after its start, readers then know the rest of the pool is not written.
+        void Limit(size_t size) {
+            if (size < _committed) {
+                throw std::runtime_error("Span is limited below what was committed.");
+            }
+            Size = std::min(Size, size);
+            _parent->_state->_spanEnd = StartOffset() + Size;
+        }
 
         ~Span() {
             if (_parent) {
-                _parent->_inUse->store(false);  // Release the lock
+                _parent->_inUse->store(0);  // Release the lock
             }
         }
 
@@ -87,9 +105,27 @@ public:
     /// <returns></returns>
     bool Unlock()
     {
-        bool desired = false;
-        bool t = true;
-        return _inUse->compare_exchange_weak(t, desired);
+        return _inUse->exchange(0) != 0;
+    }
+    // Process that holds the write span, 0 when none does.
+    pid_t Writer() const
+    {
+        return static_cast<pid_t>(_inUse->load());
+    }
+    // True while a writer holds the lock, with the bytes of the pool it may write.
+    bool OpenSpan(size_t& start, size_t& end) const
+    {
+        if (_inUse->load() == 0)
+            return false;
+        start = _state->_spanStart;
+        end = _state->_spanEnd;
+        return true;
+    }
+    // Releases the lock of a writer that died holding it, true when it did.
+    bool UnlockOwnedBy(pid_t pid)
+    {
+        uint32_t owner = static_cast<uint32_t>(pid);
+        return _inUse->compare_exchange_strong(owner, 0);
     }
     // WHen we initialize structures;
     CyclicMemoryPool(byte* externalBuffer, size_t size) : _state(new ((byte*)externalBuffer) State(size)),
@@ -124,6 +160,8 @@ public:
         return (T*)(_buffer + offset);
     }
     size_t Size() const { return *_size; }
+    // Where the next span starts, unless it does not fit before the end of the pool.
+    size_t Offset() const { return *_offset; }
     byte* End() { return _buffer + *_offset; }
 
     template<typename T, typename... Args>
@@ -135,24 +173,33 @@ public:
         return ptr;
     }
 
-    Span GetWriteSpan(size_t minSize) {
+    // Waits up to wait for the span of another writer to end.
+    Span GetWriteSpan(size_t minSize, std::chrono::nanoseconds wait = std::chrono::nanoseconds::zero()) {
         if (minSize > *_size) {
             throw std::runtime_error("Requested size exceeds buffer capacity.");
         }
 
-        size_t freeSpace = Remaining();
-        bool expected = false;
-
+        uint32_t owner = static_cast<uint32_t>(getCurrentProcessId());
+        uint32_t expected = 0;
         // Try to acquire the lock
-        if (!_inUse->compare_exchange_strong(expected, true)) {
-            throw std::runtime_error("Buffer is already in use.");
+        if (!_inUse->compare_exchange_strong(expected, owner)) {
+            auto deadline = std::chrono::steady_clock::now() + wait;
+            do {
+                if (std::chrono::steady_clock::now() >= deadline)
+                    throw std::runtime_error("Buffer is already in use.");
+                std::this_thread::yield();
+                expected = 0;
+            } while (!_inUse->compare_exchange_weak(expected, owner));
         }
+        size_t freeSpace = Remaining();
 
         // Check if there is enough space, or reset the pointer to reuse the buffer
         if (freeSpace < minSize) {
             *_offset = 0;
             freeSpace = *_size;
         }
+        _state->_spanStart = *_offset;
+        _state->_spanEnd = *_offset + freeSpace;
 
         return Span(this->End(), freeSpace, this);
     }
@@ -0,0 +1,180 @@
+#pragma once
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#endif
+
+// Tracks which fragments of a frame were received: a flat bitmap and a counter of set bits, so completeness is a
+// comparison and setting a bit touches one word. Bitmaps of up to InlineBits live inside the object, larger ones in a
+// heap buffer that is kept across reset, so a reused bitmap does not allocate. Padding bits of the last word are set,
+// scans never report them.
+template<size_t InlineBits = 8192>
+class FragmentBitmap {
+public:
+    using Word = uint64_t;
+    static constexpr size_t BitsPerWord = 64;
+
+    // Fragments [First, End) are missing.
+    struct Range {
+        size_t First;
+        size_t End;
+    };
+
+    explicit FragmentBitmap(size_t bits = 1) {
+        reset(bits);
+    }
+
+    // Clears all bits and changes the size.
+    void reset(size_t bits) {
+        if (bits == 0)
+            throw std::invalid_argument("BitSet size must be positive");
+        numBits = bits;
+        numWords = (bits + BitsPerWord - 1) / BitsPerWord;
+        setCount = 0;
+        if (numWords > inlineWords.size())
+            heapWords.assign(numWords, 0);
+        else
+            std::memset(inlineWords.data(), 0, numWords * sizeof(Word));
+        if (bits % BitsPerWord != 0)
+            words()[numWords - 1] = ~Word(0) << (bits % BitsPerWord);
+    }
+
+    // Returns false when the bit was already set.
+    bool setBit(size_t index) {
+        if (index >= numBits)
+            throw std::out_of_range("Bit index out of range");
+        Word& word = words()[index / BitsPerWord];
+        Word mask = Word(1) << (index % BitsPerWord);
+        if (word & mask)
+            return false;
+        word |= mask;
+        setCount++;
+        return true;
+    }
+
+    bool getBit(size_t index) const {
+        if (index >= numBits)
+            throw std::out_of_range("Bit index out of range");
+        return (words()[index / BitsPerWord] >> (index % BitsPerWord)) & 1;
+    }
+
+    bool isComplete() const { return setCount == numBits; }
+    size_t count() const { return setCount; }
+    size_t size() const { return numBits; }
+
+    // Index of the first bit at or after from that is not set, size() when there is none.
+    size_t findUnset(size_t from) const {
+        if (from >= numBits)
+            return numBits;
+        const Word* w = words();
+        size_t word = from / BitsPerWord;
+        Word unset = ~w[word] & (~Word(0) << (from % BitsPerWord));
+        if (unset == 0) {
+            word = skipFull(word + 1);
+            if (word == numWords)
+                return numBits;
+            unset = ~w[word];
+        }
+        return word * BitsPerWord + std::countr_zero(unset);
+    }
+
+    // Index of the first bit at or after from that is set, size() when there is none.
+    size_t findSet(size_t from) const {
+        if (from >= numBits)
+            return numBits;
+        const Word* w = words();
+        size_t word = from / BitsPerWord;
+        Word set = w[word] & (~Word(0) << (from % BitsPerWord));
+        if (set == 0) {
+            word = skipEmpty(word + 1);
+            if (word == numWords)
+                return numBits;
+            set = w[word];
+        }
+        size_t index = word * BitsPerWord + std::countr_zero(set);
+        return index < numBits ? index : numBits;
+    }
+
+    // Copies up to count words, starting with the word of bit firstWord * 64, with bits inverted: a set bit in out
+    // is a bit that is not set yet. Returns number of words copied.
+    size_t copyUnset(size_t firstWord, Word* out, size_t count) const {
+        const Word* w = words();
+        size_t copied = 0;
+        for (size_t word = firstWord; word < numWords && copied < count; word++)
+            out[copied++] = ~w[word];
+        return copied;
+    }
+
+    // Fills out with up to max ranges of bits in [from, end) that are not set. Returns number of ranges.
+    size_t missingRanges(size_t from, size_t end, Range* out, size_t max) const {
+        if (end > numBits)
+            end = numBits;
+        size_t ranges = 0;
+        while (ranges < max) {
+            size_t first = findUnset(from);
+            if (first >= end)
+                break;
+            size_t last = findSet(first);
+            from = last < end ? last : end;
+            out[ranges++] = Range{ first, from };
+        }
+        return ranges;
+    }
+
+private:
+    Word* words() { return numWords > inlineWords.size() ? heapWords.data() : inlineWords.data(); }
+    const Word* words() const { return numWords > inlineWords.size() ? heapWords.data() : inlineWords.data(); }
+
+    // First word at or after word that has a bit not set, numWords when all are set.
+    size_t skipFull(size_t word) const {
+        const Word* w = words();
+#if defined(__AVX2__)
+        const __m256i ones = _mm256_set1_epi64x(-1);
+        for (; word + 4 <= numWords; word += 4)
+            if (!_mm256_testc_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + word)), ones))
+                break;
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        const __m128i ones = _mm_set1_epi32(-1);
+        for (; word + 2 <= numWords; word += 2)
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(w + word)), ones)) != 0xFFFF)
+                break;
+#endif
+        for (; word < numWords; word++)
+            if (w[word] != ~Word(0))
+                break;
+        return word;
+    }
+
+    // First word at or after word that has a bit set, numWords when none is.
+    size_t skipEmpty(size_t word) const {
+        const Word* w = words();
+#if defined(__AVX2__)
+        for (; word + 4 <= numWords; word += 4) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + word));
+            if (!_mm256_testz_si256(v, v))
+                break;
+        }
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        const __m128i zero = _mm_setzero_si128();
+        for (; word + 2 <= numWords; word += 2)
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(w + word)), zero)) != 0xFFFF)
+                break;
+#endif
+        for (; word < numWords; word++)
+            if (w[word] != 0)
+                break;
+        return word;
+    }
+
+    std::array<Word, (InlineBits + BitsPerWord - 1) / BitsPerWord> inlineWords;
+    std::vector<Word> heapWords;
+    size_t numBits = 0;
+    size_t numWords = 0;
+    size_t setCount = 0;
+};
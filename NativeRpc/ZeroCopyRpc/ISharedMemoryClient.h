@@ -2,7 +2,13 @@
 #include <string>
 #include <memory>
 #include "CyclicBuffer.hpp"
+#include "Messages.h"
+#include "LatencyHistogram.h"
+#include "MessageSchema.h"
+#include "TopicWriter.h"
+#include "ZeroCopyRpcException.h"
 #include <chrono>
+#include <vector>
 
 class EXPORT ISubscriptionCursor {
 public:
@@ -15,6 +21,56 @@ public:
     virtual bool TryRead(CyclicBuffer::Accessor& accessor) = 0;
     virtual CyclicBuffer::Accessor Read() = 0;
 
+    // Of the messages read that have timestamps (see TopicWriter::SetTimestamps): time from the commit to this topic's
+    // buffer, and from the original publish by the system clock, which spans the replication hops. Call them on the
+    // thread that reads.
+    virtual LatencyHistogram Latency() const { return {}; }
+    virtual LatencyHistogram EndToEndLatency() const { return {}; }
+
+    // Reads the next message into data, for readers that the writer does not wait for and may lap while they read, as
+    // on a conflating topic. The copy is checked with Accessor::IsLive and, when the message was written over, the read
+    // is retried with the message that follows: what is returned is always whole. False when none came in time.
+    bool TryReadCopyFor(std::vector<uint8_t>& data, uint64_t& type, const std::chrono::milliseconds& timeout)
+    {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        CyclicBuffer::Accessor accessor;
+        while (true)
+        {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            if (!TryReadFor(accessor, std::max(remaining, std::chrono::milliseconds(0))))
+                return false;
+            const uint8_t* start = accessor.Get();
+            data.assign(start, start + accessor.Size());
+            type = accessor.Type();
+            if (accessor.IsLive())
+                return true;
+        }
+    }
+
+    // Reads the next message as a T, that stays valid as long as the accessor does. Throws ZeroCopyRpcException when
+    // the message is of another type or its variable-length fields do not fit it.
+    template<SchemaMessage T>
+    const T& Read(CyclicBuffer::Accessor& accessor)
+    {
+        accessor = Read();
+        return Typed<T>(accessor);
+    }
+    // nullptr when there is no message.
+    template<SchemaMessage T>
+    const T* TryRead(CyclicBuffer::Accessor& accessor)
+    {
+        return TryRead(accessor) ? &Typed<T>(accessor) : nullptr;
+    }
+
+private:
+    template<SchemaMessage T>
+    static const T& Typed(CyclicBuffer::Accessor& accessor)
+    {
+        auto message = MessageSchema<T>::View(accessor.Get(), accessor.Size(), accessor.Type());
+        if (message == nullptr)
+            throw ZeroCopyRpcException("The message is not of the expected schema.");
+        return *message;
+    }
 };
 
 class EXPORT ISharedMemoryClient {
@@ -24,6 +80,28 @@ public:
     // Connect to the shared memory.
     virtual void Connect() = 0;
 
-    // Subscribe to a topic and return a subscription cursor.
-    virtual std::unique_ptr<ISubscriptionCursor> Subscribe(const std::string& topicName) = 0;
+    // Subscribe to a topic and return a subscription cursor. By default only messages published after subscribing are
+    // read, start can replay messages that are still in the topic buffer. With a filter, the cursor is woken for and
+    // reads only messages of the filtered types.
+    virtual std::unique_ptr<ISubscriptionCursor> Subscribe(const std::string& topicName, const SubscribeStart& start = {},
+        const TypeFilter& filter = {}) = 0;
+
+    // MessageSchema::Hash stored with the topic, 0 when it has no schema.
+    virtual ulong SchemaHash(const std::string& topicName) = 0;
+
+    // Publishes into a topic the server created, alongside the server and other clients. Connect first, so that the
+    // server unlocks the topic should this process die while writing. The writer is used by one thread at a time and
+    // does not outlive the client.
+    virtual std::unique_ptr<TopicWriter> OpenPublisher(const std::string& topicName) = 0;
+
+    // Subscribes to the messages of type T only. Throws ZeroCopyRpcException when the topic has the schema of another
+    // layout.
+    template<SchemaMessage T>
+    std::unique_ptr<ISubscriptionCursor> Subscribe(const std::string& topicName, const SubscribeStart& start = {})
+    {
+        auto hash = SchemaHash(topicName);
+        if (hash != 0 && hash != MessageSchema<T>::Hash)
+            throw ZeroCopyRpcException("The topic has another schema than the subscriber.");
+        return Subscribe(topicName, start, TypeFilter::Of({ MessageSchema<T>::TypeId }));
+    }
 };
\ No newline at end of file
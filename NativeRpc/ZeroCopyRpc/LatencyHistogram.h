@@ -0,0 +1,57 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+
+#include "TypeDefs.h"
+
+// Log2 histogram of latencies in ns. Bucket 0 counts latencies under 64ns, bucket i under 64ns << i, the last one
+// everything longer. Not synchronized, it belongs to the thread that records.
+struct LatencyHistogram
+{
+    static constexpr int Buckets = 32;
+
+    std::array<ulong, Buckets> Counts{};
+    ulong Count = 0;
+    ulong Sum = 0;
+    ulong Max = 0;
+
+    static int Bucket(ulong ns)
+    {
+        int bucket = static_cast<int>(std::bit_width(ns >> 6));
+        return bucket < Buckets ? bucket : Buckets - 1;
+    }
+    // Upper bound of the bucket in ns.
+    static ulong BucketLimit(int bucket) { return 64ul << bucket; }
+
+    void Record(ulong ns)
+    {
+        Counts[Bucket(ns)]++;
+        Count++;
+        Sum += ns;
+        Max = std::max(Max, ns);
+    }
+    void Merge(const LatencyHistogram& other)
+    {
+        for (int i = 0; i < Buckets; i++)
+            Counts[i] += other.Counts[i];
+        Count += other.Count;
+        Sum += other.Sum;
+        Max = std::max(Max, other.Max);
+    }
+    // Upper bound in ns of the latency the given fraction of the records is under, never above Max; 0 when empty.
+    ulong Percentile(double fraction) const
+    {
+        if (Count == 0)
+            return 0;
+        ulong rank = static_cast<ulong>(fraction * static_cast<double>(Count));
+        ulong seen = 0;
+        for (int i = 0; i < Buckets; i++) {
+            seen += Counts[i];
+            if (seen > rank)
+                return std::min(BucketLimit(i), Max);
+        }
+        return Max;
+    }
+    ulong Mean() const { return Count != 0 ? Sum / Count : 0; }
+};
@@ -0,0 +1,265 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <new>
+#include <span>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+
+#include "TypeDefs.h"
+#include "ZeroCopyRpcException.h"
+
+// Typed messages. A message is a trivially copyable struct that declares its type id and its fields:
+//
+//     struct CameraFrame {
+//         static constexpr ulong TypeId = 10;
+//         ulong FrameId;
+//         uint32_t Width, Height;
+//         InlineArray<byte> Pixels;
+//         InlineString Label;
+//         static constexpr auto Fields() {
+//             return std::make_tuple(SchemaField("FrameId", &CameraFrame::FrameId), SchemaField("Width", &CameraFrame::Width),
+//                 SchemaField("Height", &CameraFrame::Height), SchemaField("Pixels", &CameraFrame::Pixels),
+//                 SchemaField("Label", &CameraFrame::Label));
+//         }
+//     };
+//
+// Variable-length fields are written after the fixed part, in the same span, and hold the offset of their data
+// relative to themselves; readers access them in place. MessageSchema<T>::Hash digests the type id and the layout:
+// sizes, alignments, and the names and types of the fields in order. It is stored with a topic and checked when a
+// typed subscriber subscribes (see TopicWriter::SetSchema and ISharedMemoryClient::Subscribe<T>). Fields must be
+// listed in declaration order, and all of them, for the hash to describe the layout.
+
+// Elements of a variable-length field, laid out after the fixed part of the message.
+template<typename T>
+struct InlineArray
+{
+    static_assert(std::is_trivially_copyable_v<T>, "Inline arrays hold trivially copyable elements only.");
+    typedef T Element;
+
+    // From the address of this field to the first element.
+    uint32_t Offset = 0;
+    uint32_t Count = 0;
+
+    const T* Data() const
+    {
+        return Count == 0 ? nullptr : reinterpret_cast<const T*>(reinterpret_cast<const byte*>(this) + Offset);
+    }
+    size_t Size() const { return Count; }
+    std::span<const T> Span() const { return { Data(), Count }; }
+    const T& operator[](size_t index) const { return Data()[index]; }
+    const T* begin() const { return Data(); }
+    const T* end() const { return Data() + Count; }
+};
+
+// Characters of a variable-length string, without a terminating zero.
+struct InlineString : InlineArray<char>
+{
+    std::string_view View() const { return { Data(), Count }; }
+};
+
+template<typename TMessage, typename TField>
+struct SchemaField
+{
+    typedef TField Type;
+    std::string_view Name;
+    TField TMessage::* Member;
+
+    constexpr SchemaField(std::string_view name, TField TMessage::* member) : Name(name), Member(member) {}
+};
+
+// A struct with a field list, that can be a field of a message.
+template<typename T>
+concept SchemaLayout = std::is_trivially_copyable_v<T> && std::is_standard_layout_v<T> && requires { T::Fields(); };
+
+template<typename T>
+concept SchemaMessage = SchemaLayout<T> && requires { { T::TypeId } -> std::convertible_to<ulong>; };
+
+namespace SchemaDetail
+{
+    template<typename T> struct IsInlineArray : std::false_type {};
+    template<typename T> struct IsInlineArray<InlineArray<T>> : std::true_type {};
+    template<typename T> struct IsStdArray : std::false_type {};
+    template<typename T, size_t N> struct IsStdArray<std::array<T, N>> : std::true_type {};
+    template<typename T> inline constexpr bool Unsupported = false;
+
+    // FNV-1a, stable across compilers and runs.
+    constexpr ulong Fnv(std::string_view text, ulong hash = 14695981039346656037ull)
+    {
+        for (char c : text)
+        {
+            hash ^= static_cast<byte>(c);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+    constexpr ulong Mix(ulong hash, ulong value)
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            hash ^= (value >> (i * 8)) & 0xff;
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    template<typename T>
+    constexpr ulong LayoutHash();
+
+    template<typename F>
+    constexpr ulong TypeHash()
+    {
+        if constexpr (std::is_same_v<F, bool>)
+            return Fnv("bool");
+        else if constexpr (std::is_same_v<F, char>)
+            return Fnv("char");
+        else if constexpr (std::is_enum_v<F>)
+            return Mix(Fnv("enum"), TypeHash<std::underlying_type_t<F>>());
+        else if constexpr (std::is_integral_v<F>)
+            return Mix(Fnv(std::is_signed_v<F> ? "int" : "uint"), sizeof(F));
+        else if constexpr (std::is_floating_point_v<F>)
+            return Mix(Fnv("float"), sizeof(F));
+        else if constexpr (std::is_same_v<F, InlineString>)
+            return Fnv("string");
+        else if constexpr (IsInlineArray<F>::value)
+            return Mix(Fnv("array"), TypeHash<typename F::Element>());
+        else if constexpr (std::is_array_v<F>)
+            return Mix(Mix(Fnv("fixed"), std::extent_v<F>), TypeHash<std::remove_extent_t<F>>());
+        else if constexpr (IsStdArray<F>::value)
+            return Mix(Mix(Fnv("fixed"), std::tuple_size_v<F>), TypeHash<typename F::value_type>());
+        else if constexpr (SchemaLayout<F>)
+            return LayoutHash<F>();
+        else
+            static_assert(Unsupported<F>, "The field type has no schema, give it a Fields() list.");
+    }
+
+    template<typename T>
+    constexpr ulong LayoutHash()
+    {
+        ulong hash = Mix(Mix(Fnv("struct"), sizeof(T)), alignof(T));
+        std::apply([&](const auto&... fields)
+        {
+            ((hash = Mix(Mix(hash, Fnv(fields.Name)), TypeHash<typename std::remove_cvref_t<decltype(fields)>::Type>())), ...);
+        }, T::Fields());
+        return hash;
+    }
+
+    template<typename T>
+    constexpr bool HasInlineFields()
+    {
+        bool found = false;
+        std::apply([&](const auto&... fields)
+        {
+            auto check = [&]<typename F>(std::type_identity<F>)
+            {
+                if constexpr (std::is_same_v<F, InlineString> || IsInlineArray<F>::value)
+                    found = true;
+                else if constexpr (SchemaLayout<F>)
+                    found = found || HasInlineFields<F>();
+            };
+            (check(std::type_identity<typename std::remove_cvref_t<decltype(fields)>::Type>{}), ...);
+        }, T::Fields());
+        return found;
+    }
+
+    // Checks that the variable-length fields of the layout at data point inside the message.
+    template<typename T>
+    bool Fits(const byte* message, size_t size, const T& layout)
+    {
+        bool fits = true;
+        std::apply([&](const auto&... fields)
+        {
+            auto check = [&](const auto& value)
+            {
+                typedef std::remove_cvref_t<decltype(value)> F;
+                if constexpr (std::is_same_v<F, InlineString> || IsInlineArray<F>::value)
+                {
+                    if (value.Count == 0)
+                        return;
+                    size_t at = reinterpret_cast<const byte*>(&value) - message + value.Offset;
+                    typedef std::remove_cvref_t<decltype(*value.Data())> E;
+                    fits = fits && value.Offset >= sizeof(F) && at <= size && value.Count <= (size - at) / sizeof(E);
+                }
+                else if constexpr (SchemaLayout<F> && !std::is_array_v<F>)
+                    fits = fits && Fits(message, size, value);
+            };
+            (check(layout.*(fields.Member)), ...);
+        }, T::Fields());
+        return fits;
+    }
+}
+
+template<SchemaMessage T>
+struct MessageSchema
+{
+    static constexpr ulong TypeId = T::TypeId;
+    static constexpr ulong Hash = SchemaDetail::Mix(SchemaDetail::LayoutHash<T>(), T::TypeId);
+    static_assert(Hash != 0, "0 stands for a topic without a schema.");
+    static constexpr bool HasInlineFields = SchemaDetail::HasInlineFields<T>();
+
+    // The message at data, when it is one of T and its variable-length fields lie within size bytes; nullptr
+    // otherwise.
+    static const T* View(const byte* data, size_t size, ulong type)
+    {
+        if (type != TypeId || data == nullptr || size < sizeof(T))
+            return nullptr;
+        auto message = reinterpret_cast<const T*>(data);
+        return SchemaDetail::Fits(data, size, *message) ? message : nullptr;
+    }
+};
+
+// Builds a message in place: the fixed part is value initialized at the start of the memory, variable-length fields
+// are appended after it, each aligned for its elements. Size() is what has to be committed.
+template<SchemaMessage T>
+class MessageWriter
+{
+public:
+    MessageWriter(byte* start, size_t capacity) : _start(start), _capacity(capacity), _size(sizeof(T))
+    {
+        if (capacity < sizeof(T))
+            throw ZeroCopyRpcException("The span is smaller than the message.");
+        _message = new (start) T();
+    }
+
+    T* operator->() { return _message; }
+    T& Message() { return *_message; }
+    size_t Size() const { return _size; }
+
+    // Reserves count elements of the field and points it at them, for the caller to fill in place.
+    template<typename U>
+    std::span<U> Allocate(InlineArray<U>& field, size_t count)
+    {
+        auto address = reinterpret_cast<byte*>(&field);
+        if (address < _start || address + sizeof(field) > _start + sizeof(T))
+            throw ZeroCopyRpcException("The field is not a field of this message.");
+        size_t at = (_size + alignof(U) - 1) & ~(alignof(U) - 1);
+        if (count > (_capacity - std::min(at, _capacity)) / sizeof(U))
+            throw ZeroCopyRpcException("The message does not fit the span, prepare more inline bytes.");
+        field.Offset = static_cast<uint32_t>(_start + at - address);
+        field.Count = static_cast<uint32_t>(count);
+        _size = at + count * sizeof(U);
+        return { reinterpret_cast<U*>(_start + at), count };
+    }
+    template<typename U>
+    void Assign(InlineArray<U>& field, std::span<const U> values)
+    {
+        auto target = Allocate(field, values.size());
+        if (!values.empty())
+            std::memcpy(target.data(), values.data(), values.size_bytes());
+    }
+    void Assign(InlineString& field, std::string_view value)
+    {
+        Assign<char>(field, std::span<const char>(value.data(), value.size()));
+    }
+
+private:
+    byte* _start;
+    size_t _capacity;
+    size_t _size;
+    T* _message;
+};
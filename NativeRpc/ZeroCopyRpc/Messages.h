@@ -2,9 +2,13 @@
 
 #include "TypeDefs.h"
 #include <boost/uuid/uuid.hpp>
+#include <future>
+#include <initializer_list>
+#include <stdexcept>
 #include "Random.h"
 #include "ProcessUtils.h"
 #include "CrossPlatform.h"
+#include "TopicMetrics.h"
 
 using namespace boost::uuids;
 
@@ -24,11 +28,25 @@ struct RemoveTopic
         return os << "Topic name: " << obj.TopicName;
     }
 };
+// How subscribers read a topic.
+enum class TopicMode : byte
+{
+    // Every message, in order.
+    Queue = 0,
+    // Only the latest message: a subscriber is woken when the topic changes and reads the newest message, messages
+    // published meanwhile are skipped. For state-like topics, a slow subscriber never falls behind.
+    Conflate = 1,
+    // Every message, in order, and none is lost: the publisher waits for the slowest subscriber instead of
+    // overwriting messages it did not read yet (see TopicWriter::SetBackPressure).
+    Lossless = 2
+};
+
 struct CreateTopic
 {
     char TopicName[256];
     unsigned int MaxMessageCount;
     unsigned int BufferSize;
+    TopicMode Mode = TopicMode::Queue;
 
     inline void SetTopicName(const std::string& str)
     {
@@ -125,6 +143,11 @@ struct UnSubscribeCommand
         strncpy_s(TopicName, str.c_str(), sizeof(TopicName) - 1);  // Leave room for null terminator
     }
 };
+// Sent by the server's process watchdog to its own dispatcher, when a client process exited.
+struct ClientExited
+{
+    pid_t ExitedPid;
+};
 struct UnSubscribeResponse
 {
     bool IsSuccess;
@@ -137,11 +160,75 @@ struct UnSubscribeResponse
     }
 };
 
+// Where a new subscription starts reading, positions are indexes of messages in the topic buffer.
+enum class SubscribeFrom : byte
+{
+    // Only messages published after subscribing.
+    Latest = 0,
+    // The oldest message that is still in the buffer.
+    Oldest = 1,
+    // Message at Position, or the oldest one when it was already overwritten.
+    Sequence = 2,
+    // Last Position messages, as far as they are still in the buffer.
+    LastN = 3
+};
+
+struct SubscribeStart
+{
+    SubscribeFrom From = SubscribeFrom::Latest;
+    ulong Position = 0;
+
+    static SubscribeStart Latest() { return SubscribeStart{ SubscribeFrom::Latest, 0 }; }
+    static SubscribeStart Oldest() { return SubscribeStart{ SubscribeFrom::Oldest, 0 }; }
+    static SubscribeStart At(ulong sequence) { return SubscribeStart{ SubscribeFrom::Sequence, sequence }; }
+    static SubscribeStart Last(ulong count) { return SubscribeStart{ SubscribeFrom::LastN, count }; }
+};
+
+// Message types a subscription is woken for, the server signals it only for messages of these types and its cursor
+// steps over the others. Empty accepts every type.
+struct TypeFilter
+{
+    static constexpr byte Capacity = 16;
+
+    byte Count = 0;
+    ulong Types[Capacity] = {};
+
+    static TypeFilter Any() { return TypeFilter{}; }
+    static TypeFilter Of(std::initializer_list<ulong> types)
+    {
+        TypeFilter filter;
+        for (auto type : types)
+            filter.Add(type);
+        return filter;
+    }
+    void Add(ulong type)
+    {
+        for (byte i = 0; i < Count; i++)
+            if (Types[i] == type)
+                return;
+        if (Count == Capacity)
+            throw std::invalid_argument("Too many types in a subscription filter.");
+        Types[Count++] = type;
+    }
+    bool IsAny() const { return Count == 0; }
+    bool Accepts(ulong type) const
+    {
+        if (Count == 0)
+            return true;
+        for (byte i = 0; i < Count; i++)
+            if (Types[i] == type)
+                return true;
+        return false;
+    }
+};
+
 struct SubscribeCommand {
 	// TODO: Should be char*, and have static SizeOf method. Allocation should be done by in-place operator.
     char TopicName[256];
+    SubscribeStart Start;
+    TypeFilter Filter;
 
-    SubscribeCommand() : TopicName{}
+    SubscribeCommand() : TopicName{}, Start{}, Filter{}
     {
 
     }
@@ -160,32 +247,67 @@ private:
 
 struct TopicMetadata
 {
+    static constexpr uint32_t MagicValue = 0x5A51544F; // "ZQTO"
+    // Bumped whenever anything in the region moves; regions of another version are not reused.
+    static constexpr uint32_t CurrentVersion = 2;
+
+    uint32_t Magic;
+    uint32_t Version;
     ulong TotalBufferSize;
     ulong SubscribesTableSize;
     ulong BufferItemCapacity;
     ulong BufferSize;
+    TopicMode Mode;
+    // MessageSchema::Hash of the messages of the topic, 0 when it has no schema.
+    ulong SchemaHash;
 
-    ulong TotalSize()
+    // The metrics block follows the buffer, on a cache line boundary.
+    ulong TotalSize() const
     {
-        return sizeof(TopicMetadata) + TotalBufferSize + SubscribesTableSize;
+        return sizeof(TopicMetadata) + TotalBufferSize + SubscribesTableSize + alignof(TopicMetrics) + sizeof(TopicMetrics);
+    }
+    // Whether a region of regionSize bytes that starts with this metadata has the current layout.
+    bool IsValid(ulong regionSize) const
+    {
+        return regionSize >= sizeof(TopicMetadata) && Magic == MagicValue && Version == CurrentVersion
+            && regionSize >= TotalSize();
     }
     void* MetadataAddress(void* base) { return base; }
     void* SubscribersTableAddress(void* base) { return (void*)((size_t)base + sizeof(TopicMetadata)); }
     void* BufferAddress(void* base) { return (void*)((size_t)base + sizeof(TopicMetadata) + SubscribesTableSize); }
+    void* MetricsAddress(void* base)
+    {
+        size_t end = (size_t)base + sizeof(TopicMetadata) + SubscribesTableSize + TotalBufferSize;
+        return (void*)((end + alignof(TopicMetrics) - 1) & ~(alignof(TopicMetrics) - 1));
+    }
 };
 
 #pragma pack(pop)
 
 struct SubscriptionSharedData
 {
+    // Index of the first message of the subscription.
     std::atomic<ulong> NextIndex;
-    std::atomic<ulong> Notified;
+    // Messages below this index were released on the subscription semaphore, one release per message that passes the
+    // filter.
+    std::atomic<ulong> Released;
+    // Maintained by the subscriber of a lossless topic: the oldest message it may still access, an accessor is valid
+    // until the next read. Older messages may be overwritten.
+    std::atomic<ulong> Consumed;
     std::atomic<bool> PendingRemove;
     std::atomic<bool> Active;
     pid_t Pid;
-    void Reset(pid_t pid) {
+    TypeFilter Filter;
+    // Changes whenever the slot is given to a new subscription, so that publishers of other processes know when the
+    // semaphore they opened for it is stale.
+    std::atomic<ulong> Generation;
+    void Reset(pid_t pid, ulong first, const TypeFilter& filter) {
+        Generation.fetch_add(1);
         Pid = pid;
-        Notified.store(0);
+        Filter = filter;
+        NextIndex.store(first);
+        Released.store(first);
+        Consumed.store(first);
         Active.store(true);
         PendingRemove.store(false);
     }
@@ -203,4 +325,5 @@ typedef RequestResponseEnvelope<CreateTopic, 2, TopicService*> CreateSubscriptio
 typedef RequestResponseEnvelope<RemoveTopic, 8, bool> RemoveSubscriptionEnvelope;
 
 typedef RequestEnvelope<HelloCommand, 3> HelloCommandEnvelope;
-typedef ResponseEnvelope<HelloResponse, 4> HelloResponseEnvelope;
\ No newline at end of file
+typedef ResponseEnvelope<HelloResponse, 4> HelloResponseEnvelope;
+typedef RequestEnvelope<ClientExited, 9> ClientExitedEnvelope;
\ No newline at end of file
@@ -0,0 +1,390 @@
+#include "PayloadCompression.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+#include "ZeroCopyRpcException.h"
+
+#if defined(__linux__)
+#include <time.h>
+#endif
+#if defined(ZEROCOPYRPC_LZ4)
+#include <lz4.h>
+#endif
+#if defined(ZEROCOPYRPC_ZSTD)
+#include <zstd.h>
+#endif
+#if defined(ZEROCOPYRPC_ZLIB)
+#include <zlib.h>
+#endif
+
+namespace {
+
+    int64_t ThreadCpuTime()
+    {
+#if defined(__linux__)
+        timespec ts;
+        ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return static_cast<int64_t>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+#if defined(ZEROCOPYRPC_ZSTD)
+    // Contexts are reused by every thread, zstd allocates a lot for a new one.
+    ZSTD_CCtx* CompressionContext()
+    {
+        thread_local std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> context(ZSTD_createCCtx(), &ZSTD_freeCCtx);
+        return context.get();
+    }
+
+    ZSTD_DCtx* DecompressionContext()
+    {
+        thread_local std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> context(ZSTD_createDCtx(), &ZSTD_freeDCtx);
+        return context.get();
+    }
+#endif
+
+    size_t CompressBound(CompressionCodec codec, size_t size)
+    {
+        switch (codec) {
+#if defined(ZEROCOPYRPC_LZ4)
+        case CompressionCodec::Lz4: return static_cast<size_t>(LZ4_compressBound(static_cast<int>(size)));
+#endif
+#if defined(ZEROCOPYRPC_ZSTD)
+        case CompressionCodec::Zstd: return ZSTD_compressBound(size);
+#endif
+#if defined(ZEROCOPYRPC_ZLIB)
+        case CompressionCodec::Deflate: return compressBound(static_cast<uLong>(size));
+#endif
+        default: return 0;
+        }
+    }
+
+    // Returns the compressed size, 0 when the chunk could not be compressed into capacity bytes.
+    size_t CompressChunk(CompressionCodec codec, int level, const uint8_t* src, size_t size, uint8_t* dst, size_t capacity)
+    {
+        switch (codec) {
+#if defined(ZEROCOPYRPC_LZ4)
+        case CompressionCodec::Lz4:
+            return static_cast<size_t>(LZ4_compress_fast(reinterpret_cast<const char*>(src), reinterpret_cast<char*>(dst),
+                static_cast<int>(size), static_cast<int>(capacity), level > 0 ? level : 1));
+#endif
+#if defined(ZEROCOPYRPC_ZSTD)
+        case CompressionCodec::Zstd: {
+            auto written = ZSTD_compressCCtx(CompressionContext(), dst, capacity, src, size, level != 0 ? level : -1);
+            return ZSTD_isError(written) ? 0 : written;
+        }
+#endif
+#if defined(ZEROCOPYRPC_ZLIB)
+        case CompressionCodec::Deflate: {
+            uLongf written = static_cast<uLongf>(capacity);
+            return compress2(dst, &written, src, static_cast<uLong>(size), level != 0 ? level : 1) == Z_OK ? written : 0;
+        }
+#endif
+        default:
+            return 0;
+        }
+    }
+
+    bool DecompressChunk(CompressionCodec codec, const uint8_t* src, size_t size, uint8_t* dst, size_t rawSize)
+    {
+        switch (codec) {
+#if defined(ZEROCOPYRPC_LZ4)
+        case CompressionCodec::Lz4:
+            return LZ4_decompress_safe(reinterpret_cast<const char*>(src), reinterpret_cast<char*>(dst),
+                static_cast<int>(size), static_cast<int>(rawSize)) == static_cast<int>(rawSize);
+#endif
+#if defined(ZEROCOPYRPC_ZSTD)
+        case CompressionCodec::Zstd:
+            return ZSTD_decompressDCtx(DecompressionContext(), dst, rawSize, src, size) == rawSize;
+#endif
+#if defined(ZEROCOPYRPC_ZLIB)
+        case CompressionCodec::Deflate: {
+            uLongf written = static_cast<uLongf>(rawSize);
+            return uncompress(dst, &written, src, static_cast<uLong>(size)) == Z_OK && written == rawSize;
+        }
+#endif
+        default:
+            return false;
+        }
+    }
+}
+
+bool IsCodecSupported(CompressionCodec codec)
+{
+    return (SupportedCodecs() & (1u << static_cast<uint8_t>(codec))) != 0;
+}
+
+uint32_t SupportedCodecs()
+{
+    uint32_t codecs = 1u << static_cast<uint8_t>(CompressionCodec::None);
+#if defined(ZEROCOPYRPC_LZ4)
+    codecs |= 1u << static_cast<uint8_t>(CompressionCodec::Lz4);
+#endif
+#if defined(ZEROCOPYRPC_ZSTD)
+    codecs |= 1u << static_cast<uint8_t>(CompressionCodec::Zstd);
+#endif
+#if defined(ZEROCOPYRPC_ZLIB)
+    codecs |= 1u << static_cast<uint8_t>(CompressionCodec::Deflate);
+#endif
+    return codecs;
+}
+
+const char* CodecName(CompressionCodec codec)
+{
+    switch (codec) {
+    case CompressionCodec::None: return "none";
+    case CompressionCodec::Lz4: return "lz4";
+    case CompressionCodec::Zstd: return "zstd";
+    case CompressionCodec::Deflate: return "deflate";
+    default: return "unknown";
+    }
+}
+
+CompressionCodec ParseCodec(const std::string& name)
+{
+    for (auto codec : { CompressionCodec::None, CompressionCodec::Lz4, CompressionCodec::Zstd, CompressionCodec::Deflate })
+        if (name == CodecName(codec))
+            return codec;
+    throw std::invalid_argument("Unknown compression codec " + name + ", expected none, lz4, zstd or deflate.");
+}
+
+CompressionCodec NegotiateCodec(CompressionCodec preferred, uint32_t accepted)
+{
+    accepted &= SupportedCodecs();
+    if ((accepted & (1u << static_cast<uint8_t>(preferred))) != 0)
+        return preferred;
+    for (auto codec : { CompressionCodec::Lz4, CompressionCodec::Zstd, CompressionCodec::Deflate })
+        if ((accepted & (1u << static_cast<uint8_t>(codec))) != 0)
+            return codec;
+    return CompressionCodec::None;
+}
+
+CompressionPool::CompressionPool(size_t threads) : _threadCount(threads)
+{
+}
+
+CompressionPool::~CompressionPool()
+{
+    {
+        std::lock_guard lock(_mutex);
+        _stopping = true;
+    }
+    _work.notify_all();
+    for (auto& thread : _threads)
+        thread.join();
+}
+
+void CompressionPool::Run(size_t count, const std::function<void(size_t)>& job)
+{
+    if (count <= 1 || _threadCount == 0) {
+        for (size_t i = 0; i < count; i++)
+            job(i);
+        return;
+    }
+
+    Batch batch;
+    batch.Job = &job;
+    batch.Count = count;
+    {
+        std::lock_guard lock(_mutex);
+        while (_threads.size() < _threadCount)
+            _threads.emplace_back([this]() { WorkerLoop(); });
+        _batches.push_back(&batch);
+    }
+    _work.notify_all();
+    Work(batch);
+
+    // Once the batch is off the list no worker picks it up, the ones that hold it are waited for.
+    std::unique_lock lock(_mutex);
+    std::erase(_batches, &batch);
+    _done.wait(lock, [&batch]() { return batch.Done == batch.Count && batch.Users == 0; });
+}
+
+void CompressionPool::Work(Batch& batch)
+{
+    for (size_t i = batch.Next++; i < batch.Count; i = batch.Next++) {
+        (*batch.Job)(i);
+        if (++batch.Done == batch.Count) {
+            std::lock_guard lock(_mutex);
+            _done.notify_all();
+        }
+    }
+}
+
+void CompressionPool::WorkerLoop()
+{
+    std::unique_lock lock(_mutex);
+    while (true) {
+        Batch* batch = nullptr;
+        _work.wait(lock, [this, &batch]() {
+            for (auto b : _batches)
+                if (b->Next < b->Count) {
+                    batch = b;
+                    return true;
+                }
+            return _stopping;
+            });
+        if (batch == nullptr)
+            return;
+
+        batch->Users++;
+        lock.unlock();
+        Work(*batch);
+        lock.lock();
+        batch->Users--;
+        _done.notify_all();
+    }
+}
+
+PayloadCompressor::PayloadCompressor(CompressionConfig config, CompressionPool* pool)
+    : _config(config), _pool(pool)
+{
+    if (!IsCodecSupported(_config.Codec))
+        throw std::invalid_argument(std::string("Compression codec ") + CodecName(_config.Codec) + " is not compiled in.");
+    if (_config.ChunkSize == 0 || _config.ChunkSize > UINT32_MAX)
+        throw std::invalid_argument("Compression chunk size is out of range.");
+}
+
+CompressionCodec PayloadCompressor::Compress(const uint8_t* data, size_t size, std::vector<uint8_t>& out)
+{
+    auto codec = _config.Codec;
+    size_t wireSize = size;
+    std::atomic<int64_t> cpu{ 0 };
+
+    if (codec != CompressionCodec::None && size >= _config.MinSize && size <= UINT32_MAX) {
+        const size_t chunkSize = std::min(_config.ChunkSize, size);
+        const size_t chunks = (size + chunkSize - 1) / chunkSize;
+        const size_t bound = CompressBound(codec, chunkSize);
+        const size_t chunksStart = sizeof(CompressedFrameHeader) + chunks * sizeof(uint32_t);
+        out.resize(chunksStart + chunks * bound);
+        _chunkSizes.assign(chunks, 0);
+
+        // Every chunk is compressed into a slot of the bound size, then the chunks are moved together.
+        auto job = [&](size_t i) {
+            auto start = ThreadCpuTime();
+            size_t offset = i * chunkSize;
+            _chunkSizes[i] = static_cast<uint32_t>(CompressChunk(codec, _config.Level, data + offset,
+                std::min(chunkSize, size - offset), out.data() + chunksStart + i * bound, bound));
+            cpu += ThreadCpuTime() - start;
+        };
+        if (_pool != nullptr)
+            _pool->Run(chunks, job);
+        else
+            for (size_t i = 0; i < chunks; i++)
+                job(i);
+
+        size_t end = chunksStart;
+        for (size_t i = 0; i < chunks && end < size; i++) {
+            if (_chunkSizes[i] == 0) {
+                end = size;
+                break;
+            }
+            std::memmove(out.data() + end, out.data() + chunksStart + i * bound, _chunkSizes[i]);
+            end += _chunkSizes[i];
+        }
+        if (end < size) {
+            CompressedFrameHeader header{ static_cast<uint32_t>(size), static_cast<uint32_t>(chunkSize),
+                static_cast<uint32_t>(chunks), 0 };
+            std::memcpy(out.data(), &header, sizeof(header));
+            std::memcpy(out.data() + sizeof(header), _chunkSizes.data(), chunks * sizeof(uint32_t));
+            out.resize(end);
+            wireSize = end;
+        }
+    }
+
+    std::lock_guard lock(_statsMutex);
+    _stats.Frames++;
+    _stats.RawBytes += size;
+    _stats.WireBytes += wireSize;
+    _stats.CpuTime += std::chrono::nanoseconds(cpu.load());
+    if (wireSize == size)
+        return CompressionCodec::None;
+    _stats.Compressed++;
+    return codec;
+}
+
+CompressionStats PayloadCompressor::Stats() const
+{
+    std::lock_guard lock(_statsMutex);
+    return _stats;
+}
+
+PayloadDecompressor::PayloadDecompressor(CompressionPool* pool) : _pool(pool)
+{
+}
+
+size_t PayloadDecompressor::RawSize(const uint8_t* wire, size_t wireSize)
+{
+    CompressedFrameHeader header;
+    if (wireSize < sizeof(header))
+        return 0;
+    std::memcpy(&header, wire, sizeof(header));
+    if (header.ChunkSize == 0 || header.Chunks != (static_cast<uint64_t>(header.RawSize) + header.ChunkSize - 1) / header.ChunkSize)
+        return 0;
+    uint64_t expected = sizeof(header) + static_cast<uint64_t>(header.Chunks) * sizeof(uint32_t);
+    if (expected > wireSize)
+        return 0;
+    auto sizes = wire + sizeof(header);
+    for (uint32_t i = 0; i < header.Chunks; i++) {
+        uint32_t size;
+        std::memcpy(&size, sizes + i * sizeof(uint32_t), sizeof(size));
+        expected += size;
+    }
+    return expected == wireSize ? header.RawSize : 0;
+}
+
+void PayloadDecompressor::Decompress(CompressionCodec codec, const uint8_t* wire, size_t wireSize, uint8_t* dst, size_t dstSize)
+{
+    if (!IsCodecSupported(codec) || codec == CompressionCodec::None)
+        throw ZeroCopyRpcException("Compression codec is not compiled in.");
+    size_t rawSize = RawSize(wire, wireSize);
+    if (rawSize == 0 || rawSize != dstSize)
+        throw ZeroCopyRpcException("Compressed frame is corrupt.");
+
+    CompressedFrameHeader header;
+    std::memcpy(&header, wire, sizeof(header));
+    const uint8_t* chunks = wire + sizeof(header) + header.Chunks * sizeof(uint32_t);
+    _offsets.resize(header.Chunks + 1);
+    _offsets[0] = 0;
+    for (uint32_t i = 0; i < header.Chunks; i++) {
+        uint32_t size;
+        std::memcpy(&size, wire + sizeof(header) + i * sizeof(uint32_t), sizeof(size));
+        _offsets[i + 1] = _offsets[i] + size;
+    }
+
+    std::atomic<bool> failed{ false };
+    std::atomic<int64_t> cpu{ 0 };
+    auto job = [&](size_t i) {
+        auto start = ThreadCpuTime();
+        size_t offset = i * header.ChunkSize;
+        if (!DecompressChunk(codec, chunks + _offsets[i], _offsets[i + 1] - _offsets[i], dst + offset,
+            std::min<size_t>(header.ChunkSize, rawSize - offset)))
+            failed = true;
+        cpu += ThreadCpuTime() - start;
+    };
+    if (_pool != nullptr)
+        _pool->Run(header.Chunks, job);
+    else
+        for (size_t i = 0; i < header.Chunks; i++)
+            job(i);
+    if (failed)
+        throw ZeroCopyRpcException("Compressed frame is corrupt.");
+
+    std::lock_guard lock(_statsMutex);
+    _stats.Frames++;
+    _stats.Compressed++;
+    _stats.RawBytes += rawSize;
+    _stats.WireBytes += wireSize;
+    _stats.CpuTime += std::chrono::nanoseconds(cpu.load());
+}
+
+CompressionStats PayloadDecompressor::Stats() const
+{
+    std::lock_guard lock(_statsMutex);
+    return _stats;
+}
@@ -0,0 +1,150 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Export.h"
+#include "PayloadDelta.h"
+
+// Codecs of replicated payloads. Each one is compiled in only when the build found its library
+// (ZEROCOPYRPC_LZ4, ZEROCOPYRPC_ZSTD, ZEROCOPYRPC_ZLIB); None is always available.
+enum class CompressionCodec : uint8_t {
+    None = 0,
+    Lz4 = 1,
+    Zstd = 2,
+    // zlib at a fast level, for builds without LZ4 and zstd; noticeably slower than both.
+    Deflate = 3
+};
+
+EXPORT bool IsCodecSupported(CompressionCodec codec);
+// Bit 1 << codec is set for every codec this build can compress and decompress.
+EXPORT uint32_t SupportedCodecs();
+EXPORT const char* CodecName(CompressionCodec codec);
+// Accepts none, lz4, zstd and deflate; throws std::invalid_argument otherwise.
+EXPORT CompressionCodec ParseCodec(const std::string& name);
+// The codec to send a peer that accepts the codecs of the given bits: preferred when it is among them, otherwise
+// the first of lz4, zstd and deflate both sides support, otherwise None.
+EXPORT CompressionCodec NegotiateCodec(CompressionCodec preferred, uint32_t accepted);
+
+struct CompressionConfig {
+    CompressionCodec Codec = CompressionCodec::None;
+    // Codec specific, 0 picks a real-time default: LZ4 acceleration 1, zstd level -1, zlib level 1.
+    int Level = 0;
+    // Frames are compressed in independent chunks, so that a large frame is compressed and decompressed in parallel.
+    size_t ChunkSize = 256 * 1024;
+    // Frames below are sent as they are; so are frames that do not shrink.
+    size_t MinSize = 1024;
+    // Worker threads of the pool a replicator shares between its topics, in addition to the calling thread.
+    size_t Threads = 2;
+    // Delta encoding against the previous message of the same type, it runs before the codec.
+    DeltaConfig Delta;
+
+    bool Enabled() const { return Codec != CompressionCodec::None; }
+};
+
+struct CompressionStats {
+    uint64_t Frames = 0;
+    // Frames that went out compressed, the others did not shrink or were too small.
+    uint64_t Compressed = 0;
+    uint64_t RawBytes = 0;
+    uint64_t WireBytes = 0;
+    // Thread CPU time spent in the codec, summed over the pool.
+    std::chrono::nanoseconds CpuTime{ 0 };
+
+    double Ratio() const { return WireBytes != 0 ? static_cast<double>(RawBytes) / WireBytes : 1.0; }
+};
+
+// Layout of a compressed frame: this header, Chunks compressed sizes (uint32_t), then the chunks. Every chunk but
+// the last holds ChunkSize raw bytes.
+struct CompressedFrameHeader {
+    uint32_t RawSize;
+    uint32_t ChunkSize;
+    uint32_t Chunks;
+    uint32_t Reserved;
+};
+static_assert(sizeof(CompressedFrameHeader) == 16, "Compressed frame header layout changed.");
+
+// Runs the chunks of one frame on a few worker threads; the calling thread takes chunks as well. Several replication
+// threads may share a pool, their frames are worked on side by side. Workers start with the first frame that has
+// more than one chunk.
+class EXPORT CompressionPool {
+public:
+    explicit CompressionPool(size_t threads = 2);
+    ~CompressionPool();
+    CompressionPool(const CompressionPool&) = delete;
+    CompressionPool& operator=(const CompressionPool&) = delete;
+
+    // Calls job(0) ... job(count - 1) and returns when all finished.
+    void Run(size_t count, const std::function<void(size_t)>& job);
+
+private:
+    struct Batch {
+        const std::function<void(size_t)>* Job;
+        size_t Count;
+        std::atomic<size_t> Next{ 0 };
+        std::atomic<size_t> Done{ 0 };
+        // Workers that hold the batch, guarded by the pool mutex.
+        size_t Users = 0;
+    };
+
+    void Work(Batch& batch);
+    void WorkerLoop();
+
+    const size_t _threadCount;
+    std::vector<std::thread> _threads;
+    std::vector<Batch*> _batches;
+    std::mutex _mutex;
+    std::condition_variable _work;
+    std::condition_variable _done;
+    bool _stopping = false;
+};
+
+// Compresses the frames of one topic on the replication source. Used by one thread, Stats can be read from any thread.
+class EXPORT PayloadCompressor {
+public:
+    PayloadCompressor(CompressionConfig config, CompressionPool* pool = nullptr);
+
+    const CompressionConfig& Config() const { return _config; }
+
+    // Writes the compressed frame to out, resized to fit, and returns the codec. Returns None when the frame is to be
+    // sent as it is; out is scratch then, it may have been resized and written to.
+    CompressionCodec Compress(const uint8_t* data, size_t size, std::vector<uint8_t>& out);
+
+    CompressionStats Stats() const;
+
+private:
+    const CompressionConfig _config;
+    CompressionPool* _pool;
+    std::vector<uint32_t> _chunkSizes;
+
+    mutable std::mutex _statsMutex;
+    CompressionStats _stats;
+};
+
+// Restores frames of a compressed topic on the replication target, straight into the span of the target topic.
+class EXPORT PayloadDecompressor {
+public:
+    explicit PayloadDecompressor(CompressionPool* pool = nullptr);
+
+    // Raw size of a compressed frame, 0 when wire does not hold a well-formed one.
+    static size_t RawSize(const uint8_t* wire, size_t wireSize);
+
+    // Throws ZeroCopyRpcException when the frame is corrupt or the codec is not compiled in.
+    void Decompress(CompressionCodec codec, const uint8_t* wire, size_t wireSize, uint8_t* dst, size_t dstSize);
+
+    CompressionStats Stats() const;
+
+private:
+    CompressionPool* _pool;
+    std::vector<size_t> _offsets;
+
+    mutable std::mutex _statsMutex;
+    CompressionStats _stats;
+};
@@ -0,0 +1,208 @@
+#include "PayloadDelta.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "Crc32c.h"
+#include "UdpFec.h"
+
+namespace {
+
+    // Whether two blocks are equal, vectorised like XorBlock.
+    bool BlockEquals(const uint8_t* a, const uint8_t* b, size_t size)
+    {
+        size_t i = 0;
+#if defined(__AVX2__)
+        for (; i + 32 <= size; i += 32) {
+            __m256i x = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+            if (!_mm256_testz_si256(x, x))
+                return false;
+        }
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        for (; i + 16 <= size; i += 16) {
+            __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+            if (_mm_movemask_epi8(eq) != 0xFFFF)
+                return false;
+        }
+#elif defined(__aarch64__)
+        for (; i + 16 <= size; i += 16)
+            if (vmaxvq_u8(veorq_u8(vld1q_u8(a + i), vld1q_u8(b + i))) != 0)
+                return false;
+#endif
+        return std::memcmp(a + i, b + i, size - i) == 0;
+    }
+
+    bool IsValidBlockSize(size_t blockSize)
+    {
+        return blockSize == 32 || blockSize == 64;
+    }
+}
+
+DeltaEncoder::DeltaEncoder(DeltaConfig config) : _config(config)
+{
+    if (!IsValidBlockSize(_config.BlockSize))
+        throw std::invalid_argument("Delta block size must be 32 or 64 bytes.");
+    if (_config.KeyframeInterval == 0)
+        throw std::invalid_argument("Delta keyframe interval must be at least 1.");
+}
+
+void DeltaEncoder::Keyframe(TypeState& state, const uint8_t* data, size_t size, std::vector<uint8_t>& out)
+{
+    DeltaFrameHeader header{ static_cast<uint32_t>(size), state.Sequence, state.Sequence, _config.BlockSize, 1, 0 };
+    out.resize(sizeof(header) + size);
+    std::memcpy(out.data(), &header, sizeof(header));
+    std::memcpy(out.data() + sizeof(header), data, size);
+    state.Previous.assign(data, data + size);
+    state.SinceKeyframe = 0;
+}
+
+void DeltaEncoder::Encode(const uint8_t* data, size_t size, uint64_t type, std::vector<uint8_t>& out)
+{
+    auto& state = _types[type];
+    const uint32_t base = state.Sequence;
+    if (state.Started)
+        state.Sequence++;
+    bool keyframe = !state.Started || state.Previous.size() != size || ++state.SinceKeyframe >= _config.KeyframeInterval;
+    state.Started = true;
+
+    if (!keyframe) {
+        const size_t blockSize = _config.BlockSize;
+        const size_t blocks = (size + blockSize - 1) / blockSize;
+        // Runs alternate with unchanged blocks, so there are at most half as many runs as blocks.
+        out.resize(sizeof(DeltaFrameHeader) + size + (blocks + 1) / 2 * sizeof(DeltaRun));
+        uint8_t* previous = state.Previous.data();
+        size_t pos = sizeof(DeltaFrameHeader);
+
+        for (size_t block = 0; block < blocks;) {
+            size_t offset = block * blockSize;
+            if (BlockEquals(data + offset, previous + offset, std::min(blockSize, size - offset))) {
+                block++;
+                continue;
+            }
+            DeltaRun run{ static_cast<uint32_t>(block), 0 };
+            while (block < blocks) {
+                size_t o = block * blockSize;
+                if (BlockEquals(data + o, previous + o, std::min(blockSize, size - o)))
+                    break;
+                block++;
+            }
+            run.Blocks = static_cast<uint32_t>(block) - run.FirstBlock;
+            size_t bytes = std::min(block * blockSize, size) - offset;
+
+            std::memcpy(out.data() + pos, &run, sizeof(run));
+            pos += sizeof(run);
+            std::memcpy(out.data() + pos, data + offset, bytes);
+            XorBlock(out.data() + pos, previous + offset, bytes);
+            std::memcpy(previous + offset, data + offset, bytes);
+            pos += bytes;
+        }
+
+        if (pos < sizeof(DeltaFrameHeader) + size) {
+            DeltaFrameHeader header{ static_cast<uint32_t>(size), state.Sequence, base, _config.BlockSize, 0, 0 };
+            std::memcpy(out.data(), &header, sizeof(header));
+            out.resize(pos);
+        }
+        else
+            keyframe = true;
+    }
+    if (keyframe)
+        Keyframe(state, data, size, out);
+
+    std::lock_guard lock(_statsMutex);
+    _stats.Frames++;
+    if (keyframe)
+        _stats.Keyframes++;
+    _stats.RawBytes += size;
+    _stats.EncodedBytes += out.size();
+}
+
+DeltaStats DeltaEncoder::Stats() const
+{
+    std::lock_guard lock(_statsMutex);
+    return _stats;
+}
+
+size_t DeltaDecoder::RawSize(const uint8_t* frame, size_t size)
+{
+    DeltaFrameHeader header;
+    if (size < sizeof(header))
+        return 0;
+    std::memcpy(&header, frame, sizeof(header));
+    if (!IsValidBlockSize(header.BlockSize))
+        return 0;
+    if (header.Keyframe)
+        return size - sizeof(header) == header.RawSize ? header.RawSize : 0;
+
+    const size_t blocks = (static_cast<size_t>(header.RawSize) + header.BlockSize - 1) / header.BlockSize;
+    size_t pos = sizeof(header);
+    while (pos < size) {
+        DeltaRun run;
+        if (size - pos < sizeof(run))
+            return 0;
+        std::memcpy(&run, frame + pos, sizeof(run));
+        if (run.Blocks == 0 || run.FirstBlock >= blocks || run.Blocks > blocks - run.FirstBlock)
+            return 0;
+        size_t bytes = std::min<size_t>(static_cast<size_t>(run.FirstBlock + run.Blocks) * header.BlockSize, header.RawSize)
+            - static_cast<size_t>(run.FirstBlock) * header.BlockSize;
+        pos += sizeof(run);
+        if (size - pos < bytes)
+            return 0;
+        pos += bytes;
+    }
+    return header.RawSize;
+}
+
+bool DeltaDecoder::Apply(const uint8_t* frame, size_t size, uint64_t type, uint8_t* dst, uint32_t* checksum)
+{
+    size_t rawSize = RawSize(frame, size);
+    DeltaFrameHeader header;
+    if (size < sizeof(header))
+        return false;
+    std::memcpy(&header, frame, sizeof(header));
+    if (rawSize != header.RawSize)
+        return false;
+    auto& state = _types[type];
+
+    if (header.Keyframe) {
+        state.Base.assign(frame + sizeof(header), frame + size);
+    }
+    else {
+        if (!state.Valid || state.Sequence != header.BaseSequence || state.Base.size() != rawSize) {
+            std::lock_guard lock(_statsMutex);
+            _stats.Dropped++;
+            return false;
+        }
+        for (size_t pos = sizeof(header); pos < size;) {
+            DeltaRun run;
+            std::memcpy(&run, frame + pos, sizeof(run));
+            pos += sizeof(run);
+            size_t offset = static_cast<size_t>(run.FirstBlock) * header.BlockSize;
+            size_t bytes = std::min<size_t>(offset + static_cast<size_t>(run.Blocks) * header.BlockSize, rawSize) - offset;
+            XorBlock(state.Base.data() + offset, frame + pos, bytes);
+            pos += bytes;
+        }
+    }
+    if (checksum != nullptr)
+        *checksum = Crc32cCopy(dst, state.Base.data(), rawSize);
+    else
+        std::memcpy(dst, state.Base.data(), rawSize);
+    state.Sequence = header.Sequence;
+    state.Valid = true;
+
+    std::lock_guard lock(_statsMutex);
+    _stats.Frames++;
+    if (header.Keyframe)
+        _stats.Keyframes++;
+    _stats.RawBytes += rawSize;
+    _stats.EncodedBytes += size;
+    return true;
+}
+
+DeltaStats DeltaDecoder::Stats() const
+{
+    std::lock_guard lock(_statsMutex);
+    return _stats;
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "Export.h"
+
+// How the bytes of a replicated frame relate to the message, before any compression.
+enum class PayloadEncoding : uint8_t {
+    Raw = 0,
+    // A DeltaFrameHeader, then either the whole message (keyframe) or the changed blocks XORed with the previous
+    // message of the same type.
+    Delta = 1
+};
+
+struct DeltaConfig {
+    bool Enabled = false;
+    // Every this many messages of a type the whole message is sent, so that a target that lost a frame recovers.
+    uint32_t KeyframeInterval = 100;
+    // Messages are compared in blocks of 32 or 64 bytes.
+    uint16_t BlockSize = 64;
+};
+
+struct DeltaStats {
+    uint64_t Frames = 0;
+    uint64_t Keyframes = 0;
+    uint64_t RawBytes = 0;
+    uint64_t EncodedBytes = 0;
+    // Deltas the target could not apply, because it missed the message they were taken against.
+    uint64_t Dropped = 0;
+};
+
+struct DeltaFrameHeader {
+    uint32_t RawSize;
+    // Counts the frames of one message type.
+    uint32_t Sequence;
+    // Frame the delta was taken against, equal to Sequence for a keyframe.
+    uint32_t BaseSequence;
+    uint16_t BlockSize;
+    uint8_t Keyframe;
+    uint8_t Reserved;
+};
+static_assert(sizeof(DeltaFrameHeader) == 16, "Delta frame header layout changed.");
+
+// A run of consecutive changed blocks, followed by their XOR with the previous message. The last block of the
+// message may be shorter than BlockSize.
+struct DeltaRun {
+    uint32_t FirstBlock;
+    uint32_t Blocks;
+};
+
+// Encodes the messages of one topic on the replication source, against a copy of the previous message of every type.
+// Used by one thread, Stats can be read from any thread.
+class EXPORT DeltaEncoder {
+public:
+    explicit DeltaEncoder(DeltaConfig config);
+
+    // Writes the delta frame of the message to out.
+    void Encode(const uint8_t* data, size_t size, uint64_t type, std::vector<uint8_t>& out);
+
+    DeltaStats Stats() const;
+
+private:
+    struct TypeState {
+        std::vector<uint8_t> Previous;
+        uint32_t Sequence = 0;
+        uint32_t SinceKeyframe = 0;
+        bool Started = false;
+    };
+
+    void Keyframe(TypeState& state, const uint8_t* data, size_t size, std::vector<uint8_t>& out);
+
+    const DeltaConfig _config;
+    std::unordered_map<uint64_t, TypeState> _types;
+
+    mutable std::mutex _statsMutex;
+    DeltaStats _stats;
+};
+
+// Rebuilds messages of a delta encoded topic on the replication target from its copy of the previous message of
+// every type.
+class EXPORT DeltaDecoder {
+public:
+    // Size of the message a delta frame rebuilds, 0 when frame is not a well-formed one.
+    static size_t RawSize(const uint8_t* frame, size_t size);
+
+    // Writes the message to dst, which holds RawSize bytes. Returns false, without touching dst, when the frame
+    // was taken against a message this decoder did not see; the type recovers with its next keyframe.
+    // When checksum is given, the CRC32C of the message is computed while it is copied to dst.
+    bool Apply(const uint8_t* frame, size_t size, uint64_t type, uint8_t* dst, uint32_t* checksum = nullptr);
+
+    DeltaStats Stats() const;
+
+private:
+    struct TypeState {
+        std::vector<uint8_t> Base;
+        uint32_t Sequence = 0;
+        bool Valid = false;
+    };
+
+    std::unordered_map<uint64_t, TypeState> _types;
+
+    mutable std::mutex _statsMutex;
+    DeltaStats _stats;
+};
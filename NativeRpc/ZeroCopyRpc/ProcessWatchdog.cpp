@@ -0,0 +1,201 @@
+#include "ProcessWatchdog.h"
+
+#include <vector>
+
+#include <boost/log/trivial.hpp>
+
+#include "ZeroCopyRpcException.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+static int pidfd_open(pid_t pid)
+{
+	return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+}
+#endif
+
+ProcessWatchdog::ProcessWatchdog(std::function<void(pid_t)> onExit, std::chrono::milliseconds pollInterval)
+	: _onExit(std::move(onExit)), _pollInterval(pollInterval)
+{
+#ifdef __linux__
+	_epoll = epoll_create1(EPOLL_CLOEXEC);
+	_wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (_epoll < 0 || _wake < 0)
+		throw ZeroCopyRpcException("Cannot create the process watchdog's epoll.");
+	// Pids are positive, 0 stands for the wake up.
+	epoll_event ev{};
+	ev.events = EPOLLIN;
+	ev.data.u64 = 0;
+	epoll_ctl(_epoll, EPOLL_CTL_ADD, _wake, &ev);
+#endif
+	_thread = std::thread([this]() { Run(); });
+}
+
+ProcessWatchdog::~ProcessWatchdog()
+{
+	Stop();
+#ifdef __linux__
+	for (auto& [pid, fd] : _watched)
+		if (fd >= 0)
+			close(fd);
+	close(_wake);
+	close(_epoll);
+#endif
+}
+
+void ProcessWatchdog::Stop()
+{
+	if (!_running.exchange(false))
+		return;
+	{
+		std::lock_guard lock(_mutex);
+		_changed.notify_all();
+	}
+#ifdef __linux__
+	uint64_t one = 1;
+	if (write(_wake, &one, sizeof(one)) < 0)
+		BOOST_LOG_TRIVIAL(warning) << "Cannot wake the process watchdog up.";
+#endif
+	if (_thread.joinable())
+		_thread.join();
+}
+
+void ProcessWatchdog::Watch(pid_t pid)
+{
+	std::lock_guard lock(_mutex);
+	if (_watched.contains(pid))
+		return;
+	int fd = -1;
+#ifdef __linux__
+	fd = pidfd_open(pid);
+	if (fd >= 0)
+	{
+		epoll_event ev{};
+		ev.events = EPOLLIN;
+		ev.data.u64 = static_cast<uint64_t>(pid);
+		if (epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &ev) != 0)
+		{
+			close(fd);
+			fd = -1;
+		}
+	}
+	else if (errno != ESRCH)
+		BOOST_LOG_TRIVIAL(debug) << "Cannot open pidfd of process " << pid << ", it is polled instead.";
+#endif
+	_watched.emplace(pid, fd);
+	if (fd < 0)
+	{
+		_polled.insert(pid);
+		_changed.notify_all();
+#ifdef __linux__
+		uint64_t one = 1;
+		if (write(_wake, &one, sizeof(one)) < 0)
+			BOOST_LOG_TRIVIAL(warning) << "Cannot wake the process watchdog up.";
+#endif
+	}
+}
+
+bool ProcessWatchdog::Unwatch(pid_t pid)
+{
+	std::lock_guard lock(_mutex);
+	auto it = _watched.find(pid);
+	if (it == _watched.end())
+		return false;
+#ifdef __linux__
+	if (it->second >= 0)
+	{
+		epoll_ctl(_epoll, EPOLL_CTL_DEL, it->second, nullptr);
+		close(it->second);
+	}
+#endif
+	_polled.erase(pid);
+	_watched.erase(it);
+	return true;
+}
+
+bool ProcessWatchdog::IsWatched(pid_t pid) const
+{
+	std::lock_guard lock(_mutex);
+	return _watched.contains(pid);
+}
+
+size_t ProcessWatchdog::Count() const
+{
+	std::lock_guard lock(_mutex);
+	return _watched.size();
+}
+
+void ProcessWatchdog::Report(pid_t pid)
+{
+	// Unwatched meanwhile, by whoever learnt about the exit first.
+	if (!Unwatch(pid))
+		return;
+	try
+	{
+		_onExit(pid);
+	}
+	catch (const std::exception& e)
+	{
+		BOOST_LOG_TRIVIAL(error) << "Exit of process " << pid << " was not handled: " << e.what();
+	}
+}
+
+void ProcessWatchdog::Poll()
+{
+	std::vector<pid_t> gone;
+	{
+		std::lock_guard lock(_mutex);
+		for (auto pid : _polled)
+			if (!is_process_running(pid))
+				gone.push_back(pid);
+	}
+	for (auto pid : gone)
+		Report(pid);
+}
+
+void ProcessWatchdog::Run()
+{
+	while (_running.load())
+	{
+#ifdef __linux__
+		bool polling;
+		{
+			std::lock_guard lock(_mutex);
+			polling = !_polled.empty();
+		}
+		epoll_event events[16];
+		int n = epoll_wait(_epoll, events, 16, polling ? static_cast<int>(_pollInterval.count()) : -1);
+		if (n < 0 && errno != EINTR)
+		{
+			BOOST_LOG_TRIVIAL(error) << "Process watchdog cannot wait for processes, it stopped.";
+			return;
+		}
+		for (int i = 0; i < n && _running.load(); i++)
+		{
+			if (events[i].data.u64 == 0)
+			{
+				uint64_t count;
+				while (read(_wake, &count, sizeof(count)) > 0) {}
+				continue;
+			}
+			Report(static_cast<pid_t>(events[i].data.u64));
+		}
+#else
+		{
+			std::unique_lock lock(_mutex);
+			_changed.wait_for(lock, _pollInterval, [this]() { return !_running.load(); });
+		}
+#endif
+		if (_running.load())
+			Poll();
+	}
+}
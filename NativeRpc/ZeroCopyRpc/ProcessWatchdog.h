@@ -0,0 +1,54 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "Export.h"
+#include "ProcessUtils.h"
+
+// Reports processes that exit, on a thread of its own. On Linux every watched process is held by a pidfd, that refers
+// to that very process even when its pid is reused, and the pidfds are waited for with epoll, so an exit is reported
+// within a wake up. Where pidfds are not available (kernels before 5.3, other systems) the processes are polled with
+// is_process_running every poll interval instead.
+class EXPORT ProcessWatchdog {
+public:
+    // onExit is called on the watchdog thread, once for every watched process that exits.
+    explicit ProcessWatchdog(std::function<void(pid_t)> onExit,
+        std::chrono::milliseconds pollInterval = std::chrono::milliseconds(100));
+    ~ProcessWatchdog();
+
+    ProcessWatchdog(const ProcessWatchdog&) = delete;
+    ProcessWatchdog& operator=(const ProcessWatchdog&) = delete;
+
+    // Watches the process until it exits. A process watched already is left as it is; one that is gone already is
+    // reported on the next poll.
+    void Watch(pid_t pid);
+    bool Unwatch(pid_t pid);
+    bool IsWatched(pid_t pid) const;
+    size_t Count() const;
+    // Stops the thread, no exit is reported after it returns.
+    void Stop();
+
+private:
+    void Run();
+    // Reports the polled processes that are gone.
+    void Poll();
+    void Report(pid_t pid);
+
+    std::function<void(pid_t)> _onExit;
+    std::chrono::milliseconds _pollInterval;
+    mutable std::mutex _mutex;
+    std::condition_variable _changed;
+    // Pidfd of every watched process, -1 for the polled ones.
+    std::unordered_map<pid_t, int> _watched;
+    std::unordered_set<pid_t> _polled;
+    std::atomic<bool> _running{ true };
+    int _epoll = -1;
+    int _wake = -1;
+    std::thread _thread;
+};
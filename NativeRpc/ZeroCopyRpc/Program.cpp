@@ -7,6 +7,8 @@
 #include <boost/url.hpp>
 
 #include <iostream>
+#include <iomanip>
+#include <map>
 #include <vector>
 #ifdef WIN32
 #include <conio.h>
@@ -18,6 +20,10 @@
 
 #include "TcpReplicator.h"
 #include "UdpReplicator.h"
+#include "TopicRecorder.h"
+#include "TopicReplayer.h"
+#include "TopicMonitor.h"
+#include "TopicRegistry.h"
 namespace po = boost::program_options;
 
 struct UrlInfo {
@@ -31,6 +37,115 @@ std::vector<std::string> parse_topics(const std::string& topics_str) {
     boost::split(topics, topics_str, boost::is_any_of(","));
     return topics;
 }
+std::string toLower(const std::string& str) {
+    std::string result = str;
+    std::ranges::transform(result, result.begin(),
+                           [](unsigned char c) { return std::tolower(c); });
+    return result;
+}
+bool parse_flag(const po::variables_map& vm, const char* name) {
+    if (!vm.contains(name))
+        return false;
+    auto value = vm[name].as<std::string>();
+    return toLower(value) == "true" || value == "";
+}
+// UDP replication takes --topic or --topics; all topics share one socket.
+std::vector<std::string> parse_udp_topics(const po::variables_map& vm) {
+    if (vm.contains("topics"))
+        return parse_topics(vm["topics"].as<std::string>());
+    if (vm.contains("topic"))
+        return { vm["topic"].as<std::string>() };
+    throw ZeroCopyRpcException("Topic is required when replication with udp protocol.");
+}
+// Parses "K:M", K data fragments protected by M parity fragments.
+UdpFecConfig parse_fec(const std::string& value) {
+    std::vector<std::string> parts;
+    boost::split(parts, value, boost::is_any_of(":"));
+    if (parts.size() != 2)
+        throw std::runtime_error("Invalid FEC format. Expected: data:parity, for example 8:2");
+    auto data = std::stoi(parts[0]);
+    auto parity = std::stoi(parts[1]);
+    if (data < 1 || data > 255 || parity < 1 || parity > data)
+        throw std::runtime_error("Invalid FEC value. Expected 1 <= parity <= data <= 255.");
+    return UdpFecConfig(static_cast<uint8_t>(data), static_cast<uint8_t>(parity));
+}
+// Parses "codec" for every topic, or "topic=codec,..." per topic; topics without an entry are not compressed.
+// Delta encoding applies to every topic.
+CompressionConfig parse_compression(const po::variables_map& vm, std::unordered_map<std::string, CompressionConfig>& topics) {
+    CompressionConfig compression;
+    compression.Threads = vm["compress-threads"].as<size_t>();
+    compression.Delta.Enabled = parse_flag(vm, "delta");
+    compression.Delta.KeyframeInterval = vm["keyframe-interval"].as<uint32_t>();
+    if (compression.Delta.Enabled)
+        BOOST_LOG_TRIVIAL(info) << "Delta encoding enabled, keyframe every " << compression.Delta.KeyframeInterval << " messages.";
+    if (!vm.contains("compress"))
+        return compression;
+    for (auto& entry : parse_topics(vm["compress"].as<std::string>())) {
+        auto equals = entry.find('=');
+        if (equals == std::string::npos) {
+            compression.Codec = ParseCodec(toLower(entry));
+            continue;
+        }
+        auto topic = compression;
+        topic.Codec = ParseCodec(toLower(entry.substr(equals + 1)));
+        topics[entry.substr(0, equals)] = topic;
+    }
+    return compression;
+}
+// Parses "latest", "oldest", "seq:N" or "last:N".
+SubscribeStart parse_start(const std::string& value) {
+    auto lower = toLower(value);
+    if (lower == "latest")
+        return SubscribeStart::Latest();
+    if (lower == "oldest")
+        return SubscribeStart::Oldest();
+    auto colon = lower.find(':');
+    if (colon != std::string::npos) {
+        auto kind = lower.substr(0, colon);
+        auto position = std::stoull(lower.substr(colon + 1));
+        if (kind == "seq")
+            return SubscribeStart::At(position);
+        if (kind == "last")
+            return SubscribeStart::Last(position);
+    }
+    throw std::runtime_error("Invalid start position. Expected: latest, oldest, seq:N or last:N");
+}
+// Parses "queue" or "conflate".
+TopicMode parse_mode(const std::string& value) {
+    auto lower = toLower(value);
+    if (lower == "queue")
+        return TopicMode::Queue;
+    if (lower == "conflate")
+        return TopicMode::Conflate;
+    throw std::runtime_error("Invalid topic mode. Expected: queue or conflate");
+}
+// Parses "none", "monotonic" or "tsc".
+TimestampClock parse_clock(const std::string& value) {
+    auto lower = toLower(value);
+    if (lower == "none")
+        return TimestampClock::None;
+    if (lower == "monotonic")
+        return TimestampClock::Monotonic;
+    if (lower == "tsc")
+        return TimestampClock::Tsc;
+    throw std::runtime_error("Invalid timestamp clock. Expected: none, monotonic or tsc");
+}
+// Logs percentiles of a latency histogram in us.
+void log_latency(const char* name, const LatencyHistogram& latency) {
+    if (latency.Count == 0)
+        return;
+    BOOST_LOG_TRIVIAL(info) << name << " latency of " << latency.Count << " messages: p50 " << latency.Percentile(0.5) / 1000.0
+        << "us, p99 " << latency.Percentile(0.99) / 1000.0 << "us, max " << latency.Max / 1000.0 << "us";
+}
+// Parses a comma-separated list of message types, empty accepts all.
+TypeFilter parse_types(const std::string& value) {
+    TypeFilter filter;
+    if (value.empty())
+        return filter;
+    for (const auto& type : parse_topics(value))
+        filter.Add(std::stoull(type));
+    return filter;
+}
 UrlInfo parse_url(const std::string& url_str) {
     auto result = boost::urls::parse_uri(url_str);
     if (!result) {
@@ -91,22 +206,69 @@ int handle_replication_publish(const po::variables_map& vm) {
                 << url_info.host << ":" << url_info.port;
             BOOST_LOG_TRIVIAL(info) << "Waiting for subscription requests...";
 
-            TcpReplicationSource source(io, channel, url_info.port);
+            std::unordered_map<std::string, CompressionConfig> topicCompression;
+            auto compression = parse_compression(vm, topicCompression);
+            auto checksums = parse_flag(vm, "checksum");
+            if (checksums)
+                BOOST_LOG_TRIVIAL(info) << "Messages are sent with CRC32C checksums.";
+            TcpReplicationSource source(io, channel, url_info.port, compression, checksums);
+            for (auto& [topic, config] : topicCompression)
+                source.SetCompression(topic, config);
             executor_work_guard<io_context::executor_type> work_guard(io.get_executor());
             io.run();
         }
         else if(url_info.protocol == "udp")
         {
-            if (!vm.contains("topic"))
-                throw ZeroCopyRpcException("Topic is required when replication with udp protocol.");
-            auto topic = vm["topic"].as<std::string>();
+            // Patterns are matched against the topics the channel has now.
+            auto topics = TopicRegistry::Expand(channel, parse_udp_topics(vm));
 
-            BOOST_LOG_TRIVIAL(info) << "Starting publisher for channel: " << channel << " with data for topic: " << topic
+            BOOST_LOG_TRIVIAL(info) << "Starting publisher for channel: " << channel << " with data for topics: " << boost::join(topics, ",")
                 << ", pushing data to remote: " << url_info.protocol << "://"
                 << url_info.host << ":" << url_info.port;
 
-            UdpReplicationSource source(io, channel);
-            source.ReplicateTopic(topic, url_info.host, url_info.port);
+            auto gso = parse_flag(vm, "gso");
+            if (gso)
+                BOOST_LOG_TRIVIAL(info) << "UDP segmentation offload enabled.";
+
+            auto mtu = vm["mtu"].as<size_t>();
+            BOOST_LOG_TRIVIAL(info) << "UDP link MTU: " << mtu << "B.";
+
+            UdpFecConfig fec;
+            if (vm.contains("fec")) {
+                fec = parse_fec(vm["fec"].as<std::string>());
+                BOOST_LOG_TRIVIAL(info) << "Forward error correction: " << (int)fec.Parity << " parity fragments per " << (int)fec.Data << " data fragments.";
+            }
+
+            UdpRetransmitConfig retransmit;
+            retransmit.Window = vm["retransmit-window"].as<size_t>();
+            retransmit.MaxBytesPerSecond = vm["retransmit-rate"].as<size_t>() * 1024 * 1024;
+            if (retransmit.Enabled())
+                BOOST_LOG_TRIVIAL(info) << "Retransmission of last " << retransmit.Window << " frames enabled.";
+
+            UdpMulticastConfig multicast;
+            if (vm.contains("multicast-interface"))
+                multicast.Interface = vm["multicast-interface"].as<std::string>();
+            multicast.Ttl = vm["multicast-ttl"].as<int>();
+            multicast.Loopback = parse_flag(vm, "multicast-loopback");
+
+            UdpPacingConfig pacing;
+            pacing.BytesPerSecond = vm["pacing-rate"].as<size_t>() * 1024 * 1024;
+            pacing.FrameBudget = std::chrono::microseconds(vm["pacing-budget"].as<size_t>());
+            if (pacing.BytesPerSecond != 0)
+                BOOST_LOG_TRIVIAL(info) << "Fragments are paced at " << vm["pacing-rate"].as<size_t>() << " MB/s.";
+            else if (pacing.Enabled())
+                BOOST_LOG_TRIVIAL(info) << "Every frame is spread over " << pacing.FrameBudget.count() << "us.";
+
+            std::unordered_map<std::string, CompressionConfig> topicCompression;
+            auto compression = parse_compression(vm, topicCompression);
+            auto checksums = parse_flag(vm, "checksum");
+            if (checksums)
+                BOOST_LOG_TRIVIAL(info) << "Fragments are sent with CRC32C checksums.";
+            UdpReplicationSource source(io, channel, gso, mtu, fec, retransmit, multicast, pacing, compression, checksums);
+            for (auto& [topic, config] : topicCompression)
+                source.SetCompression(topic, config);
+            for (const auto& topic : topics)
+                source.ReplicateTopic(topic, url_info.host, url_info.port);
 
             executor_work_guard<io_context::executor_type> work_guard(io.get_executor());
             io.run();
@@ -154,13 +316,22 @@ int handle_replication_subscribe(const po::variables_map& vm) {
         }
     	else if(url_info.protocol == "udp")
         {
-            if (!vm.contains("topic"))
-                throw ZeroCopyRpcException("Topic parameter is required when subscribing with udp protocol.");
+            auto topics = parse_udp_topics(vm);
 
-            auto topic = vm["topic"].as<std::string>();
-            
-            auto target = std::make_shared<UdpReplicationTarget>(io, server,url_info.host, url_info.port);
-            target->ReplicateTopic(topic);
+            UdpNackConfig nack;
+            nack.Enabled = parse_flag(vm, "nack");
+            if (nack.Enabled)
+                BOOST_LOG_TRIVIAL(info) << "Missing fragments are requested from the source.";
+
+            UdpMulticastConfig multicast;
+            if (vm.contains("multicast-interface"))
+                multicast.Interface = vm["multicast-interface"].as<std::string>();
+
+            auto target = std::make_shared<UdpReplicationTarget>(io, server,url_info.host, url_info.port, vm["mtu"].as<size_t>(), nack, multicast);
+            for (const auto& topic : topics) {
+                BOOST_LOG_TRIVIAL(info) << "Subscribing to topic: " << topic;
+                target->ReplicateTopic(topic);
+            }
             executor_work_guard<io_context::executor_type> work_guard(io.get_executor());
             io.run();
             return 0;
@@ -180,16 +351,27 @@ int handle_clear(const po::variables_map& vm) {
 
         BOOST_LOG_TRIVIAL(info) << "Clearing shared memory channel: " << channel;
 
-        // Add implementation for clearing the shared memory channel
-        // This would depend on your SharedMemoryServer implementation
+        // Topics are looked up before the channel, and its registry, is removed. Without --topic, every registered one.
+        std::vector<std::string> topics;
+        if (vm.contains("topic"))
+            topics = TopicRegistry::Expand(channel, { vm["topic"].as<std::string>() });
+        else {
+            try {
+                for (auto& topic : TopicRegistry(channel).Topics())
+                    topics.push_back(topic.Name);
+            }
+            catch (const interprocess_exception&) {
+                BOOST_LOG_TRIVIAL(info) << "Channel: " << channel << " has no topic registry, name the topic with --topic.";
+            }
+        }
+
         if (SharedMemoryServer::RemoveChannel(channel))
             BOOST_LOG_TRIVIAL(info) << "Channel: " << channel << " was removed successfully.";
         else
             BOOST_LOG_TRIVIAL(info) << "Channel: " << channel << " does not exists or was not removed.";
 
-        if(vm.contains("topic"))
+        for (const auto& topic : topics)
         {
-            auto topic = vm["topic"].as<std::string>();
             if (TopicService::TryRemove(channel, topic))
                 BOOST_LOG_TRIVIAL(info) << "Topic: " << topic << " data removed successfully.";
             else 
@@ -203,11 +385,216 @@ int handle_clear(const po::variables_map& vm) {
         return 1;
     }
 }
-std::string toLower(const std::string& str) {
-    std::string result = str;
-    std::ranges::transform(result, result.begin(),
-                           [](unsigned char c) { return std::tolower(c); });
-    return result;
+int handle_record(const po::variables_map& vm) {
+    try {
+        boost::asio::io_context io;
+        global_io_context = &io;
+        std::signal(SIGINT, signalHandler);
+
+        auto channel = vm["channel"].as<std::string>();
+        auto topics = TopicRegistry::Expand(channel, parse_topics(vm["topics"].as<std::string>()));
+        RecordingConfig config;
+        config.Directory = vm["dir"].as<std::string>();
+        config.Prefix = vm["prefix"].as<std::string>();
+        config.SegmentSize = vm["segment-size"].as<size_t>() * 1024 * 1024;
+        auto start = parse_start(vm["from"].as<std::string>());
+
+        BOOST_LOG_TRIVIAL(info) << "Recording topics: " << boost::join(topics, ",") << " of channel: " << channel
+            << " to " << config.Directory << ", segments of " << vm["segment-size"].as<size_t>() << "MB.";
+
+        TopicRecorder recorder(channel, config);
+        for (const auto& topic : topics)
+            recorder.RecordTopic(topic, start);
+
+        executor_work_guard<io_context::executor_type> work_guard(io.get_executor());
+        io.run();
+        recorder.Stop();
+
+        auto stats = recorder.Stats();
+        BOOST_LOG_TRIVIAL(info) << "Recorded " << stats.Messages << " messages, " << stats.Bytes << " bytes in "
+            << stats.Segments << " segments, " << stats.Dropped << " messages were overwritten before they were recorded.";
+        return 0;
+    }
+    catch (const std::exception& e) {
+        BOOST_LOG_TRIVIAL(error) << "Error in recorder: " << e.what();
+        return 1;
+    }
+}
+int handle_replay(const po::variables_map& vm) {
+    try {
+        boost::asio::io_context io;
+        global_io_context = &io;
+        std::signal(SIGINT, signalHandler);
+
+        auto channel = vm["channel"].as<std::string>();
+        RecordingConfig recording;
+        recording.Directory = vm["dir"].as<std::string>();
+        recording.Prefix = vm["prefix"].as<std::string>();
+        ReplayConfig config;
+        config.Speed = vm["speed"].as<double>();
+        config.From = vm["from"].as<uint64_t>();
+        if (vm.contains("topics"))
+            config.Topics = parse_topics(vm["topics"].as<std::string>());
+
+        BOOST_LOG_TRIVIAL(info) << "Replaying " << recording.Directory << " into channel: " << channel << " at "
+            << (config.Speed > 0 ? std::to_string(config.Speed) + "x" : std::string("full")) << " speed.";
+
+        SharedMemoryServer server(channel);
+        TopicReplayer replayer(server, recording, config);
+        ReplayStats stats;
+        std::thread replay([&]() {
+            stats = replayer.Run();
+            io.stop();
+        });
+        executor_work_guard<io_context::executor_type> work_guard(io.get_executor());
+        io.run();
+        replayer.Stop();
+        replay.join();
+
+        BOOST_LOG_TRIVIAL(info) << "Replayed " << stats.Messages << " messages, " << stats.Bytes << " bytes, "
+            << stats.Skipped << " skipped, last one " << stats.Lag.count() / 1000 << "us late.";
+        return 0;
+    }
+    catch (const std::exception& e) {
+        BOOST_LOG_TRIVIAL(error) << "Error in replay: " << e.what();
+        return 1;
+    }
+}
+std::string format_mode(TopicMode mode) {
+    switch (mode) {
+    case TopicMode::Conflate: return "conflate";
+    case TopicMode::Lossless: return "lossless";
+    default: return "queue";
+    }
+}
+// Notification time in us, buckets are powers of two from 256ns.
+std::string format_notify(ulong ns) {
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(ns < 10000 ? 2 : 0) << ns / 1000.0;
+    return oss.str();
+}
+struct TopicView {
+    std::unique_ptr<TopicMonitor> Monitor;
+    TopicSample Last;
+};
+// One screen of `zq top`: every topic with the rates since the previous sample and its subscribers below it.
+void print_top(const std::string& channel, std::map<std::string, TopicView>& views) {
+    std::ostringstream out;
+    out << "\033[H\033[2J" << "Channel: " << channel << ", " << views.size() << " topics\n\n";
+    out << std::left << std::setw(24) << "TOPIC" << std::right << std::setw(9) << "MODE" << std::setw(11) << "MSG/s"
+        << std::setw(10) << "MB/s" << std::setw(12) << "PUBLISHED" << std::setw(8) << "WRAPS" << std::setw(10) << "MAX B"
+        << std::setw(20) << "NOTIFY p50/p99 us" << "\n";
+    for (auto& [name, view] : views) {
+        auto sample = view.Monitor->Sample();
+        auto& last = view.Last;
+        double seconds = std::chrono::duration<double>(sample.At - last.At).count();
+        auto rate = [&](ulong now, ulong before) { return seconds > 0 && now >= before ? (now - before) / seconds : 0.0; };
+        out << std::left << std::setw(24) << name << std::right << std::setw(9) << format_mode(sample.Mode)
+            << std::setw(11) << std::fixed << std::setprecision(0) << rate(sample.Published, last.Published)
+            << std::setw(10) << std::setprecision(2) << rate(sample.Bytes, last.Bytes) / (1024 * 1024)
+            << std::setw(12) << sample.Published << std::setw(8) << sample.Wraps << std::setw(10) << sample.MaxMessageSize
+            << std::setw(20) << (format_notify(TopicMonitor::NotifyLatencyPercentile(last, sample, 0.5)) + "/"
+                + format_notify(TopicMonitor::NotifyLatencyPercentile(last, sample, 0.99))) << "\n";
+        for (auto& subscriber : sample.Subscribers) {
+            ulong before = 0;
+            for (auto& previous : last.Subscribers)
+                if (previous.Slot == subscriber.Slot && previous.Pid == subscriber.Pid)
+                    before = previous.Delivered;
+            out << "  #" << std::left << std::setw(4) << (int)subscriber.Slot << "pid " << std::setw(8) << subscriber.Pid
+                << std::setw(8) << (subscriber.Running ? "" : "(dead)") << std::right
+                << std::setw(11) << std::setprecision(0) << rate(subscriber.Delivered, before) << " msg/s"
+                << "  lag " << std::setw(8) << subscriber.Lag << "  overruns " << subscriber.Overruns << "\n";
+        }
+        last = std::move(sample);
+    }
+    std::cout << out.str() << std::flush;
+}
+int handle_top(const po::variables_map& vm) {
+    try {
+        boost::asio::io_context io;
+        global_io_context = &io;
+        std::signal(SIGINT, signalHandler);
+
+        auto channel = vm["channel"].as<std::string>();
+        auto interval = std::chrono::milliseconds(vm["interval"].as<uint32_t>());
+        std::vector<std::string> named;
+        if (vm.contains("topics"))
+            named = TopicRegistry::Expand(channel, parse_topics(vm["topics"].as<std::string>()));
+        else if (TopicMonitor::Topics(channel).empty())
+            BOOST_LOG_TRIVIAL(warning) << "No topics of channel " << channel << " found, name them with --topics.";
+
+        std::map<std::string, TopicView> views;
+        boost::asio::steady_timer timer(io);
+        std::function<void()> refresh = [&]() {
+            // Topics come and go, the ones that cannot be opened are left out until they can.
+            auto topics = named.empty() ? TopicMonitor::Topics(channel) : named;
+            std::erase_if(views, [&](auto& view) { return std::ranges::find(topics, view.first) == topics.end(); });
+            for (const auto& topic : topics) {
+                if (views.contains(topic))
+                    continue;
+                try {
+                    auto monitor = std::make_unique<TopicMonitor>(channel, topic);
+                    auto first = monitor->Sample();
+                    views.emplace(topic, TopicView{ std::move(monitor), std::move(first) });
+                }
+                catch (const std::exception& e) {
+                    BOOST_LOG_TRIVIAL(debug) << "Topic " << topic << " cannot be monitored: " << e.what();
+                }
+            }
+            print_top(channel, views);
+            timer.expires_after(interval);
+            timer.async_wait([&](const boost::system::error_code& error) {
+                if (!error)
+                    refresh();
+            });
+        };
+        refresh();
+        io.run();
+        return 0;
+    }
+    catch (const std::exception& e) {
+        BOOST_LOG_TRIVIAL(error) << "Error in top: " << e.what();
+        return 1;
+    }
+}
+int handle_ls(const po::variables_map& vm) {
+    try {
+        auto channel = vm["channel"].as<std::string>();
+        TopicRegistry registry(channel);
+        auto generation = registry.Generation();
+        auto topics = registry.Topics();
+
+        std::ostringstream out;
+        out << "Channel " << channel << ", " << topics.size() << " topics, generation " << generation << "\n";
+        out << std::left << std::setw(24) << "TOPIC" << std::right << std::setw(9) << "MODE" << std::setw(10) << "MESSAGES"
+            << std::setw(12) << "BUFFER" << std::setw(12) << "MAX MSG" << std::setw(16) << "PUBLISHER" << std::setw(6) << "SUBS"
+            << "  CREATED\n";
+        for (const auto& topic : topics) {
+            // Subscribers are counted from the topic's own region, when it can be mapped.
+            std::string subscribers = "-";
+            try {
+                subscribers = std::to_string(TopicMonitor(channel, topic.Name).Sample().Subscribers.size());
+            }
+            catch (const std::exception&) {
+            }
+            auto publisher = std::to_string(topic.Publisher) + (is_process_running(topic.Publisher) ? "" : " dead");
+            auto created = std::chrono::system_clock::to_time_t(topic.Created);
+            out << std::left << std::setw(24) << topic.Name << std::right << std::setw(9) << format_mode(topic.Mode)
+                << std::setw(10) << topic.MessageCount << std::setw(12) << topic.BufferSize << std::setw(12) << topic.MaxMessageSize
+                << std::setw(16) << publisher << std::setw(6) << subscribers
+                << "  " << std::put_time(std::localtime(&created), "%Y-%m-%d %H:%M:%S") << "\n";
+        }
+        std::cout << out.str() << std::flush;
+        return 0;
+    }
+    catch (const interprocess_exception&) {
+        BOOST_LOG_TRIVIAL(error) << "Channel " << vm["channel"].as<std::string>() << " has no topic registry, is its server running?";
+        return 1;
+    }
+    catch (const std::exception& e) {
+        BOOST_LOG_TRIVIAL(error) << "Error in ls: " << e.what();
+        return 1;
+    }
 }
 int handle_test_write(const po::variables_map& vm) {
     try {
@@ -226,15 +613,20 @@ int handle_test_write(const po::variables_map& vm) {
         BOOST_LOG_TRIVIAL(info) << "  Frequency: " << frequency << " messages/second";
         BOOST_LOG_TRIVIAL(info) << "  Message payload size: " << messageSize << " bytes, actual: " << messageSize + sizeof(TestFrame) << " bytes";
         BOOST_LOG_TRIVIAL(info) << "  Interactive: " << (interactive ? "true" : "false");
+        BOOST_LOG_TRIVIAL(info) << "  Mode: " << vm["mode"].as<std::string>();
+        BOOST_LOG_TRIVIAL(info) << "  Checksums: " << (parse_flag(vm, "checksum") ? "true" : "false");
+        BOOST_LOG_TRIVIAL(info) << "  Timestamps: " << vm["timestamps"].as<std::string>();
         
         // Create server and topic
         auto server = std::make_shared<SharedMemoryServer>(channelName);
-        auto topic = server->CreateTopic(topicName);
+        auto topic = server->CreateTopic(topicName, 256, 8 * 1024 * 1024, parse_mode(vm["mode"].as<std::string>()));
 
         if (!topic) {
             BOOST_LOG_TRIVIAL(error) << "Failed to create topic";
             return 1;
         }
+        topic->SetChecksums(parse_flag(vm, "checksum"));
+        topic->SetTimestamps(parse_clock(vm["timestamps"].as<std::string>()));
         PeriodicTimer pt = PeriodicTimer::CreateFromFrequency(frequency);
 
         if (interactive)
@@ -296,12 +688,16 @@ int handle_test_read(const po::variables_map& vm) {
         BOOST_LOG_TRIVIAL(info) << "  Channel: " << channelName;
         BOOST_LOG_TRIVIAL(info) << "  Topic: " << topicName;
         BOOST_LOG_TRIVIAL(info) << "  Interactive: " << (interactive ? "true" : "false");
+        BOOST_LOG_TRIVIAL(info) << "  From: " << vm["from"].as<std::string>();
+        if (vm.contains("types"))
+            BOOST_LOG_TRIVIAL(info) << "  Types: " << vm["types"].as<std::string>();
 
         auto client = std::make_shared<SharedMemoryClient>(channelName);
 
         client->Connect();
         
-        auto cursor = client->Subscribe(topicName);
+        auto cursor = client->Subscribe(topicName, parse_start(vm["from"].as<std::string>()),
+            parse_types(vm.contains("types") ? vm["types"].as<std::string>() : ""));
         CyclicBuffer::Accessor accessor;
         bool read;
         while((read=cursor->TryReadFor(accessor, chrono::seconds(10))) || interactive)
@@ -321,6 +717,8 @@ int handle_test_read(const po::variables_map& vm) {
 #endif
                 continue;
             }
+            if (!accessor.Verify())
+                BOOST_LOG_TRIVIAL(error) << "Message checksum does not match, it is corrupted.";
 			if(accessor.Type() == 69)
 			{
 				auto ptr = accessor.Get();
@@ -344,6 +742,8 @@ int handle_test_read(const po::variables_map& vm) {
 			}
         }
         BOOST_LOG_TRIVIAL(info) << "No more messages has arrived in last 10 seconds. Exiting.";
+        log_latency("Commit to read", cursor->Latency());
+        log_latency("End-to-end", cursor->EndToEndLatency());
 
         return 0;
     }
@@ -360,7 +760,7 @@ int main(int argc, char* argv[]) {
         po::options_description main_opts("Main options");
         main_opts.add_options()
             ("help", "Print help message")
-            ("command", po::value<std::string>(), "Command (replication, test, clear)");
+            ("command", po::value<std::string>(), "Command (replication, record, replay, ls, top, test, clear)");
 
         // Replication subcommand options
         po::options_description repl_opts("Replication options");
@@ -405,22 +805,42 @@ int main(int argc, char* argv[]) {
                 << "    Subcommands:\n"
                 << "      publish   - Start a publisher\n"
                 << "                  Required: --channel, \n"
-        	    << "                  Options: --url=tcp://host:port or --url=udp://host.port, --topics  \n"
+        	    << "                  Options: --url=tcp://host:port or --url=udp://host.port, --topics, --gso=[true|false], --mtu=N, --fec=K:M, --retransmit-window=N, --retransmit-rate=MB/s,\n"
+                << "                           --multicast-interface=ip, --multicast-ttl=N, --multicast-loopback=[true|false], --pacing-rate=MB/s, --pacing-budget=us,\n"
+                << "                           --compress=codec or --compress=topic=codec,..., --compress-threads=N,\n"
+                << "                           --delta=[true|false], --keyframe-interval=N, --checksum=[true|false]\n"
                 << "                  Example: --url=tcp://localhost:5000\n"
                 << "      subscribe - Start a subscriber\n"
                 << "                  Required: --channel\n"
-                << "                  Options: --url=udp://host:port, --topics or --url=tcp://host:port \n"
+                << "                  Options: --url=udp://host:port, --topics, --mtu=N, --nack=[true|false], --multicast-interface=ip or --url=tcp://host:port \n"
+                << "                  Multicast: --url=udp://239.1.1.1:5000 on both publisher and subscribers\n"
                 << "                  Example: --url=tcp://localhost:5000\n"
+                << "  record        - Append messages of topics to a segmented log on disk, until Ctrl+C\n"
+                << "                  Required: --channel, --topics\n"
+                << "                  Options: --dir=path, --prefix=name, --segment-size=MB, --from=[latest|oldest|seq:N|last:N]\n"
+                << "  replay        - Republish a recording into topics of a channel\n"
+                << "                  Required: --channel\n"
+                << "                  Options: --dir=path, --prefix=name, --topics, --speed=X (0 is as fast as possible), --from=ns since epoch\n"
+                << "  ls            - List the topics of a channel from its registry\n"
+                << "                  Required: --channel\n"
+                << "  top           - Show rates and lags of the topics of a channel and their subscribers, every second until Ctrl+C\n"
+                << "                  Required: --channel\n"
+                << "                  Options: --topics, all topics of the channel by default, --interval=ms\n"
+                << "                  Topics of publish over udp, record and top may be globs, e.g. --topics=cam.*, matched against the registry\n"
                 << "  test <subcommand> [options]\n"
                 << "    Subcommands:\n"
                 << "      write     - Run write test\n"
                 << "                  Required: --channel, --topic\n"
-                << "                  Options: --count=N, --frequency=N, --message-size=N, --interactive=[true|false]\n"
+                << "                  Options: --count=N, --frequency=N, --message-size=N, --interactive=[true|false], --mode=[queue|conflate],\n"
+                << "                           --checksum=[true|false], every message gets a CRC32C that readers verify\n"
+                << "                           --timestamps=[none|monotonic|tsc], every message is stamped, readers log its latency\n"
                 << "      read      - Run read test\n"
                 << "                  Required: --channel, --topic\n"
+                << "                  Options: --from=[latest|oldest|seq:N|last:N], messages still in the buffer are replayed first\n"
+                << "                           --types=T1,T2, read only messages of these types, the others do not wake the reader\n"
                 << "  clear         - Clear a shared memory channel\n"
                 << "                  Required: --channel\n"
-                << "                  Options: --topic\n\n"
+                << "                  Options: --topic, a name or a glob, every registered topic by default\n\n"
                 << main_opts << "\n"
                 
                 << subscribe_opts << "\n"
@@ -443,7 +863,22 @@ int main(int argc, char* argv[]) {
                             ("channel", po::value<std::string>()->required(), "Channel name")
                             ("url", po::value<std::string>()->required(), "Tcp listen url, or remote udp url.")
                             ("topics", po::value<std::string>(), "Comma-separated list of topics to subscribe to")
-                            ("topic", po::value<std::string>(), "Required topic when published with UDP");
+                            ("topic", po::value<std::string>(), "Topic when published with UDP, --topics replicates several over one socket")
+                            ("gso", po::value<std::string>()->default_value("false"), "Use UDP segmentation offload when published with UDP [true|false]")
+                            ("mtu", po::value<size_t>()->default_value(1500), "Link MTU when published with UDP, 9000 for jumbo frames")
+                            ("fec", po::value<std::string>(), "Forward error correction when published with UDP, K data fragments protected by M parity fragments [K:M]")
+                            ("retransmit-window", po::value<size_t>()->default_value(0), "Number of last frames retransmitted on NACK when published with UDP, 0 disables")
+                            ("retransmit-rate", po::value<size_t>()->default_value(0), "Retransmission limit in MB/s when published with UDP, 0 is unlimited")
+                            ("multicast-interface", po::value<std::string>(), "Address of the interface that sends to a multicast group")
+                            ("multicast-ttl", po::value<int>()->default_value(1), "Multicast TTL, 1 keeps datagrams on the local network")
+                            ("multicast-loopback", po::value<std::string>()->default_value("true"), "Deliver multicast to subscribers on the publishing host [true|false]")
+                            ("pacing-rate", po::value<size_t>()->default_value(0), "Send rate in MB/s per topic when published with UDP, 0 sends frames in one burst")
+                            ("pacing-budget", po::value<size_t>()->default_value(0), "Spread every frame over this many microseconds when published with UDP and no pacing rate is set")
+                            ("compress", po::value<std::string>(), "Compress payloads with a codec [none|lz4|zstd|deflate], for every topic or per topic as topic=codec,...")
+                            ("compress-threads", po::value<size_t>()->default_value(2), "Threads that compress large frames in parallel chunks")
+                            ("delta", po::value<std::string>()->default_value("false"), "Send only the blocks that changed since the previous message of the same type [true|false]")
+                            ("keyframe-interval", po::value<uint32_t>()->default_value(100), "Send the whole message every N messages of a type when delta encoding")
+                            ("checksum", po::value<std::string>()->default_value("false"), "Send every message with a CRC32C that the target verifies [true|false]");
 
                         po::store(po::command_line_parser(argc, argv)
                             .options(publish_opts)
@@ -460,7 +895,10 @@ int main(int argc, char* argv[]) {
                             ("channel", po::value<std::string>()->required(), "Channel name")
                             ("url", po::value<std::string>()->required(), "Tcp remote url, or listen udp url.")
                             ("topics", po::value<std::string>(),"Comma-separated list of topics to subscribe to")
-                            ("topic", po::value<std::string>(), "Required topic when subscribed with UDP");
+                            ("topic", po::value<std::string>(), "Topic when subscribed with UDP, --topics receives several on one socket")
+                            ("mtu", po::value<size_t>()->default_value(9000), "Largest link MTU accepted when subscribed with UDP")
+                            ("nack", po::value<std::string>()->default_value("false"), "Request missing fragments from the source when subscribed with UDP [true|false]")
+                            ("multicast-interface", po::value<std::string>(), "Address of the interface that joins a multicast group");
 
                         po::store(po::command_line_parser(argc, argv)
                             .options(subscribe_opts)
@@ -472,6 +910,70 @@ int main(int argc, char* argv[]) {
                     }
                 }
             }
+            else if (command == "record") {
+                po::options_description record_opts;
+                record_opts.add_options()
+                    ("channel", po::value<std::string>()->required(), "Channel name")
+                    ("topics", po::value<std::string>()->required(), "Comma-separated list of topics to record")
+                    ("dir", po::value<std::string>()->default_value("."), "Directory of the recording")
+                    ("prefix", po::value<std::string>()->default_value("zq"), "File name prefix of the segments")
+                    ("segment-size", po::value<size_t>()->default_value(1024), "Size of a segment in MB")
+                    ("from", po::value<std::string>()->default_value("latest"), "Where to start recording [latest|oldest|seq:N|last:N]");
+
+                po::store(po::command_line_parser(argc, argv)
+                    .options(record_opts)
+                    .allow_unregistered()
+                    .run(), vm);
+                po::notify(vm);
+
+                return handle_record(vm);
+            }
+            else if (command == "replay") {
+                po::options_description replay_opts;
+                replay_opts.add_options()
+                    ("channel", po::value<std::string>()->required(), "Channel name")
+                    ("dir", po::value<std::string>()->default_value("."), "Directory of the recording")
+                    ("prefix", po::value<std::string>()->default_value("zq"), "File name prefix of the segments")
+                    ("topics", po::value<std::string>(), "Comma-separated list of topics to replay, all by default")
+                    ("speed", po::value<double>()->default_value(1.0), "Replay speed, 2 is twice as fast, 0 is as fast as possible")
+                    ("from", po::value<uint64_t>()->default_value(0), "Start at the first message recorded at or after this system clock time in ns");
+
+                po::store(po::command_line_parser(argc, argv)
+                    .options(replay_opts)
+                    .allow_unregistered()
+                    .run(), vm);
+                po::notify(vm);
+
+                return handle_replay(vm);
+            }
+            else if (command == "ls") {
+                po::options_description ls_opts;
+                ls_opts.add_options()
+                    ("channel", po::value<std::string>()->required(), "Channel name");
+
+                po::store(po::command_line_parser(argc, argv)
+                    .options(ls_opts)
+                    .allow_unregistered()
+                    .run(), vm);
+                po::notify(vm);
+
+                return handle_ls(vm);
+            }
+            else if (command == "top") {
+                po::options_description top_opts;
+                top_opts.add_options()
+                    ("channel", po::value<std::string>()->required(), "Channel name")
+                    ("topics", po::value<std::string>(), "Comma-separated list of topics to show, all topics of the channel by default")
+                    ("interval", po::value<uint32_t>()->default_value(1000u), "Refresh interval in milliseconds");
+
+                po::store(po::command_line_parser(argc, argv)
+                    .options(top_opts)
+                    .allow_unregistered()
+                    .run(), vm);
+                po::notify(vm);
+
+                return handle_top(vm);
+            }
             else if (command == "test") {
                 if (vm.count("sub-command") == 0) {
                     BOOST_LOG_TRIVIAL(error) << "Error: test command requires a subcommand (write or read)";
@@ -488,6 +990,9 @@ int main(int argc, char* argv[]) {
                         ("count", po::value<uint32_t>()->default_value(10u), "Number of messages to write")
                         ("interactive", po::value<std::string>()->default_value("false"), "Interactive mode")
                         ("frequency", po::value<uint32_t>()->default_value(1u), "Messages per second [Hz]")
+                        ("mode", po::value<std::string>()->default_value("queue"), "Topic mode, conflate delivers only the latest message [queue|conflate]")
+                        ("checksum", po::value<std::string>()->default_value("false"), "Store a CRC32C with every message [true|false]")
+                        ("timestamps", po::value<std::string>()->default_value("none"), "Stamp every message with its publish time [none|monotonic|tsc]")
                         ("message-size", po::value<uint32_t>()->default_value(8u), "Size of each message in bytes");
                     po::store(po::command_line_parser(argc, argv)
                         .options(test_ops)
@@ -503,6 +1008,8 @@ int main(int argc, char* argv[]) {
                     test_ops.add_options()
                         ("channel", po::value<std::string>()->required(), "Channel name")
                         ("interactive", po::value<std::string>()->default_value("false"), "Interactive mode")
+                        ("from", po::value<std::string>()->default_value("latest"), "Where to start reading [latest|oldest|seq:N|last:N]")
+                        ("types", po::value<std::string>(), "Comma-separated list of message types to read, all by default")
                         ("topic", po::value<std::string>()->required(), "Topic name");
 
                     po::store(po::command_line_parser(argc, argv)
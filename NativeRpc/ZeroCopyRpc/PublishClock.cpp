@@ -0,0 +1,88 @@
+#include "PublishClock.h"
+
+#include <chrono>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define ZEROCOPYRPC_TSC 1
+#elif defined(__aarch64__)
+#define ZEROCOPYRPC_TSC 1
+#endif
+
+namespace {
+    uint64_t MonotonicNow()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+#if defined(ZEROCOPYRPC_TSC)
+    uint64_t ReadCounter()
+    {
+#if defined(__aarch64__)
+        uint64_t value;
+        asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+        return value;
+#else
+        return __rdtsc();
+#endif
+    }
+
+    double Calibrate()
+    {
+#if defined(__aarch64__)
+        uint64_t frequency;
+        asm volatile("mrs %0, cntfrq_el0" : "=r"(frequency));
+        if (frequency != 0)
+            return 1e9 / static_cast<double>(frequency);
+#endif
+        // Counter ticks over a few ms of the monotonic clock.
+        uint64_t startNs = MonotonicNow();
+        uint64_t startTicks = ReadCounter();
+        uint64_t endNs;
+        do {
+            endNs = MonotonicNow();
+        } while (endNs - startNs < 5'000'000);
+        uint64_t ticks = ReadCounter() - startTicks;
+        return ticks != 0 ? static_cast<double>(endNs - startNs) / static_cast<double>(ticks) : 1.0;
+    }
+#endif
+}
+
+uint64_t PublishClock::Now(TimestampClock clock)
+{
+#if defined(ZEROCOPYRPC_TSC)
+    if (clock == TimestampClock::Tsc)
+        return ReadCounter();
+#endif
+    return MonotonicNow();
+}
+
+uint64_t PublishClock::Elapsed(TimestampClock clock, uint64_t from, uint64_t to)
+{
+    if (to <= from)
+        return 0;
+#if defined(ZEROCOPYRPC_TSC)
+    if (clock == TimestampClock::Tsc)
+        return static_cast<uint64_t>(static_cast<double>(to - from) * TscPeriod());
+#endif
+    return to - from;
+}
+
+uint64_t PublishClock::SystemNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+double PublishClock::TscPeriod()
+{
+#if defined(ZEROCOPYRPC_TSC)
+    static const double period = Calibrate();
+    return period;
+#else
+    return 1.0;
+#endif
+}
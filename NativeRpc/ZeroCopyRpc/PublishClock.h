@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+
+#include "Export.h"
+
+// Clock a topic stamps the ring entries of its messages with (see TopicWriter::SetTimestamps).
+enum class TimestampClock : uint8_t
+{
+    None = 0,
+    // CLOCK_MONOTONIC ns, comparable between processes of the host.
+    Monotonic = 1,
+    // Raw time stamp counter, cheaper to read; needs an invariant TSC that all cores share.
+    Tsc = 2
+};
+
+// Reads and compares publish timestamps. Timestamps are only ever compared on the host that took them; across hosts
+// the system clock time of the original publish is carried instead, so end-to-end latency is as good as the clock sync.
+struct EXPORT PublishClock
+{
+    // Falls back to Monotonic where there is no counter to read.
+    static uint64_t Now(TimestampClock clock);
+    // ns between two timestamps of the clock, 0 when to is before from.
+    static uint64_t Elapsed(TimestampClock clock, uint64_t from, uint64_t to);
+    // System clock ns since the epoch.
+    static uint64_t SystemNow();
+    // ns per tick of the counter, calibrated once against the monotonic clock on first use.
+    static double TscPeriod();
+};
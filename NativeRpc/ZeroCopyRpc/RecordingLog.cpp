@@ -0,0 +1,344 @@
+#include "RecordingLog.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <boost/log/trivial.hpp>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace bip = boost::interprocess;
+
+namespace {
+	uint64_t NowNs()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	// Creates the file at its full size, so that writes into the mapping do not allocate blocks one page at a time.
+	void Preallocate(const std::string& path, size_t size)
+	{
+#if defined(__linux__)
+		int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			throw std::runtime_error("Cannot create recording segment " + path + ": " + std::strerror(errno));
+		int result = ::fallocate(fd, 0, 0, static_cast<off_t>(size));
+		if (result != 0)
+			result = ::posix_fallocate(fd, 0, static_cast<off_t>(size));
+		::close(fd);
+		if (result != 0)
+			throw std::runtime_error("Cannot preallocate recording segment " + path);
+#else
+		std::FILE* file = std::fopen(path.c_str(), "wb");
+		if (file == nullptr)
+			throw std::runtime_error("Cannot create recording segment " + path);
+		std::fclose(file);
+		std::filesystem::resize_file(path, size);
+#endif
+	}
+
+	// Numbers of the segments of a recording, ascending.
+	std::vector<uint64_t> ListSegments(const RecordingConfig& config)
+	{
+		std::vector<uint64_t> segments;
+		if (!std::filesystem::is_directory(config.Directory))
+			return segments;
+		std::string prefix = config.Prefix + ".";
+		for (auto& file : std::filesystem::directory_iterator(config.Directory)) {
+			auto name = file.path().filename().string();
+			if (name.size() != prefix.size() + 10 || name.compare(0, prefix.size(), prefix) != 0 || file.path().extension() != ".log")
+				continue;
+			try {
+				segments.push_back(std::stoull(name.substr(prefix.size(), 6)));
+			}
+			catch (const std::exception&) {}
+		}
+		std::sort(segments.begin(), segments.end());
+		return segments;
+	}
+}
+
+bool RecordingSegmentHeader::IsValid() const
+{
+	return std::memcmp(Magic, MagicValue, sizeof(Magic)) == 0 && Version == CurrentVersion
+		&& HeaderSize == sizeof(RecordingSegmentHeader);
+}
+
+std::string RecordingConfig::SegmentPath(uint64_t segment, const char* extension) const
+{
+	char name[32];
+	std::snprintf(name, sizeof(name), ".%06llu.", static_cast<unsigned long long>(segment));
+	return (std::filesystem::path(Directory) / (Prefix + name + extension)).string();
+}
+
+RecordingLogWriter::RecordingLogWriter(RecordingConfig config) : _config(std::move(config))
+{
+	if (_config.SegmentSize < sizeof(RecordingSegmentHeader) + sizeof(RecordingEntryHeader))
+		throw std::invalid_argument("Recording segment size is too small.");
+	std::filesystem::create_directories(_config.Directory);
+
+	// A recording that is restarted continues after the segments that are already there.
+	auto segments = ListSegments(_config);
+	if (!segments.empty())
+		_segment = segments.back() + 1;
+}
+
+RecordingLogWriter::~RecordingLogWriter()
+{
+	try {
+		Close();
+	}
+	catch (const std::exception& e) {
+		BOOST_LOG_TRIVIAL(error) << "Cannot close recording segment " << _path << ": " << e.what();
+	}
+}
+
+void RecordingLogWriter::AddTopic(uint32_t topicId, const std::string& name)
+{
+	if (_topics.emplace(topicId, name).second)
+		Close();
+}
+
+void RecordingLogWriter::Append(uint32_t topicId, uint64_t sequence, uint64_t timestamp, uint64_t type,
+	const void* data, size_t size)
+{
+	Write(RecordingEntryKind::Message, topicId, sequence, timestamp, type, data, size);
+}
+
+void RecordingLogWriter::Rewind()
+{
+	if (_base == nullptr || _lastEntry >= _used)
+		return;
+	auto entry = reinterpret_cast<RecordingEntryHeader*>(_base + _lastEntry);
+	if (entry->Kind != RecordingEntryKind::Message)
+		return;
+	_bytesWritten -= entry->Stride();
+	if (_indexed && _lastIndexed == _lastEntry) {
+		// The next message takes the index entry over.
+		std::fseek(_index, -static_cast<long>(sizeof(RecordingIndexEntry)), SEEK_CUR);
+		_indexed = false;
+	}
+	std::memset(entry, 0, sizeof(RecordingEntryHeader));
+	_used = _lastEntry;
+	if (_flushed > _used)
+		_flushed = _used;
+}
+
+void RecordingLogWriter::Flush()
+{
+	if (_base == nullptr)
+		return;
+	reinterpret_cast<RecordingSegmentHeader*>(_base)->Used = _used;
+	_region->flush(0, sizeof(RecordingSegmentHeader), true);
+	if (_used > _flushed)
+		_region->flush(_flushed, _used - _flushed, true);
+	_flushed = _used;
+	std::fflush(_index);
+}
+
+void RecordingLogWriter::Close()
+{
+	if (_base == nullptr)
+		return;
+	reinterpret_cast<RecordingSegmentHeader*>(_base)->Used = _used;
+	_region->flush(0, _used, false);
+	_region.reset();
+	_file.reset();
+	_base = nullptr;
+	std::fclose(_index);
+	_index = nullptr;
+	// Gives back the preallocated space that was not used.
+	std::filesystem::resize_file(_path, _used);
+}
+
+void RecordingLogWriter::Open(size_t minSize)
+{
+	size_t topics = 0;
+	for (auto& [id, name] : _topics)
+		topics += RecordingEntryHeader::StrideOf(name.size());
+	_capacity = std::max(_config.SegmentSize, sizeof(RecordingSegmentHeader) + topics + minSize);
+
+	_path = _config.SegmentPath(_segment, "log");
+	Preallocate(_path, _capacity);
+	_file = std::make_unique<bip::file_mapping>(_path.c_str(), bip::read_write);
+	_region = std::make_unique<bip::mapped_region>(*_file, bip::read_write, 0, _capacity);
+	_region->advise(bip::mapped_region::advice_sequential);
+	_base = static_cast<uint8_t*>(_region->get_address());
+
+	auto indexPath = _config.SegmentPath(_segment, "idx");
+	_index = std::fopen(indexPath.c_str(), "wb");
+	if (_index == nullptr)
+		throw std::runtime_error("Cannot create recording index " + indexPath);
+
+	auto header = reinterpret_cast<RecordingSegmentHeader*>(_base);
+	std::memcpy(header->Magic, RecordingSegmentHeader::MagicValue, sizeof(header->Magic));
+	header->Version = RecordingSegmentHeader::CurrentVersion;
+	header->HeaderSize = sizeof(RecordingSegmentHeader);
+	header->Segment = _segment;
+	header->Created = NowNs();
+	header->Used = sizeof(RecordingSegmentHeader);
+
+	_used = sizeof(RecordingSegmentHeader);
+	_flushed = 0;
+	_lastEntry = _used;
+	_lastIndexed = 0;
+	_indexed = false;
+	_segment++;
+	_segments++;
+	BOOST_LOG_TRIVIAL(info) << "Recording to " << _path;
+
+	for (auto& [id, name] : _topics)
+		Write(RecordingEntryKind::Topic, id, 0, header->Created, 0, name.data(), name.size());
+}
+
+void RecordingLogWriter::Write(RecordingEntryKind kind, uint32_t topicId, uint64_t sequence, uint64_t timestamp,
+	uint64_t type, const void* data, size_t size)
+{
+	size_t stride = RecordingEntryHeader::StrideOf(size);
+	if (_base == nullptr || _used + stride > _capacity) {
+		Close();
+		Open(stride);
+		if (kind == RecordingEntryKind::Topic)
+			return;
+	}
+
+	auto entry = reinterpret_cast<RecordingEntryHeader*>(_base + _used);
+	*entry = RecordingEntryHeader{ kind, topicId, sequence, timestamp, type, size };
+	auto payload = reinterpret_cast<uint8_t*>(entry + 1);
+	std::memcpy(payload, data, size);
+	std::memset(payload + size, 0, stride - sizeof(RecordingEntryHeader) - size);
+
+	if (kind == RecordingEntryKind::Message && (!_indexed || _used - _lastIndexed >= _config.IndexInterval)) {
+		RecordingIndexEntry index{ sequence, timestamp, _used, topicId, 0 };
+		if (std::fwrite(&index, sizeof(index), 1, _index) != 1)
+			throw std::runtime_error("Cannot write recording index of " + _path);
+		_lastIndexed = _used;
+		_indexed = true;
+	}
+	_lastEntry = _used;
+	_used += stride;
+	_bytesWritten += stride;
+}
+
+RecordingLogReader::RecordingLogReader(RecordingConfig config) : _config(std::move(config)), _segments(ListSegments(_config))
+{
+	if (_segments.empty())
+		throw std::runtime_error("No recording " + _config.Prefix + " in " + _config.Directory);
+	Open(0);
+}
+
+bool RecordingLogReader::Open(size_t segment)
+{
+	_region.reset();
+	_file.reset();
+	_base = nullptr;
+	_size = 0;
+	_offset = 0;
+	_current = segment;
+	if (segment >= _segments.size())
+		return false;
+
+	auto path = _config.SegmentPath(_segments[segment], "log");
+	_size = std::filesystem::file_size(path);
+	if (_size < sizeof(RecordingSegmentHeader))
+		return false;
+	_file = std::make_unique<bip::file_mapping>(path.c_str(), bip::read_only);
+	_region = std::make_unique<bip::mapped_region>(*_file, bip::read_only, 0, _size);
+	_region->advise(bip::mapped_region::advice_sequential);
+	_base = static_cast<const uint8_t*>(_region->get_address());
+	if (!reinterpret_cast<const RecordingSegmentHeader*>(_base)->IsValid())
+		throw std::runtime_error("Invalid recording segment " + path);
+	_offset = sizeof(RecordingSegmentHeader);
+
+	// Topics come first, they name the ids of the whole segment.
+	while (auto entry = Current()) {
+		if (entry->Kind != RecordingEntryKind::Topic)
+			break;
+		_topics[entry->TopicId] = std::string(reinterpret_cast<const char*>(entry + 1), entry->Size);
+		_offset += entry->Stride();
+	}
+	return true;
+}
+
+const RecordingEntryHeader* RecordingLogReader::Current() const
+{
+	if (_base == nullptr || _offset + sizeof(RecordingEntryHeader) > _size)
+		return nullptr;
+	auto entry = reinterpret_cast<const RecordingEntryHeader*>(_base + _offset);
+	// Zero is space that was preallocated but not written, a shorter tail is an entry cut by a crash.
+	if (entry->Kind == RecordingEntryKind::None || _offset + entry->Stride() > _size)
+		return nullptr;
+	return entry;
+}
+
+bool RecordingLogReader::Next(const RecordingEntryHeader*& header, const uint8_t*& payload)
+{
+	while (_current < _segments.size()) {
+		while (auto entry = Current()) {
+			_offset += entry->Stride();
+			if (entry->Kind != RecordingEntryKind::Message)
+				continue;
+			header = entry;
+			payload = reinterpret_cast<const uint8_t*>(entry + 1);
+			return true;
+		}
+		Open(_current + 1);
+	}
+	return false;
+}
+
+std::vector<RecordingIndexEntry> RecordingLogReader::ReadIndex(size_t segment) const
+{
+	std::vector<RecordingIndexEntry> index;
+	std::FILE* file = std::fopen(_config.SegmentPath(_segments[segment], "idx").c_str(), "rb");
+	if (file == nullptr)
+		return index;
+	RecordingIndexEntry entry;
+	while (std::fread(&entry, sizeof(entry), 1, file) == 1)
+		index.push_back(entry);
+	std::fclose(file);
+	return index;
+}
+
+void RecordingLogReader::Seek(uint64_t timestamp)
+{
+	// Last segment whose first message is not later than timestamp; the first one of every index is the first message.
+	size_t segment = 0;
+	for (size_t i = 1; i < _segments.size(); i++) {
+		auto index = ReadIndex(i);
+		if (!index.empty() && index.front().Timestamp > timestamp)
+			break;
+		if (!index.empty())
+			segment = i;
+	}
+	Open(segment);
+
+	auto index = ReadIndex(segment);
+	auto it = std::upper_bound(index.begin(), index.end(), timestamp,
+		[](uint64_t ts, const RecordingIndexEntry& entry) { return ts < entry.Timestamp; });
+	if (it != index.begin() && std::prev(it)->Offset >= _offset && std::prev(it)->Offset < _size)
+		_offset = std::prev(it)->Offset;
+
+	// Then forward over the entries between two index entries.
+	while (_current < _segments.size()) {
+		while (auto entry = Current()) {
+			if (entry->Kind == RecordingEntryKind::Message && entry->Timestamp >= timestamp)
+				return;
+			_offset += entry->Stride();
+		}
+		Open(_current + 1);
+	}
+}
+
+const std::string& RecordingLogReader::TopicName(uint32_t topicId) const
+{
+	static const std::string unknown;
+	auto it = _topics.find(topicId);
+	return it != _topics.end() ? it->second : unknown;
+}
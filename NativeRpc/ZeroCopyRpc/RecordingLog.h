@@ -0,0 +1,162 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include "Export.h"
+
+// On-disk format of topic recordings. A recording is a directory of segments; every segment is a preallocated,
+// memory-mapped log and a sparse index next to it:
+//   <prefix>.<segment>.log  RecordingSegmentHeader, then 8 byte aligned entries: RecordingEntryHeader + payload
+//   <prefix>.<segment>.idx  RecordingIndexEntry for the first entry and then every IndexInterval bytes of the log
+// Every segment starts with Topic entries that name all topic ids used in it, so a segment can be read alone; a topic
+// that is added later starts a new segment.
+// Preallocated space that was not written is zero, a reader stops at the first entry of kind None, also after a crash.
+
+enum class RecordingEntryKind : uint32_t {
+    None = 0,
+    Message = 1,
+    // Payload is the topic name of TopicId.
+    Topic = 2
+};
+
+struct RecordingSegmentHeader {
+    static constexpr char MagicValue[8] = { 'Z', 'Q', 'R', 'E', 'C', 'O', 'R', 'D' };
+    static constexpr uint32_t CurrentVersion = 1;
+
+    char Magic[8];
+    uint32_t Version;
+    uint32_t HeaderSize;
+    uint64_t Segment;
+    // System clock ns.
+    uint64_t Created;
+    // Bytes of log written, updated on flush and when the segment is closed.
+    uint64_t Used;
+
+    bool IsValid() const;
+};
+
+struct RecordingEntryHeader {
+    static constexpr size_t Align = 8;
+
+    RecordingEntryKind Kind;
+    uint32_t TopicId;
+    // Index of the message in the topic buffer.
+    uint64_t Sequence;
+    // System clock ns.
+    uint64_t Timestamp;
+    uint64_t Type;
+    // Payload bytes that follow the header.
+    uint64_t Size;
+
+    static size_t StrideOf(size_t size) { return sizeof(RecordingEntryHeader) + ((size + Align - 1) & ~(Align - 1)); }
+    size_t Stride() const { return StrideOf(Size); }
+};
+
+struct RecordingIndexEntry {
+    uint64_t Sequence;
+    uint64_t Timestamp;
+    // Offset of the entry in the log file.
+    uint64_t Offset;
+    uint32_t TopicId;
+    uint32_t Reserved;
+};
+
+struct RecordingConfig {
+    std::string Directory = ".";
+    std::string Prefix = "zq";
+    // Segments are preallocated at this size, a message that is larger gets a segment of its own.
+    size_t SegmentSize = 1024 * 1024 * 1024;
+    size_t IndexInterval = 1024 * 1024;
+    std::chrono::milliseconds FlushInterval{ 1000 };
+
+    std::string SegmentPath(uint64_t segment, const char* extension) const;
+};
+
+// Appends entries to the segments of a recording. Payload is copied straight into the mapping, the kernel writes it
+// back in the background; Flush only starts the writeback of what was appended since the last one. Not thread safe.
+class EXPORT RecordingLogWriter {
+public:
+    explicit RecordingLogWriter(RecordingConfig config);
+    ~RecordingLogWriter();
+
+    RecordingLogWriter(const RecordingLogWriter&) = delete;
+    RecordingLogWriter& operator=(const RecordingLogWriter&) = delete;
+
+    // Names a topic id, the name is repeated at the start of every later segment. Closes the open segment.
+    void AddTopic(uint32_t topicId, const std::string& name);
+    void Append(uint32_t topicId, uint64_t sequence, uint64_t timestamp, uint64_t type, const void* data, size_t size);
+    // Takes back the last appended message, for a payload that was overwritten while it was copied.
+    void Rewind();
+    void Flush();
+    void Close();
+
+    // Segments opened by this writer.
+    uint64_t Segments() const { return _segments; }
+    uint64_t BytesWritten() const { return _bytesWritten; }
+
+private:
+    void Open(size_t minSize);
+    void Write(RecordingEntryKind kind, uint32_t topicId, uint64_t sequence, uint64_t timestamp, uint64_t type,
+        const void* data, size_t size);
+
+    const RecordingConfig _config;
+    std::unordered_map<uint32_t, std::string> _topics;
+
+    uint64_t _segment = 0;
+    uint64_t _segments = 0;
+    std::string _path;
+    std::unique_ptr<boost::interprocess::file_mapping> _file;
+    std::unique_ptr<boost::interprocess::mapped_region> _region;
+    uint8_t* _base = nullptr;
+    size_t _capacity = 0;
+    size_t _used = 0;
+    size_t _flushed = 0;
+    size_t _lastEntry = 0;
+    size_t _lastIndexed = 0;
+    bool _indexed = false;
+    std::FILE* _index = nullptr;
+    uint64_t _bytesWritten = 0;
+};
+
+// Reads the messages of a recording in the order they were written, straight from the mapped segments. Segments are
+// mapped one at a time. Not thread safe.
+class EXPORT RecordingLogReader {
+public:
+    explicit RecordingLogReader(RecordingConfig config);
+
+    RecordingLogReader(const RecordingLogReader&) = delete;
+    RecordingLogReader& operator=(const RecordingLogReader&) = delete;
+
+    // Moves to the next message, false at the end of the recording. Header and payload point into the mapping and
+    // stay valid until the reader moves to another segment.
+    bool Next(const RecordingEntryHeader*& header, const uint8_t*& payload);
+    // Positions the reader at the first message recorded at or after timestamp (system clock ns), using the index.
+    void Seek(uint64_t timestamp);
+    // Recorded name of a topic id, empty when it was not named in the segments read so far.
+    const std::string& TopicName(uint32_t topicId) const;
+    size_t Segments() const { return _segments.size(); }
+
+private:
+    bool Open(size_t segment);
+    // Entry at the read offset, nullptr at the end of the segment.
+    const RecordingEntryHeader* Current() const;
+    std::vector<RecordingIndexEntry> ReadIndex(size_t segment) const;
+
+    const RecordingConfig _config;
+    // Numbers of the segments in the directory, ascending.
+    std::vector<uint64_t> _segments;
+    std::unordered_map<uint32_t, std::string> _topics;
+
+    size_t _current = 0;
+    std::unique_ptr<boost::interprocess::file_mapping> _file;
+    std::unique_ptr<boost::interprocess::mapped_region> _region;
+    const uint8_t* _base = nullptr;
+    size_t _size = 0;
+    size_t _offset = 0;
+};
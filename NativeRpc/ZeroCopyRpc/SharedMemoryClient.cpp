@@ -40,21 +40,41 @@ Name(topicName), Parent(parent),
 _openCursorServerCount(0),
 _openCursorClientCount(0)
 {
-	Shm = new boost::interprocess::shared_memory_object(open_only, ShmName().c_str(), read_only);
+	// Read-only, but for what subscribers write: their counters in the metrics block and, on a lossless topic, what
+	// they consumed in the subscribers table.
+	Shm = new boost::interprocess::shared_memory_object(open_only, ShmName().c_str(), read_write);
 	Region = new mapped_region(*Shm, read_only);
 	auto base = Region->get_address();
 	Metadata = (TopicMetadata*)base;
-	Subscribers = (SubscriptionSharedData*)Metadata->SubscribersTableAddress(base);
-	
+	if (!Metadata->IsValid(Region->get_size()))
+	{
+		delete Region;
+		delete Shm;
+		throw ZeroCopyRpcException(("Topic " + topicName + " was created with another layout.").c_str());
+	}
+	auto offset = [base](void* address) { return static_cast<offset_t>((byte*)address - (byte*)base); };
+	if (Metadata->Mode == TopicMode::Lossless)
+	{
+		SubscribersRegion = new mapped_region(*Shm, read_write, offset(Metadata->SubscribersTableAddress(base)),
+			Metadata->SubscribesTableSize);
+		Subscribers = (SubscriptionSharedData*)SubscribersRegion->get_address();
+	}
+	else
+		Subscribers = (SubscriptionSharedData*)Metadata->SubscribersTableAddress(base);
+
 	SharedBuffer = new CyclicBuffer((byte*)Metadata->BufferAddress(base));
-	
+	MetricsRegion = new mapped_region(*Shm, read_write, offset(Metadata->MetricsAddress(base)), sizeof(TopicMetrics));
+	Metrics = (TopicMetrics*)MetricsRegion->get_address();
 }
 
 SharedMemoryClient::Topic::~Topic()
 {
 	SharedBuffer = nullptr;
 	Subscribers = nullptr;
+	Metrics = nullptr;
 	Metadata = nullptr;
+	delete MetricsRegion;
+	delete SubscribersRegion;
 	delete Region;
 	Shm->remove(Shm->get_name());
 	delete Shm;
@@ -138,12 +158,14 @@ void SharedMemoryClient::OnUnsubscribed(void* buffer, void* promise)
 {
 	auto ptr = (UnSubscribeResponseEnvelope*)buffer;
 	auto p = (std::promise<UnSubscribeResponseEnvelope*>*)promise;
-	p->set_value(new UnSubscribeResponseEnvelope(*ptr)); // default copy-ctor;
-	_messages.Remove(ptr->CorrelationId);
+	// Ack before the promise is set, the waiting thread may drop the topic right after.
 	if (ptr->Response.IsSuccess) {
 		auto topic = this->Get(ptr->Response.TopicName);
-		topic->AckUnsubscribed(ptr->Response.SlothId);
+		if (topic != nullptr)
+			topic->AckUnsubscribed(ptr->Response.SlothId);
 	}
+	_messages.Remove(ptr->CorrelationId);
+	p->set_value(new UnSubscribeResponseEnvelope(*ptr)); // default copy-ctor;
 }
 SharedMemoryClient::Topic* SharedMemoryClient::Get(const std::string& topic)
 {
@@ -176,15 +198,112 @@ SharedMemoryClient::Topic* SharedMemoryClient::GetOrCreate(const std::string& to
 	return t;
 }
 
-SharedMemoryClient::SubscriptionCursor::SubscriptionCursor(byte sloth, Topic* topic): _sem(nullptr), _sloth(sloth), _topic(topic), _cursor(nullptr)
+SharedMemoryClient::SubscriptionCursor::SubscriptionCursor(byte sloth, Topic* topic): _sem(nullptr), _sloth(sloth), _topic(topic), _cursor(nullptr), _conflate(false), _consumed(nullptr), _metrics(nullptr)
 {
 	_sem = new NamedSemaphore( SemaphoreName(), NamedSemaphore::OpenMode::Open);
+	// The server set the start of the subscription before it responded; history, if asked for, is already released.
+	auto value = _topic->Subscribers[_sloth].NextIndex.load();
+	BOOST_LOG_TRIVIAL(debug) << "Loaded next cursor value: " << value;
+	_cursor = new CyclicBuffer::Cursor(_topic->SharedBuffer->OpenCursor(value));
+	_filter = _topic->Subscribers[_sloth].Filter;
+	_conflate = _topic->Metadata->Mode == TopicMode::Conflate;
+	_consumed = _topic->Metadata->Mode == TopicMode::Lossless ? &_topic->Subscribers[_sloth].Consumed : nullptr;
+	_metrics = &_topic->Metrics->Subscribers[_sloth];
 	
 	_topic->_openCursorClientCount.fetch_add(1);
 	_topic->_openCursorServerCount.fetch_add(1);
 	_topic->_openSlots.push_back(sloth);
 }
 
+bool SharedMemoryClient::SubscriptionCursor::Advance()
+{
+	// The semaphore was released only for messages that pass the filter, the others are stepped over.
+	auto buffer = _topic->SharedBuffer;
+	while (_cursor->TryRead())
+	{
+		// Writers step over them as well, so the cursor may fall more than a lap behind; those entries were reused.
+		if (!_filter.IsAny())
+			_cursor->Index = buffer->WithinLap(_cursor->Index);
+		if (_filter.Accepts(_cursor->Data().Type()))
+		{
+			if (_consumed != nullptr)
+				_consumed->store(_cursor->Index);
+			Account();
+			return true;
+		}
+	}
+	return false;
+}
+
+void SharedMemoryClient::SubscriptionCursor::Account()
+{
+	auto buffer = _topic->SharedBuffer;
+	TopicMetrics::Add(_metrics->Delivered);
+	if (buffer->NextIndex() - _cursor->Index > buffer->Capacity())
+		TopicMetrics::Add(_metrics->Overruns);
+	_metrics->Position.store(_cursor->Index + 1, std::memory_order_relaxed);
+
+	auto& entry = buffer->EntryAt(_cursor->Index);
+	auto clock = entry.Clock();
+	if (clock != TimestampClock::None)
+	{
+		_latency.Record(PublishClock::Elapsed(clock, entry.Timestamp, PublishClock::Now(clock)));
+		auto now = PublishClock::SystemNow();
+		_endToEnd.Record(now > entry.Origin ? now - entry.Origin : 0);
+	}
+}
+
+LatencyHistogram SharedMemoryClient::SubscriptionCursor::Latency() const
+{
+	return _latency;
+}
+
+LatencyHistogram SharedMemoryClient::SubscriptionCursor::EndToEndLatency() const
+{
+	return _endToEnd;
+}
+
+bool SharedMemoryClient::SubscriptionCursor::JumpToLatest()
+{
+	auto buffer = _topic->SharedBuffer;
+	ulong next = buffer->NextIndex();
+	ulong capacity = buffer->Capacity();
+	// Entries more than a lap back were reused, they are not looked at.
+	for (ulong i = next - 1, checked = 0; i != _cursor->Index && checked < capacity; i--, checked++)
+	{
+		if (_filter.Accepts(buffer->TypeAt(i)))
+		{
+			_cursor->Index = i;
+			return true;
+		}
+	}
+	_cursor->Index = next - 1;
+	return false;
+}
+
+bool SharedMemoryClient::SubscriptionCursor::ReadLatest(CyclicBuffer::Accessor& a, const std::chrono::milliseconds& timeout)
+{
+	// The semaphore only signals a change. It is released after the message is committed, so the buffer is looked at
+	// first and wake ups for messages that were skipped over are dropped.
+	auto deadline = std::chrono::steady_clock::now() + timeout;
+	while (true)
+	{
+		// A writer that lapped the reader since the jump took the message, the newest one is looked for again.
+		if (JumpToLatest() && _topic->SharedBuffer->IsLive(_cursor->Index))
+		{
+			while (_sem->TryAcquire())
+			{
+			}
+			Account();
+			a = std::move(_cursor->Data());
+			return true;
+		}
+		auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+		if (!_sem->TryAcquireFor(std::max(remaining, std::chrono::milliseconds(0))))
+			return false;
+	}
+}
+
 std::string SharedMemoryClient::SubscriptionCursor::SemaphoreName() const
 {
 	std::ostringstream oss;
@@ -195,17 +314,21 @@ std::string SharedMemoryClient::SubscriptionCursor::SemaphoreName() const
 CyclicBuffer::Accessor SharedMemoryClient::SubscriptionCursor::Read()
 {
 	// WARNING: IF YOU CHANGE THIS METHOD, you need to change 2 more TryRead and Read
-	_sem->Acquire();
-
-	if(_cursor == nullptr)
+	if (_consumed != nullptr)
+		_consumed->store(_cursor->Index + 1); // The accessor of the previous read is done with.
+	if (_conflate)
 	{
-		auto value = _topic->Subscribers[_sloth].NextIndex.load(); // this should the value from shared memory.
-		BOOST_LOG_TRIVIAL(debug) << "Loaded next cursor value: " << value;
-		_cursor = new CyclicBuffer::Cursor(_topic->SharedBuffer->OpenCursor(value)); // move ctor.
+		CyclicBuffer::Accessor a;
+		while (!ReadLatest(a, std::chrono::seconds(1)))
+		{
+		}
+		return a;
 	}
+	_sem->Acquire();
+
 	for(int i = 0; i < 50; i++)
 	{
-		if (_cursor->TryRead())
+		if (Advance())
 		{
 			BOOST_LOG_TRIVIAL(debug) << "Waited " << (i * 200) << "CPU cycles before memory was in sync";
 			return _cursor->Data();
@@ -219,19 +342,16 @@ CyclicBuffer::Accessor SharedMemoryClient::SubscriptionCursor::Read()
 bool SharedMemoryClient::SubscriptionCursor::TryRead(CyclicBuffer::Accessor &a) 
 {
 	// WARNING: IF YOU CHANGE THIS METHOD, you need to change 2 more TryRead and Read
+	if (_consumed != nullptr)
+		_consumed->store(_cursor->Index + 1); // The accessor of the previous read is done with.
+	if (_conflate)
+		return ReadLatest(a, std::chrono::milliseconds(0));
 	if (!_sem->TryAcquire())
 		return false;
 
-	if (_cursor == nullptr)
-	{
-		auto value = _topic->Subscribers[_sloth].NextIndex.load(); // this should the value from shared memory.
-		BOOST_LOG_TRIVIAL(debug) << "Loaded next cursor value: " << value;
-		_cursor = new CyclicBuffer::Cursor(_topic->SharedBuffer->OpenCursor(value)); // move ctor.
-	}
-
 	for (int i = 0; i < 50; i++)
 	{
-		if (_cursor->TryRead())
+		if (Advance())
 		{
 			BOOST_LOG_TRIVIAL(debug) << "Waited " << (i * 200) << "CPU cycles before memory was in sync";
 			a = std::move(_cursor->Data());
@@ -245,7 +365,13 @@ SharedMemoryClient::SubscriptionCursor::SubscriptionCursor(SubscriptionCursor&&
 	_sem(other._sem),
 	_sloth(other._sloth),
 	_topic(other._topic),
-	_cursor(other._cursor)
+	_cursor(other._cursor),
+	_filter(other._filter),
+	_conflate(other._conflate),
+	_consumed(other._consumed),
+	_metrics(other._metrics),
+	_latency(other._latency),
+	_endToEnd(other._endToEnd)
 {
 	other._cursor = nullptr;
 	other._sem = nullptr;
@@ -305,18 +431,16 @@ bool SharedMemoryClient::SubscriptionCursor::TryReadFor(
 	const std::chrono::milliseconds& timeout)
 {
 	// WARNING: IF YOU CHANGE THIS METHOD, you need to change 2 more TryRead and Read
+	if (_consumed != nullptr)
+		_consumed->store(_cursor->Index + 1); // The accessor of the previous read is done with.
+	if (_conflate)
+		return ReadLatest(a, timeout);
 	if (!_sem->TryAcquireFor(timeout)) {
 		return false;
 	}
 
-	if (_cursor == nullptr) {
-		auto value = _topic->Subscribers[_sloth].NextIndex.load();
-		BOOST_LOG_TRIVIAL(debug) << "Loaded next cursor value: " << value;
-		_cursor = new CyclicBuffer::Cursor(_topic->SharedBuffer->OpenCursor(value));
-	}
-
 	for (int i = 0; i < 50; i++) {
-		if (_cursor->TryRead()) {
+		if (Advance()) {
 			if(i > 0)
 				BOOST_LOG_TRIVIAL(debug) << "Waited " << (i * 200) << " CPU cycles before memory was in sync";
 			a = std::move(_cursor->Data());
@@ -339,11 +463,14 @@ void SharedMemoryClient::Connect()
 	BOOST_LOG_TRIVIAL(info) << "Connection established successfully. [" << RequestDuration(value->Response) << "]";
 }
 
-std::unique_ptr<ISubscriptionCursor> SharedMemoryClient::Subscribe(const std::string& topicName)
+std::unique_ptr<ISubscriptionCursor> SharedMemoryClient::Subscribe(const std::string& topicName, const SubscribeStart& start,
+	const TypeFilter& filter)
 {
 	SubscribeCommandEnvelope env;
 	auto delegate = std::bind(&SharedMemoryClient::OnSubscribed, this, std::placeholders::_1, std::placeholders::_2);
 	env.Request.SetTopicName(topicName);
+	env.Request.Start = start;
+	env.Request.Filter = filter;
 
 	std::promise<SubscribeResponseEnvelope*> promise;
 	Callback c(&promise, delegate);
@@ -361,6 +488,78 @@ std::unique_ptr<ISubscriptionCursor> SharedMemoryClient::Subscribe(const std::st
 	return result;
 }
 
+ulong SharedMemoryClient::SchemaHash(const std::string& topicName)
+{
+	return GetOrCreate(topicName)->Metadata->SchemaHash;
+}
+
+std::unique_ptr<TopicWriter> SharedMemoryClient::OpenPublisher(const std::string& topicName)
+{
+	return std::make_unique<TopicPublisher>(GetOrCreate(topicName));
+}
+
+SharedMemoryClient::TopicPublisher::TopicPublisher(Topic* topic) : _topic(topic),
+	_shm(open_only, topic->ShmName().c_str(), read_write),
+	_region(_shm, read_write)
+{
+	// The topic checked the layout of the region.
+	auto base = _region.get_address();
+	auto metadata = (TopicMetadata*)base;
+	Bind(topic->Name, metadata, (SubscriptionSharedData*)metadata->SubscribersTableAddress(base),
+		new CyclicBuffer((byte*)metadata->BufferAddress(base)), (TopicMetrics*)metadata->MetricsAddress(base));
+	// Subscriptions are made on the server, this writer does not hear of them.
+	_cacheSlowest = false;
+}
+
+NamedSemaphore* SharedMemoryClient::TopicPublisher::Open(int index, SubscriptionSharedData& data)
+{
+	auto& s = _semaphores[index];
+	ulong generation = data.Generation.load();
+	if (s.Sem != nullptr && s.Generation == generation)
+		return s.Sem;
+	delete s.Sem;
+	s.Sem = nullptr;
+	std::ostringstream oss;
+	oss << _topic->Parent->_chName << "." << _name << "." << data.Pid << "." << index << ".sem";
+	try
+	{
+		s.Sem = new NamedSemaphore(oss.str(), NamedSemaphore::OpenMode::Open);
+		s.Generation = generation;
+	}
+	catch (const std::exception&)
+	{
+		// Removed meanwhile, the subscription is going away.
+	}
+	return s.Sem;
+}
+
+void SharedMemoryClient::TopicPublisher::NotifyAll()
+{
+	Account();
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < 256; i++)
+	{
+		auto& data = _subscribers[i];
+		if (!data.Active.load() || data.PendingRemove.load())
+			continue;
+		auto sem = Open(i, data);
+		if (sem == nullptr)
+			continue;
+		auto count = Claim(data);
+		if (count > 0)
+			sem->Release(count);
+	}
+	RecordNotify(start);
+}
+
+SharedMemoryClient::TopicPublisher::~TopicPublisher()
+{
+	for (auto& s : _semaphores)
+		delete s.Sem;
+	delete _buffer;
+	_buffer = nullptr;
+}
+
 SharedMemoryClient::~SharedMemoryClient()
 {
 	auto topics = _topics;
@@ -384,4 +583,10 @@ void swap(SharedMemoryClient::SubscriptionCursor& lhs, SharedMemoryClient::Subsc
 	swap(lhs._sloth, rhs._sloth);
 	swap(lhs._topic, rhs._topic);
 	swap(lhs._cursor, rhs._cursor);
+	swap(lhs._filter, rhs._filter);
+	swap(lhs._conflate, rhs._conflate);
+	swap(lhs._consumed, rhs._consumed);
+	swap(lhs._metrics, rhs._metrics);
+	swap(lhs._latency, rhs._latency);
+	swap(lhs._endToEnd, rhs._endToEnd);
 }
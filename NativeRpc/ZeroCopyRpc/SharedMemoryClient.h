@@ -20,6 +20,7 @@
 #include <semaphore>
 #include <memory>
 #include <unordered_map>
+#include <array>
 
 #include "TypeDefs.h"
 #include "ConcurrentBag.hpp"
@@ -35,6 +36,7 @@
 #include "ThreadSpin.h"
 #include "ZeroCopyRpcException.h"
 #include "ISharedMemoryClient.h"
+#include "TopicWriter.h"
 using namespace boost::interprocess;
 using namespace boost::uuids;
 
@@ -71,6 +73,7 @@ private:
         TopicMetadata* Metadata = nullptr;
         SubscriptionSharedData* Subscribers = nullptr;
         CyclicBuffer* SharedBuffer = nullptr;
+        TopicMetrics* Metrics = nullptr;
         SharedMemoryClient* Parent = nullptr;
         std::string Name;
         Topic(SharedMemoryClient* parent, const std::string& topicName);
@@ -80,6 +83,7 @@ private:
         void Unsubscribe(byte sloth);
         void AckUnsubscribed(byte sloth);
         void UnsubscribeAll();
+        std::string ShmName() const;
 
     private:
         // these are open cursors on the server, by this client.
@@ -89,8 +93,9 @@ private:
 
         shared_memory_object* Shm = nullptr;
         mapped_region* Region = nullptr;
-
-        std::string ShmName() const;
+        // Writable views of the parts of Region subscribers write to.
+        mapped_region* SubscribersRegion = nullptr;
+        mapped_region* MetricsRegion = nullptr;
     };
     std::string _chName;
     message_queue _srvQueue;
@@ -110,6 +115,30 @@ private:
 
     Topic* GetOrCreate(const std::string& topic);
 
+    // Writes into the topic's region through a read-write mapping of its own, and signals the subscribers itself: it
+    // opens their semaphores by name and releases the messages it claims in the subscribers table.
+    class TopicPublisher : public TopicWriter
+    {
+    public:
+        TopicPublisher(Topic* topic);
+        void NotifyAll() override;
+        ~TopicPublisher() override;
+
+    private:
+        struct Subscriber
+        {
+            NamedSemaphore* Sem = nullptr;
+            // SubscriptionSharedData::Generation the semaphore was opened for.
+            ulong Generation = 0;
+        };
+        NamedSemaphore* Open(int index, SubscriptionSharedData& data);
+
+        Topic* _topic;
+        shared_memory_object _shm;
+        mapped_region _region;
+        std::array<Subscriber, 256> _semaphores;
+    };
+
 public:
     struct EXPORT SubscriptionCursor : public ISubscriptionCursor
     {
@@ -117,10 +146,14 @@ public:
 
         std::string SemaphoreName() const;
 
+        using ISubscriptionCursor::Read;
+        using ISubscriptionCursor::TryRead;
         CyclicBuffer::Accessor Read() override;
         
         bool TryReadFor(CyclicBuffer::Accessor& a, const std::chrono::milliseconds& timeout) override;
         bool TryRead(CyclicBuffer::Accessor &a) override;
+        LatencyHistogram Latency() const override;
+        LatencyHistogram EndToEndLatency() const override;
         SubscriptionCursor(const SubscriptionCursor& other) = delete;
 
         friend void swap(SubscriptionCursor& lhs, SubscriptionCursor& rhs) noexcept;
@@ -133,17 +166,36 @@ public:
         ~SubscriptionCursor() override;
 
     private:
+        // Moves the cursor to the next message that passes the filter, false when it is not visible yet.
+        bool Advance();
+        // Moves the cursor of a conflating topic to the newest unread message that passes the filter.
+        bool JumpToLatest();
+        bool ReadLatest(CyclicBuffer::Accessor& a, const std::chrono::milliseconds& timeout);
+        // Counts the message the cursor moved to in the subscription's metrics and its latency.
+        void Account();
+
         NamedSemaphore* _sem;
         byte _sloth;
         Topic* _topic;
         CyclicBuffer::Cursor* _cursor;
+        TypeFilter _filter;
+        bool _conflate;
+        // Consumed index of the subscription on a lossless topic: the message of the last read until the next read.
+        std::atomic<ulong>* _consumed;
+        SubscriberMetrics* _metrics;
+        LatencyHistogram _latency;
+        LatencyHistogram _endToEnd;
     };
 
     SharedMemoryClient(const std::string& channelName);
 
     void Connect() override;
 
-    std::unique_ptr<ISubscriptionCursor> Subscribe(const std::string& topicName) override;
+    using ISharedMemoryClient::Subscribe;
+    std::unique_ptr<ISubscriptionCursor> Subscribe(const std::string& topicName, const SubscribeStart& start = {},
+        const TypeFilter& filter = {}) override;
+    ulong SchemaHash(const std::string& topicName) override;
+    std::unique_ptr<TopicWriter> OpenPublisher(const std::string& topicName) override;
     ~SharedMemoryClient() override;
     
 };
@@ -3,6 +3,7 @@
 #include <boost/log/trivial.hpp>
 
 #include "ProcessUtils.h"
+#include "ThreadSpin.h"
 #include "ZeroCopyRpcException.h"
 
 
@@ -45,31 +46,44 @@ TopicService::Subscription::Subscription(): Sem(nullptr), Name(nullptr)
 
 void TopicService::NotifyAll()
 {
-	std::array<Subscription,256> toRemove;
-	int ix = 0;
+	Account();
+	auto start = std::chrono::steady_clock::now();
+	while (_notifying.test_and_set(std::memory_order_acquire))
+		ThreadSpin::Wait(10);
+	bool pending = false;
 	for(auto i = _subscriptions.begin(); i.is_valid(); i++)
 	{
 		auto s =i.current_item();
             
 		auto& data = _subscribers[s.Index];
 		if(data.PendingRemove)
-		{
-			toRemove[ix++] = s;
-		}
+			pending = true;
 		else 
-		{
-			if (data.Notified.fetch_add(1) == 0)
-			{
-				ulong nx = _buffer->NextIndex() - 1;
-				// this is the first time, need to set the cursors index.
-				data.NextIndex.store(nx);
-				BOOST_LOG_TRIVIAL(debug) << "Setting cursors next position to: " << nx;
-				//std::cout << "SERVER: Start offset set: " << data.NextIndex << std::endl;
-			}
+			Release(s, data);
+	}
+	if (pending)
+		RemovePending();
+	_notifying.clear(std::memory_order_release);
+	RecordNotify(start);
+}
 
-			s.Sem->Release();
-		}
-            
+void TopicService::Reclaim()
+{
+	while (_notifying.test_and_set(std::memory_order_acquire))
+		ThreadSpin::Wait(10);
+	RemovePending();
+	_notifying.clear(std::memory_order_release);
+}
+
+void TopicService::RemovePending()
+{
+	std::array<Subscription,256> toRemove;
+	int ix = 0;
+	for(auto i = _subscriptions.begin(); i.is_valid(); i++)
+	{
+		auto s =i.current_item();
+		if(_subscribers[s.Index].PendingRemove)
+			toRemove[ix++] = s;
 	}
 	for(--ix;ix >= 0;--ix)
 	{
@@ -87,46 +101,25 @@ void TopicService::NotifyAll()
 	}
 }
 
-CyclicBuffer* TopicService::GetBuffer()
-{
-	return this->_buffer;
-}
-
 std::string TopicService::ShmName(const std::string& channel_name, const std::string& topic_name)
 {
 	return channel_name + "." + topic_name + ".buffer";
 }
 
-PublishScope::PublishScope(CyclicBuffer::WriterScope&& w, TopicService* parent)
-	: _scope(std::make_unique<CyclicBuffer::WriterScope>(std::move(w)))
-	, _parent(parent)
-{
-}
-
-ulong PublishScope::Type() const
-{ return _scope->Type; }
-
-PublishScope::PublishScope(PublishScope&& other) noexcept: _scope(std::move(other._scope))
-{
-	other._parent = nullptr;
-}
-
-PublishScope::~PublishScope()
+static bool HasCurrentLayout(const shared_memory_object& shm, offset_t size)
 {
-	if(_parent != nullptr && _scope->Span.CommitedSize() > 0)
-	{
-		_scope.reset();
-		_parent->NotifyAll();
-		_parent = nullptr;
-	}
+	if (static_cast<ulong>(size) < sizeof(TopicMetadata))
+		return false;
+	mapped_region region(shm, read_only, 0, sizeof(TopicMetadata));
+	return ((TopicMetadata*)region.get_address())->IsValid(size);
 }
 
-
 void TopicService::RemoveDanglingSubscriptionEntry(int i, SubscriptionSharedData& sub) const
 {
 	auto semName = GetSubscriptionSemaphoreName(sub.Pid, i);
 	NamedSemaphore::Remove(semName);
 	sub.PendingRemove.store(false);
+	sub.Active.store(false);
 }
 
 ulong TopicService::MaxMessageSize()
@@ -140,20 +133,39 @@ bool TopicService::ClearIfExists(const std::string& channel_name, const std::str
 		shared_memory_object shm(open_only, ShmName(channel_name, topic_name).c_str(), read_write);
 		offset_t size;
 		shm.get_size(size);
-		TopicMetadata m = {
-			CyclicBuffer::SizeOf(messageCount, bufferSize),
-			sizeof(SubscriptionSharedData) * 256,
-		messageCount,
-			bufferSize };
 
+		if (size > 0 && !HasCurrentLayout(shm, size))
+		{
+			// Nothing can be kept of another layout, the next TopicService creates the region anew.
+			shared_memory_object::remove(shm.get_name());
+			return false;
+		}
 		if (size > 0)
 		{
+			// The topic keeps the mode and the schema it was created with.
+			TopicMode mode;
+			ulong schemaHash;
+			{
+				mapped_region existing(shm, read_only);
+				auto metadata = (TopicMetadata*)existing.get_address();
+				mode = metadata->Mode;
+				schemaHash = metadata->SchemaHash;
+			}
+			TopicMetadata m = {
+				TopicMetadata::MagicValue,
+				TopicMetadata::CurrentVersion,
+				CyclicBuffer::SizeOf(messageCount, bufferSize),
+				sizeof(SubscriptionSharedData) * 256,
+				messageCount,
+				bufferSize,
+				mode,
+				schemaHash };
 			if (size != m.TotalSize())
 				shm.truncate(m.TotalSize());
 
 			mapped_region region(shm, read_write);
 			auto ptr = region.get_address();
-			memset(ptr, 0, size);
+			memset(ptr, 0, region.get_size());
 
 			TopicMetadata* metadata = (TopicMetadata*)ptr;
 			*metadata = m; // copy
@@ -175,22 +187,36 @@ bool TopicService::TryRemove(const std::string& channel_name, const std::string&
 }
 
 TopicService::TopicService(const std::string& channel_name, const std::string& topic_name, 
-                           unsigned int messageCount, unsigned int bufferSize) :
+                           unsigned int messageCount, unsigned int bufferSize, TopicMode mode) :
 	_channelName(channel_name),
 	_topicName(topic_name),
 	_shm(nullptr),
 	_region(nullptr),
 	_maxMessageSize(bufferSize/messageCount*3/2)
 {
-	_shm = new shared_memory_object(open_or_create, ShmName(channel_name, topic_name).c_str(), read_write);
+	auto name = ShmName(channel_name, topic_name);
+	_shm = new shared_memory_object(open_or_create, name.c_str(), read_write);
 
 	TopicMetadata m = {
+		TopicMetadata::MagicValue,
+		TopicMetadata::CurrentVersion,
 		CyclicBuffer::SizeOf(messageCount,bufferSize),
 		sizeof(SubscriptionSharedData) * 256,
 		messageCount,
-		bufferSize};
+		bufferSize,
+		mode,
+		0};
 	offset_t size;
 	_shm->get_size(size);
+	if (size > 0 && !HasCurrentLayout(*_shm, size))
+	{
+		// Left by a build with another layout. Processes that still map it keep the old, unlinked region.
+		BOOST_LOG_TRIVIAL(warning) << "Channel's '" << channel_name << "' shared memory buffer for topic " << topic_name << " has another layout, it is recreated.";
+		delete _shm;
+		shared_memory_object::remove(name.c_str());
+		_shm = new shared_memory_object(create_only, name.c_str(), read_write);
+		size = 0;
+	}
 
 	if (size == 0) {
 		_shm->truncate(m.TotalSize());
@@ -199,11 +225,13 @@ TopicService::TopicService(const std::string& channel_name, const std::string& t
 		auto dst = _region->get_address();
 		memset(dst, 0, m.TotalSize());
 
-		TopicMetadata* metadata = (TopicMetadata*)dst;
-		*metadata = m; // copy
+		_metadata = (TopicMetadata*)dst;
+		*_metadata = m; // copy
 
 		_subscribers = (SubscriptionSharedData*)m.SubscribersTableAddress(dst);
 		_buffer = new CyclicBuffer(static_cast<byte*>(m.BufferAddress(dst)),messageCount, bufferSize);
+		_metrics = (TopicMetrics*)m.MetricsAddress(dst);
+		Bind(topic_name, _metadata, _subscribers, _buffer, _metrics);
 	}
 	else
 	{
@@ -211,11 +239,27 @@ TopicService::TopicService(const std::string& channel_name, const std::string& t
 		_region = new mapped_region(*_shm, read_write);
 		auto dst = _region->get_address();
 		auto& m = *(TopicMetadata*)dst;
+		_metadata = &m;
 		_subscribers = (SubscriptionSharedData*)m.SubscribersTableAddress(dst);
+		_metrics = (TopicMetrics*)m.MetricsAddress(dst);
+		if (m.Mode != mode)
+			BOOST_LOG_TRIVIAL(warning) << "Topic " << topic_name << " keeps the mode it was created with.";
+		if (m.BufferItemCapacity != messageCount || m.BufferSize != bufferSize)
+			BOOST_LOG_TRIVIAL(warning) << "Topic " << topic_name << " keeps the size it was created with.";
+		_maxMessageSize = m.BufferSize / m.BufferItemCapacity * 3 / 2;
 
 		_buffer = new CyclicBuffer(static_cast<byte*>(m.BufferAddress(dst)));
+		Bind(topic_name, _metadata, _subscribers, _buffer, _metrics);
+		// Messages committed before this server came up are not counted again.
+		ulong accounted = _metrics->Publisher.Accounted.load();
+		ulong next = _buffer->NextIndex();
+		while (accounted < next && !_metrics->Publisher.Accounted.compare_exchange_weak(accounted, next))
+		{
+		}
 		
-		if(_buffer->Unlock())
+		// Client publishers that still run keep their lock.
+		auto writer = _buffer->Writer();
+		if(writer != 0 && !is_process_running(writer) && _buffer->UnlockOwnedBy(writer))
 		{
 			BOOST_LOG_TRIVIAL(warning) << "Buffer was unlocked.";
 		}
@@ -265,25 +309,51 @@ std::string TopicService::GetSubscriptionSemaphoreName(pid_t pid, int index) con
 	return semName;
 }
 
-byte TopicService::Subscribe(pid_t pid)
+byte TopicService::Subscribe(pid_t pid, const SubscribeStart& start, const TypeFilter& filter)
 {
 	byte index = 0;
 	if (!this->_idPool.rent(index))
 		throw ZeroCopyRpcException("Cannot find free id.");
 
 	auto& item = this->_subscribers[index];
-	item.Reset(pid);
+	ulong first = StartIndex(start);
+	item.Reset(pid, first, filter);
+	_metrics->Subscribers[index].Reset(first);
+	_rescanConsumers.store(true);
 	//Subscription s(GetSubscriptionSemaphoreName(pid, index), index);
 	Subscription s;
 	s.OpenOrCreate(GetSubscriptionSemaphoreName(pid, index), index);
 	_subscriptions.push(s);
 
+	// History is readable right away, messages published meanwhile are released by whichever thread comes first.
+	Release(s, item);
+	BOOST_LOG_TRIVIAL(debug) << "Subscription " << (int)index << " starts at: " << first;
 	return index;
 }
 
-PublishScope TopicService::Prepare(ulong minSize, ulong type)
+ulong TopicService::StartIndex(const SubscribeStart& start) const
 {
-	return PublishScope(_buffer->WriteScope(minSize,type), this);
+	ulong next = _buffer->NextIndex();
+	switch (start.From)
+	{
+	case SubscribeFrom::Latest:
+		return next;
+	case SubscribeFrom::Oldest:
+		return _buffer->OldestLive();
+	case SubscribeFrom::Sequence:
+		return std::max(start.Position, _buffer->OldestLive());
+	case SubscribeFrom::LastN:
+		return next - std::min(start.Position, next - _buffer->OldestLive());
+	default:
+		throw ZeroCopyRpcException("Unknown subscription start.");
+	}
+}
+
+void TopicService::Release(Subscription& s, SubscriptionSharedData& data) const
+{
+	auto count = Claim(data);
+	if (count > 0)
+		s.Sem->Release(count);
 }
 
 TopicService::~TopicService()
@@ -318,22 +388,43 @@ bool TopicService::Unsubscribe(pid_t pid, byte id) const
 	return false;
 }
 
-std::string TopicService::Name()
+int TopicService::Evict(pid_t pid) const
 {
-	return this->_topicName;
+	int evicted = 0;
+	for (int i = 0; i < 256; i++)
+	{
+		auto& r = this->_subscribers[i];
+		if (!r.Active.load() || r.Pid != pid)
+			continue;
+		bool expected = false;
+		if (r.PendingRemove.compare_exchange_strong(expected, true))
+		{
+			// The publisher keeps its handle until it closes the subscription, the name is gone already.
+			NamedSemaphore::Remove(GetSubscriptionSemaphoreName(pid, i));
+			evicted++;
+		}
+	}
+	return evicted;
 }
 
-CyclicMemoryPool::Span& PublishScope::Span()
+std::vector<pid_t> TopicService::SubscriberPids() const
 {
-	CyclicMemoryPool::Span &p  = _scope->Span; return p;
+	std::vector<pid_t> pids;
+	for (int i = 0; i < 256; i++)
+	{
+		auto& r = this->_subscribers[i];
+		if (r.Active.load() && !r.PendingRemove.load() && std::ranges::find(pids, r.Pid) == pids.end())
+			pids.push_back(r.Pid);
+	}
+	return pids;
 }
 
-void PublishScope::ChangeType(uint64_t type)
+std::string TopicService::Name()
 {
-	_scope->Type = type;
+	return this->_topicName;
 }
 
-byte SharedMemoryServer::Subscribe(const char* topicName, pid_t pid)
+byte SharedMemoryServer::Subscribe(const char* topicName, pid_t pid, const SubscribeStart& start, const TypeFilter& filter)
 {
 	// construct std::string out of str,
 	// find the topic in _topics
@@ -344,7 +435,7 @@ byte SharedMemoryServer::Subscribe(const char* topicName, pid_t pid)
 	if(it != _topics.end())
 	{
 		// we have found
-		sloth = it->second->Subscribe(pid);
+		sloth = it->second->Subscribe(pid, start, filter);
 		return sloth;
 	}
 	else
@@ -363,7 +454,11 @@ bool SharedMemoryServer::OnUnsubscribe(const char* topicName, pid_t pid, byte id
 	if (it != _topics.end())
 	{
 		// we have found
-		return it->second->Unsubscribe(pid, id);
+		bool removed = it->second->Unsubscribe(pid, id);
+		// The topic may have no publisher of this process to return the slot on its next notification.
+		if (removed)
+			it->second->Reclaim();
+		return removed;
 	}
 	return false;
 }
@@ -378,6 +473,7 @@ message_queue* SharedMemoryServer::GetClient(pid_t pid)
 		std::string rspMsgQueue = _chName + "." + std::to_string(pid);
 		m = new message_queue(open_only, rspMsgQueue.c_str());
 		_clients.emplace(pid, m);
+		_watchdog.Watch(pid);
 	}
 	else m = it->second;
 	return m;
@@ -418,7 +514,7 @@ void SharedMemoryServer::DispatchMessages()
 					BOOST_LOG_TRIVIAL(debug) << "Handling subscribe to topic from PID: " << env.Pid << ", " << env.Request;
 					SubscribeResponseEnvelope rsp;
 					rsp.CorrelationId = env.CorrelationId;
-					rsp.Response.Id = this->Subscribe(env.Request.TopicName, env.Pid);
+					rsp.Response.Id = this->Subscribe(env.Request.TopicName, env.Pid, env.Request.Start, env.Request.Filter);
 					if(!GetClient(env.Pid)->try_send(&rsp, sizeof(SubscribeResponseEnvelope), 0))
 					{
 						BOOST_LOG_TRIVIAL(error) << "Cannot send message to client.";
@@ -431,7 +527,7 @@ void SharedMemoryServer::DispatchMessages()
 					auto& env= *(CreateSubscriptionEnvelope*)buffer;
 					auto &rqt = env.Request;
 					BOOST_LOG_TRIVIAL(debug) << "Handling CreateTopic command: " << rqt;
-					env.Set(this->OnCreateTopic(rqt.TopicName, rqt.MaxMessageCount, rqt.BufferSize));
+					env.Set(this->OnCreateTopic(rqt.TopicName, rqt.MaxMessageCount, rqt.BufferSize, rqt.Mode));
 					break;
 				}
 			case 3:
@@ -469,6 +565,12 @@ void SharedMemoryServer::DispatchMessages()
 				env.Set(this->RemoveSubscription(env.Request.TopicName));
 				break;
 				}
+			case 9:
+				{
+				auto& env = *(ClientExitedEnvelope*)buffer;
+				this->OnClientExited(env.Request.ExitedPid);
+				break;
+				}
 			
 			default:
 				break;
@@ -480,6 +582,36 @@ void SharedMemoryServer::DispatchMessages()
 	BOOST_LOG_TRIVIAL(debug) << "Shared memory server's dispatcher thread exited.";
 }
 
+void SharedMemoryServer::OnClientExited(pid_t pid)
+{
+	int evicted = 0;
+	for (const auto& [name, topic] : _topics)
+	{
+		evicted += topic->Evict(pid);
+		topic->Reclaim();
+		// A client publisher that died while writing holds the ring.
+		if (topic->GetBuffer()->UnlockOwnedBy(pid))
+			BOOST_LOG_TRIVIAL(warning) << "Client PID: " << pid << " exited writing to topic " << name << ", its buffer was unlocked.";
+	}
+
+	auto it = _clients.find(pid);
+	if (it != _clients.end())
+	{
+		delete it->second;
+		_clients.erase(it);
+	}
+	// The client did not get to remove its queue.
+	message_queue::remove((_chName + "." + std::to_string(pid)).c_str());
+	BOOST_LOG_TRIVIAL(info) << "Client PID: " << pid << " exited, " << evicted << " subscription(s) evicted.";
+}
+
+void SharedMemoryServer::WatchSubscribers(TopicService* topic)
+{
+	// Subscribers of a previous server that still run did not say hello to this one.
+	for (auto pid : topic->SubscriberPids())
+		_watchdog.Watch(pid);
+}
+
 bool SharedMemoryServer::RemoveSubscription(const char* topicName)
 {
 	std::string name = topicName;
@@ -489,6 +621,7 @@ bool SharedMemoryServer::RemoveSubscription(const char* topicName)
 		// we have found
 		delete it->second;
 		_topics.erase(it);
+		_registry.Remove(name);
 
 		return true;
 	}
@@ -497,7 +630,7 @@ bool SharedMemoryServer::RemoveSubscription(const char* topicName)
 		return false;
 	}
 }
-TopicService* SharedMemoryServer::OnCreateTopic(const char* topicName, unsigned int messageCount, unsigned int bufferSize)
+TopicService* SharedMemoryServer::OnCreateTopic(const char* topicName, unsigned int messageCount, unsigned int bufferSize, TopicMode mode)
 {
 	std::string key(topicName);
 	auto it = _topics.find(key);
@@ -509,22 +642,45 @@ TopicService* SharedMemoryServer::OnCreateTopic(const char* topicName, unsigned
 	}
 	else
 	{
-		auto result = new TopicService(this->_chName, topicName, messageCount, bufferSize);
+		auto result = new TopicService(this->_chName, topicName, messageCount, bufferSize, mode);
            
 		_topics.emplace(topicName, result);
+		WatchSubscribers(result);
+
+		// A reused region keeps what it was created with.
+		auto& metadata = result->Metadata();
+		TopicInfo info;
+		info.Name = key;
+		info.Mode = result->Mode();
+		info.MessageCount = metadata.BufferItemCapacity;
+		info.BufferSize = metadata.BufferSize;
+		info.MaxMessageSize = result->MaxMessageSize();
+		info.Created = std::chrono::system_clock::now();
+		info.Publisher = getCurrentProcessId();
+		_registry.Add(info);
 		return result;
 	}
 	//delete promise;
 }
 
 SharedMemoryServer::SharedMemoryServer(const std::string& channel): _chName(channel),
-_messageQueue(open_or_create, channel.c_str(), 256, 1024)
+_messageQueue(open_or_create, channel.c_str(), 256, 1024),
+_registry(channel, open_or_create),
+_watchdog([this](pid_t pid)
+{
+	ClientExitedEnvelope env;
+	env.Request.ExitedPid = pid;
+	// The dispatcher runs as long as the watchdog does, a full queue is drained.
+	_messageQueue.send(&env, sizeof(ClientExitedEnvelope), 0);
+})
 {
 	this->dispatcher = std::thread([this]() { DispatchMessages(); });
 }
 
 SharedMemoryServer::~SharedMemoryServer()
 {
+	// No exits are posted once the dispatcher is gone.
+	_watchdog.Stop();
 	// exit command
 	ulong buffer[1];
 	buffer[0] = 0;
@@ -534,9 +690,18 @@ SharedMemoryServer::~SharedMemoryServer()
 	if(this->dispatcher.joinable())
 		this->dispatcher.join();
 
-	for (const auto& t : _topics | std::views::values)
+	for (const auto& [name, t] : _topics)
 	{
 		delete t;
+		// Regions that subscribers still hold stay listed, with a publisher that is gone, until they are cleared.
+		try
+		{
+			shared_memory_object shm(open_only, (_chName + "." + name + ".buffer").c_str(), read_only);
+		}
+		catch (const interprocess_exception&)
+		{
+			_registry.Remove(name);
+		}
 	}
 
 	// If there are no topics, we can safely remote communication channel.
@@ -549,6 +714,7 @@ SharedMemoryServer::~SharedMemoryServer()
 
 bool SharedMemoryServer::RemoveChannel(const std::string& channel)
 {
+	TopicRegistry::Destroy(channel);
 	return message_queue::remove(channel.c_str());
 }
 
@@ -561,12 +727,13 @@ bool SharedMemoryServer::RemoveTopic(const std::string& topicName)
 
 	return env.Response();
 }
-TopicService* SharedMemoryServer::CreateTopic(const std::string& topicName, unsigned int messageCount, unsigned int bufferSize)
+TopicService* SharedMemoryServer::CreateTopic(const std::string& topicName, unsigned int messageCount, unsigned int bufferSize, TopicMode mode)
 {
 	CreateSubscriptionEnvelope env;
 	env.Request.SetTopicName(topicName);
 	env.Request.MaxMessageCount = messageCount;
 	env.Request.BufferSize = bufferSize;
+	env.Request.Mode = mode;
 	_messageQueue.send(&env, sizeof(CreateSubscriptionEnvelope), 0);
         
 	return env.Response();
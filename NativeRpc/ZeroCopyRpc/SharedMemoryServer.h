@@ -53,6 +53,10 @@ using namespace boost::uuids;
 #include "Messages.h"
 #include "Random.h"
 #include "Export.h"
+#include "TopicRegistry.h"
+#include "ProcessWatchdog.h"
+#include "MessageSchema.h"
+#include "TopicWriter.h"
 
 
 
@@ -63,26 +67,7 @@ using namespace boost::uuids;
 // In publish thread - which is different that subscribe thread, this is the named-semaphore.
 // When client disconnects, we only mark subscription to be disposed on the next iteration of publish loop.
 
-struct EXPORT PublishScope
-{
-    PublishScope() = default;
-    PublishScope(CyclicBuffer::WriterScope&& w, TopicService* parent);
-    CyclicMemoryPool::Span& Span();
-    void ChangeType(uint64_t type);
-    PublishScope(const PublishScope& other) = delete;
-    ulong Type() const;
-
-    PublishScope(PublishScope&& other) noexcept;
-    ~PublishScope();
-
-private:
-
-    std::unique_ptr<CyclicBuffer::WriterScope> _scope;
-    TopicService* _parent;
-};
-
-class EXPORT TopicService {
-      
+class EXPORT TopicService : public TopicWriter {
 
 public:
     struct Subscription
@@ -99,7 +84,6 @@ public:
         void Close();
 
     };
-    friend struct PublishScope;
     inline static std::string ShmName(const std::string& channel_name, const std::string& topic_name);
         
 
@@ -109,46 +93,42 @@ public:
                               unsigned int messageCount = 256, 
                               unsigned int bufferSize = 8*1024*1024);
     static bool TryRemove(const std::string& channel_name, const std::string& topic_name);
-    TopicService(const std::string& channel_name, const std::string& topic_name, unsigned int messageCount, unsigned int bufferSize);
+    TopicService(const std::string& channel_name, const std::string& topic_name, unsigned int messageCount, unsigned int bufferSize,
+        TopicMode mode = TopicMode::Queue);
 
     inline std::string GetSubscriptionSemaphoreName(pid_t pid, int index) const;
 
-    template<typename T, typename... Args>
-    T* Publish(ulong type, Args&&... args) {
-        auto scope = Prepare(sizeof(T), type);
-        auto& span = scope.Span();
-        auto ptr = new (span.Start) T(std::forward<Args>(args)...);
-        span.Commit(sizeof(T));
-        return ptr;
-    }
-
-
-    PublishScope Prepare(ulong minSize, ulong type);
-    byte Subscribe(pid_t pid);
+    byte Subscribe(pid_t pid, const SubscribeStart& start = {}, const TypeFilter& filter = {});
     bool Unsubscribe(pid_t pid, byte id) const;
+    // Marks every subscription of a process that exited to be removed, and unlinks their semaphores right away; the
+    // slots are returned on the next notification or Reclaim. Returns the number of subscriptions evicted.
+    int Evict(pid_t pid) const;
+    // Processes with a live subscription.
+    std::vector<pid_t> SubscriberPids() const;
     std::string Name();
-    void NotifyAll();
-    CyclicBuffer* GetBuffer();
+    void NotifyAll() override;
+    // Closes the subscriptions marked to be removed and returns their slots, as NotifyAll does, for topics that are
+    // not published to.
+    void Reclaim();
     ~TopicService();
 private:
+    ulong StartIndex(const SubscribeStart& start) const;
+    // Releases the semaphore once for every message of the filtered types the subscription was not signalled about yet.
+    void Release(Subscription& s, SubscriptionSharedData& data) const;
+    // Removes the subscriptions marked to be removed, called holding _notifying.
+    void RemovePending();
+
     std::string _channelName;
     std::string _topicName;
     ulong _maxMessageSize;
+    // Held by NotifyAll and Reclaim, that the publishing thread and the dispatcher call.
+    std::atomic_flag _notifying = ATOMIC_FLAG_INIT;
     // Client Semaphore table
     ConcurrentBag<Subscription, 256> _subscriptions;
     IDPool256 _idPool;
 
     shared_memory_object* _shm;
     mapped_region* _region;
-
-    // IN SHM
-    // Client PID, Notified, Current Offset table.
-    SubscriptionSharedData* _subscribers; // 256
-
-    // IN SHM
-    CyclicBuffer* _buffer;
-
-    
 };
 
 
@@ -159,10 +139,18 @@ private:
     std::unordered_map<std::string, TopicService*> _topics;
     std::unordered_map<pid_t, message_queue*> _clients;
     message_queue _messageQueue;
+    // Lists the topics of the channel for clients and tools, changed only on the dispatcher thread.
+    TopicRegistry _registry;
+    // Holds every client process, its exit is handled on the dispatcher thread (see OnClientExited).
+    ProcessWatchdog _watchdog;
     std::thread dispatcher;
 
-    byte Subscribe(const char* topicName, pid_t pid);
+    byte Subscribe(const char* topicName, pid_t pid, const SubscribeStart& start, const TypeFilter& filter);
     bool OnUnsubscribe(const char* topicName, pid_t pid, byte id);
+    // Evicts the subscriptions of a client that exited and returns their slots right away, unlocks the topics it was
+    // writing to and drops its message queue.
+    void OnClientExited(pid_t pid);
+    void WatchSubscribers(TopicService* topic);
 
     message_queue* GetClient(pid_t pid);
 
@@ -170,7 +158,7 @@ private:
 
     void DispatchMessages();
     
-    TopicService* OnCreateTopic(const char *topicName, unsigned int messageCount, unsigned int bufferSize);
+    TopicService* OnCreateTopic(const char *topicName, unsigned int messageCount, unsigned int bufferSize, TopicMode mode);
     bool RemoveSubscription(const char* topicName);
 public:
     SharedMemoryServer(const std::string& channel);
@@ -181,6 +169,7 @@ public:
     static bool RemoveChannel(const std::string& channel);
     TopicService* CreateTopic(const std::string& topicName, 
         unsigned int messageCount = 256, 
-        unsigned int bufferSize = 8*1024*1024);
+        unsigned int bufferSize = 8*1024*1024,
+        TopicMode mode = TopicMode::Queue);
     bool RemoveTopic(const std::string& topicName);
 };
\ No newline at end of file
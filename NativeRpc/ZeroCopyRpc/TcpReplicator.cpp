@@ -1,5 +1,6 @@
 #include "TcpReplicator.h"
 
+#include <algorithm>
 #include <boost/log/trivial.hpp>
 
 #include "ZeroCopyRpcException.h"
@@ -9,6 +10,8 @@ void TcpReplicationSource::AcceptLoop() {
 		try {
 			auto socket = std::make_shared<tcp::socket>(_io);
 			_acceptor.accept(*socket);
+			if (!_running)
+				return;
 
 			std::thread([this, socket]() {
 				HandleNewClient(socket);
@@ -51,6 +54,32 @@ void TcpReplicationSource::HandleReplicateSubscription(std::shared_ptr<tcp::sock
 
 	auto replicator = std::make_shared<TopicReplicator>();
 	replicator->TopicName = topicName;
+	auto compression = _compression;
+	{
+		std::lock_guard lock(_clientsMutex);
+		auto it = _topicCompression.find(topicName);
+		if (it != _topicCompression.end())
+			compression = it->second;
+	}
+	if (compression.Enabled()) {
+		auto codec = NegotiateCodec(compression.Codec, header.AcceptedCodecs);
+		if (codec != compression.Codec) {
+			BOOST_LOG_TRIVIAL(warning) << "Target does not accept " << CodecName(compression.Codec) << ", topic "
+				<< topicName << (codec != CompressionCodec::None ? " is replicated with " : " is replicated uncompressed")
+				<< (codec != CompressionCodec::None ? CodecName(codec) : "") << ".";
+			// The level is codec specific, the fallback runs at its default.
+			compression.Codec = codec;
+			compression.Level = 0;
+		}
+		if (compression.Enabled())
+			replicator->Compressor = std::make_unique<PayloadCompressor>(compression, &_compressionPool);
+	}
+	if (compression.Delta.Enabled) {
+		if ((header.AcceptedEncodings & (1u << static_cast<uint8_t>(PayloadEncoding::Delta))) != 0)
+			replicator->Delta = std::make_unique<DeltaEncoder>(compression.Delta);
+		else
+			BOOST_LOG_TRIVIAL(warning) << "Target does not accept delta encoding, topic " << topicName << " is replicated whole.";
+	}
 	replicator->Cursor = _shmClient.Subscribe(topicName);
 	{
 		std::lock_guard lock(_clientsMutex);
@@ -64,6 +93,7 @@ void TcpReplicationSource::HandleReplicateSubscription(std::shared_ptr<tcp::sock
 void TcpReplicationSource::ReplicateLoop(std::shared_ptr<tcp::socket> socket,
 	std::shared_ptr<TopicReplicator> replicator) {
 
+	auto reported = std::chrono::steady_clock::now();
 	while (replicator->Running && _running) {
 		CyclicBuffer::Accessor msg;
 
@@ -71,13 +101,55 @@ void TcpReplicationSource::ReplicateLoop(std::shared_ptr<tcp::socket> socket,
 			if (!replicator->Running || !_running)
 				return;
 
-		TcpReplicationMessage header;
+		TcpReplicationMessage header{};
 		header.Size = msg.Size();
+		header.Codec = CompressionCodec::None;
+		header.Encoding = PayloadEncoding::Raw;
 		header.Type = msg.Type();
+		const uint8_t* data = msg.Get();
+		if (msg.HasChecksum() || _checksums) {
+			header.Flags = TcpReplicationMessage::HasChecksum;
+			header.Checksum = msg.HasChecksum() ? msg.Checksum() : Crc32c(data, msg.Size());
+		}
+		if (msg.HasTimestamp()) {
+			header.Flags |= TcpReplicationMessage::HasTimestamp;
+			header.Origin = msg.Origin();
+			auto age = msg.Age();
+			std::lock_guard lock(replicator->LatencyMutex);
+			replicator->Latency.Record(age);
+		}
+
+		if (replicator->Delta) {
+			replicator->Delta->Encode(data, msg.Size(), msg.Type(), replicator->Encoded);
+			header.Encoding = PayloadEncoding::Delta;
+			data = replicator->Encoded.data();
+			header.Size = static_cast<uint32_t>(replicator->Encoded.size());
+		}
+		if (replicator->Compressor) {
+			header.Codec = replicator->Compressor->Compress(data, header.Size, replicator->Compressed);
+			if (header.Codec != CompressionCodec::None) {
+				data = replicator->Compressed.data();
+				header.Size = static_cast<uint32_t>(replicator->Compressed.size());
+			}
+		}
+		if ((replicator->Delta || replicator->Compressor) && std::chrono::steady_clock::now() - reported > std::chrono::seconds(10)) {
+			reported = std::chrono::steady_clock::now();
+			if (replicator->Delta) {
+				auto stats = replicator->Delta->Stats();
+				BOOST_LOG_TRIVIAL(info) << "Topic " << replicator->TopicName << " delta encoded to "
+					<< 100 * stats.EncodedBytes / std::max<uint64_t>(stats.RawBytes, 1) << "% of its size, "
+					<< stats.Keyframes << " of " << stats.Frames << " frames were keyframes.";
+			}
+			if (replicator->Compressor) {
+				auto stats = replicator->Compressor->Stats();
+				BOOST_LOG_TRIVIAL(info) << "Topic " << replicator->TopicName << " compressed " << stats.Ratio()
+					<< "x, codec CPU time " << std::chrono::duration_cast<std::chrono::milliseconds>(stats.CpuTime).count() << "ms.";
+			}
+		}
 
 		try {
 			asio::write(*socket, asio::buffer(&header, sizeof(header)));
-			asio::write(*socket, asio::buffer(msg.Get(), msg.Size()));
+			asio::write(*socket, asio::buffer(data, header.Size));
 		}
 		catch (...) {
 			replicator->Running = false;
@@ -89,19 +161,89 @@ void TcpReplicationSource::ReplicateLoop(std::shared_ptr<tcp::socket> socket,
 }
 
 TcpReplicationSource::TcpReplicationSource(asio::io_context& io,
-	const std::string& channelName, uint16_t port)
+	const std::string& channelName, uint16_t port, CompressionConfig compression, bool checksums)
 	: _io(io)
 	, _acceptor(io, tcp::endpoint(tcp::v4(), port))
-	, _shmClient(channelName) {
+	, _shmClient(channelName)
+	, _compression(compression)
+	, _compressionPool(compression.Threads)
+	, _checksums(checksums) {
+
+	if (!IsCodecSupported(compression.Codec))
+		throw std::invalid_argument(std::string("Compression codec ") + CodecName(compression.Codec) + " is not compiled in.");
 
 	_shmClient.Connect();
 
-	std::thread acceptThread([this]() { AcceptLoop(); });
-	acceptThread.detach();
+	_acceptThread = std::thread([this]() { AcceptLoop(); });
+}
+
+void TcpReplicationSource::SetCompression(const std::string& topicName, CompressionConfig compression) {
+	if (!IsCodecSupported(compression.Codec))
+		throw std::invalid_argument(std::string("Compression codec ") + CodecName(compression.Codec) + " is not compiled in.");
+	std::lock_guard lock(_clientsMutex);
+	_topicCompression[topicName] = compression;
+}
+
+CompressionStats TcpReplicationSource::TopicCompressionStats(const std::string& topicName) {
+	CompressionStats result;
+	std::lock_guard lock(_clientsMutex);
+	for (auto& replicators : _clientTopics | std::views::values) {
+		for (auto& replicator : replicators) {
+			if (replicator->TopicName != topicName || !replicator->Compressor)
+				continue;
+			auto stats = replicator->Compressor->Stats();
+			result.Frames += stats.Frames;
+			result.Compressed += stats.Compressed;
+			result.RawBytes += stats.RawBytes;
+			result.WireBytes += stats.WireBytes;
+			result.CpuTime += stats.CpuTime;
+		}
+	}
+	return result;
+}
+
+DeltaStats TcpReplicationSource::TopicDeltaStats(const std::string& topicName) {
+	DeltaStats result;
+	std::lock_guard lock(_clientsMutex);
+	for (auto& replicators : _clientTopics | std::views::values) {
+		for (auto& replicator : replicators) {
+			if (replicator->TopicName != topicName || !replicator->Delta)
+				continue;
+			auto stats = replicator->Delta->Stats();
+			result.Frames += stats.Frames;
+			result.Keyframes += stats.Keyframes;
+			result.RawBytes += stats.RawBytes;
+			result.EncodedBytes += stats.EncodedBytes;
+		}
+	}
+	return result;
+}
+
+LatencyHistogram TcpReplicationSource::TopicLatency(const std::string& topicName) {
+	LatencyHistogram result;
+	std::lock_guard lock(_clientsMutex);
+	for (auto& replicators : _clientTopics | std::views::values) {
+		for (auto& replicator : replicators) {
+			if (replicator->TopicName != topicName)
+				continue;
+			std::lock_guard latencyLock(replicator->LatencyMutex);
+			result.Merge(replicator->Latency);
+		}
+	}
+	return result;
 }
 
 TcpReplicationSource::~TcpReplicationSource() {
 	_running = false;
+	// Closing the acceptor does not return a blocking accept on every platform, a connection of our own does.
+	try {
+		tcp::socket wake(_io);
+		wake.connect(tcp::endpoint(asio::ip::address_v4::loopback(), _acceptor.local_endpoint().port()));
+	}
+	catch (...) {
+	}
+	if (_acceptThread.joinable())
+		_acceptThread.join();
 	_acceptor.close();
 
 	std::lock_guard lock(_clientsMutex);
@@ -125,15 +267,30 @@ void TcpReplicationTarget::ReplicateLoop(std::shared_ptr<TopicReplicator> replic
 			if (rhs != sizeof(TcpReplicationMessage))
 				throw ZeroCopyRpcException("Replication header message incomplete");
 
-			auto scope = topic->Prepare(header.Size, header.Type);
-			auto& span = scope.Span();
+			if (header.Codec == CompressionCodec::None && header.Encoding == PayloadEncoding::Raw) {
+				auto scope = topic->Prepare(header.Size, header.Type);
+				if (header.Flags & TcpReplicationMessage::HasTimestamp)
+					scope.SetOrigin(header.Origin);
+				auto& span = scope.Span();
 
-			auto ms = asio::read(_socket, asio::buffer(span.Start, header.Size));
+				auto ms = asio::read(_socket, asio::buffer(span.Start, header.Size));
 
-			if (ms != header.Size)
-				throw ZeroCopyRpcException("Replication message incomplete");
+				if (ms != header.Size)
+					throw ZeroCopyRpcException("Replication message incomplete");
+
+				if (header.Flags & TcpReplicationMessage::HasChecksum) {
+					if (!IsIntact(*replicator, header, Crc32c(span.Start, header.Size)))
+						continue;
+					scope.SetChecksum(header.Checksum);
+				}
+				span.Commit(header.Size);
+				continue;
+			}
 
-			span.Commit(header.Size);
+			replicator->Compressed.resize(header.Size);
+			if (asio::read(_socket, asio::buffer(replicator->Compressed.data(), header.Size)) != header.Size)
+				throw ZeroCopyRpcException("Replication message incomplete");
+			Rebuild(*replicator, *topic, header);
 		}
 		catch (const boost::system::system_error& e) {
 			auto error_code = e.code();
@@ -170,16 +327,88 @@ void TcpReplicationTarget::ReplicateLoop(std::shared_ptr<TopicReplicator> replic
 	}
 }
 
+// Compressed or delta encoded frame is received aside and rebuilt straight into the span.
+void TcpReplicationTarget::Rebuild(TopicReplicator& replicator, TopicService& topic, const TcpReplicationMessage& header) {
+	const uint8_t* frame = replicator.Compressed.data();
+	size_t frameSize = replicator.Compressed.size();
+	try {
+		if (header.Codec != CompressionCodec::None) {
+			auto rawSize = PayloadDecompressor::RawSize(frame, frameSize);
+			if (rawSize == 0)
+				throw ZeroCopyRpcException("Compressed frame is corrupt.");
+			if (header.Encoding == PayloadEncoding::Raw) {
+				auto scope = topic.Prepare(rawSize, header.Type);
+				if (header.Flags & TcpReplicationMessage::HasTimestamp)
+					scope.SetOrigin(header.Origin);
+				auto& span = scope.Span();
+				replicator.Decompressor.Decompress(header.Codec, frame, frameSize, span.Start, rawSize);
+				if (header.Flags & TcpReplicationMessage::HasChecksum) {
+					if (!IsIntact(replicator, header, Crc32c(span.Start, rawSize)))
+						return;
+					scope.SetChecksum(header.Checksum);
+				}
+				span.Commit(rawSize);
+				return;
+			}
+			replicator.Decoded.resize(rawSize);
+			replicator.Decompressor.Decompress(header.Codec, frame, frameSize, replicator.Decoded.data(), rawSize);
+			frame = replicator.Decoded.data();
+			frameSize = rawSize;
+		}
+
+		auto rawSize = DeltaDecoder::RawSize(frame, frameSize);
+		if (rawSize == 0)
+			throw ZeroCopyRpcException("Delta frame is corrupt.");
+		auto scope = topic.Prepare(rawSize, header.Type);
+		if (header.Flags & TcpReplicationMessage::HasTimestamp)
+			scope.SetOrigin(header.Origin);
+		auto& span = scope.Span();
+		const bool checked = (header.Flags & TcpReplicationMessage::HasChecksum) != 0;
+		uint32_t checksum = 0;
+		if (!replicator.Delta.Apply(frame, frameSize, header.Type, span.Start, checked ? &checksum : nullptr)) {
+			BOOST_LOG_TRIVIAL(warning) << "Delta of topic " << replicator.TopicName << " was taken against a message that is missing, dropped.";
+			return;
+		}
+		if (checked) {
+			if (!IsIntact(replicator, header, checksum))
+				return;
+			scope.SetChecksum(checksum);
+		}
+		span.Commit(rawSize);
+	}
+	catch (const ZeroCopyRpcException& e) {
+		BOOST_LOG_TRIVIAL(error) << "Message of topic " << replicator.TopicName << " dropped: " << e.what();
+	}
+}
+
+bool TcpReplicationTarget::IsIntact(TopicReplicator& replicator, const TcpReplicationMessage& header, uint32_t checksum) {
+	if (checksum == header.Checksum)
+		return true;
+	replicator.ChecksumErrors++;
+	BOOST_LOG_TRIVIAL(error) << "Message of topic " << replicator.TopicName << " dropped, its checksum does not match.";
+	return false;
+}
+
+uint64_t TcpReplicationTarget::ChecksumErrors(const std::string& topicName) {
+	std::lock_guard lock(_replicatorsMutex);
+	for (auto& replicator : _replicators)
+		if (replicator->TopicName == topicName)
+			return replicator->ChecksumErrors;
+	return 0;
+}
+
 void TcpReplicationTarget::StartReplication(const std::string& topicName) {
 	TcpReplicationHeader msg;
 	msg.TopicNameLength = static_cast<uint32_t>(topicName.length());
+	msg.AcceptedCodecs = SupportedCodecs();
+	msg.AcceptedEncodings = (1u << static_cast<uint8_t>(PayloadEncoding::Raw)) | (1u << static_cast<uint8_t>(PayloadEncoding::Delta));
 
 	asio::write(_socket, asio::buffer(&msg, sizeof(msg)));
 	asio::write(_socket, asio::buffer(topicName.data(), topicName.length()));
 }
 
 void TcpReplicationTarget::ReplicateTopic(const std::string& topicName) {
-	auto replicator = std::make_shared<TopicReplicator>();
+	auto replicator = std::make_shared<TopicReplicator>(&_compressionPool);
 	replicator->TopicName = topicName;
 
 	{
@@ -4,17 +4,35 @@
 #include "SharedMemoryServer.h"
 #include <boost/asio.hpp>
 #include "Export.h"
+#include "PayloadCompression.h"
 
 using boost::asio::ip::tcp;
 using namespace boost;
 using namespace boost::asio;
 struct TcpReplicationHeader {
     uint32_t TopicNameLength;
+    // Codecs the target can decompress (see SupportedCodecs), the source picks one of them or none.
+    uint32_t AcceptedCodecs;
+    // Bit 1 << PayloadEncoding for every encoding the target can rebuild messages from.
+    uint32_t AcceptedEncodings;
     // Topic name follows as char array
 };
 struct TcpReplicationMessage {
+    static constexpr uint8_t HasChecksum = 1;
+    static constexpr uint8_t HasTimestamp = 2;
+
+    // Bytes that follow, the compressed frame when Codec is set.
     uint32_t Size;
+    CompressionCodec Codec;
+    PayloadEncoding Encoding;
+    uint8_t Flags;
+    uint8_t Reserved;
     uint64_t Type;
+    // CRC32C of the message the target rebuilds, valid when Flags has HasChecksum.
+    uint32_t Checksum;
+    uint32_t Reserved2;
+    // System clock ns of the original publish, valid when Flags has HasTimestamp; the target keeps it in its entry.
+    uint64_t Origin;
     // Data follows
 };
 class TcpReplicationTarget;
@@ -30,6 +48,15 @@ private:
         std::unique_ptr<ISubscriptionCursor> Cursor;
         std::thread ReplicationThread;
         std::atomic<bool> Running{ true };
+        // Set when the topic is compressed with a codec the target accepted.
+        std::unique_ptr<PayloadCompressor> Compressor;
+        std::vector<uint8_t> Compressed;
+        // Set when the topic is delta encoded and the target accepted it.
+        std::unique_ptr<DeltaEncoder> Delta;
+        std::vector<uint8_t> Encoded;
+        // Time from the commit of a message with a timestamp until it was read for replication.
+        LatencyHistogram Latency;
+        std::mutex LatencyMutex;
     };
 
     boost::asio::io_context& _io;
@@ -38,6 +65,11 @@ private:
     std::unordered_map<std::shared_ptr<tcp::socket>, std::vector<std::shared_ptr<TopicReplicator>>> _clientTopics;
     std::atomic<bool> _running{ true };
     std::mutex _clientsMutex;
+    const CompressionConfig _compression;
+    std::unordered_map<std::string, CompressionConfig> _topicCompression;
+    CompressionPool _compressionPool;
+    const bool _checksums;
+    std::thread _acceptThread;
 
     void AcceptLoop();
     void HandleNewClient(std::shared_ptr<tcp::socket> socket);
@@ -45,8 +77,18 @@ private:
     void HandleReplicateSubscription(std::shared_ptr<tcp::socket> socket);
 
 public:
+    // compression applies to every topic that has no configuration of its own (see SetCompression). With checksums,
+    // every message is sent with a CRC32C that the target verifies; messages that have one in their entry always are.
     TcpReplicationSource(asio::io_context& io, const std::string& channelName,
-         uint16_t port);
+         uint16_t port, CompressionConfig compression = {}, bool checksums = false);
+
+    // Applies to subscriptions of the topic made afterwards.
+    void SetCompression(const std::string& topicName, CompressionConfig compression);
+    // Summed over the targets that replicate the topic.
+    CompressionStats TopicCompressionStats(const std::string& topicName);
+    DeltaStats TopicDeltaStats(const std::string& topicName);
+    // Merged over the targets that replicate the topic, see TopicReplicator::Latency.
+    LatencyHistogram TopicLatency(const std::string& topicName);
 
     ~TcpReplicationSource();
 };
@@ -61,6 +103,14 @@ private:
         std::string TopicName;
         std::thread ReplicationThread;
         std::atomic<bool> Running{ true };
+        // Compressed and delta encoded frames are received here and rebuilt into the topic.
+        std::vector<uint8_t> Compressed;
+        PayloadDecompressor Decompressor;
+        std::vector<uint8_t> Decoded;
+        DeltaDecoder Delta;
+        std::atomic<uint64_t> ChecksumErrors{ 0 };
+
+        explicit TopicReplicator(CompressionPool* pool) : Decompressor(pool) {}
     };
 
     asio::io_context& _io;
@@ -69,9 +119,13 @@ private:
     std::vector<std::shared_ptr<TopicReplicator>> _replicators;
     std::atomic<bool> _running{ true };
     std::mutex _replicatorsMutex;
+    CompressionPool _compressionPool;
 
     
     void ReplicateLoop(std::shared_ptr<TopicReplicator> replicator);
+    void Rebuild(TopicReplicator& replicator, TopicService& topic, const TcpReplicationMessage& header);
+    // Counts and logs a message whose checksum does not match, the caller drops it.
+    bool IsIntact(TopicReplicator& replicator, const TcpReplicationMessage& header, uint32_t checksum);
     void StartReplication(const std::string& topicName);
 
 public:
@@ -82,5 +136,7 @@ public:
     bool Reconnect(const tcp::endpoint& peer_endpoint);
 
     void ReplicateTopic(const std::string& topicName);
+    // Messages of the topic dropped because they did not match their checksum.
+    uint64_t ChecksumErrors(const std::string& topicName);
     ~TcpReplicationTarget();
 };
\ No newline at end of file
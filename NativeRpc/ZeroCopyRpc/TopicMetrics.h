@@ -0,0 +1,82 @@
+#pragma once
+#include <atomic>
+#include <bit>
+
+#include "TypeDefs.h"
+
+// Counters of a topic, kept at the end of its shared memory region (see TopicMetadata::MetricsAddress) so that
+// `zq top` can read them without any cooperation of the publisher or the subscribers. Every subscriber slot has a
+// single writer and a cache line of its own; it is updated with relaxed loads and stores, no read-modify-write, so
+// counting costs a few plain stores on the hot path. Publisher counters are shared by the processes that publish into
+// the topic (see SharedMemoryClient::OpenPublisher) and are added to atomically. Readers only ever sample them.
+struct alignas(64) PublisherMetrics
+{
+    static constexpr int NotifyBuckets = 16;
+
+    // Messages below this index were counted, claimed by whichever publisher counts them.
+    std::atomic<ulong> Accounted;
+
+    std::atomic<ulong> Published;
+    std::atomic<ulong> Bytes;
+    // Times the memory pool started over from its beginning.
+    std::atomic<ulong> Wraps;
+    std::atomic<ulong> MaxMessageSize;
+    // Time the publisher took to signal the subscribers of a message. Bucket 0 counts notifications under 256ns,
+    // bucket i under 256ns << i, the last one everything longer.
+    std::atomic<ulong> NotifyLatency[NotifyBuckets];
+
+    static int NotifyBucket(ulong ns)
+    {
+        int bucket = static_cast<int>(std::bit_width(ns >> 8));
+        return bucket < NotifyBuckets ? bucket : NotifyBuckets - 1;
+    }
+    // Upper bound of the bucket in ns.
+    static ulong NotifyBucketLimit(int bucket) { return 256ul << bucket; }
+};
+
+struct alignas(64) SubscriberMetrics
+{
+    // Messages read by the subscriber.
+    std::atomic<ulong> Delivered;
+    // Index after the last message read, the subscriber lags NextIndex - Position messages behind.
+    std::atomic<ulong> Position;
+    // Messages whose entry was reused before the subscriber got to them.
+    std::atomic<ulong> Overruns;
+
+    void Reset(ulong position)
+    {
+        Delivered.store(0, std::memory_order_relaxed);
+        Overruns.store(0, std::memory_order_relaxed);
+        Position.store(position, std::memory_order_relaxed);
+    }
+};
+
+struct TopicMetrics
+{
+    PublisherMetrics Publisher;
+    // Indexed like the subscribers table.
+    SubscriberMetrics Subscribers[256];
+
+    // Only the owner of the counter writes it.
+    static void Add(std::atomic<ulong>& counter, ulong value = 1)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+    static void Max(std::atomic<ulong>& counter, ulong value)
+    {
+        if (value > counter.load(std::memory_order_relaxed))
+            counter.store(value, std::memory_order_relaxed);
+    }
+    // Counters that several publishers write.
+    static void Sum(std::atomic<ulong>& counter, ulong value = 1)
+    {
+        counter.fetch_add(value, std::memory_order_relaxed);
+    }
+    static void SharedMax(std::atomic<ulong>& counter, ulong value)
+    {
+        ulong current = counter.load(std::memory_order_relaxed);
+        while (value > current && !counter.compare_exchange_weak(current, value, std::memory_order_relaxed))
+        {
+        }
+    }
+};
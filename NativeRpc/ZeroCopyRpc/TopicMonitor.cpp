@@ -0,0 +1,102 @@
+#include "TopicMonitor.h"
+
+#include <algorithm>
+#include <filesystem>
+
+#include "ProcessUtils.h"
+#include "TopicRegistry.h"
+#include "ZeroCopyRpcException.h"
+
+using namespace boost::interprocess;
+
+TopicMonitor::TopicMonitor(const std::string& channelName, const std::string& topicName)
+    : _topicName(topicName),
+      _shm(open_only, (channelName + "." + topicName + ".buffer").c_str(), read_only),
+      _region(_shm, read_only)
+{
+    auto base = _region.get_address();
+    _metadata = static_cast<TopicMetadata*>(base);
+    if (!_metadata->IsValid(_region.get_size()))
+        throw ZeroCopyRpcException("Topic was created with another layout.");
+    _subscribers = static_cast<SubscriptionSharedData*>(_metadata->SubscribersTableAddress(base));
+    _metrics = static_cast<TopicMetrics*>(_metadata->MetricsAddress(base));
+    _buffer = std::make_unique<CyclicBuffer>(static_cast<byte*>(_metadata->BufferAddress(base)));
+}
+
+TopicSample TopicMonitor::Sample() const
+{
+    constexpr auto relaxed = std::memory_order_relaxed;
+    TopicSample sample;
+    sample.At = std::chrono::steady_clock::now();
+    sample.Mode = _metadata->Mode;
+    sample.Capacity = _metadata->BufferItemCapacity;
+    sample.BufferSize = _metadata->BufferSize;
+    sample.NextIndex = _buffer->NextIndex();
+
+    auto& publisher = _metrics->Publisher;
+    sample.Published = publisher.Published.load(relaxed);
+    sample.Bytes = publisher.Bytes.load(relaxed);
+    sample.Wraps = publisher.Wraps.load(relaxed);
+    sample.MaxMessageSize = publisher.MaxMessageSize.load(relaxed);
+    for (int i = 0; i < PublisherMetrics::NotifyBuckets; i++)
+        sample.NotifyLatency[i] = publisher.NotifyLatency[i].load(relaxed);
+
+    for (int i = 0; i < 256; i++) {
+        auto& data = _subscribers[i];
+        if (!data.Active.load(relaxed) || data.PendingRemove.load(relaxed))
+            continue;
+        auto& metrics = _metrics->Subscribers[i];
+        SubscriberSample subscriber;
+        subscriber.Slot = static_cast<byte>(i);
+        subscriber.Pid = data.Pid;
+        subscriber.Running = is_process_running(data.Pid);
+        subscriber.Delivered = metrics.Delivered.load(relaxed);
+        subscriber.Overruns = metrics.Overruns.load(relaxed);
+        ulong position = metrics.Position.load(relaxed);
+        subscriber.Lag = sample.NextIndex > position ? sample.NextIndex - position : 0;
+        sample.Subscribers.push_back(subscriber);
+    }
+    return sample;
+}
+
+ulong TopicMonitor::NotifyLatencyPercentile(const TopicSample& from, const TopicSample& to, double fraction)
+{
+    ulong total = 0;
+    for (int i = 0; i < PublisherMetrics::NotifyBuckets; i++)
+        total += to.NotifyLatency[i] - from.NotifyLatency[i];
+    if (total == 0)
+        return 0;
+    ulong rank = static_cast<ulong>(fraction * static_cast<double>(total));
+    ulong seen = 0;
+    for (int i = 0; i < PublisherMetrics::NotifyBuckets; i++) {
+        seen += to.NotifyLatency[i] - from.NotifyLatency[i];
+        if (seen > rank)
+            return PublisherMetrics::NotifyBucketLimit(i);
+    }
+    return PublisherMetrics::NotifyBucketLimit(PublisherMetrics::NotifyBuckets - 1);
+}
+
+std::vector<std::string> TopicMonitor::Topics(const std::string& channelName)
+{
+    std::vector<std::string> topics;
+    try {
+        for (auto& topic : TopicRegistry(channelName).Topics())
+            topics.push_back(topic.Name);
+        return topics;
+    }
+    catch (const interprocess_exception&) {
+        // No server of the channel runs, its topics may still have regions.
+    }
+#if defined(__linux__)
+    const std::string prefix = channelName + ".";
+    const std::string suffix = ".buffer";
+    std::error_code error;
+    for (const auto& file : std::filesystem::directory_iterator("/dev/shm", error)) {
+        auto name = file.path().filename().string();
+        if (name.size() > prefix.size() + suffix.size() && name.starts_with(prefix) && name.ends_with(suffix))
+            topics.push_back(name.substr(prefix.size(), name.size() - prefix.size() - suffix.size()));
+    }
+    std::ranges::sort(topics);
+#endif
+    return topics;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "CyclicBuffer.hpp"
+#include "Export.h"
+#include "Messages.h"
+#include "TopicMetrics.h"
+
+struct SubscriberSample {
+    byte Slot = 0;
+    pid_t Pid = 0;
+    bool Running = false;
+    ulong Delivered = 0;
+    ulong Overruns = 0;
+    // Messages published that the subscriber did not get to yet, including ones its filter steps over.
+    ulong Lag = 0;
+};
+
+struct TopicSample {
+    std::chrono::steady_clock::time_point At;
+    TopicMode Mode = TopicMode::Queue;
+    ulong Capacity = 0;
+    ulong BufferSize = 0;
+    ulong NextIndex = 0;
+    ulong Published = 0;
+    ulong Bytes = 0;
+    ulong Wraps = 0;
+    ulong MaxMessageSize = 0;
+    std::array<ulong, PublisherMetrics::NotifyBuckets> NotifyLatency{};
+    std::vector<SubscriberSample> Subscribers;
+};
+
+// Maps the shared memory region of a topic read-only and samples its metrics block (see TopicMetrics.h). Neither the
+// publisher nor the subscribers take part, rates are the difference of two samples.
+class EXPORT TopicMonitor {
+public:
+    // Throws interprocess_exception when the topic has no region.
+    TopicMonitor(const std::string& channelName, const std::string& topicName);
+
+    const std::string& Name() const { return _topicName; }
+    TopicSample Sample() const;
+
+    // Upper bound in ns of the notification time that the given fraction of notifications between two samples took,
+    // 0 when there were none.
+    static ulong NotifyLatencyPercentile(const TopicSample& from, const TopicSample& to, double fraction);
+    // Topics listed in the registry of the channel. When it has none, the topics that have a region, found by name
+    // where shared memory is visible as files; elsewhere the list is empty and topics need to be named.
+    static std::vector<std::string> Topics(const std::string& channelName);
+
+private:
+    std::string _topicName;
+    boost::interprocess::shared_memory_object _shm;
+    boost::interprocess::mapped_region _region;
+    TopicMetadata* _metadata;
+    SubscriptionSharedData* _subscribers;
+    TopicMetrics* _metrics;
+    std::unique_ptr<CyclicBuffer> _buffer;
+};
@@ -0,0 +1,102 @@
+#include "TopicRecorder.h"
+
+#include <boost/log/trivial.hpp>
+
+#include "UdpReplicationMessages.h"
+
+TopicRecorder::TopicRecorder(const std::string& channelName, RecordingConfig config)
+    : _shmClient(channelName), _config(config), _writer(std::move(config))
+{
+    _shmClient.Connect();
+    _flushThread = std::thread([this]() { FlushLoop(); });
+}
+
+TopicRecorder::~TopicRecorder()
+{
+    Stop();
+}
+
+void TopicRecorder::RecordTopic(const std::string& topicName, const SubscribeStart& start)
+{
+    auto recording = std::make_unique<TopicRecording>();
+    recording->TopicName = topicName;
+    recording->TopicId = UdpTopicId(topicName);
+    {
+        std::lock_guard lock(_writerMutex);
+        _writer.AddTopic(recording->TopicId, topicName);
+    }
+    recording->Cursor = _shmClient.Subscribe(topicName, start);
+    recording->RecordingThread = std::thread([this, r = recording.get()]() { RecordLoop(*r); });
+
+    std::lock_guard lock(_stopMutex);
+    _recordings.push_back(std::move(recording));
+}
+
+void TopicRecorder::RecordLoop(TopicRecording& recording)
+{
+    while (_running) {
+        CyclicBuffer::Accessor msg;
+        if (!recording.Cursor->TryReadFor(msg, std::chrono::milliseconds(100)))
+            continue;
+
+        if (!msg.Buffer->IsLive(msg.Index)) {
+            std::lock_guard lock(_writerMutex);
+            _stats.Dropped++;
+            continue;
+        }
+        std::lock_guard lock(_writerMutex);
+        // Taken under the lock, so that records of all topics are in time order, as Seek expects.
+        auto timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        try {
+            _writer.Append(recording.TopicId, msg.Index, timestamp, msg.Type(), msg.Get(), msg.Size());
+        }
+        catch (const std::exception& e) {
+            BOOST_LOG_TRIVIAL(error) << "Cannot record message of topic " << recording.TopicName << ": " << e.what();
+            _running = false;
+            break;
+        }
+        // The publisher may have wrapped over the payload while it was copied.
+        if (!msg.Buffer->IsLive(msg.Index)) {
+            _writer.Rewind();
+            _stats.Dropped++;
+            continue;
+        }
+        _stats.Messages++;
+        _stats.Bytes += msg.Size();
+    }
+}
+
+void TopicRecorder::FlushLoop()
+{
+    std::unique_lock stopLock(_stopMutex);
+    while (!_stopped.wait_for(stopLock, _config.FlushInterval, [this]() { return !_running; })) {
+        std::lock_guard lock(_writerMutex);
+        _writer.Flush();
+    }
+}
+
+RecorderStats TopicRecorder::Stats()
+{
+    std::lock_guard lock(_writerMutex);
+    RecorderStats stats = _stats;
+    stats.Segments = _writer.Segments();
+    return stats;
+}
+
+void TopicRecorder::Stop()
+{
+    {
+        std::lock_guard lock(_stopMutex);
+        _running = false;
+    }
+    _stopped.notify_all();
+    if (_flushThread.joinable())
+        _flushThread.join();
+    for (auto& recording : _recordings)
+        if (recording->RecordingThread.joinable())
+            recording->RecordingThread.join();
+
+    std::lock_guard lock(_writerMutex);
+    _writer.Close();
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Export.h"
+#include "RecordingLog.h"
+#include "SharedMemoryClient.h"
+
+struct RecorderStats {
+    uint64_t Messages = 0;
+    uint64_t Bytes = 0;
+    // Messages that were overwritten in the ring before they were copied to the log.
+    uint64_t Dropped = 0;
+    uint64_t Segments = 0;
+};
+
+// Subscribes to topics of a channel and appends every message to a recording (see RecordingLog.h). The recorder is
+// an ordinary subscriber, it never holds the publisher back: a message that the ring overwrote before it was copied is
+// counted as dropped and left out of the recording.
+class EXPORT TopicRecorder {
+public:
+    TopicRecorder(const std::string& channelName, RecordingConfig config);
+    ~TopicRecorder();
+
+    void RecordTopic(const std::string& topicName, const SubscribeStart& start = {});
+    RecorderStats Stats();
+    // Stops the topic threads and closes the log, it is called by the destructor.
+    void Stop();
+
+private:
+    struct TopicRecording {
+        std::string TopicName;
+        uint32_t TopicId;
+        std::unique_ptr<ISubscriptionCursor> Cursor;
+        std::thread RecordingThread;
+    };
+
+    void RecordLoop(TopicRecording& recording);
+    void FlushLoop();
+
+    SharedMemoryClient _shmClient;
+    const RecordingConfig _config;
+    RecordingLogWriter _writer;
+    std::mutex _writerMutex;
+    RecorderStats _stats;
+    std::vector<std::unique_ptr<TopicRecording>> _recordings;
+    std::atomic<bool> _running{ true };
+    std::mutex _stopMutex;
+    std::condition_variable _stopped;
+    std::thread _flushThread;
+};
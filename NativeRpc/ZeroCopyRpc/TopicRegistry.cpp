@@ -0,0 +1,209 @@
+#include "TopicRegistry.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#include <boost/log/trivial.hpp>
+
+#include "ZeroCopyRpcException.h"
+
+using namespace boost::interprocess;
+
+TopicRegistry::TopicRegistry(const std::string& channelName)
+    : _shm(open_only, ShmName(channelName).c_str(), read_only),
+      _region(_shm, read_only)
+{
+    if (_region.get_size() < sizeof(Table))
+        throw ZeroCopyRpcException("Topic registry is smaller than expected, it was created by another version.");
+    _table = static_cast<Table*>(_region.get_address());
+}
+
+TopicRegistry::TopicRegistry(const std::string& channelName, open_or_create_t)
+    : _shm(open_or_create, ShmName(channelName).c_str(), read_write)
+{
+    offset_t size = 0;
+    _shm.get_size(size);
+    if (size < static_cast<offset_t>(sizeof(Table)))
+        _shm.truncate(sizeof(Table));
+    _region = mapped_region(_shm, read_write);
+    _table = static_cast<Table*>(_region.get_address());
+
+    // A server that crashed while it changed the table left the generation odd.
+    auto generation = _table->Generation.load(std::memory_order_relaxed);
+    if (generation % 2 != 0)
+        _table->Generation.store(generation + 1, std::memory_order_release);
+    Clear();
+}
+
+std::string TopicRegistry::ShmName(const std::string& channelName)
+{
+    return channelName + ".registry";
+}
+
+bool TopicRegistry::Destroy(const std::string& channelName)
+{
+    return shared_memory_object::remove(ShmName(channelName).c_str());
+}
+
+ulong TopicRegistry::Generation() const
+{
+    return _table->Generation.load(std::memory_order_acquire);
+}
+
+template<typename F>
+void TopicRegistry::Change(F&& change)
+{
+    auto generation = _table->Generation.load(std::memory_order_relaxed);
+    _table->Generation.store(generation + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    change();
+    _table->Generation.store(generation + 2, std::memory_order_release);
+}
+
+std::vector<TopicRegistry::Entry> TopicRegistry::Snapshot() const
+{
+    std::vector<Entry> entries;
+    for (int attempt = 0; attempt < 10000; attempt++) {
+        auto before = _table->Generation.load(std::memory_order_acquire);
+        if (before % 2 != 0) {
+            std::this_thread::yield();
+            continue;
+        }
+        entries.clear();
+        for (const auto& entry : _table->Topics) {
+            if (!entry.Active)
+                continue;
+            entries.emplace_back();
+            std::memcpy(&entries.back(), &entry, sizeof(Entry));
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (_table->Generation.load(std::memory_order_relaxed) == before)
+            return entries;
+    }
+    throw ZeroCopyRpcException("Topic registry keeps changing, it cannot be read.");
+}
+
+std::vector<TopicInfo> TopicRegistry::Topics() const
+{
+    std::vector<TopicInfo> topics;
+    for (const auto& entry : Snapshot()) {
+        TopicInfo info;
+        info.Name.assign(entry.Name, strnlen(entry.Name, sizeof(entry.Name)));
+        info.Mode = entry.Mode;
+        info.MessageCount = entry.MessageCount;
+        info.BufferSize = entry.BufferSize;
+        info.MaxMessageSize = entry.MaxMessageSize;
+        info.Created = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+            std::chrono::nanoseconds(entry.Created)));
+        info.Publisher = entry.Publisher;
+        topics.push_back(std::move(info));
+    }
+    std::ranges::sort(topics, {}, &TopicInfo::Name);
+    return topics;
+}
+
+std::optional<TopicInfo> TopicRegistry::Find(const std::string& topicName) const
+{
+    for (auto& topic : Topics())
+        if (topic.Name == topicName)
+            return topic;
+    return std::nullopt;
+}
+
+void TopicRegistry::Add(const TopicInfo& topic)
+{
+    Entry* slot = nullptr;
+    for (auto& entry : _table->Topics) {
+        if (entry.Active && topic.Name == entry.Name) {
+            slot = &entry;
+            break;
+        }
+        if (!entry.Active && slot == nullptr)
+            slot = &entry;
+    }
+    if (slot == nullptr || topic.Name.size() >= sizeof(slot->Name)) {
+        BOOST_LOG_TRIVIAL(warning) << "Topic " << topic.Name << " is not listed in the registry, it is full or the name is too long.";
+        return;
+    }
+    Change([&]() {
+        std::memset(slot->Name, 0, sizeof(slot->Name));
+        std::memcpy(slot->Name, topic.Name.data(), topic.Name.size());
+        slot->MessageCount = topic.MessageCount;
+        slot->BufferSize = topic.BufferSize;
+        slot->MaxMessageSize = topic.MaxMessageSize;
+        slot->Created = std::chrono::duration_cast<std::chrono::nanoseconds>(topic.Created.time_since_epoch()).count();
+        slot->Publisher = topic.Publisher;
+        slot->Mode = topic.Mode;
+        slot->Active = true;
+    });
+}
+
+bool TopicRegistry::Remove(const std::string& topicName)
+{
+    for (auto& entry : _table->Topics) {
+        if (entry.Active && topicName == entry.Name) {
+            Change([&]() { entry.Active = false; });
+            return true;
+        }
+    }
+    return false;
+}
+
+void TopicRegistry::Clear()
+{
+    Change([&]() {
+        for (auto& entry : _table->Topics)
+            entry.Active = false;
+    });
+}
+
+bool TopicRegistry::IsPattern(const std::string& name)
+{
+    return name.find_first_of("*?") != std::string::npos;
+}
+
+bool TopicRegistry::Matches(const std::string& pattern, const std::string& name)
+{
+    // Backtracks to the last star only, which is enough for globs.
+    size_t p = 0, n = 0, star = std::string::npos, resume = 0;
+    while (n < name.size()) {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) {
+            p++;
+            n++;
+        }
+        else if (p < pattern.size() && pattern[p] == '*') {
+            star = p++;
+            resume = n;
+        }
+        else if (star != std::string::npos) {
+            p = star + 1;
+            n = ++resume;
+        }
+        else
+            return false;
+    }
+    while (p < pattern.size() && pattern[p] == '*')
+        p++;
+    return p == pattern.size();
+}
+
+std::vector<std::string> TopicRegistry::Expand(const std::string& channelName, const std::vector<std::string>& patterns)
+{
+    std::vector<TopicInfo> registered;
+    if (std::ranges::any_of(patterns, IsPattern))
+        registered = TopicRegistry(channelName).Topics();
+
+    std::vector<std::string> names;
+    for (const auto& pattern : patterns) {
+        if (!IsPattern(pattern)) {
+            if (std::ranges::find(names, pattern) == names.end())
+                names.push_back(pattern);
+            continue;
+        }
+        for (const auto& topic : registered)
+            if (Matches(pattern, topic.Name) && std::ranges::find(names, topic.Name) == names.end())
+                names.push_back(topic.Name);
+    }
+    return names;
+}
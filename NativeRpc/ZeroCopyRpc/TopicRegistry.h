@@ -0,0 +1,87 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "Export.h"
+#include "Messages.h"
+#include "ProcessUtils.h"
+#include "TypeDefs.h"
+
+struct TopicInfo {
+    std::string Name;
+    TopicMode Mode = TopicMode::Queue;
+    ulong MessageCount = 0;
+    ulong BufferSize = 0;
+    ulong MaxMessageSize = 0;
+    std::chrono::system_clock::time_point Created;
+    // Process of the SharedMemoryServer that publishes the topic.
+    pid_t Publisher = 0;
+};
+
+// Topics of a channel, kept by its SharedMemoryServer in a shared memory segment of their own, so that clients and
+// tools can list them without knowing their names. Topics whose region outlived the server stay listed until a new
+// server of the channel starts or the channel is cleared. The server is the only writer. Generation changes with every
+// change of the table, so a watcher polls a single counter and lists the topics only when it moved.
+class EXPORT TopicRegistry {
+public:
+    static constexpr size_t MaxTopics = 256;
+
+    // Opens the registry of the channel read-only; throws interprocess_exception when no server of the channel
+    // created one.
+    explicit TopicRegistry(const std::string& channelName);
+    // Opens the registry for the server of the channel, creating it when needed, and forgets the topics of a previous
+    // server.
+    TopicRegistry(const std::string& channelName, boost::interprocess::open_or_create_t);
+
+    ulong Generation() const;
+    // Sorted by name.
+    std::vector<TopicInfo> Topics() const;
+    std::optional<TopicInfo> Find(const std::string& topicName) const;
+
+    // Server side. A topic that does not fit the table is left out of it, with a warning.
+    void Add(const TopicInfo& topic);
+    bool Remove(const std::string& topicName);
+    void Clear();
+
+    static std::string ShmName(const std::string& channelName);
+    static bool Destroy(const std::string& channelName);
+    // True when name matches the glob pattern: * stands for any run of characters, ? for a single one.
+    static bool Matches(const std::string& pattern, const std::string& name);
+    static bool IsPattern(const std::string& name);
+    // Registered topics of the channel that match any of the patterns. Names without wildcards are kept as they are,
+    // registered or not, so that topics created later can still be named.
+    static std::vector<std::string> Expand(const std::string& channelName, const std::vector<std::string>& patterns);
+
+private:
+    struct Entry {
+        char Name[256];
+        ulong MessageCount;
+        ulong BufferSize;
+        ulong MaxMessageSize;
+        // System clock ns.
+        ulong Created;
+        pid_t Publisher;
+        TopicMode Mode;
+        bool Active;
+    };
+    struct Table {
+        // Odd while the server changes the table: readers retry then, and when it moved while they copied.
+        std::atomic<ulong> Generation;
+        Entry Topics[MaxTopics];
+    };
+
+    template<typename F>
+    void Change(F&& change);
+    // Copies the active entries consistently.
+    std::vector<Entry> Snapshot() const;
+
+    boost::interprocess::shared_memory_object _shm;
+    boost::interprocess::mapped_region _region;
+    Table* _table;
+};
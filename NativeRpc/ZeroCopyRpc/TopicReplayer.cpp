@@ -0,0 +1,95 @@
+#include "TopicReplayer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <boost/log/trivial.hpp>
+
+TopicReplayer::TopicReplayer(SharedMemoryServer& server, RecordingConfig recording, ReplayConfig config)
+    : _server(server), _reader(std::move(recording)), _config(std::move(config))
+{
+    if (_config.Speed < 0)
+        throw std::invalid_argument("Replay speed must not be negative.");
+    if (_config.From != 0)
+        _reader.Seek(_config.From);
+}
+
+TopicService* TopicReplayer::Target(uint32_t topicId)
+{
+    auto it = _targets.find(topicId);
+    if (it != _targets.end())
+        return it->second;
+
+    auto& name = _reader.TopicName(topicId);
+    TopicService* topic = nullptr;
+    if (name.empty())
+        BOOST_LOG_TRIVIAL(warning) << "Messages of unnamed topic " << topicId << " are not replayed.";
+    else if (_config.Topics.empty() || std::ranges::find(_config.Topics, name) != _config.Topics.end()) {
+        topic = _server.CreateTopic(name, _config.MessageCount, _config.BufferSize);
+        BOOST_LOG_TRIVIAL(info) << "Replaying topic " << name;
+    }
+    _targets.emplace(topicId, topic);
+    return topic;
+}
+
+void TopicReplayer::WaitUntil(std::chrono::steady_clock::time_point target)
+{
+    // Sleeps in slices, so that a long gap in the recording does not delay Stop, and spins for the last part.
+    auto remaining = target - std::chrono::steady_clock::now();
+    while (remaining > std::chrono::milliseconds(50) && _running) {
+        std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(remaining - std::chrono::milliseconds(50),
+            std::chrono::milliseconds(100)));
+        remaining = target - std::chrono::steady_clock::now();
+    }
+    if (remaining > std::chrono::nanoseconds(0) && _running)
+        _spin.WaitFor(remaining);
+}
+
+ReplayStats TopicReplayer::Run()
+{
+    ReplayStats stats;
+    const RecordingEntryHeader* entry;
+    const uint8_t* payload;
+    uint64_t first = 0;
+    std::chrono::steady_clock::time_point start;
+
+    while (_running && _reader.Next(entry, payload)) {
+        auto topic = Target(entry->TopicId);
+        if (topic == nullptr)
+            continue;
+        if (entry->Size > topic->MaxMessageSize()) {
+            BOOST_LOG_TRIVIAL(warning) << "Message " << entry->Sequence << " of " << entry->Size
+                << " bytes is larger than topic " << _reader.TopicName(entry->TopicId) << " accepts.";
+            stats.Skipped++;
+            continue;
+        }
+
+        if (_config.Speed > 0) {
+            if (stats.Messages == 0) {
+                first = entry->Timestamp;
+                start = std::chrono::steady_clock::now();
+            }
+            auto offset = entry->Timestamp > first ? entry->Timestamp - first : 0;
+            auto target = start + std::chrono::nanoseconds(static_cast<int64_t>(offset / _config.Speed));
+            WaitUntil(target);
+            if (!_running)
+                break;
+            stats.Lag = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - target);
+        }
+
+        {
+            auto scope = topic->Prepare(entry->Size, entry->Type);
+            auto& span = scope.Span();
+            std::memcpy(span.Start, payload, entry->Size);
+            span.Commit(entry->Size);
+        }
+        stats.Messages++;
+        stats.Bytes += entry->Size;
+    }
+    return stats;
+}
+
+void TopicReplayer::Stop()
+{
+    _running = false;
+}
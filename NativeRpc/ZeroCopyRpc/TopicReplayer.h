@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Export.h"
+#include "RecordingLog.h"
+#include "SharedMemoryServer.h"
+#include "ThreadSpin.h"
+
+struct ReplayConfig {
+    // 1 keeps the recorded pace, 2 replays twice as fast, 0.5 at half speed, 0 as fast as possible.
+    double Speed = 1.0;
+    // System clock ns of the first message to replay, 0 replays from the start of the recording.
+    uint64_t From = 0;
+    // Topics to replay, empty replays every recorded topic.
+    std::vector<std::string> Topics;
+    // Buffer of topics that the replayer creates.
+    unsigned int MessageCount = 256;
+    unsigned int BufferSize = 8 * 1024 * 1024;
+};
+
+struct ReplayStats {
+    uint64_t Messages = 0;
+    uint64_t Bytes = 0;
+    // Messages larger than the target topic accepts.
+    uint64_t Skipped = 0;
+    // How late the last message was published against the recorded timing.
+    std::chrono::nanoseconds Lag{ 0 };
+};
+
+// Republishes a recording into topics of the same name on a server. The payload is copied from the mapped segment
+// straight into the publish span; messages keep the spacing they were recorded with, scaled by the speed.
+class EXPORT TopicReplayer {
+public:
+    TopicReplayer(SharedMemoryServer& server, RecordingConfig recording, ReplayConfig config = {});
+
+    // Replays until the end of the recording or until Stop is called.
+    ReplayStats Run();
+    void Stop();
+
+private:
+    // Topic the messages of a topic id are published to, nullptr when the topic is not replayed.
+    TopicService* Target(uint32_t topicId);
+    void WaitUntil(std::chrono::steady_clock::time_point target);
+
+    SharedMemoryServer& _server;
+    RecordingLogReader _reader;
+    const ReplayConfig _config;
+    std::unordered_map<uint32_t, TopicService*> _targets;
+    std::atomic<bool> _running{ true };
+    ThreadSpin _spin;
+};
@@ -0,0 +1,256 @@
+#include "TopicWriter.h"
+
+#include <thread>
+
+#include <boost/log/trivial.hpp>
+
+#include "ProcessUtils.h"
+#include "ThreadSpin.h"
+#include "ZeroCopyRpcException.h"
+
+PublishScope::PublishScope(CyclicBuffer::WriterScope&& w, TopicWriter* parent)
+	: _scope(std::make_unique<CyclicBuffer::WriterScope>(std::move(w)))
+	, _parent(parent)
+{
+}
+
+ulong PublishScope::Type() const
+{ return _scope->Type; }
+
+PublishScope::PublishScope(PublishScope&& other) noexcept: _scope(std::move(other._scope)), _parent(other._parent)
+{
+	other._parent = nullptr;
+}
+
+PublishScope::~PublishScope()
+{
+	if(_parent != nullptr && _scope->Span.CommitedSize() > 0)
+	{
+		if (_parent->_checksums && !_scope->HasChecksum)
+			_scope->SetChecksum(Crc32c(_scope->Span.Start, _scope->Span.CommitedSize()));
+		_scope.reset();
+		_parent->NotifyAll();
+		_parent = nullptr;
+	}
+}
+
+CyclicMemoryPool::Span& PublishScope::Span()
+{
+	CyclicMemoryPool::Span &p  = _scope->Span; return p;
+}
+
+void PublishScope::ChangeType(uint64_t type)
+{
+	_scope->Type = type;
+}
+
+void PublishScope::SetChecksum(uint32_t checksum)
+{
+	_scope->SetChecksum(checksum);
+}
+
+void PublishScope::SetOrigin(uint64_t origin)
+{
+	auto clock = _parent->_timestamps != TimestampClock::None ? _parent->_timestamps : TimestampClock::Monotonic;
+	_scope->SetTimestamp(clock, origin);
+}
+
+void TopicWriter::Bind(const std::string& topicName, TopicMetadata* metadata, SubscriptionSharedData* subscribers,
+	CyclicBuffer* buffer, TopicMetrics* metrics)
+{
+	_name = topicName;
+	_metadata = metadata;
+	_subscribers = subscribers;
+	_buffer = buffer;
+	_metrics = metrics;
+	_mode = metadata->Mode;
+}
+
+PublishScope TopicWriter::Prepare(ulong minSize, ulong type)
+{
+	auto scope = _buffer->WriteScope(minSize, type, WriteTimeout);
+	// Under the write lock, so that another writer cannot take the space meanwhile.
+	if (_mode == TopicMode::Lossless)
+		WaitForSpace(minSize);
+	// On a lossless topic only minSize bytes are known to be free, the rest up to the end of the pool may hold unread
+	// messages. On any topic, readers that check IsLive take every byte of the span for written.
+	scope.Span.Limit(minSize);
+	scope.SetTimestamp(_timestamps);
+	return PublishScope(std::move(scope), this);
+}
+
+unsigned int TopicWriter::Claim(SubscriptionSharedData& data) const
+{
+	ulong next = _buffer->NextIndex();
+	ulong released = data.Released.load();
+	while (released < next && !data.Released.compare_exchange_weak(released, next))
+	{
+	}
+	if (released >= next)
+		return 0;
+	ulong count = next - released;
+	if (!data.Filter.IsAny())
+	{
+		// Entries of a subscriber that fell a lap behind were reused, only the last capacity of them can be looked at.
+		ulong capacity = _buffer->Capacity();
+		count = 0;
+		for (ulong i = next - released > capacity ? next - capacity : released; i < next; i++)
+			if (data.Filter.Accepts(_buffer->TypeAt(i)))
+				count++;
+	}
+	// A conflating subscriber reads only the latest message, one wake up is enough.
+	if (count == 0)
+		return 0;
+	return _mode == TopicMode::Conflate ? 1 : static_cast<unsigned int>(count);
+}
+
+void TopicWriter::Account()
+{
+	ulong next = _buffer->NextIndex();
+	auto& publisher = _metrics->Publisher;
+	ulong accounted = publisher.Accounted.load();
+	while (accounted < next && !publisher.Accounted.compare_exchange_weak(accounted, next))
+	{
+	}
+	if (accounted >= next)
+		return;
+	TopicMetrics::Sum(publisher.Published, next - accounted);
+	// Entries more than a lap back were reused, their sizes are gone.
+	ulong capacity = _buffer->Capacity();
+	ulong bytes = 0;
+	for (ulong i = next - accounted > capacity ? next - capacity : accounted; i < next; i++)
+	{
+		auto& entry = _buffer->EntryAt(i);
+		bytes += entry.Size;
+		TopicMetrics::SharedMax(publisher.MaxMessageSize, entry.Size);
+		if (i > 0 && next - i < capacity)
+		{
+			auto& previous = _buffer->EntryAt(i - 1);
+			if (entry.Offset < previous.Offset + previous.Size)
+				TopicMetrics::Sum(publisher.Wraps);
+		}
+	}
+	TopicMetrics::Sum(publisher.Bytes, bytes);
+}
+
+void TopicWriter::RecordNotify(std::chrono::steady_clock::time_point start)
+{
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	TopicMetrics::Sum(_metrics->Publisher.NotifyLatency[PublisherMetrics::NotifyBucket(static_cast<ulong>(ns))]);
+}
+
+CyclicBuffer* TopicWriter::GetBuffer()
+{
+	return this->_buffer;
+}
+
+const TopicMetrics& TopicWriter::Metrics() const
+{
+	return *_metrics;
+}
+
+TopicMode TopicWriter::Mode() const
+{
+	return _mode;
+}
+
+const TopicMetadata& TopicWriter::Metadata() const
+{
+	return *_metadata;
+}
+
+void TopicWriter::SetBackPressure(BackPressure policy, std::chrono::milliseconds timeout)
+{
+	_backPressure = policy;
+	_backPressureTimeout = timeout;
+}
+
+void TopicWriter::SetChecksums(bool enabled)
+{
+	_checksums = enabled;
+}
+
+bool TopicWriter::Checksums() const
+{
+	return _checksums;
+}
+
+void TopicWriter::SetTimestamps(TimestampClock clock)
+{
+	_timestamps = clock;
+}
+
+TimestampClock TopicWriter::Timestamps() const
+{
+	return _timestamps;
+}
+
+void TopicWriter::SetSchemaHash(ulong hash)
+{
+	if (_metadata->SchemaHash != 0 && _metadata->SchemaHash != hash)
+		BOOST_LOG_TRIVIAL(warning) << "Topic " << _name << " changes its schema, subscribers of the previous one are refused.";
+	_metadata->SchemaHash = hash;
+}
+
+ulong TopicWriter::SchemaHash() const
+{
+	return _metadata->SchemaHash;
+}
+
+void TopicWriter::CheckSchema(ulong hash) const
+{
+	if (_metadata->SchemaHash != 0 && _metadata->SchemaHash != hash)
+		throw ZeroCopyRpcException("The message does not match the schema of the topic.");
+}
+
+ulong TopicWriter::SlowestConsumer(bool evictDead)
+{
+	ulong next = _buffer->NextIndex();
+	ulong slowest = next;
+	for (int i = 0; i < 256; i++)
+	{
+		auto& data = _subscribers[i];
+		if (!data.Active || data.PendingRemove)
+			continue;
+		ulong consumed = data.Consumed.load();
+		// Messages the filter rejects are stepped over unread. Entries more than a lap back were reused, the ones that
+		// held were stepped over already.
+		if (!data.Filter.IsAny())
+		{
+			consumed = _buffer->WithinLap(consumed);
+			while (consumed < next && !data.Filter.Accepts(_buffer->TypeAt(consumed)))
+				consumed++;
+		}
+		if (evictDead && consumed < slowest && !is_process_running(data.Pid))
+		{
+			// A crashed subscriber would hold the topic forever, it is removed on the next notification.
+			BOOST_LOG_TRIVIAL(warning) << "Subscriber " << data.Pid << " of topic " << _name << " is not running, evicted.";
+			data.PendingRemove.store(true);
+			continue;
+		}
+		slowest = std::min(slowest, consumed);
+	}
+	return slowest;
+}
+
+void TopicWriter::WaitForSpace(ulong size)
+{
+	if (!_cacheSlowest || _rescanConsumers.exchange(false))
+		_slowest = SlowestConsumer();
+	if (_buffer->CanWrite(size, _slowest))
+		return;
+
+	auto deadline = std::chrono::steady_clock::now() + _backPressureTimeout;
+	while (true)
+	{
+		_slowest = SlowestConsumer(true);
+		if (_buffer->CanWrite(size, _slowest))
+			return;
+		if (_backPressure == BackPressure::Fail || std::chrono::steady_clock::now() >= deadline)
+			throw ZeroCopyRpcException("Topic is full, a subscriber does not keep up.");
+		if (_backPressure == BackPressure::Spin)
+			ThreadSpin::Wait(200);
+		else
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+	}
+}
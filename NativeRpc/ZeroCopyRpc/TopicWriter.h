@@ -0,0 +1,184 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "CyclicBuffer.hpp"
+#include "Export.h"
+#include "MessageSchema.h"
+#include "Messages.h"
+#include "PublishClock.h"
+#include "TopicMetrics.h"
+#include "TypeDefs.h"
+
+class TopicWriter;
+
+// What Prepare does on a lossless topic when the message would overwrite one that a subscriber did not read yet.
+enum class BackPressure : byte
+{
+    // Sleeps until the subscriber moves on.
+    Block = 0,
+    // Spins until the subscriber moves on, for the lowest latency at the cost of a core.
+    Spin = 1,
+    // Throws right away.
+    Fail = 2
+};
+
+struct EXPORT PublishScope
+{
+    PublishScope() = default;
+    PublishScope(CyclicBuffer::WriterScope&& w, TopicWriter* parent);
+    CyclicMemoryPool::Span& Span();
+    void ChangeType(uint64_t type);
+    // Stores a CRC32C the caller computed while writing the message, instead of the one a topic with checksums computes.
+    void SetChecksum(uint32_t checksum);
+    // Keeps the system clock ns of the original publish, as replicators do; the message is stamped even when the topic
+    // has no timestamps.
+    void SetOrigin(uint64_t origin);
+    PublishScope(const PublishScope& other) = delete;
+    ulong Type() const;
+
+    PublishScope(PublishScope&& other) noexcept;
+    ~PublishScope();
+
+private:
+
+    std::unique_ptr<CyclicBuffer::WriterScope> _scope;
+    TopicWriter* _parent;
+};
+
+// PublishScope of a schema message: the fixed part is constructed at the start of the span and variable-length fields
+// are appended after it (see MessageWriter). All of it is committed when the scope ends, unless it ends by an exception.
+template<SchemaMessage T>
+struct MessageScope
+{
+    explicit MessageScope(PublishScope&& scope)
+        : _scope(std::move(scope)), _writer(_scope.Span().Start, _scope.Span().Size), _exceptions(std::uncaught_exceptions())
+    {
+    }
+    MessageScope(const MessageScope&) = delete;
+    MessageScope(MessageScope&&) = delete;
+
+    T* operator->() { return &_writer.Message(); }
+    T& Message() { return _writer.Message(); }
+    template<typename U>
+    std::span<U> Allocate(InlineArray<U>& field, size_t count) { return _writer.Allocate(field, count); }
+    template<typename U>
+    void Assign(InlineArray<U>& field, std::span<const U> values) { _writer.Assign(field, values); }
+    void Assign(InlineString& field, std::string_view value) { _writer.Assign(field, value); }
+    // Stamps the original publish time, see PublishScope::SetOrigin.
+    void SetOrigin(uint64_t origin) { _scope.SetOrigin(origin); }
+
+    ~MessageScope()
+    {
+        if (std::uncaught_exceptions() == _exceptions)
+            _scope.Span().Commit(_writer.Size());
+    }
+
+private:
+    PublishScope _scope;
+    MessageWriter<T> _writer;
+    int _exceptions;
+};
+
+// Publishes into the shared memory region of a topic: TopicService for the server that owns the topic, a client's
+// TopicPublisher for any other process (see SharedMemoryClient::OpenPublisher). Writers take turns on the ring and each
+// one signals the subscribers of what it committed; a message is released to a subscriber once, by whichever writer
+// claims it first in the subscribers table.
+class EXPORT TopicWriter {
+public:
+    friend struct PublishScope;
+    virtual ~TopicWriter() = default;
+
+    template<typename T, typename... Args> requires (!SchemaMessage<T>)
+    T* Publish(ulong type, Args&&... args) {
+        auto scope = Prepare(sizeof(T), type);
+        auto& span = scope.Span();
+        auto ptr = new (span.Start) T(std::forward<Args>(args)...);
+        span.Commit(sizeof(T));
+        return ptr;
+    }
+    // Schema messages carry their type id; ones with variable-length fields are built with Prepare<T>.
+    template<SchemaMessage T>
+    T* Publish(const T& message) {
+        static_assert(!MessageSchema<T>::HasInlineFields, "Messages with variable-length fields are built with Prepare<T>.");
+        auto scope = Prepare<T>();
+        scope.Message() = message;
+        return &scope.Message();
+    }
+    // Room for the fixed part of the message and inlineBytes of variable-length fields, including the padding that
+    // aligns each of them. Throws ZeroCopyRpcException when the topic has another schema.
+    template<SchemaMessage T>
+    MessageScope<T> Prepare(ulong inlineBytes = 0) {
+        CheckSchema(MessageSchema<T>::Hash);
+        return MessageScope<T>(Prepare(sizeof(T) + inlineBytes, MessageSchema<T>::TypeId));
+    }
+    // Stores the layout of T with the topic, typed subscribers of other layouts are refused.
+    template<SchemaMessage T>
+    void SetSchema() { SetSchemaHash(MessageSchema<T>::Hash); }
+    void SetSchemaHash(ulong hash);
+    ulong SchemaHash() const;
+
+    // Waits up to WriteTimeout while another writer holds the ring, then throws runtime_error. On a lossless topic then
+    // waits, according to the back-pressure policy and holding the ring, until minSize bytes can be written without
+    // overwriting a message that a subscriber did not read; throws ZeroCopyRpcException when that wait times out. The
+    // span is minSize bytes, committing more throws.
+    PublishScope Prepare(ulong minSize, ulong type);
+    void SetBackPressure(BackPressure policy, std::chrono::milliseconds timeout = std::chrono::seconds(1));
+    // Every committed message gets a CRC32C in its entry, that subscribers and replicators verify.
+    void SetChecksums(bool enabled);
+    bool Checksums() const;
+    // Every committed message gets its commit time in the clock, and the time of its original publish, in its entry;
+    // subscribers measure latency from them (see ISubscriptionCursor::Latency).
+    void SetTimestamps(TimestampClock clock);
+    TimestampClock Timestamps() const;
+    // Oldest message a live subscriber of a lossless topic still reads, NextIndex when all were read.
+    ulong SlowestConsumer(bool evictDead = false);
+    TopicMode Mode() const;
+    // Geometry, mode and schema of the topic as kept in its region, which a reused region keeps from its creation.
+    const TopicMetadata& Metadata() const;
+    // Signals the subscribers of every message committed since the last call, and counts them in the metrics block.
+    virtual void NotifyAll() = 0;
+    CyclicBuffer* GetBuffer();
+    const TopicMetrics& Metrics() const;
+
+    static constexpr std::chrono::milliseconds WriteTimeout{ 1000 };
+
+protected:
+    TopicWriter() = default;
+    void Bind(const std::string& topicName, TopicMetadata* metadata, SubscriptionSharedData* subscribers, CyclicBuffer* buffer,
+        TopicMetrics* metrics);
+    // Claims the messages of the filtered types committed since the subscription was last signalled, returns how many
+    // times its semaphore is to be released.
+    unsigned int Claim(SubscriptionSharedData& data) const;
+    // Counts messages committed since the last call of any writer. Written through the buffer's entries, so messages
+    // that replicators commit without a PublishScope are counted as well.
+    void Account();
+    void RecordNotify(std::chrono::steady_clock::time_point start);
+    void CheckSchema(ulong hash) const;
+    void WaitForSpace(ulong size);
+
+    // For logs.
+    std::string _name;
+    TopicMode _mode = TopicMode::Queue;
+    BackPressure _backPressure = BackPressure::Block;
+    std::chrono::milliseconds _backPressureTimeout{ 1000 };
+    bool _checksums = false;
+    TimestampClock _timestamps = TimestampClock::None;
+    // Cached SlowestConsumer, only ever behind the real one as long as a new subscription asks for a rescan; writers
+    // that do not learn about new subscriptions rescan every time.
+    ulong _slowest = 0;
+    std::atomic<bool> _rescanConsumers{ true };
+    bool _cacheSlowest = true;
+
+    // IN SHM
+    TopicMetadata* _metadata = nullptr;
+    // Client PID, Released, Current Offset table.
+    SubscriptionSharedData* _subscribers = nullptr; // 256
+    CyclicBuffer* _buffer = nullptr;
+    TopicMetrics* _metrics = nullptr;
+};
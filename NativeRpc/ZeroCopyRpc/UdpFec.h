@@ -0,0 +1,109 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// dst ^= src, vectorised with the widest instruction set the library is compiled for.
+inline void XorBlock(uint8_t* dst, const uint8_t* src, size_t size) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 32 <= size; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(a, b));
+    }
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    for (; i + 16 <= size; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(a, b));
+    }
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+    for (; i + 16 <= size; i += 16)
+        vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), vld1q_u8(src + i)));
+#endif
+    for (; i + 8 <= size; i += 8) {
+        uint64_t a, b;
+        std::memcpy(&a, dst + i, 8);
+        std::memcpy(&b, src + i, 8);
+        a ^= b;
+        std::memcpy(dst + i, &a, 8);
+    }
+    for (; i < size; i++)
+        dst[i] ^= src[i];
+}
+
+// Forward error correction of a UDP frame: data fragments are split into groups of Data fragments, every group is
+// followed by Parity XOR fragments. Parity j of a group covers fragments j, j + Parity, j + 2*Parity ... of the group,
+// so any burst of up to Parity consecutive lost fragments in a group can be rebuilt.
+// Parity fragments are sent after data fragments, with sequence numbers that continue after the last data fragment.
+struct UdpFecConfig {
+    uint8_t Data = 0;
+    uint8_t Parity = 0;
+
+    UdpFecConfig() = default;
+    UdpFecConfig(uint8_t data, uint8_t parity) : Data(data), Parity(parity) {
+        if ((data == 0) != (parity == 0) || parity > data)
+            throw std::invalid_argument("FEC parity fragments must be between 1 and the number of data fragments in a group.");
+    }
+
+    bool Enabled() const { return Data != 0 && Parity != 0; }
+
+    // Number of parity fragments for a frame made of chunks data fragments.
+    size_t ParityCount(size_t chunks) const {
+        if (!Enabled() || chunks <= 1)
+            return 0;
+        return (chunks + Data - 1) / Data * Parity;
+    }
+
+    // Parity fragment that covers data fragment seq.
+    size_t ParityOf(size_t seq) const {
+        return seq / Data * Parity + seq % Data % Parity;
+    }
+
+    // First data fragment covered by parity fragment p; the next ones are Parity apart, until the end of the group.
+    size_t FirstCovered(size_t p) const {
+        return p / Parity * Data + p % Parity;
+    }
+    size_t GroupEnd(size_t p, size_t chunks) const {
+        size_t end = (p / Parity + 1) * Data;
+        return end < chunks ? end : chunks;
+    }
+};
+
+// Computes parity fragments of a frame in a single pass over its data. Parity buffer is reused between frames.
+class UdpFecEncoder {
+public:
+    explicit UdpFecEncoder(UdpFecConfig config = {}) : _config(config) {}
+
+    const UdpFecConfig& Config() const { return _config; }
+    const uint8_t* Parity() const { return _parity.data(); }
+    size_t ParityCount() const { return _parityCount; }
+
+    void Encode(const uint8_t* frame, size_t size, size_t fragmentSize) {
+        size_t chunks = (size + fragmentSize - 1) / fragmentSize;
+        _parityCount = _config.ParityCount(chunks);
+        if (_parityCount == 0)
+            return;
+        // Last data fragment is shorter; it is treated as padded with zeros.
+        _parity.assign(_parityCount * fragmentSize, 0);
+        for (size_t seq = 0; seq < chunks; seq++) {
+            size_t offset = seq * fragmentSize;
+            size_t chunkSize = std::min(fragmentSize, size - offset);
+            XorBlock(_parity.data() + _config.ParityOf(seq) * fragmentSize, frame + offset, chunkSize);
+        }
+    }
+
+private:
+    UdpFecConfig _config;
+    std::vector<uint8_t> _parity;
+    size_t _parityCount = 0;
+};
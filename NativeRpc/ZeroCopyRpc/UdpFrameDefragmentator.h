@@ -1,30 +1,92 @@
 #pragma once
 #include <memory>
-#include <unordered_map>
+#include <optional>
+#include <vector>
+#include <stdexcept>
 #include "CyclicBuffer.hpp"
 #include "UdpReplicationMessages.h"
-#include <bitset>
+#include "Crc32c.h"
+#include "UdpFec.h"
+#include <chrono>
 
-#include "FastBitSet.h"
+#include "FragmentBitmap.h"
+#include "PayloadCompression.h"
 
+// Reassembles frames from UDP fragments. Up to window frames may be in flight at once, so fragments of consecutive
+// frames can interleave. Frames are committed to the ring in frame id order: the frame that is next to be committed
+// is assembled directly in the ring (the ring allows only one open span), the others in staging buffers of a
+// preallocated slot pool and are copied when their turn comes. A frame that makes no progress for timeout, or a frame
+// that never showed up while later ones wait for timeout, is given up; so is the oldest frame when the window is full.
+// Compressed and delta encoded frames are always assembled in staging and restored into the ring when they are
+// committed. Frames that carry the time of their original publish keep it in their entry, stamped with the monotonic
+// clock of this host when committed.
 class UdpFrameDefragmentator {
+public:
+    static constexpr size_t DefaultWindow = 4;
+    static constexpr std::chrono::milliseconds DefaultTimeout{ 100 };
+
 private:
     struct FrameState {
-        CyclicBuffer::WriterScope scope;
-        
-        FastBitSet receivedChunks;
-        
-        uint64_t lastActivity;
-        uint16_t receivedCount;
-        uint16_t expectedChunks;
-
-        FrameState(CyclicBuffer::WriterScope&& s, size_t chunks)
-            : scope(std::move(s))
-            , receivedChunks(chunks)
-            , lastActivity(0)
-            , receivedCount(0)
-            , expectedChunks(chunks)
-        {
+        bool active = false;
+        uint64_t frameId = 0;
+        uint64_t type = 0;
+        uint8_t codec = 0;
+        uint8_t encoding = 0;
+        // System clock ns of the original publish, 0 when the frame has none.
+        uint64_t origin = 0;
+
+        // Open while the frame is assembled in the ring, otherwise data points to staging.
+        std::optional<CyclicBuffer::WriterScope> scope;
+        std::vector<uint8_t> staging;
+        uint8_t* data = nullptr;
+
+        FragmentBitmap<> receivedChunks;
+
+        // Steady clock ns.
+        uint64_t openedAt = 0;
+        uint64_t lastActivity = 0;
+        uint32_t expectedChunks = 0;
+        uint32_t nextSequence = 0;
+        size_t size = 0;
+        size_t fragmentSize = 0;
+
+        // Forward error correction, parity fragments are kept aside until the data they cover can be rebuilt.
+        UdpFecConfig fec;
+        std::vector<uint8_t> parity;
+        std::vector<bool> parityReceived;
+        std::vector<uint16_t> parityMissing; // data fragments not yet received, per parity fragment
+
+        // Selective retransmission, steady clock ns.
+        uint64_t nackedAt = 0;
+        uint8_t nacks = 0;
+        uint32_t receivedAtNack = 0;
+
+        void open(const UdpReplicationMessageHeader& header, size_t chunks, size_t fragment, UdpFecConfig fecConfig, uint64_t now) {
+            active = true;
+            frameId = header.FrameId;
+            type = header.Type;
+            codec = header.Codec;
+            encoding = header.Encoding;
+            origin = originOf(header);
+            data = nullptr;
+            receivedChunks.reset(chunks);
+            openedAt = now;
+            lastActivity = now;
+            expectedChunks = static_cast<uint32_t>(chunks);
+            nextSequence = 0;
+            size = header.Size;
+            fragmentSize = fragment;
+            fec = fecConfig;
+            nackedAt = now;
+            nacks = 0;
+            receivedAtNack = 0;
+
+            size_t parityCount = fec.ParityCount(chunks);
+            parity.resize(parityCount * fragmentSize);
+            parityReceived.assign(parityCount, false);
+            parityMissing.assign(parityCount, 0);
+            for (size_t seq = 0; parityCount != 0 && seq < chunks; seq++)
+                parityMissing[fec.ParityOf(seq)]++;
         }
 
         bool isComplete() const {
@@ -33,118 +95,492 @@ private:
     };
 
     CyclicBuffer& buffer_;
-    std::unique_ptr<FrameState> currentFrame_;
-    std::unique_ptr<FrameState> previousFrame_;
-    uint64_t currentFrameCreated_;
-    uint64_t previousFrameCreated_;
-    static constexpr uint16_t MAX_NEXT_FRAME_MESSAGES = 16;
-    uint16_t nextFrameMessages_;
+    std::vector<FrameState> frames_;
+    FrameState* ringFrame_;       // frame assembled in the ring, it is always the next one to commit
+    FrameState* lastFrame_;       // frame of the last fragment, placement is asked from it
+    uint64_t nextFrameId_;        // frames below were committed or given up
+    bool started_;
+    // Until the first commit, fragments of frames older than the first one seen may still arrive, so nextFrameId_ can
+    // move down and frames are assembled only in staging.
+    bool settled_;
     const size_t mtu_;
-    const size_t maxPayloadSize_; // MTU - header size
+    const size_t maxPayloadSize_; // MTU - header size, used when the sender does not put fragment size in the header.
+    const uint64_t timeout_;
+    PayloadDecompressor decompressor_;
+    DeltaDecoder delta_;
+    std::vector<uint8_t> decoded_;
+    uint64_t checksumErrors_ = 0;
+
+    size_t fragmentSize(const UdpReplicationMessageHeader& header) const {
+        return header.FragmentSize != 0 ? header.FragmentSize : maxPayloadSize_;
+    }
+
+    static uint64_t originOf(const UdpReplicationMessageHeader& header) {
+        return (header.Flags & UdpReplicationMessageHeader::HasTimestamp) != 0 ? header.Origin : 0;
+    }
+
+    CyclicBuffer::WriterScope writeScope(size_t size, uint64_t type, uint64_t origin) {
+        auto scope = buffer_.WriteScope(size, type);
+        // Messages are committed whole, the rest of the pool is left to readers.
+        scope.Span.Limit(size);
+        if (origin != 0)
+            scope.SetTimestamp(TimestampClock::Monotonic, origin);
+        return scope;
+    }
+
+    static uint64_t steadyNow() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
 
 public:
-    explicit UdpFrameDefragmentator(CyclicBuffer& buffer, size_t mtu)
+    explicit UdpFrameDefragmentator(CyclicBuffer& buffer, size_t mtu, size_t window = DefaultWindow,
+        std::chrono::milliseconds timeout = DefaultTimeout, CompressionPool* compressionPool = nullptr)
         : buffer_(buffer)
-        , currentFrameCreated_(0)
-        , previousFrameCreated_(0)
-        , nextFrameMessages_(0)
+        , frames_(window)
+        , ringFrame_(nullptr)
+        , lastFrame_(nullptr)
+        , nextFrameId_(0)
+        , started_(false)
+        , settled_(false)
         , mtu_(mtu)
         , maxPayloadSize_(mtu - sizeof(UdpReplicationMessageHeader))
+        , timeout_(std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count())
+        , decompressor_(compressionPool)
     {
+        if (window == 0)
+            throw std::invalid_argument("Reorder window must hold at least one frame.");
     }
 
-    bool ProcessFragment(const uint8_t* msgData, size_t msgSize) {
+    size_t ProcessFragment(const uint8_t* msgData, size_t msgSize) {
         UdpReplicationMessageHeader* header = (UdpReplicationMessageHeader*)msgData;
         uint8_t* dataPtr = (uint8_t*)msgData + sizeof(UdpReplicationMessageHeader);
         size_t dataSize = msgSize - sizeof(UdpReplicationMessageHeader);
         return ProcessFragment(*header, dataPtr, dataSize);
     }
 
-    bool ProcessFragment(const UdpReplicationMessageHeader& header, const uint8_t* data, size_t dataSize) {
-        // If header.Size equals dataSize, we have a complete message
-        if (header.Size == dataSize) {
-            auto scope = buffer_.WriteScope(header.Size, header.Type);
-            std::memcpy(scope.Span.Start, data, dataSize);
-            scope.Span.Commit(header.Size);
-            BOOST_LOG_TRIVIAL(debug) << "Received datagram: " << (dataSize+sizeof(UdpReplicationMessageHeader)) << "B, message-size: " << header.Size << " msg-type: " << header.Type;
-            return true;
+    // Returns the number of frames committed to the ring, every one is a message for the subscribers.
+    size_t ProcessFragment(const UdpReplicationMessageHeader& header, const uint8_t* data, size_t dataSize) {
+        if (header.Version != UdpReplicationMessageHeader::CurrentVersion) {
+            BOOST_LOG_TRIVIAL(warning) << "Unsupported replication fragment version " << static_cast<int>(header.Version) << ".";
+            return 0;
+        }
+        if (!started_ || (!settled_ && header.FrameId < nextFrameId_)) {
+            nextFrameId_ = header.FrameId;
+            started_ = true;
         }
+        if (header.FrameId < nextFrameId_)
+            return 0;
 
-        // Handle previous frame fragments
-        if (previousFrame_ && header.Created == previousFrameCreated_) {
-            bool frameCompleted = processFrameFragment(*previousFrame_, header, data, dataSize);
-            if (frameCompleted) {
-                previousFrame_.reset();
+        // Complete message in order, nothing to reassemble.
+        if (header.Size == dataSize && header.FrameId == nextFrameId_ && ringFrame_ == nullptr) {
+            size_t written = 1;
+            if (header.Codec != 0 || header.Encoding != 0) {
+                if (!copyChecked(header, nullptr, data, dataSize))
+                    return 0;
+                written = commitEncoded(header.Codec, header.Encoding, data, dataSize, header.Type, originOf(header)) ? 1 : 0;
+            }
+            else {
+                auto scope = writeScope(header.Size, header.Type, originOf(header));
+                if (!copyChecked(header, scope.Span.Start, data, dataSize))
+                    return 0;
+                scope.Span.Commit(header.Size);
             }
-            return frameCompleted;
+            settled_ = true;
+            BOOST_LOG_TRIVIAL(debug) << "Received datagram: " << (dataSize+sizeof(UdpReplicationMessageHeader)) << "B, message-size: " << header.Size << " msg-type: " << header.Type;
+            nextFrameId_++;
+            return written + commitReady(steadyNow());
         }
 
-        // Handle current frame fragments
-        if (currentFrame_ && header.Created == currentFrameCreated_) {
-            return processFrameFragment(*currentFrame_, header, data, dataSize);
+        const uint64_t now = steadyNow();
+        size_t committed = 0;
+        FrameState* frame = find(header.FrameId);
+        if (frame == nullptr) {
+            frame = openFrame(header, now, committed);
+            if (frame == nullptr)
+                return committed;
         }
+        lastFrame_ = frame;
+        processFrameFragment(*frame, header, data, dataSize, now);
+        return committed + commitReady(now);
+    }
 
-        // Handle new frame
-        if (header.Created > currentFrameCreated_) {
-            if (currentFrame_) {
-                previousFrame_ = std::move(currentFrame_);
-                previousFrameCreated_ = currentFrameCreated_;
-                nextFrameMessages_ = 1;
-            }
+    // Gives up frames that timed out and commits the ones that waited for them; to be called when no fragments arrive.
+    // Returns the number of frames committed.
+    size_t Expire() {
+        return started_ ? commitReady(steadyNow()) : 0;
+    }
+
+    // Fills nack with data fragments of a frame in flight that did not arrive, frames are visited in id order.
+    // Gaps before the highest received fragment are reported once the frame is interval old, the tail only when the
+    // stream is idle or a later frame has started. Frames with FEC are nacked only then, because parity comes last.
+    // A frame that makes no progress is nacked at most maxNacks times. now and interval are steady clock ns.
+    // Returns false when there is nothing to ask for; call again to collect NACKs of other frames.
+    bool CollectNack(UdpNackMessage& nack, uint64_t now, uint64_t interval, uint8_t maxNacks, bool idle) {
+        uint64_t newest = 0;
+        for (auto& frame : frames_)
+            if (frame.active && frame.frameId > newest)
+                newest = frame.frameId;
 
-            // Initialize new current frame
-            initializeNewFrame(header, data, dataSize);
+        FrameState* selected = nullptr;
+        size_t selectedEnd = 0;
+        for (auto& frame : frames_) {
+            if (!frame.active || (selected && selected->frameId < frame.frameId))
+                continue;
+            if (frame.receivedChunks.count() != frame.receivedAtNack)
+                frame.nacks = 0;
+            if (frame.nacks >= maxNacks || now < frame.nackedAt + interval)
+                continue;
+            bool finished = idle || frame.frameId < newest;
+            size_t end = finished ? frame.expectedChunks : (frame.parityMissing.empty() ? frame.nextSequence : 0);
+            if (frame.receivedChunks.findUnset(0) >= end)
+                continue;
+            selected = &frame;
+            selectedEnd = end;
+        }
+        if (selected == nullptr)
             return false;
+
+        auto& frame = *selected;
+        constexpr size_t bitsPerWord = 64;
+        size_t firstBlock = frame.receivedChunks.findUnset(0) / bitsPerWord;
+        size_t words = frame.receivedChunks.copyUnset(firstBlock, nack.Missing, UdpNackMessage::MaxWords);
+        size_t endBit = selectedEnd - firstBlock * bitsPerWord;
+        if (endBit < words * bitsPerWord) {
+            words = (endBit + bitsPerWord - 1) / bitsPerWord;
+            if (endBit % bitsPerWord != 0)
+                nack.Missing[words - 1] &= (uint64_t(1) << (endBit % bitsPerWord)) - 1;
+        }
+
+        nack.FrameId = frame.frameId;
+        nack.First = static_cast<uint32_t>(firstBlock * bitsPerWord);
+        nack.Words = static_cast<uint32_t>(words);
+        nack.Reserved = 0;
+        frame.nackedAt = now;
+        frame.nacks++;
+        frame.receivedAtNack = static_cast<uint32_t>(frame.receivedChunks.count());
+        return true;
+    }
+
+    // Frames of a compressed topic restored so far.
+    CompressionStats DecompressionStats() const {
+        return decompressor_.Stats();
+    }
+
+    // Fragments dropped because they did not match their checksum.
+    uint64_t ChecksumErrors() const {
+        return checksumErrors_;
+    }
+
+    // Frames of a delta encoded topic rebuilt so far, and deltas dropped because a frame before them was lost.
+    ::DeltaStats DeltaStats() const {
+        return delta_.Stats();
+    }
+
+    // Returns the place inside the frame of the last fragment where the payload of fragment (next expected + ahead)
+    // belongs, so that a receiver can scatter the datagram directly into the ring or the frame's staging buffer.
+    // Returns nullptr when there is no frame in progress or that fragment is already there. frameId, sequence and
+    // capacity describe the expected fragment.
+    uint8_t* Placement(size_t ahead, uint64_t& frameId, uint32_t& sequence, size_t& capacity) const {
+        if (!lastFrame_)
+            return nullptr;
+        auto& frame = *lastFrame_;
+        size_t seq = frame.nextSequence + ahead;
+        if (seq >= frame.expectedChunks || frame.receivedChunks.getBit(seq))
+            return nullptr;
+
+        const size_t offset = seq * frame.fragmentSize;
+        frameId = frame.frameId;
+        sequence = static_cast<uint32_t>(seq);
+        capacity = std::min(frame.fragmentSize, frame.size - offset);
+        return frame.data + offset;
+    }
+
+private:
+    FrameState* find(uint64_t frameId) {
+        for (auto& frame : frames_)
+            if (frame.active && frame.frameId == frameId)
+                return &frame;
+        return nullptr;
+    }
+
+    FrameState* oldest() {
+        FrameState* result = nullptr;
+        for (auto& frame : frames_)
+            if (frame.active && (result == nullptr || frame.frameId < result->frameId))
+                result = &frame;
+        return result;
+    }
+
+    FrameState* freeSlot() {
+        for (auto& frame : frames_)
+            if (!frame.active)
+                return &frame;
+        return nullptr;
+    }
+
+    void dropFrame(FrameState& frame, const char* reason) {
+        BOOST_LOG_TRIVIAL(debug) << "Incomplete frame " << frame.frameId << " dropped (" << reason << "), "
+            << frame.receivedChunks.count() << " of " << frame.expectedChunks << " fragments received.";
+        release(frame);
+    }
+
+    void release(FrameState& frame) {
+        frame.scope.reset();
+        frame.active = false;
+        if (ringFrame_ == &frame)
+            ringFrame_ = nullptr;
+        if (lastFrame_ == &frame)
+            lastFrame_ = nullptr;
+    }
+
+    FrameState* openFrame(const UdpReplicationMessageHeader& header, uint64_t now, size_t& committed) {
+        // Calculate number of chunks based on sender's fragment size
+        const size_t chunkSize = fragmentSize(header);
+        size_t numChunks = std::max<size_t>(1, (header.Size + chunkSize - 1) / chunkSize);
+        if (header.FragmentCount != 0 && header.FragmentCount != numChunks)
+            return nullptr;
+
+        FrameState* frame = freeSlot();
+        while (frame == nullptr) {
+            // Window is full; the oldest frame is given up, unless this one is even older.
+            FrameState* first = oldest();
+            if (header.FrameId < first->frameId)
+                return nullptr;
+            nextFrameId_ = first->frameId + 1;
+            dropFrame(*first, "reorder window is full");
+            committed += commitReady(now);
+            frame = freeSlot();
         }
 
-        if (currentFrame_ && header.Created > previousFrameCreated_) {
-            nextFrameMessages_++;
+        UdpFecConfig fec;
+        if (header.FecParity != 0 && header.FecParity <= header.FecData)
+            fec = UdpFecConfig(header.FecData, header.FecParity);
+        frame->open(header, numChunks, chunkSize, fec, now);
+        if (settled_ && header.FrameId == nextFrameId_ && ringFrame_ == nullptr && frame->codec == 0 && frame->encoding == 0)
+            assembleInRing(*frame, false);
+        else {
+            if (frame->staging.size() < header.Size)
+                frame->staging.resize(header.Size);
+            frame->data = frame->staging.data();
+        }
+        return frame;
+    }
+
+    // Moves the frame into the ring, with what was received so far when it was staged.
+    void assembleInRing(FrameState& frame, bool staged) {
+        frame.scope.emplace(writeScope(frame.size, frame.type, frame.origin));
+        if (staged)
+            std::memcpy(frame.scope->Span.Start, frame.data, frame.size);
+        frame.data = frame.scope->Span.Start;
+        ringFrame_ = &frame;
+    }
+
+    // Returns false when a compressed or delta encoded frame could not be restored and was dropped.
+    bool commit(FrameState& frame) {
+        bool written = true;
+        if (frame.codec != 0 || frame.encoding != 0)
+            written = commitEncoded(frame.codec, frame.encoding, frame.data, frame.size, frame.type, frame.origin);
+        else if (ringFrame_ != &frame) {
+            auto scope = writeScope(frame.size, frame.type, frame.origin);
+            std::memcpy(scope.Span.Start, frame.data, frame.size);
+            scope.Span.Commit(frame.size);
+        }
+        else
+            frame.scope->Span.Commit(frame.size);
+        nextFrameId_ = frame.frameId + 1;
+        settled_ = true;
+        release(frame);
+        return written;
+    }
 
-            if (nextFrameMessages_ > MAX_NEXT_FRAME_MESSAGES && previousFrame_) {
-                previousFrame_.reset();
+    // Decompresses, then rebuilds a delta encoded frame from the previous message of its type. A compressed raw frame
+    // is decompressed straight into the ring.
+    bool commitEncoded(uint8_t codec, uint8_t encoding, const uint8_t* data, size_t size, uint64_t type, uint64_t origin) {
+        const bool delta = encoding == static_cast<uint8_t>(PayloadEncoding::Delta);
+        if (encoding != 0 && !delta) {
+            BOOST_LOG_TRIVIAL(warning) << "Frame dropped, unknown payload encoding " << static_cast<int>(encoding) << ".";
+            return false;
+        }
+        if (codec != 0) {
+            size_t rawSize = PayloadDecompressor::RawSize(data, size);
+            if (rawSize == 0 || !IsCodecSupported(static_cast<CompressionCodec>(codec))) {
+                BOOST_LOG_TRIVIAL(warning) << "Compressed frame dropped, it is corrupt or codec " << static_cast<int>(codec)
+                    << " is not compiled in.";
+                return false;
+            }
+            std::optional<CyclicBuffer::WriterScope> scope;
+            uint8_t* dst;
+            if (delta) {
+                decoded_.resize(rawSize);
+                dst = decoded_.data();
+            }
+            else {
+                scope.emplace(writeScope(rawSize, type, origin));
+                dst = scope->Span.Start;
+            }
+            try {
+                decompressor_.Decompress(static_cast<CompressionCodec>(codec), data, size, dst, rawSize);
             }
+            catch (const std::exception& e) {
+                BOOST_LOG_TRIVIAL(warning) << "Compressed frame dropped: " << e.what();
+                return false;
+            }
+            if (!delta) {
+                scope->Span.Commit(rawSize);
+                return true;
+            }
+            data = decoded_.data();
+            size = rawSize;
         }
 
-        return false;
+        size_t rawSize = DeltaDecoder::RawSize(data, size);
+        if (rawSize == 0) {
+            BOOST_LOG_TRIVIAL(warning) << "Delta frame dropped, it is corrupt.";
+            return false;
+        }
+        auto scope = writeScope(rawSize, type, origin);
+        if (!delta_.Apply(data, size, type, scope.Span.Start))
+            return false;
+        scope.Span.Commit(rawSize);
+        return true;
     }
 
-private:
-    void initializeNewFrame(const UdpReplicationMessageHeader& header, const uint8_t* data, size_t dataSize) {
-        auto scope = buffer_.WriteScope(header.Size, header.Type);
+    // Commits complete frames in id order, gives up the ones that block them for too long.
+    size_t commitReady(uint64_t now) {
+        size_t committed = 0;
+        while (true) {
+            FrameState* next = find(nextFrameId_);
+            if (next != nullptr) {
+                if (next->isComplete()) {
+                    if (commit(*next))
+                        committed++;
+                    continue;
+                }
+                if (now - next->lastActivity >= timeout_) {
+                    nextFrameId_++;
+                    dropFrame(*next, "timed out");
+                    continue;
+                }
+                if (settled_ && ringFrame_ == nullptr && next->codec == 0 && next->encoding == 0)
+                    assembleInRing(*next, true);
+                break;
+            }
 
-        // Calculate number of chunks based on max payload size
-        size_t numChunks = (header.Size + maxPayloadSize_ - 1) / maxPayloadSize_;
-        currentFrame_ = std::make_unique<FrameState>(std::move(scope), numChunks);
-        currentFrameCreated_ = header.Created;
+            // Frame that is next has not arrived; it is given up when the ones after it wait too long.
+            FrameState* first = oldest();
+            if (first == nullptr || now - first->openedAt < timeout_)
+                break;
+            BOOST_LOG_TRIVIAL(debug) << "Frames " << nextFrameId_ << " to " << first->frameId - 1 << " were lost.";
+            nextFrameId_ = first->frameId;
+        }
+        return committed;
+    }
 
-        writeChunk(*currentFrame_, header, data, dataSize);
+    void processFrameFragment(FrameState& frame, const UdpReplicationMessageHeader& header,
+        const uint8_t* data, size_t dataSize, uint64_t now) {
+        if (header.Sequence >= frame.expectedChunks) {
+            if (!processParity(frame, header, data, dataSize))
+                return;
+        }
+        else if (!isValid(frame, header, dataSize) || frame.receivedChunks.getBit(header.Sequence)) {
+            return;
+        }
+        else if (!writeChunk(frame, header, data, dataSize))
+            return;
+        frame.lastActivity = now;
     }
 
-    bool processFrameFragment(FrameState& frame, const UdpReplicationMessageHeader& header,
+    bool processParity(FrameState& frame, const UdpReplicationMessageHeader& header,
         const uint8_t* data, size_t dataSize) {
-        if (frame.receivedChunks.getBit(header.Sequence)) {
+        size_t p = header.Sequence - frame.expectedChunks;
+        if (p >= frame.parityReceived.size() || dataSize != frame.fragmentSize)
             return false;
+        if (frame.parityReceived[p] || frame.parityMissing[p] == 0)
+            return false;
+
+        if (!copyChecked(header, frame.parity.data() + p * frame.fragmentSize, data, dataSize))
+            return false;
+        frame.parityReceived[p] = true;
+        recover(frame, header, p);
+        return true;
+    }
+
+    // When exactly one data fragment covered by parity p is missing, it is parity XOR all the others.
+    void recover(FrameState& frame, const UdpReplicationMessageHeader& header, size_t p) {
+        if (!frame.parityReceived[p] || frame.parityMissing[p] != 1)
+            return;
+
+        const size_t step = frame.fec.Parity;
+        const size_t end = frame.fec.GroupEnd(p, frame.expectedChunks);
+        size_t missing = end;
+        for (size_t seq = frame.fec.FirstCovered(p); seq < end; seq += step)
+            if (!frame.receivedChunks.getBit(seq)) {
+                missing = seq;
+                break;
+            }
+        if (missing == end)
+            return;
+
+        uint8_t* dst = frame.data + missing * frame.fragmentSize;
+        const size_t size = std::min(frame.fragmentSize, frame.size - missing * frame.fragmentSize);
+        std::memcpy(dst, frame.parity.data() + p * frame.fragmentSize, size);
+        for (size_t seq = frame.fec.FirstCovered(p); seq < end; seq += step) {
+            if (seq == missing)
+                continue;
+            const size_t offset = seq * frame.fragmentSize;
+            XorBlock(dst, frame.data + offset, std::min(size, frame.size - offset));
         }
 
-        writeChunk(frame, header, data, dataSize);
+        UdpReplicationMessageHeader recovered = header;
+        recovered.Sequence = static_cast<uint32_t>(missing);
+        recovered.Flags &= ~UdpReplicationMessageHeader::HasChecksum;
+        writeChunk(frame, recovered, dst, size);
+    }
+
+    // Fragment must fit exactly in its place, otherwise it would corrupt offsets of the frame.
+    static bool isValid(const FrameState& frame, const UdpReplicationMessageHeader& header, size_t dataSize) {
+        if (header.Sequence >= frame.expectedChunks)
+            return false;
+        const size_t offset = header.Sequence * frame.fragmentSize;
+        return dataSize == std::min(frame.fragmentSize, frame.size - offset);
+    }
 
-        if (frame.isComplete()) {
-            frame.scope.Span.Commit(header.Size);
-            this->currentFrame_.reset();
+    // Copies the payload to dst, unless it is there already or dst is nullptr, and checks the fragment against its
+    // checksum in the same pass. A fragment that does not match is dropped as if it was lost.
+    bool copyChecked(const UdpReplicationMessageHeader& header, uint8_t* dst, const uint8_t* data, size_t dataSize) {
+        const bool copy = dst != nullptr && dst != data;
+        if (!(header.Flags & UdpReplicationMessageHeader::HasChecksum)) {
+            if (copy)
+                std::memcpy(dst, data, dataSize);
             return true;
         }
-
+        const uint32_t seed = UdpHeaderChecksum(header);
+        const uint32_t checksum = copy ? Crc32cCopy(dst, data, dataSize, seed) : Crc32c(data, dataSize, seed);
+        if (checksum == header.Checksum)
+            return true;
+        checksumErrors_++;
+        BOOST_LOG_TRIVIAL(warning) << "Fragment " << header.Sequence << " of frame " << header.FrameId
+            << " dropped, its checksum does not match.";
         return false;
     }
 
-    void writeChunk(FrameState& frame, const UdpReplicationMessageHeader& header,
+    bool writeChunk(FrameState& frame, const UdpReplicationMessageHeader& header,
         const uint8_t* data, size_t dataSize) {
-        // Calculate offset based on MTU payload size
-        const size_t offset = header.Sequence * maxPayloadSize_;
-        std::memcpy(frame.scope.Span.Start + offset, data, dataSize);
+        // Calculate offset based on fragment size of the frame
+        const size_t offset = header.Sequence * frame.fragmentSize;
+        // Payload may have been received in place already (see Placement).
+        if (!copyChecked(header, frame.data + offset, data, dataSize))
+            return false;
 
         frame.receivedChunks.setBit(header.Sequence);
-        frame.receivedCount++;
-        frame.lastActivity = header.Created;
+        if (header.Sequence >= frame.nextSequence)
+            frame.nextSequence = header.Sequence + 1;
+
+        if (!frame.parityMissing.empty()) {
+            size_t p = frame.fec.ParityOf(header.Sequence);
+            frame.parityMissing[p]--;
+            recover(frame, header, p);
+        }
+        return true;
     }
 };
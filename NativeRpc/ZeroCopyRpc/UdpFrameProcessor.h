@@ -9,63 +9,304 @@
 #include <array>
 #include <boost/asio.hpp>
 #include "UdpReplicationMessages.h"
+#include "UdpFec.h"
+#include "Crc32c.h"
 #include <boost/asio/buffer.hpp>
 #include <algorithm>
 
+#if defined(__linux__)
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#endif
+
 
 using namespace boost;
 using namespace boost::asio;
 //constexpr size_t UDP_MTU = 9000; // Jumbo frame MTU size
 constexpr size_t HEADER_SIZE = sizeof(UdpReplicationMessageHeader);
+// Marks UdpFrameIterator whose datagram size is known only at runtime.
+constexpr size_t DynamicMtu = 0;
+// Largest UDP payload over IPv4.
+constexpr size_t MAX_UDP_DATAGRAM_SIZE = 65507;
+// IPv4 + UDP headers, link MTU minus this is the largest datagram that is not fragmented by IP.
+constexpr size_t IPV4_UDP_HEADERS_SIZE = 28;
 
 //template <class _Ty>
 //constexpr const _Ty& min_i(const _Ty& _Left, const _Ty& _Right) noexcept(noexcept(_Right < _Left)) {
 //    return _Right < _Left ? _Right : _Left;
 //}
 
+#if defined(__linux__)
+// Scatter/gather description of many datagrams, so that a whole frame can be pushed with a few sendmmsg calls.
+// Headers are copied into the batch (they differ by sequence), payload iovecs point directly into the ring.
+// When segmentation offload (UDP_SEGMENT) is used, one message carries several header+payload pairs and the kernel
+// cuts them into datagrams of gso-size bytes.
+struct UdpFrameBatch {
+    static constexpr size_t MaxMessages = 64;
+    static constexpr size_t MaxFragments = 1024;
+    // Kernel limit of segments in one GSO send (UDP_MAX_SEGMENTS).
+    static constexpr size_t MaxSegments = 64;
+    // One GSO send must fit in a single IP datagram.
+    static constexpr size_t MaxSegmentedSize = 65000;
+
+    mmsghdr Messages[MaxMessages];
+    iovec Vectors[MaxFragments * 2];
+    UdpReplicationMessageHeader Headers[MaxFragments];
+    alignas(cmsghdr) char Controls[MaxMessages][CMSG_SPACE(sizeof(uint16_t))];
+    size_t MessageCount = 0;
+    size_t FragmentCount = 0;
+    // Datagram bytes in the batch.
+    size_t Bytes = 0;
+
+    void Clear() {
+        MessageCount = 0;
+        FragmentCount = 0;
+        Bytes = 0;
+    }
+};
+
+// Receive side counterpart of UdpFrameBatch, used with recvmmsg. Every datagram is scattered into: its header,
+// the payload place (either directly inside the ring, when the fragment is expected, or a scratch slot) and an
+// overflow part in the scratch slot, that catches datagrams that turn out to be longer than the expected place.
+struct UdpReceiveBatch {
+    static constexpr size_t MaxMessages = 64;
+
+    struct Slot {
+        uint8_t* Placement;   // where the payload was asked to land, nullptr when received into scratch
+        size_t Capacity;      // bytes available at Placement
+        uint32_t TopicId;     // expected fragment when placed
+        uint64_t FrameId;
+        uint32_t Sequence;
+    };
+
+    mmsghdr Messages[MaxMessages];
+    iovec Vectors[MaxMessages][3];
+    UdpReplicationMessageHeader Headers[MaxMessages];
+    Slot Slots[MaxMessages];
+    sockaddr_storage Senders[MaxMessages];
+    const size_t DatagramSize;
+
+    explicit UdpReceiveBatch(size_t datagramSize)
+        : DatagramSize(datagramSize), _scratch(MaxMessages * datagramSize) {
+    }
+
+    uint8_t* Scratch(size_t i) { return _scratch.data() + i * DatagramSize; }
+
+    // Prepares slot i, placement may be nullptr.
+    void Prepare(size_t i, uint8_t* placement, size_t capacity, uint32_t topicId, uint64_t frameId, uint32_t sequence) {
+        Slots[i] = Slot{ placement, placement ? capacity : 0, topicId, frameId, sequence };
+        auto& v = Vectors[i];
+        v[0] = iovec{ &Headers[i], HEADER_SIZE };
+        if (placement) {
+            v[1] = iovec{ placement, capacity };
+            v[2] = iovec{ Scratch(i), DatagramSize - HEADER_SIZE };
+        }
+        else {
+            v[1] = iovec{ Scratch(i), DatagramSize - HEADER_SIZE };
+            v[2] = iovec{ nullptr, 0 };
+        }
+        Messages[i] = mmsghdr{};
+        Messages[i].msg_hdr.msg_name = &Senders[i];
+        Messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+        Messages[i].msg_hdr.msg_iov = v;
+        Messages[i].msg_hdr.msg_iovlen = placement ? 3 : 2;
+    }
+
+    // True when datagram i landed exactly where it was expected, so no copy is needed.
+    bool IsInPlace(size_t i) const {
+        auto& slot = Slots[i];
+        auto& header = Headers[i];
+        return slot.Placement != nullptr
+            && header.FrameId == slot.FrameId
+            && header.TopicId == slot.TopicId
+            && header.Sequence == slot.Sequence
+            && PayloadSize(i) == slot.Capacity;
+    }
+
+    size_t PayloadSize(size_t i) const { return Messages[i].msg_len - HEADER_SIZE; }
+
+    // Moves the payload of a misplaced datagram into its scratch slot and returns it. Must be done for all misplaced
+    // datagrams of a batch before any fragment is processed, because processing may overwrite the placement memory.
+    uint8_t* Stage(size_t i) {
+        auto& slot = Slots[i];
+        uint8_t* scratch = Scratch(i);
+        if (slot.Placement == nullptr)
+            return scratch;
+        size_t size = PayloadSize(i);
+        size_t placed = std::min(size, slot.Capacity);
+        std::memmove(scratch + placed, scratch, size - placed);
+        std::memcpy(scratch, slot.Placement, placed);
+        slot.Placement = nullptr;
+        return scratch;
+    }
+
+private:
+    std::vector<uint8_t> _scratch;
+};
+#endif
+
 // An iterator that is used when a udp frame needs be fragmented. Given we have buffer that contain the message (message-type), we need to create an
 // efficient iterator that would return all required frames. The UdpFrameIterator will work on typical MTU 1500 and jumbo MTU = 9KB.
-template<size_t UDP_MTU>
+// UDP_MTU is the datagram size (header + payload). With UDP_MTU = DynamicMtu the size is passed at runtime, which is how replicators use it.
+template<size_t UDP_MTU = DynamicMtu>
 class UdpFrameIterator {
 public:
-    const size_t PAYLOAD_SIZE = UDP_MTU - HEADER_SIZE;
+    static constexpr size_t PAYLOAD_SIZE = UDP_MTU == DynamicMtu ? 0 : UDP_MTU - HEADER_SIZE;
 
-    UdpFrameIterator(const uint8_t* buffer, size_t size, uint8_t type, uint64_t created)
+    UdpFrameIterator(const uint8_t* buffer, size_t size, uint64_t type, uint64_t frameId, size_t mtu = UDP_MTU, uint32_t topicId = 0)
         :
-		_header(created,size,0,type),
+		_header(frameId,size,0,type, static_cast<uint16_t>(PayloadSize(mtu)), topicId),
 		buffer_(buffer),
-		offset_(0) {
+		offset_(0),
+		parity_(nullptr),
+		paritySize_(0),
+		parityOffset_(0) {
+        if (mtu <= HEADER_SIZE || mtu > MAX_UDP_DATAGRAM_SIZE)
+            throw std::invalid_argument("MTU must be larger than the fragment header and fit in a UDP datagram.");
+    }
+
+    // Payload size of a full fragment.
+    size_t FragmentSize() const {
+        if constexpr (UDP_MTU == DynamicMtu)
+            return _header.FragmentSize;
+        else
+            return PAYLOAD_SIZE;
+    }
+    // Datagram size of a full fragment.
+    size_t Mtu() const { return FragmentSize() + HEADER_SIZE; }
+    // Bytes of all datagrams of the frame, parity included.
+    size_t WireSize() const {
+        size_t fragments = (_header.Size + FragmentSize() - 1) / FragmentSize() + paritySize_ / FragmentSize();
+        return _header.Size + paritySize_ + fragments * HEADER_SIZE;
+    }
+
+    // Marks the frame as compressed with codec, buffer then holds the compressed frame.
+    void SetCodec(uint8_t codec) {
+        _header.Codec = codec;
+    }
+    // Marks the frame as delta encoded (see PayloadEncoding).
+    void SetEncoding(uint8_t encoding) {
+        _header.Encoding = encoding;
+    }
+    // Every fragment carries the time of the original publish (see Entry::Origin); must be called before SetChecksums.
+    void SetOrigin(uint64_t origin) {
+        _header.Origin = origin;
+        _header.Flags |= UdpReplicationMessageHeader::HasTimestamp;
+        stamp();
+    }
+    // Every fragment carries its CRC32C (see UdpHeaderChecksum); must be called before iteration starts.
+    void SetChecksums(bool enabled) {
+        if (enabled)
+            _header.Flags |= UdpReplicationMessageHeader::HasChecksum;
+        else
+            _header.Flags &= ~UdpReplicationMessageHeader::HasChecksum;
+        stamp();
+    }
+
+    // Appends parity fragments computed by the encoder for this frame; must be called before iteration starts.
+    void Protect(const UdpFecEncoder& encoder) {
+        if (encoder.ParityCount() == 0)
+            return;
+        _header.FecData = encoder.Config().Data;
+        _header.FecParity = encoder.Config().Parity;
+        parity_ = encoder.Parity();
+        paritySize_ = encoder.ParityCount() * FragmentSize();
     }
 
     // Dereference operator to get the current fragment
     std::array<const_buffer, 2> operator*() const {
-        if (offset_ >= _header.Size)
+        if (!CanRead())
             throw std::out_of_range("Iterator out of range");
 
-        size_t chunkSize = std::min<size_t>(PAYLOAD_SIZE, _header.Size - offset_);
+        size_t chunkSize;
+        const uint8_t* chunk = current(chunkSize);
 
         // Return the header and payload as a pair of buffers
-        return {boost::asio::const_buffer(&_header, HEADER_SIZE), boost::asio::const_buffer(buffer_ + offset_, chunkSize) };
+        return {boost::asio::const_buffer(&_header, HEADER_SIZE), boost::asio::const_buffer(chunk, chunkSize) };
     }
 
     // Pre-increment operator
     UdpFrameIterator& operator++() {
-        if (offset_ >= _header.Size)
+        if (!CanRead())
             throw std::out_of_range("Iterator cannot be incremented past the end");
 
-        size_t chunkSize = std::min<size_t>(PAYLOAD_SIZE, _header.Size - offset_);
-        offset_ += chunkSize;
-        ++_header.Sequence;
+        size_t chunkSize;
+        current(chunkSize);
+        advance(chunkSize);
         return *this;
     }
     bool CanRead() const {
-        return offset_ < _header.Size;
+        return offset_ < _header.Size || parityOffset_ < paritySize_;
     }
-    
+#if defined(__linux__)
+    // Fills the batch with the next fragments and advances the iterator. When segments > 1, up to segments fragments
+    // are packed into one message with UDP_SEGMENT control data, so that the kernel does the segmentation.
+    // No message is started once the batch holds maxBytes, which bounds bursts when sending is paced.
+    // Returns the number of fragments added.
+    size_t Fill(UdpFrameBatch& batch, const sockaddr* target, socklen_t targetSize, size_t segments = 1, size_t maxBytes = SIZE_MAX) {
+        batch.Clear();
+        const size_t fragmentSize = FragmentSize();
+        const size_t mtu = fragmentSize + HEADER_SIZE;
+        if (segments > UdpFrameBatch::MaxSegments)
+            segments = UdpFrameBatch::MaxSegments;
+        if (segments > 1 && segments * mtu > UdpFrameBatch::MaxSegmentedSize)
+            segments = UdpFrameBatch::MaxSegmentedSize / mtu;
+        if (segments == 0)
+            segments = 1;
+
+        while (CanRead() && batch.MessageCount < UdpFrameBatch::MaxMessages
+            && batch.FragmentCount + segments <= UdpFrameBatch::MaxFragments && batch.Bytes < maxBytes) {
+            auto& msg = batch.Messages[batch.MessageCount];
+            iovec* vectors = &batch.Vectors[batch.FragmentCount * 2];
+            size_t count = 0;
+
+            while (count < segments && CanRead()) {
+                size_t chunkSize;
+                const uint8_t* chunk = current(chunkSize);
+                auto& header = batch.Headers[batch.FragmentCount + count];
+                header = _header;
+                vectors[count * 2] = iovec{ &header, HEADER_SIZE };
+                vectors[count * 2 + 1] = iovec{ const_cast<uint8_t*>(chunk), chunkSize };
+                advance(chunkSize);
+                batch.Bytes += HEADER_SIZE + chunkSize;
+                ++count;
+                // Short fragment must be the last segment; parity fragments that follow it start a new message.
+                if (chunkSize < fragmentSize)
+                    break;
+            }
+
+            msg = mmsghdr{};
+            msg.msg_hdr.msg_name = const_cast<sockaddr*>(target);
+            msg.msg_hdr.msg_namelen = targetSize;
+            msg.msg_hdr.msg_iov = vectors;
+            msg.msg_hdr.msg_iovlen = count * 2;
+            if (count > 1) {
+                // Only the last segment may be shorter than gso-size, which is exactly how the frame is cut.
+                auto* control = batch.Controls[batch.MessageCount];
+                msg.msg_hdr.msg_control = control;
+                msg.msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+                cmsghdr* cm = CMSG_FIRSTHDR(&msg.msg_hdr);
+                cm->cmsg_level = SOL_UDP;
+                cm->cmsg_type = UDP_SEGMENT;
+                cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t gsoSize = static_cast<uint16_t>(mtu);
+                std::memcpy(CMSG_DATA(cm), &gsoSize, sizeof(gsoSize));
+            }
+            batch.FragmentCount += count;
+            ++batch.MessageCount;
+        }
+        return batch.FragmentCount;
+    }
+#endif
 
     // Equality comparison
     bool operator==(const UdpFrameIterator& other) const {
-        return buffer_ == other.buffer_ && offset_ == other.offset_;
+        return buffer_ == other.buffer_ && offset_ == other.offset_ && parityOffset_ == other.parityOffset_;
     }
 
     // Inequality comparison
@@ -74,20 +315,55 @@ public:
     }
 
     // Begin iterator
-    static UdpFrameIterator Begin(const uint8_t* buffer, size_t size, uint8_t type, uint64_t created) {
-        return UdpFrameIterator(buffer, size, type, created);
+    static UdpFrameIterator Begin(const uint8_t* buffer, size_t size, uint64_t type, uint64_t frameId, size_t mtu = UDP_MTU, uint32_t topicId = 0) {
+        return UdpFrameIterator(buffer, size, type, frameId, mtu, topicId);
     }
 
     // End iterator
-    static UdpFrameIterator End(const uint8_t* buffer, size_t size, uint8_t type, uint64_t created) {
-        UdpFrameIterator it(buffer, size, type, created);
+    static UdpFrameIterator End(const uint8_t* buffer, size_t size, uint64_t type, uint64_t frameId, size_t mtu = UDP_MTU, uint32_t topicId = 0) {
+        UdpFrameIterator it(buffer, size, type, frameId, mtu, topicId);
         it.offset_ = size; // Mark as end
         return it;
     }
 
 private:
-    
+    // Data fragments come first, then parity fragments.
+    const uint8_t* current(size_t& chunkSize) const {
+        if (offset_ < _header.Size) {
+            chunkSize = std::min<size_t>(FragmentSize(), _header.Size - offset_);
+            return buffer_ + offset_;
+        }
+        chunkSize = FragmentSize();
+        return parity_ + parityOffset_;
+    }
+    void advance(size_t chunkSize) {
+        if (offset_ < _header.Size)
+            offset_ += chunkSize;
+        else
+            parityOffset_ += chunkSize;
+        ++_header.Sequence;
+        stamp();
+    }
+    // Puts the checksum of the current fragment into the header.
+    void stamp() {
+        if (!(_header.Flags & UdpReplicationMessageHeader::HasChecksum) || !CanRead())
+            return;
+        size_t chunkSize;
+        const uint8_t* chunk = current(chunkSize);
+        _header.Checksum = Crc32c(chunk, chunkSize, UdpHeaderChecksum(_header));
+    }
+
+    static size_t PayloadSize(size_t mtu) {
+        if constexpr (UDP_MTU == DynamicMtu)
+            return mtu > HEADER_SIZE ? mtu - HEADER_SIZE : 0;
+        else
+            return PAYLOAD_SIZE;
+    }
+
     UdpReplicationMessageHeader _header;
     const uint8_t* buffer_;
     size_t offset_;
+    const uint8_t* parity_;
+    size_t paritySize_;
+    size_t parityOffset_;
 };
\ No newline at end of file
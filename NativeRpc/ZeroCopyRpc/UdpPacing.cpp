@@ -0,0 +1,69 @@
+#include "UdpPacing.h"
+
+#include <stdexcept>
+#include <thread>
+
+UdpPacer::UdpPacer(UdpPacingConfig config)
+	: _config(config),
+	_nsPerByte(config.BytesPerSecond != 0 ? 1e9 / config.BytesPerSecond : 0),
+	_next(Clock::now())
+{
+	if (!config.Enabled())
+		throw std::invalid_argument("Pacing requires a rate or a frame budget.");
+	if (config.BurstBytes == 0)
+		throw std::invalid_argument("Pacing burst must be positive.");
+}
+
+void UdpPacer::BeginFrame(size_t bytes)
+{
+	if (_config.BytesPerSecond == 0 && bytes != 0)
+		_nsPerByte = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(_config.FrameBudget).count()) / bytes;
+	_frameStart = Clock::now();
+	_frameBytes = 0;
+	_frameDelay = std::chrono::nanoseconds(0);
+}
+
+void UdpPacer::Pace(size_t bytes)
+{
+	auto now = Clock::now();
+	auto credit = std::chrono::nanoseconds(static_cast<int64_t>(_config.BurstBytes * _nsPerByte));
+	if (_next < now - credit)
+		_next = now - credit;
+	if (_next > now) {
+		_frameDelay += _next - now;
+		WaitUntil(_next);
+	}
+	_next += std::chrono::nanoseconds(static_cast<int64_t>(bytes * _nsPerByte));
+	_frameBytes += bytes;
+}
+
+void UdpPacer::EndFrame()
+{
+	auto elapsed = std::chrono::duration<double>(Clock::now() - _frameStart).count();
+	std::lock_guard lock(_statsMutex);
+	_stats.Frames++;
+	_stats.Bytes += _frameBytes;
+	if (elapsed > 0)
+		_stats.AchievedBytesPerSecond = _frameBytes / elapsed;
+	_stats.QueueingDelay = _frameDelay;
+	if (_frameDelay > _stats.MaxQueueingDelay)
+		_stats.MaxQueueingDelay = _frameDelay;
+}
+
+UdpPacingStats UdpPacer::Stats() const
+{
+	std::lock_guard lock(_statsMutex);
+	return _stats;
+}
+
+void UdpPacer::WaitUntil(Clock::time_point target)
+{
+	// Sleep overshoots by tens of microseconds, the rest is spun.
+	constexpr auto spinThreshold = std::chrono::microseconds(200);
+	auto remaining = target - Clock::now();
+	if (remaining > spinThreshold)
+		std::this_thread::sleep_for(remaining - spinThreshold / 2);
+	remaining = target - Clock::now();
+	if (remaining > std::chrono::nanoseconds(0))
+		_spin.WaitFor(remaining);
+}
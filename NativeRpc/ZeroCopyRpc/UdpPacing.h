@@ -0,0 +1,63 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include "Export.h"
+#include "ThreadSpin.h"
+
+// Pacing of UDP replication, so that a large frame does not leave as one microburst that overflows switch and
+// receiver buffers. Fragments are sent either at a fixed rate, or every frame is spread over a time budget.
+struct UdpPacingConfig {
+    // Bytes per second on the wire, 0 disables.
+    size_t BytesPerSecond = 0;
+    // Time every frame is spread over when BytesPerSecond is 0, 0 disables.
+    std::chrono::microseconds FrameBudget{ 0 };
+    // Bytes that may leave back to back.
+    size_t BurstBytes = 64 * 1024;
+
+    bool Enabled() const { return BytesPerSecond != 0 || FrameBudget.count() != 0; }
+};
+
+struct UdpPacingStats {
+    uint64_t Frames = 0;
+    uint64_t Bytes = 0;
+    // Wire rate of the last frame, from its first to its last fragment.
+    double AchievedBytesPerSecond = 0;
+    // Time fragments of the last frame waited for the pacer, and the worst of all frames.
+    std::chrono::nanoseconds QueueingDelay{ 0 };
+    std::chrono::nanoseconds MaxQueueingDelay{ 0 };
+};
+
+// User space token bucket: idle time earns at most one burst, then bytes leave at the configured rate. Waits shorter
+// than a sleep are spun. Used by one sending thread, Stats can be read from any thread.
+class EXPORT UdpPacer {
+public:
+    explicit UdpPacer(UdpPacingConfig config);
+
+    const UdpPacingConfig& Config() const { return _config; }
+
+    // Starts a frame of bytes on the wire; with a frame budget it sets the rate for the frame.
+    void BeginFrame(size_t bytes);
+    // Blocks until bytes may be sent.
+    void Pace(size_t bytes);
+    void EndFrame();
+
+    UdpPacingStats Stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    void WaitUntil(Clock::time_point target);
+
+    const UdpPacingConfig _config;
+    double _nsPerByte;
+    Clock::time_point _next;
+    Clock::time_point _frameStart;
+    size_t _frameBytes = 0;
+    std::chrono::nanoseconds _frameDelay{ 0 };
+    ThreadSpin _spin;
+
+    mutable std::mutex _statsMutex;
+    UdpPacingStats _stats;
+};
@@ -1,13 +1,23 @@
 #include "UdpReplicationMessages.h"
 
+#include "Crc32c.h"
+
 UdpReplicationMessageHeader::UdpReplicationMessageHeader(): UdpReplicationMessageHeader(0,0,0,0)
 {  }
 
-UdpReplicationMessageHeader::UdpReplicationMessageHeader(uint32_t size, uint8_t type, uint16_t sequence): Created(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
-			std::chrono::system_clock::now().time_since_epoch())
-		.count())),
-	Size(size),
-	Sequence(sequence),
-	Type(type)
+uint32_t UdpTopicId(const std::string& topicName)
+{
+	uint32_t hash = 2166136261u;
+	for (unsigned char c : topicName) {
+		hash ^= c;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+uint32_t UdpHeaderChecksum(const UdpReplicationMessageHeader& header)
 {
+	UdpReplicationMessageHeader copy = header;
+	copy.Checksum = 0;
+	return Crc32c(&copy, sizeof(copy));
 }
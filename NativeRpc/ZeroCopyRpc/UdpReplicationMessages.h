@@ -1,24 +1,87 @@
-
 #pragma once
 #include <cstdint>
 
 #include "Export.h"
-#include <chrono> // For std::chrono
+#include <cstddef>
+#include <string>
 
+// Wire format of a UDP replication fragment. Version comes first and stays at offset 0 in every version, so that
+// a receiver can drop datagrams it does not understand. Remaining fields are ordered by size, without padding.
 struct EXPORT UdpReplicationMessageHeader {
-    uint64_t Created;
+    static constexpr uint8_t CurrentVersion = 3;
+    static constexpr uint8_t HasChecksum = 1;
+    static constexpr uint8_t HasTimestamp = 2;
+
+    uint8_t Version;
+    // Forward error correction: data fragments per group and parity fragments per group, 0 when the frame has none.
+    uint8_t FecData;
+    uint8_t FecParity;
+    // CompressionCodec of the frame, None when Size bytes are the message itself.
+    uint8_t Codec;
+    // Identifies the topic, so that one socket can carry several topics (see UdpTopicId).
+    uint32_t TopicId;
+    // Increases with every frame of a topic; fragments of one frame share it.
+    uint64_t FrameId;
+    uint64_t Type;
+    // System clock ns of the original publish, valid when Flags has HasTimestamp; the target keeps it in its entry.
+    uint64_t Origin;
     uint32_t Size;
-    uint16_t Sequence;
-    uint8_t Type;
+    // Index of the fragment within the frame; parity fragments continue after the last data fragment.
+    uint32_t Sequence;
+    // Number of data fragments of the frame, 0 when the sender does not put fragment size in the header.
+    uint32_t FragmentCount;
+    // CRC32C of the fragment (see UdpHeaderChecksum), valid when Flags has HasChecksum. A fragment that does not
+    // match it is dropped as if it was lost.
+    uint32_t Checksum;
+    uint32_t Reserved3;
+    // Payload size of every fragment but the last, chosen by the sender from its MTU. Receiver computes offsets from it.
+    uint16_t FragmentSize;
+    // PayloadEncoding of the frame, applied before the codec.
+    uint8_t Encoding;
+    uint8_t Flags;
 
     UdpReplicationMessageHeader();
 
-    UdpReplicationMessageHeader(uint64_t created, uint32_t size, uint16_t sequence, uint8_t type)
-	    : Created(created),
+    UdpReplicationMessageHeader(uint64_t frameId, uint32_t size, uint32_t sequence, uint64_t type, uint16_t fragmentSize = 0, uint32_t topicId = 0)
+	    : Version(CurrentVersion),
+	      FecData(0),
+	      FecParity(0),
+	      Codec(0),
+	      TopicId(topicId),
+	      FrameId(frameId),
+	      Type(type),
+	      Origin(0),
 	      Size(size),
 	      Sequence(sequence),
-	      Type(type)
+	      FragmentCount(fragmentSize != 0 ? (size + fragmentSize - 1) / fragmentSize : 0),
+	      Checksum(0),
+	      Reserved3(0),
+	      FragmentSize(fragmentSize),
+	      Encoding(0),
+	      Flags(0)
     {
     }
-    UdpReplicationMessageHeader(uint32_t size, uint8_t type, uint16_t sequence=0);
-};
\ No newline at end of file
+};
+static_assert(sizeof(UdpReplicationMessageHeader) == 56, "UDP fragment header layout changed.");
+
+// Sent back by a UDP target to ask for data fragments of frame FrameId of topic TopicId that did not arrive.
+// Bit i of Missing stands for sequence First + i; only Words words are sent.
+struct EXPORT UdpNackMessage {
+    static constexpr size_t MaxWords = 16;
+
+    uint64_t FrameId;
+    uint32_t TopicId;
+    uint32_t First;
+    uint32_t Words;
+    uint32_t Reserved;
+    uint64_t Missing[MaxWords];
+
+    size_t Size() const { return offsetof(UdpNackMessage, Missing) + Words * sizeof(uint64_t); }
+};
+
+// Topic id both ends derive from the topic name (FNV-1a), so no negotiation is needed.
+EXPORT uint32_t UdpTopicId(const std::string& topicName);
+
+// CRC32C of the header with Checksum taken as 0. The checksum of a fragment continues it over the payload, so a
+// damaged header is caught as well.
+EXPORT uint32_t UdpHeaderChecksum(const UdpReplicationMessageHeader& header);
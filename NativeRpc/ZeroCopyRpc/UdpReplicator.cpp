@@ -5,27 +5,164 @@
 #include "UdpFrameDefragmentator.h"
 #include "ZeroCopyRpcException.h"
 #include "UdpFrameProcessor.h"
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <bit>
 
 void UdpReplicationSource::ReplicateLoop(std::shared_ptr<TopicReplicator> replicator) {
+    auto reported = std::chrono::steady_clock::now();
+    auto compressionReported = reported;
     while (replicator->Running && _running) {
         CyclicBuffer::Accessor msg;
 
-        while (!replicator->Cursor->TryReadFor(msg, chrono::seconds(5)))
+        // Short waits, the destructor joins this thread.
+        while (!replicator->Cursor->TryReadFor(msg, chrono::milliseconds(200)))
             if (!replicator->Running || !_running)
                 return;
-        auto now = std::chrono::steady_clock::now();
-        auto duration = now.time_since_epoch();
-        UdpFrameIterator<1500> iterator(msg.Get(), msg.Size(), msg.Type(), duration.count());
+        auto frameId = replicator->NextFrameId++;
+        const uint8_t* data = msg.Get();
+        uint32_t size = msg.Size();
+        auto encoding = PayloadEncoding::Raw;
+        auto codec = CompressionCodec::None;
+        // Buffer that holds the frame when it is not the message in the ring.
+        std::vector<uint8_t>* wire = nullptr;
+        if (replicator->Delta) {
+            replicator->Delta->Encode(data, size, msg.Type(), replicator->Encoded);
+            encoding = PayloadEncoding::Delta;
+            wire = &replicator->Encoded;
+            data = wire->data();
+            size = static_cast<uint32_t>(wire->size());
+        }
+        if (replicator->Compressor) {
+            codec = replicator->Compressor->Compress(data, size, replicator->Compressed);
+            if (codec != CompressionCodec::None) {
+                wire = &replicator->Compressed;
+                data = wire->data();
+                size = static_cast<uint32_t>(wire->size());
+            }
+        }
+
+        UdpFrameIterator<> iterator(data, size, msg.Type(), frameId, _datagramSize, replicator->TopicId);
+        iterator.SetCodec(static_cast<uint8_t>(codec));
+        iterator.SetEncoding(static_cast<uint8_t>(encoding));
+        if (_fec.Enabled()) {
+            replicator->Fec.Encode(data, size, iterator.FragmentSize());
+            iterator.Protect(replicator->Fec);
+        }
+        const uint64_t origin = msg.HasTimestamp() ? msg.Origin() : 0;
+        if (msg.HasTimestamp()) {
+            iterator.SetOrigin(origin);
+            auto age = msg.Age();
+            std::lock_guard lock(replicator->LatencyMutex);
+            replicator->Latency.Record(age);
+        }
+        iterator.SetChecksums(_checksums);
+        if (_retransmit.Enabled()) {
+            std::lock_guard lock(replicator->WindowMutex);
+            auto& window = replicator->Window;
+            auto& frame = window.emplace_back();
+            frame.FrameId = frameId;
+            frame.Data = data;
+            frame.Size = size;
+            frame.Type = msg.Type();
+            frame.FragmentSize = static_cast<uint16_t>(iterator.FragmentSize());
+            frame.FecData = _fec.Data;
+            frame.FecParity = _fec.Parity;
+            frame.Buffer = msg.Buffer;
+            frame.Index = msg.Index;
+            frame.Codec = codec;
+            frame.Encoding = encoding;
+            frame.Origin = origin;
+            // Encoded bytes move with the frame, the buffer of the frame that leaves the window is reused.
+            if (wire != nullptr)
+                frame.Wire = std::move(*wire);
+            if (window.size() > _retransmit.Window) {
+                if (wire != nullptr)
+                    *wire = std::move(window.front().Wire);
+                window.pop_front();
+            }
+        }
 
-        while(iterator.CanRead())
+        SendFrame(*replicator, iterator);
 
+        if (replicator->Pacer && std::chrono::steady_clock::now() - reported > std::chrono::seconds(10)) {
+            reported = std::chrono::steady_clock::now();
+            auto stats = replicator->Pacer->Stats();
+            BOOST_LOG_TRIVIAL(info) << "Topic " << replicator->TopicName << " paced at " << stats.AchievedBytesPerSecond / (1024 * 1024)
+                << " MB/s, queueing delay " << std::chrono::duration_cast<std::chrono::microseconds>(stats.QueueingDelay).count()
+                << "us, max " << std::chrono::duration_cast<std::chrono::microseconds>(stats.MaxQueueingDelay).count() << "us.";
+        }
+        if ((replicator->Delta || replicator->Compressor) && std::chrono::steady_clock::now() - compressionReported > std::chrono::seconds(10)) {
+            compressionReported = std::chrono::steady_clock::now();
+            if (replicator->Delta) {
+                auto stats = replicator->Delta->Stats();
+                BOOST_LOG_TRIVIAL(info) << "Topic " << replicator->TopicName << " delta encoded to "
+                    << 100 * stats.EncodedBytes / std::max<uint64_t>(stats.RawBytes, 1) << "% of its size, "
+                    << stats.Keyframes << " of " << stats.Frames << " frames were keyframes.";
+            }
+            if (replicator->Compressor) {
+                auto stats = replicator->Compressor->Stats();
+                BOOST_LOG_TRIVIAL(info) << "Topic " << replicator->TopicName << " compressed " << stats.Ratio()
+                    << "x, codec CPU time " << std::chrono::duration_cast<std::chrono::milliseconds>(stats.CpuTime).count() << "ms.";
+            }
+        }
+    }
+}
+
+template<size_t UDP_MTU>
+void UdpReplicationSource::SendFrame(TopicReplicator& replicator, UdpFrameIterator<UDP_MTU>& iterator)
+{
+    auto* pacer = replicator.Pacer.get();
+    if (pacer)
+        pacer->BeginFrame(iterator.WireSize());
+#if defined(__linux__)
+    // Whole frame goes out in a handful of sendmmsg calls, header and payload iovecs point into the ring.
+    auto& batch = *replicator.Batch;
+    auto fd = _socket.native_handle();
+    auto target = replicator.TargetEndpoint.data();
+    auto targetSize = static_cast<socklen_t>(replicator.TargetEndpoint.size());
+
+    while (iterator.CanRead()) {
+        auto state = iterator;
+        bool gso = _segmentationOffload.load(std::memory_order_relaxed);
+        iterator.Fill(batch, target, targetSize, gso ? UdpFrameBatch::MaxSegments : 1, pacer ? pacer->Config().BurstBytes : SIZE_MAX);
+        if (pacer)
+            pacer->Pace(batch.Bytes);
+
+        size_t sent = 0;
+        while (sent < batch.MessageCount) {
+            int rc = ::sendmmsg(fd, batch.Messages + sent, static_cast<unsigned int>(batch.MessageCount - sent), 0);
+            if (rc >= 0) {
+                sent += rc;
+                continue;
+            }
+            if (errno == EINTR)
+                continue;
+            if (gso && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP)) {
+                // Kernel or NIC cannot segment; rewind past what went out and continue with one datagram per fragment.
+                BOOST_LOG_TRIVIAL(warning) << "UDP segmentation offload is not supported (" << std::strerror(errno) << "), falling back to sendmmsg.";
+                _segmentationOffload = false;
+                iterator = state;
+                for (size_t m = 0; m < sent; m++)
+                    for (size_t f = 0; f < batch.Messages[m].msg_hdr.msg_iovlen / 2; f++)
+                        ++iterator;
+                break;
+            }
+            BOOST_LOG_TRIVIAL(error) << "Failed to send UDP datagrams: " << std::strerror(errno);
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            return;
+        }
+    }
+#else
+    while (iterator.CanRead())
+    {
         try {
             auto buffers = *iterator;
-            // Create a scatter/gather array for sending both header and data in one datagram
-
-            // Send both parts as a single datagram
-            _socket.send_to(buffers, replicator->TargetEndpoint);
-            //BOOST_LOG_TRIVIAL(debug) << "Sent [" << replicator->TargetEndpoint.address().to_string() << ":" << replicator->TargetEndpoint.port() << "]: " << (buffers[0].size() + msg.Size()) << "B, message-size: " << msg.Size() << " msg-type: " << msg.Type();
+            if (pacer)
+                pacer->Pace(asio::buffer_size(buffers));
+            // Send both header and data parts as a single datagram
+            _socket.send_to(buffers, replicator.TargetEndpoint);
             ++iterator;
         }
         catch (const boost::system::system_error& e) {
@@ -33,16 +170,175 @@ void UdpReplicationSource::ReplicateLoop(std::shared_ptr<TopicReplicator> replic
             std::this_thread::sleep_for(std::chrono::milliseconds(100));
         }
     }
+#endif
+    if (pacer)
+        pacer->EndFrame();
+}
+
+static size_t DatagramSize(size_t mtu)
+{
+    if (mtu <= IPV4_UDP_HEADERS_SIZE + sizeof(UdpReplicationMessageHeader) || mtu - IPV4_UDP_HEADERS_SIZE > MAX_UDP_DATAGRAM_SIZE)
+        throw std::invalid_argument("MTU " + std::to_string(mtu) + " is out of range.");
+    return mtu - IPV4_UDP_HEADERS_SIZE;
+}
+
+void UdpReplicationSource::NackLoop()
+{
+    UdpNackMessage nack;
+#if defined(__linux__)
+    // Wake up periodically, so that the loop can observe _running.
+    auto fd = _socket.native_handle();
+    timeval timeout{ 0, 100000 };
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    while (_running) {
+        auto received = ::recv(fd, &nack, sizeof(nack), 0);
+        if (received < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && _running) {
+                BOOST_LOG_TRIVIAL(error) << "Failed to receive NACK: " << std::strerror(errno);
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            continue;
+        }
+        if (static_cast<size_t>(received) < offsetof(UdpNackMessage, Missing) || nack.Words > UdpNackMessage::MaxWords
+            || static_cast<size_t>(received) != nack.Size())
+            continue;
+        Retransmit(nack);
+    }
+#else
+    while (_running) {
+        try {
+            udp::endpoint sender;
+            size_t received = _socket.receive_from(asio::buffer(&nack, sizeof(nack)), sender);
+            if (received < offsetof(UdpNackMessage, Missing) || nack.Words > UdpNackMessage::MaxWords || received != nack.Size())
+                continue;
+            Retransmit(nack);
+        }
+        catch (const boost::system::system_error& e) {
+            if (!_running)
+                return;
+            BOOST_LOG_TRIVIAL(error) << "Failed to receive NACK: " << e.what();
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+#endif
+}
+
+void UdpReplicationSource::Retransmit(const UdpNackMessage& nack)
+{
+    std::lock_guard lock(_replicatorsMutex);
+    for (auto& replicator : _replicators) {
+        if (replicator->TopicId != nack.TopicId)
+            continue;
+        std::lock_guard windowLock(replicator->WindowMutex);
+        auto& window = replicator->Window;
+        auto frame = std::find_if(window.begin(), window.end(), [&nack](auto& f) { return f.FrameId == nack.FrameId; });
+        if (frame == window.end())
+            return;
+        if (frame->Wire.empty() && !frame->Buffer->IsLive(frame->Index)) {
+            BOOST_LOG_TRIVIAL(debug) << "Frame " << nack.FrameId << " was already overwritten in the ring, cannot retransmit.";
+            return;
+        }
+
+        const size_t chunks = (frame->Size + frame->FragmentSize - 1) / frame->FragmentSize;
+        // The publisher may reuse the entry of a frame that is sent from the ring at any time, so every fragment is
+        // copied out first and sent only when the entry was still live after the copy.
+        const bool inRing = frame->Wire.empty();
+        std::vector<uint8_t> fragment(inRing ? frame->FragmentSize : 0);
+        for (size_t w = 0; w < nack.Words; w++) {
+            for (uint64_t bits = nack.Missing[w]; bits != 0; bits &= bits - 1) {
+                size_t seq = nack.First + w * 64 + std::countr_zero(bits);
+                if (seq >= chunks)
+                    return;
+                size_t offset = seq * frame->FragmentSize;
+                size_t size = std::min<size_t>(frame->FragmentSize, frame->Size - offset);
+                if (!_rateLimiter.TryConsume(size + HEADER_SIZE)) {
+                    BOOST_LOG_TRIVIAL(warning) << "Retransmission rate limit reached.";
+                    return;
+                }
+
+                const uint8_t* payload = frame->Data + offset;
+                if (inRing) {
+                    std::memcpy(fragment.data(), payload, size);
+                    if (!frame->Buffer->IsLive(frame->Index)) {
+                        BOOST_LOG_TRIVIAL(debug) << "Frame " << nack.FrameId << " was overwritten in the ring while it was retransmitted.";
+                        return;
+                    }
+                    payload = fragment.data();
+                }
+
+                UdpReplicationMessageHeader header(frame->FrameId, frame->Size, static_cast<uint32_t>(seq), frame->Type, frame->FragmentSize, replicator->TopicId);
+                header.FecData = frame->FecData;
+                header.FecParity = frame->FecParity;
+                header.Codec = static_cast<uint8_t>(frame->Codec);
+                header.Encoding = static_cast<uint8_t>(frame->Encoding);
+                if (frame->Origin != 0) {
+                    header.Origin = frame->Origin;
+                    header.Flags |= UdpReplicationMessageHeader::HasTimestamp;
+                }
+                if (_checksums) {
+                    header.Flags |= UdpReplicationMessageHeader::HasChecksum;
+                    header.Checksum = Crc32c(payload, size, UdpHeaderChecksum(header));
+                }
+                std::array<const_buffer, 2> buffers{ asio::buffer(&header, HEADER_SIZE), asio::buffer(payload, size) };
+                boost::system::error_code ec;
+                _socket.send_to(buffers, replicator->TargetEndpoint, 0, ec);
+                if (ec) {
+                    BOOST_LOG_TRIVIAL(error) << "Failed to retransmit UDP datagram: " << ec.message();
+                    return;
+                }
+            }
+        }
+        return;
+    }
 }
 
 UdpReplicationSource::UdpReplicationSource(asio::io_context& io,
-    const std::string& channelName
+    const std::string& channelName,
+    bool segmentationOffload,
+    size_t mtu,
+    UdpFecConfig fec,
+    UdpRetransmitConfig retransmit,
+    const UdpMulticastConfig& multicast,
+    UdpPacingConfig pacing,
+    CompressionConfig compression,
+    bool checksums
    )
     : _io(io)
     , _socket(io, udp::endpoint(udp::v4(), 0))  // Bind to any port
-    , _shmClient(channelName) {
+    , _shmClient(channelName)
+    , _segmentationOffload(segmentationOffload)
+    , _datagramSize(DatagramSize(mtu))
+    , _fec(fec)
+    , _retransmit(retransmit)
+    , _pacing(pacing)
+    , _rateLimiter(retransmit.MaxBytesPerSecond)
+    , _compression(compression)
+    , _compressionPool(compression.Threads)
+    , _checksums(checksums) {
+
+    if (!IsCodecSupported(compression.Codec))
+        throw std::invalid_argument(std::string("Compression codec ") + CodecName(compression.Codec) + " is not compiled in.");
+
+    _socket.set_option(ip::multicast::hops(multicast.Ttl));
+    _socket.set_option(ip::multicast::enable_loopback(multicast.Loopback));
+    if (!multicast.Interface.empty())
+        _socket.set_option(ip::multicast::outbound_interface(ip::make_address_v4(multicast.Interface)));
+
+#if defined(__linux__) && defined(SO_MAX_PACING_RATE)
+    // Kernel paces within a burst too, but only with the fq qdisc; user space pacing applies either way.
+    if (_pacing.BytesPerSecond != 0) {
+        uint64_t rate = _pacing.BytesPerSecond;
+        if (::setsockopt(_socket.native_handle(), SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof(rate)) != 0) {
+            uint32_t rate32 = static_cast<uint32_t>(std::min<uint64_t>(rate, UINT32_MAX));
+            if (::setsockopt(_socket.native_handle(), SOL_SOCKET, SO_MAX_PACING_RATE, &rate32, sizeof(rate32)) != 0)
+                BOOST_LOG_TRIVIAL(debug) << "SO_MAX_PACING_RATE is not supported: " << std::strerror(errno);
+        }
+    }
+#endif
 
     _shmClient.Connect();
+    if (_retransmit.Enabled())
+        _nackThread = std::thread([this]() { NackLoop(); });
 }
 udp::endpoint ResolveUdpEndpoint(const std::string& host, uint16_t port, boost::asio::io_context& io_context) {
     // Create a resolver
@@ -60,8 +356,26 @@ void UdpReplicationSource::ReplicateTopic(const std::string& topicName, const st
     uint16_t targetPort) {
     auto replicator = std::make_shared<TopicReplicator>();
     replicator->TopicName = topicName;
+    replicator->TopicId = UdpTopicId(topicName);
+    replicator->NextFrameId = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
     replicator->Cursor = _shmClient.Subscribe(topicName);
     replicator->TargetEndpoint = ResolveUdpEndpoint(targetHost, targetPort, _io);
+    replicator->Fec = UdpFecEncoder(_fec);
+    if (_pacing.Enabled())
+        replicator->Pacer = std::make_unique<UdpPacer>(_pacing);
+    {
+        std::lock_guard lock(_replicatorsMutex);
+        auto it = _topicCompression.find(topicName);
+        auto& compression = it != _topicCompression.end() ? it->second : _compression;
+        if (compression.Enabled())
+            replicator->Compressor = std::make_unique<PayloadCompressor>(compression, &_compressionPool);
+        if (compression.Delta.Enabled)
+            replicator->Delta = std::make_unique<DeltaEncoder>(compression.Delta);
+    }
+#if defined(__linux__)
+    replicator->Batch = std::make_unique<UdpFrameBatch>();
+#endif
    
     try 
     {
@@ -73,7 +387,6 @@ void UdpReplicationSource::ReplicateTopic(const std::string& topicName, const st
         replicator->ReplicationThread = std::thread([this, replicator]() {
             ReplicateLoop(replicator);
             });
-        replicator->ReplicationThread.detach();
     }
     catch (const boost::system::system_error& e) {
         BOOST_LOG_TRIVIAL(error) << "Failed to send topic subscription: " << e.what();
@@ -81,79 +394,299 @@ void UdpReplicationSource::ReplicateTopic(const std::string& topicName, const st
     }
 }
 
-void UdpReplicationTarget::ReplicateLoop(std::shared_ptr<TopicReplicator> replicator) {
-    auto topic = _shmServer->CreateTopic(replicator->TopicName);
-    
-    UdpFrameDefragmentator defragmentator(*topic->GetBuffer(), 1500);
-    std::vector<byte> buffer(topic->MaxMessageSize());
-    while (replicator->Running && _running) {
-        try {
-			udp::endpoint sender_endpoint;
-			
-			size_t bytesReceived = _socket.receive_from(asio::buffer(buffer), sender_endpoint);
-			auto ret = defragmentator.ProcessFragment(buffer.data(), bytesReceived);
+UdpPacingStats UdpReplicationSource::PacingStats(const std::string& topicName)
+{
+    std::lock_guard lock(_replicatorsMutex);
+    for (auto& replicator : _replicators)
+        if (replicator->TopicName == topicName && replicator->Pacer)
+            return replicator->Pacer->Stats();
+    return {};
+}
 
-			if (bytesReceived < sizeof(UdpReplicationMessageHeader))
-				throw ZeroCopyRpcException("Replication message incomplete.");
+void UdpReplicationSource::SetCompression(const std::string& topicName, CompressionConfig compression)
+{
+    if (!IsCodecSupported(compression.Codec))
+        throw std::invalid_argument(std::string("Compression codec ") + CodecName(compression.Codec) + " is not compiled in.");
+    std::lock_guard lock(_replicatorsMutex);
+    _topicCompression[topicName] = compression;
+}
 
-			if (ret)
-				topic->NotifyAll();
+CompressionStats UdpReplicationSource::TopicCompressionStats(const std::string& topicName)
+{
+    std::lock_guard lock(_replicatorsMutex);
+    for (auto& replicator : _replicators)
+        if (replicator->TopicName == topicName && replicator->Compressor)
+            return replicator->Compressor->Stats();
+    return {};
+}
 
+DeltaStats UdpReplicationSource::TopicDeltaStats(const std::string& topicName)
+{
+    std::lock_guard lock(_replicatorsMutex);
+    for (auto& replicator : _replicators)
+        if (replicator->TopicName == topicName && replicator->Delta)
+            return replicator->Delta->Stats();
+    return {};
+}
 
-			
-		}
-		catch (const boost::system::system_error& e) {
-			BOOST_LOG_TRIVIAL(error) << "UDP receive error: " << e.what();
-			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+LatencyHistogram UdpReplicationSource::TopicLatency(const std::string& topicName)
+{
+    std::lock_guard lock(_replicatorsMutex);
+    for (auto& replicator : _replicators) {
+        if (replicator->TopicName == topicName) {
+            std::lock_guard latencyLock(replicator->LatencyMutex);
+            return replicator->Latency;
+        }
+    }
+    return {};
+}
+
+UdpReplicationTarget::TopicReplicator* UdpReplicationTarget::Find(uint32_t topicId, TopicReplicator* last)
+{
+    if (last && last->TopicId == topicId)
+        return last;
+    auto it = _replicators.find(topicId);
+    if (it == _replicators.end()) {
+        BOOST_LOG_TRIVIAL(debug) << "Fragment of unknown topic " << topicId << " dropped.";
+        return nullptr;
+    }
+    return it->second.get();
+}
+
+void UdpReplicationTarget::ReceiveLoop()
+{
+#if defined(__linux__)
+    // Pulls many datagrams per syscall. Fragments that are expected next are scattered by the kernel directly
+    // into the open frame's span, the others land in scratch slots and are copied. Placement is asked from the topic
+    // of the last fragment, as consecutive datagrams mostly belong to the same frame.
+    auto batch = std::make_unique<UdpReceiveBatch>(_datagramSize);
+    auto fd = _socket.native_handle();
+    // Wake up periodically, so that the loop can observe _running, give up lost frames and ask for the tail of a frame.
+    auto wakeUp = std::chrono::duration_cast<std::chrono::microseconds>(_nack.Enabled ? _nack.Interval : UdpFrameDefragmentator::DefaultTimeout);
+    timeval timeout{ static_cast<time_t>(wakeUp.count() / 1000000), static_cast<suseconds_t>(wakeUp.count() % 1000000) };
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    uint8_t* payloads[UdpReceiveBatch::MaxMessages];
+    TopicReplicator* last = nullptr;
+
+    while (_running) {
+        for (size_t i = 0; i < UdpReceiveBatch::MaxMessages; i++) {
+            uint64_t frameId = 0;
+            uint32_t sequence = 0;
+            size_t capacity = 0;
+            auto placement = last ? last->Defragmentator->Placement(i, frameId, sequence, capacity) : nullptr;
+            batch->Prepare(i, placement, capacity, last ? last->TopicId : 0, frameId, sequence);
+        }
+
+        int count = ::recvmmsg(fd, batch->Messages, UdpReceiveBatch::MaxMessages, MSG_WAITFORONE, nullptr);
+        if (count < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                std::lock_guard lock(_replicatorsMutex);
+                for (auto& [id, replicator] : _replicators) {
+                    for (size_t committed = replicator->Defragmentator->Expire(); committed > 0; committed--)
+                        replicator->Topic->NotifyAll();
+                    SendNacks(*replicator, true);
+                }
+                continue;
+            }
+            if (errno == EINTR)
+                continue;
+            if (!_running)
+                return;
+            BOOST_LOG_TRIVIAL(error) << "UDP receive error: " << std::strerror(errno);
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+
+        // Misplaced payloads need to be moved out, before any fragment is written into the ring.
+        for (int i = 0; i < count; i++) {
+            auto& msg = batch->Messages[i];
+            if (msg.msg_len < sizeof(UdpReplicationMessageHeader) || (msg.msg_hdr.msg_flags & MSG_TRUNC)) {
+                BOOST_LOG_TRIVIAL(warning) << "Replication message incomplete, " << msg.msg_len << "B received.";
+                payloads[i] = nullptr;
+            }
+            else
+                payloads[i] = batch->IsInPlace(i) ? batch->Slots[i].Placement : batch->Stage(i);
         }
+
+        std::lock_guard lock(_replicatorsMutex);
+        for (int i = 0; i < count; i++) {
+            if (payloads[i] == nullptr)
+                continue;
+            auto* replicator = Find(batch->Headers[i].TopicId, last);
+            if (replicator == nullptr)
+                continue;
+            last = replicator;
+            if (_nack.Enabled) {
+                auto& sender = batch->Messages[i].msg_hdr;
+                std::memcpy(replicator->Source.data(), sender.msg_name, sender.msg_namelen);
+                replicator->Source.resize(sender.msg_namelen);
+            }
+            // Every committed frame is one message for the subscribers.
+            for (size_t committed = replicator->Defragmentator->ProcessFragment(batch->Headers[i], payloads[i], batch->PayloadSize(i));
+                committed > 0; committed--)
+                replicator->Topic->NotifyAll();
+        }
+
+        if (_nack.Enabled)
+            for (auto& [id, replicator] : _replicators)
+                SendNacks(*replicator, false);
     }
+#else
+    std::vector<uint8_t> buffer(_datagramSize);
+    TopicReplicator* last = nullptr;
+    while (_running) {
+        try {
+            udp::endpoint sender_endpoint;
+
+            size_t bytesReceived = _socket.receive_from(asio::buffer(buffer), sender_endpoint);
+            if (bytesReceived < sizeof(UdpReplicationMessageHeader))
+                throw ZeroCopyRpcException("Replication message incomplete.");
+
+            std::lock_guard lock(_replicatorsMutex);
+            auto* header = reinterpret_cast<const UdpReplicationMessageHeader*>(buffer.data());
+            auto* replicator = Find(header->TopicId, last);
+            if (replicator == nullptr)
+                continue;
+            last = replicator;
+            replicator->Source = sender_endpoint;
+            for (size_t committed = replicator->Defragmentator->ProcessFragment(buffer.data(), bytesReceived); committed > 0; committed--)
+                replicator->Topic->NotifyAll();
+            // Blocking receive does not time out here, so the tail of a frame is not asked for.
+            SendNacks(*replicator, false);
+        }
+        catch (const boost::system::system_error& e) {
+            if (!_running)
+                return;
+            BOOST_LOG_TRIVIAL(error) << "UDP receive error: " << e.what();
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+#endif
+}
+
+void UdpReplicationTarget::SendNacks(TopicReplicator& replicator, bool idle)
+{
+    if (!_nack.Enabled || replicator.Source.port() == 0)
+        return;
+    auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    auto interval = std::chrono::duration_cast<std::chrono::nanoseconds>(_nack.Interval).count();
+    UdpNackMessage nack;
+    // One NACK per frame in flight that misses fragments.
+    while (replicator.Defragmentator->CollectNack(nack, now, interval, _nack.MaxNacks, idle)) {
+        nack.TopicId = replicator.TopicId;
+        boost::system::error_code ec;
+        _socket.send_to(asio::buffer(&nack, nack.Size()), replicator.Source, 0, ec);
+        if (ec) {
+            BOOST_LOG_TRIVIAL(warning) << "Failed to send NACK: " << ec.message();
+            return;
+        }
+    }
+}
+
+void UdpReplicationTarget::ConfigureReceiveBuffer(size_t maxMessageSize)
+{
+    // Socket should be able to hold a few of the largest frames, so that a burst is not dropped by the kernel.
+    constexpr size_t maxReceiveBuffer = 64 * 1024 * 1024;
+    int requested = static_cast<int>(std::min(maxMessageSize * 4, maxReceiveBuffer));
+
+    socket_base::receive_buffer_size current;
+    _socket.get_option(current);
+    if (current.value() >= requested)
+        return;
+
+    boost::system::error_code ec;
+    _socket.set_option(socket_base::receive_buffer_size(requested), ec);
+    _socket.get_option(current);
+    if (ec || current.value() < requested)
+        BOOST_LOG_TRIVIAL(warning) << "UDP receive buffer is " << current.value() << "B, requested " << requested
+            << "B. Consider raising net.core.rmem_max.";
+    else
+        BOOST_LOG_TRIVIAL(info) << "UDP receive buffer set to " << current.value() << "B.";
 }
 
 UdpReplicationTarget::UdpReplicationTarget(asio::io_context& io,
     std::shared_ptr<SharedMemoryServer> shmServer,
-    std::string &host, uint16_t port)
+    std::string &host, uint16_t port, size_t mtu, UdpNackConfig nack, const UdpMulticastConfig& multicast)
     : _io(io)
-    , _socket(io, ResolveUdpEndpoint(host, port,io))
-    , _shmServer(shmServer) {
+    , _socket(io)
+    , _shmServer(shmServer)
+    , _datagramSize(DatagramSize(mtu))
+    , _nack(nack) {
+    auto endpoint = ResolveUdpEndpoint(host, port, io);
+    _socket.open(endpoint.protocol());
+    if (!endpoint.address().is_multicast()) {
+        _socket.bind(endpoint);
+        return;
+    }
+
+    // Several targets on one host may listen to the same group.
+    _socket.set_option(socket_base::reuse_address(true));
+    _socket.bind(udp::endpoint(endpoint.protocol(), port));
+    auto group = endpoint.address().to_v4();
+    if (multicast.Interface.empty())
+        _socket.set_option(ip::multicast::join_group(group));
+    else
+        _socket.set_option(ip::multicast::join_group(group, ip::make_address_v4(multicast.Interface)));
+    BOOST_LOG_TRIVIAL(info) << "Joined multicast group " << group.to_string() << ":" << port << ".";
 }
 
 void UdpReplicationTarget::ReplicateTopic(const std::string& topicName) {
     auto replicator = std::make_shared<TopicReplicator>();
     replicator->TopicName = topicName;
+    replicator->TopicId = UdpTopicId(topicName);
+    replicator->Topic = _shmServer->CreateTopic(topicName);
+    replicator->Defragmentator = std::make_unique<UdpFrameDefragmentator>(*replicator->Topic->GetBuffer(), _datagramSize,
+        UdpFrameDefragmentator::DefaultWindow, UdpFrameDefragmentator::DefaultTimeout, &_compressionPool);
+    ConfigureReceiveBuffer(replicator->Topic->MaxMessageSize());
 
-    {
-        std::lock_guard lock(_replicatorsMutex);
-        _replicators.push_back(replicator);
-    }
-
-    replicator->ReplicationThread = std::thread([this, replicator]() {
-        ReplicateLoop(replicator);
-        });
-    replicator->ReplicationThread.detach();
+    std::lock_guard lock(_replicatorsMutex);
+    auto [it, added] = _replicators.emplace(replicator->TopicId, replicator);
+    if (!added)
+        throw std::invalid_argument("Topic " + topicName + " has the same UDP topic id as " + it->second->TopicName + ".");
+    if (!_receiveThread.joinable())
+        _receiveThread = std::thread([this]() { ReceiveLoop(); });
 }
 
 UdpReplicationTarget::~UdpReplicationTarget() {
     _running = false;
 
-    {
-        std::lock_guard lock(_replicatorsMutex);
-        for (auto& replicator : _replicators) {
-            replicator->Running = false;
-        }
-    }
-
+#if defined(__linux__)
+    // Receive times out, so the thread can finish before the socket is closed.
+    if (_receiveThread.joinable())
+        _receiveThread.join();
+#endif
     boost::system::error_code ec;
     _socket.close(ec);
+    if (_receiveThread.joinable())
+        _receiveThread.join();
 }
 
 UdpReplicationSource::~UdpReplicationSource() {
     _running = false;
 
-    std::lock_guard lock(_replicatorsMutex);
-    for (auto& replicator : _replicators) {
-        replicator->Running = false;
+    std::vector<std::shared_ptr<TopicReplicator>> replicators;
+    {
+        std::lock_guard lock(_replicatorsMutex);
+        for (auto& replicator : _replicators) {
+            replicator->Running = false;
+        }
+        replicators = _replicators;
     }
+    // Their cursors belong to _shmClient, they finish before it goes.
+    for (auto& replicator : replicators)
+        if (replicator->ReplicationThread.joinable())
+            replicator->ReplicationThread.join();
 
+#if defined(__linux__)
+    // NACK receive times out, so the thread can finish before the socket is closed.
+    if (_nackThread.joinable())
+        _nackThread.join();
+#endif
     boost::system::error_code ec;
     _socket.close(ec);
+#if !defined(__linux__)
+    // Closing the socket ends the blocking receive.
+    if (_nackThread.joinable())
+        _nackThread.join();
+#endif
 }
\ No newline at end of file
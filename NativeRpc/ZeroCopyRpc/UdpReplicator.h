@@ -6,20 +6,74 @@
 #include <boost/asio.hpp>
 #include "Export.h"
 #include "UdpReplicationMessages.h"
+#include "UdpFrameProcessor.h"
+#include "UdpRetransmission.h"
+#include "UdpPacing.h"
+#include "PayloadCompression.h"
+#include <deque>
+#include <unordered_map>
 
 using boost::asio::ip::udp;
 using namespace boost;
 using namespace boost::asio;
 
 
+class UdpFrameDefragmentator;
+
+// Used when the source's target or the target's listen host is an IPv4 multicast group, so that one transmit feeds
+// every subscribed host.
+struct UdpMulticastConfig {
+    // Address of the local interface that sends or joins the group, empty for the default one.
+    std::string Interface;
+    // Hops the datagrams may take, 1 keeps them on the local network.
+    int Ttl = 1;
+    // Whether datagrams are also delivered to group members on the sending host.
+    bool Loopback = true;
+};
+
 class EXPORT UdpReplicationSource {
 private:
     struct TopicReplicator {
         std::string TopicName;
+        uint32_t TopicId;
+        // Seeded from the wall clock, so that frame ids keep increasing when the source restarts.
+        uint64_t NextFrameId;
         std::unique_ptr<ISubscriptionCursor> Cursor;
         std::thread ReplicationThread;
         std::atomic<bool> Running{ true };
         udp::endpoint TargetEndpoint;
+        UdpFecEncoder Fec;
+        std::unique_ptr<UdpPacer> Pacer;
+#if defined(__linux__)
+        std::unique_ptr<UdpFrameBatch> Batch;
+#endif
+        std::unique_ptr<PayloadCompressor> Compressor;
+        std::vector<uint8_t> Compressed;
+        std::unique_ptr<DeltaEncoder> Delta;
+        std::vector<uint8_t> Encoded;
+        // Recently sent frames that can be retransmitted, while they are still in the ring. A compressed or delta
+        // encoded frame keeps its own copy, Data points into it.
+        struct SentFrame {
+            uint64_t FrameId;
+            const uint8_t* Data;
+            uint32_t Size;
+            uint64_t Type;
+            uint16_t FragmentSize;
+            uint8_t FecData;
+            uint8_t FecParity;
+            CyclicBuffer* Buffer;
+            ulong Index;
+            CompressionCodec Codec;
+            PayloadEncoding Encoding;
+            // Entry::Origin of the message, 0 when it has no timestamp.
+            uint64_t Origin;
+            std::vector<uint8_t> Wire;
+        };
+        std::deque<SentFrame> Window;
+        std::mutex WindowMutex;
+        // Time from the commit of a message with a timestamp until it was read for replication.
+        LatencyHistogram Latency;
+        std::mutex LatencyMutex;
     };
 
     boost::asio::io_context& _io;
@@ -27,44 +81,102 @@ private:
     SharedMemoryClient _shmClient;
     std::vector<std::shared_ptr<TopicReplicator>> _replicators;
     std::atomic<bool> _running{ true };
+    std::atomic<bool> _segmentationOffload;
+    const size_t _datagramSize;
+    const UdpFecConfig _fec;
+    const UdpRetransmitConfig _retransmit;
+    const UdpPacingConfig _pacing;
+    RetransmitRateLimiter _rateLimiter;
     std::mutex _replicatorsMutex;
+    std::thread _nackThread;
+    const CompressionConfig _compression;
+    std::unordered_map<std::string, CompressionConfig> _topicCompression;
+    CompressionPool _compressionPool;
+    const bool _checksums;
 
     void ReplicateLoop(std::shared_ptr<TopicReplicator> replicator);
+    template<size_t UDP_MTU>
+    void SendFrame(TopicReplicator& replicator, UdpFrameIterator<UDP_MTU>& iterator);
+    void NackLoop();
+    void Retransmit(const UdpNackMessage& nack);
 
 public:
+    // When segmentationOffload is set, fragments are sent with UDP_SEGMENT (GSO) and the kernel
+    // cuts them into datagrams. It is switched off automatically if the kernel or NIC does not support it.
+    // mtu is the link MTU; datagrams are sized so that IPv4 never needs to fragment them (9000 for jumbo frames).
+    // With fec enabled every group of fec.Data fragments is followed by fec.Parity XOR parity fragments.
+    // With retransmit enabled, fragments nacked by the target are sent again from the last retransmit.Window frames.
+    // multicast applies to topics replicated to a multicast group.
+    // With pacing enabled, fragments of every topic are spread over time instead of leaving in one burst.
+    // compression applies to every topic that has no configuration of its own (see SetCompression). There is no
+    // handshake over UDP: every target of a compressed topic must be built with the codec. A target of a delta encoded
+    // topic drops frames until the next keyframe when it misses one.
+    // With checksums, every fragment carries a CRC32C; the target drops fragments that do not match it,
+    // FEC and retransmission then recover them like lost ones.
     UdpReplicationSource(asio::io_context& io,
-        const std::string& channelName);
+        const std::string& channelName, bool segmentationOffload = false, size_t mtu = 1500, UdpFecConfig fec = {},
+        UdpRetransmitConfig retransmit = {}, const UdpMulticastConfig& multicast = {}, UdpPacingConfig pacing = {},
+        CompressionConfig compression = {}, bool checksums = false);
+
+    // Applies to topics replicated afterwards.
+    void SetCompression(const std::string& topicName, CompressionConfig compression);
 
     void ReplicateTopic(const std::string& topicName, const std::string& targetHost,
         uint16_t targetPort);
 
+    // Achieved rate and queueing delay of a paced topic, empty stats when the topic is not paced.
+    UdpPacingStats PacingStats(const std::string& topicName);
+    // Ratio and codec CPU time of a compressed topic, empty stats when the topic is not compressed.
+    CompressionStats TopicCompressionStats(const std::string& topicName);
+    // Encoded size and keyframes of a delta encoded topic, empty stats when the topic is not delta encoded.
+    DeltaStats TopicDeltaStats(const std::string& topicName);
+    // See TopicReplicator::Latency.
+    LatencyHistogram TopicLatency(const std::string& topicName);
+
     ~UdpReplicationSource();
 };
 
+// Receives every replicated topic on one socket; fragments are routed to topics by the TopicId in their header.
 class EXPORT UdpReplicationTarget {
 private:
     struct TopicReplicator {
         std::string TopicName;
-        std::thread ReplicationThread;
-        std::atomic<bool> Running{ true };
+        uint32_t TopicId;
+        TopicService* Topic;
+        std::unique_ptr<UdpFrameDefragmentator> Defragmentator;
+        // Where the topic's fragments come from, NACKs are sent there.
+        udp::endpoint Source;
     };
 
     asio::io_context& _io;
     udp::socket _socket;
     std::shared_ptr<SharedMemoryServer> _shmServer;
-    std::vector<std::shared_ptr<TopicReplicator>> _replicators;
+    std::unordered_map<uint32_t, std::shared_ptr<TopicReplicator>> _replicators;
     std::atomic<bool> _running{ true };
+    const size_t _datagramSize;
+    const UdpNackConfig _nack;
     std::mutex _replicatorsMutex;
+    std::thread _receiveThread;
+    CompressionPool _compressionPool;
 
-    void ReplicateLoop(std::shared_ptr<TopicReplicator> replicator);
-    void StartReplication(const std::string& topicName);
+    void ReceiveLoop();
+    TopicReplicator* Find(uint32_t topicId, TopicReplicator* last);
+    void SendNacks(TopicReplicator& replicator, bool idle);
+    void ConfigureReceiveBuffer(size_t maxMessageSize);
 
 public:
+    // mtu is the largest link MTU the target accepts; bigger datagrams are dropped as truncated.
+    // With nack enabled, missing fragments are requested from the source, which must have retransmission enabled.
+    // When host is a multicast group, the target joins it on multicast.Interface.
     UdpReplicationTarget(asio::io_context& io,
         std::shared_ptr<SharedMemoryServer> shmServer,
         std::string &host,
-        uint16_t port);
+        uint16_t port,
+        size_t mtu = 9000,
+        UdpNackConfig nack = {},
+        const UdpMulticastConfig& multicast = {});
 
+    // Topics of one target may be published by one or several sources to the same host and port.
     void ReplicateTopic(const std::string& topicName);
     ~UdpReplicationTarget();
 };
\ No newline at end of file
@@ -0,0 +1,53 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+// Selective retransmission of UDP replication: the target sends NACK bitmaps of missing data fragments back to the
+// source, the source resends them from frames that are still in its ring.
+
+// Source side.
+struct UdpRetransmitConfig {
+    // Number of recently sent frames that can be retransmitted, 0 disables retransmission.
+    size_t Window = 0;
+    // Retransmitted bytes per second, 0 is unlimited.
+    size_t MaxBytesPerSecond = 0;
+
+    bool Enabled() const { return Window != 0; }
+};
+
+// Target side.
+struct UdpNackConfig {
+    bool Enabled = false;
+    // A frame is nacked again only after this time, it is also how long a gap may wait for a reordered fragment.
+    std::chrono::milliseconds Interval{ 5 };
+    // After this many NACKs the frame is given up.
+    uint8_t MaxNacks = 5;
+};
+
+// Token bucket that bounds retransmitted bytes per second; allows a burst of one second.
+class RetransmitRateLimiter {
+public:
+    explicit RetransmitRateLimiter(size_t bytesPerSecond = 0)
+        : _rate(bytesPerSecond), _tokens(static_cast<double>(bytesPerSecond)), _last(std::chrono::steady_clock::now()) {
+    }
+
+    bool TryConsume(size_t bytes) {
+        if (_rate == 0)
+            return true;
+        auto now = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(now - _last).count();
+        _last = now;
+        _tokens = std::min(static_cast<double>(_rate), _tokens + elapsed * _rate);
+        if (_tokens < bytes)
+            return false;
+        _tokens -= bytes;
+        return true;
+    }
+
+private:
+    size_t _rate;
+    double _tokens;
+    std::chrono::steady_clock::time_point _last;
+};
@@ -0,0 +1,123 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include "SharedMemoryServer.h"
+#include "SharedMemoryClient.h"
+#include "TestChannel.h"
+
+using namespace std::chrono;
+
+TEST(ClientPublishTest, ServerAndClientPublishIntoOneTopic) {
+	RemoveChannel("ClientPublish");
+	{
+		SharedMemoryServer srv("ClientPublish");
+		TopicService* topic = srv.CreateTopic("Topic", 64, 64 * 1024, TopicMode::Lossless);
+		SharedMemoryClient client("ClientPublish");
+		client.Connect();
+		auto cursor = client.Subscribe("Topic");
+		auto filtered = client.Subscribe("Topic", {}, TypeFilter::Of({ 2 }));
+		auto publisher = client.OpenPublisher("Topic");
+		EXPECT_EQ(publisher->Mode(), TopicMode::Lossless);
+
+		// Both wait for the subscribers on the lossless topic, the filtered one steps over the server's messages.
+		constexpr ulong count = 500;
+		std::thread server([&]() {
+			for (ulong i = 0; i < count; i++)
+				topic->Publish<ulong>(1, i);
+		});
+		std::thread other([&]() {
+			for (ulong i = 0; i < count; i++)
+				publisher->Publish<ulong>(2, i);
+		});
+		// The last message a lossless subscriber read is held until it reads the next one, so it reads on its own.
+		ulong filteredRead = 0;
+		std::thread reader([&]() {
+			CyclicBuffer::Accessor accessor;
+			while (filteredRead < count && filtered->TryReadFor(accessor, milliseconds(2000))) {
+				EXPECT_EQ(accessor.Type(), 2);
+				EXPECT_EQ(*accessor.As<ulong>(), filteredRead++);
+			}
+			// Hands the last message back, the server may still be publishing.
+			EXPECT_FALSE(filtered->TryRead(accessor));
+		});
+
+		ulong next[3] = { 0, 0, 0 };
+		CyclicBuffer::Accessor accessor;
+		for (ulong i = 0; i < 2 * count; i++) {
+			ASSERT_TRUE(cursor->TryReadFor(accessor, milliseconds(2000))) << i;
+			auto type = accessor.Type();
+			ASSERT_TRUE(type == 1 || type == 2);
+			EXPECT_EQ(*accessor.As<ulong>(), next[type]++);
+		}
+		server.join();
+		other.join();
+		reader.join();
+		EXPECT_EQ(filteredRead, count);
+
+		// Every message was released once, by one of the writers.
+		EXPECT_FALSE(cursor->TryReadFor(accessor, milliseconds(10)));
+		EXPECT_FALSE(filtered->TryReadFor(accessor, milliseconds(10)));
+		EXPECT_EQ(topic->Metrics().Publisher.Published.load(), 2 * count);
+		EXPECT_EQ(topic->Metrics().Publisher.Bytes.load(), 2 * count * sizeof(ulong));
+	}
+	RemoveChannel("ClientPublish");
+}
+
+#if defined(__linux__)
+TEST(ClientPublishTest, SubscribersReadMessagesOfAnotherProcess) {
+	RemoveChannel("ClientPublish");
+	ForkedChild child([]() {
+		SharedMemoryClient other("ClientPublish");
+		other.Connect();
+		auto publisher = other.OpenPublisher("Topic");
+		for (ulong i = 0; i < 10; i++)
+			publisher->Publish<ulong>(7, i);
+		return 0;
+	});
+	{
+		SharedMemoryServer srv("ClientPublish");
+		TopicService* topic = srv.CreateTopic("Topic", 16, 64 * 1024);
+		topic->SetTimestamps(TimestampClock::Monotonic);
+		SharedMemoryClient client("ClientPublish");
+		client.Connect();
+		auto cursor = client.Subscribe("Topic");
+		child.Start();
+
+		CyclicBuffer::Accessor accessor;
+		for (ulong i = 0; i < 10; i++) {
+			ASSERT_TRUE(cursor->TryReadFor(accessor, milliseconds(2000))) << i;
+			EXPECT_EQ(accessor.Type(), 7);
+			EXPECT_EQ(*accessor.As<ulong>(), i);
+		}
+		EXPECT_EQ(child.Wait(), 0);
+		EXPECT_FALSE(cursor->TryReadFor(accessor, milliseconds(10)));
+		EXPECT_EQ(topic->Metrics().Publisher.Published.load(), 10);
+	}
+	RemoveChannel("ClientPublish");
+}
+
+TEST(ClientPublishTest, ServerUnlocksTopicOfCrashedPublisher) {
+	RemoveChannel("ClientPublish");
+	ForkedChild child([]() {
+		// Dies in the middle of a message.
+		SharedMemoryClient other("ClientPublish");
+		other.Connect();
+		auto publisher = other.OpenPublisher("Topic");
+		auto scope = publisher->Prepare(sizeof(ulong), 1);
+		_exit(0);
+		return 0;
+	});
+	{
+		SharedMemoryServer srv("ClientPublish");
+		TopicService* topic = srv.CreateTopic("Topic", 16, 64 * 1024);
+		child.Start();
+		EXPECT_EQ(child.Wait(), 0);
+
+		EXPECT_TRUE(WaitUntil([&]() { return topic->GetBuffer()->Writer() == 0; }));
+		topic->Publish<ulong>(1, 1ul);
+		EXPECT_EQ(topic->GetBuffer()->NextIndex(), 1);
+	}
+	RemoveChannel("ClientPublish");
+}
+#endif
@@ -0,0 +1,154 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <vector>
+#include "Crc32c.h"
+#include "CyclicBuffer.hpp"
+#include "UdpFec.h"
+#include "UdpFrameDefragmentator.h"
+#include "UdpFrameProcessor.h"
+
+// Bit at a time, straight from the definition.
+static uint32_t ReferenceCrc32c(const uint8_t* data, size_t size) {
+    uint32_t crc = ~0u;
+    for (size_t i = 0; i < size; i++) {
+        crc ^= data[i];
+        for (int k = 0; k < 8; k++)
+            crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78 : crc >> 1;
+    }
+    return ~crc;
+}
+
+static std::vector<uint8_t> Pattern(size_t size) {
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i < size; i++)
+        data[i] = static_cast<uint8_t>((i * 2654435761u) >> 13);
+    return data;
+}
+
+// Checksummed fragments of a frame as the sender would put them on the wire.
+static std::vector<std::vector<uint8_t>> Fragment(const std::vector<uint8_t>& frame, size_t mtu,
+    UdpFecEncoder* encoder = nullptr, uint64_t frameId = 7) {
+    UdpFrameIterator<> iterator(frame.data(), frame.size(), 1, frameId, mtu);
+    if (encoder) {
+        encoder->Encode(frame.data(), frame.size(), iterator.FragmentSize());
+        iterator.Protect(*encoder);
+    }
+    iterator.SetChecksums(true);
+    std::vector<std::vector<uint8_t>> datagrams;
+    for (; iterator.CanRead(); ++iterator) {
+        auto buffers = *iterator;
+        std::vector<uint8_t> datagram(buffers[0].size() + buffers[1].size());
+        std::memcpy(datagram.data(), buffers[0].data(), buffers[0].size());
+        std::memcpy(datagram.data() + buffers[0].size(), buffers[1].data(), buffers[1].size());
+        datagrams.push_back(std::move(datagram));
+    }
+    return datagrams;
+}
+
+TEST(Crc32cTest, MatchesReference) {
+    EXPECT_EQ(Crc32c("123456789", 9), 0xE3069283u);
+    EXPECT_EQ(Crc32c(nullptr, 0), 0u);
+
+    auto data = Pattern(100000);
+    std::vector<uint8_t> copy(data.size());
+    // Sizes around the stream and fold lengths, at unaligned offsets.
+    for (size_t size : { 1, 7, 8, 100, 511, 512, 767, 768, 1400, 24576, 24577, 99000 }) {
+        for (size_t offset : { 0, 1, 5 }) {
+            uint32_t expected = ReferenceCrc32c(data.data() + offset, size);
+            EXPECT_EQ(Crc32c(data.data() + offset, size), expected) << size << "+" << offset;
+            EXPECT_EQ(Crc32cCopy(copy.data() + offset, data.data() + offset, size), expected) << size << "+" << offset;
+            EXPECT_EQ(std::memcmp(copy.data() + offset, data.data() + offset, size), 0);
+            // Continued over two parts.
+            size_t half = size / 3;
+            EXPECT_EQ(Crc32c(data.data() + offset + half, size - half, Crc32c(data.data() + offset, half)), expected);
+        }
+    }
+}
+
+TEST(Crc32cTest, EntryCarriesChecksum) {
+    CyclicBuffer buffer(16, 64 * 1024);
+    auto cursor = buffer.OpenCursor();
+    auto data = Pattern(3000);
+    {
+        auto scope = buffer.WriteScope(data.size(), 1);
+        scope.SetChecksum(Crc32cCopy(scope.Span.Start, data.data(), data.size()));
+        scope.Span.Commit(data.size());
+    }
+    {
+        auto scope = buffer.WriteScope(data.size(), 2);
+        std::memcpy(scope.Span.Start, data.data(), data.size());
+        scope.Span.Commit(data.size());
+    }
+
+    ASSERT_TRUE(cursor.TryRead());
+    auto checked = cursor.Data();
+    EXPECT_TRUE(checked.HasChecksum());
+    EXPECT_EQ(checked.Checksum(), ReferenceCrc32c(data.data(), data.size()));
+    EXPECT_TRUE(checked.Verify());
+    checked.Get()[100] ^= 0x10;
+    EXPECT_FALSE(checked.Verify());
+
+    ASSERT_TRUE(cursor.TryRead());
+    auto unchecked = cursor.Data();
+    EXPECT_FALSE(unchecked.HasChecksum());
+    EXPECT_TRUE(unchecked.Verify());
+}
+
+TEST(Crc32cTest, DamagedFragmentIsDroppedAndSentAgain) {
+    auto frame = Pattern(10000);
+    auto datagrams = Fragment(frame, 1000);
+    ASSERT_GT(datagrams.size(), 3);
+    CyclicBuffer buffer(16, 64 * 1024);
+    UdpFrameDefragmentator defragmentator(buffer, 1000);
+    auto cursor = buffer.OpenCursor();
+
+    auto damaged = datagrams[2];
+    damaged[HEADER_SIZE + 10] ^= 0x01;
+    size_t committed = 0;
+    for (size_t i = 0; i < datagrams.size(); i++)
+        committed += defragmentator.ProcessFragment(i == 2 ? damaged.data() : datagrams[i].data(), datagrams[i].size());
+    EXPECT_EQ(committed, 0);
+    EXPECT_EQ(defragmentator.ChecksumErrors(), 1);
+
+    // A damaged header is caught as well.
+    damaged = datagrams[2];
+    reinterpret_cast<UdpReplicationMessageHeader*>(damaged.data())->Reserved3 = 1;
+    EXPECT_EQ(defragmentator.ProcessFragment(damaged.data(), damaged.size()), 0);
+    EXPECT_EQ(defragmentator.ChecksumErrors(), 2);
+
+    // Retransmitted intact.
+    EXPECT_EQ(defragmentator.ProcessFragment(datagrams[2].data(), datagrams[2].size()), 1);
+    ASSERT_TRUE(cursor.TryRead());
+    auto accessor = cursor.Data();
+    ASSERT_EQ(accessor.Size(), frame.size());
+    EXPECT_EQ(std::memcmp(accessor.Get(), frame.data(), frame.size()), 0);
+}
+
+TEST(Crc32cTest, DamagedFragmentIsRecoveredFromParity) {
+    auto frame = Pattern(10000);
+    UdpFecEncoder encoder(UdpFecConfig(4, 1));
+    auto datagrams = Fragment(frame, 1000, &encoder);
+    CyclicBuffer buffer(16, 64 * 1024);
+    UdpFrameDefragmentator defragmentator(buffer, 1000);
+    auto cursor = buffer.OpenCursor();
+
+    datagrams[1][HEADER_SIZE] ^= 0x80;
+    size_t committed = 0;
+    for (auto& datagram : datagrams)
+        committed += defragmentator.ProcessFragment(datagram.data(), datagram.size());
+    EXPECT_EQ(committed, 1);
+    EXPECT_EQ(defragmentator.ChecksumErrors(), 1);
+    ASSERT_TRUE(cursor.TryRead());
+    auto accessor = cursor.Data();
+    ASSERT_EQ(accessor.Size(), frame.size());
+    EXPECT_EQ(std::memcmp(accessor.Get(), frame.data(), frame.size()), 0);
+
+    // A message that fits one fragment takes the direct path, it is checked there too.
+    auto small = Pattern(500);
+    auto single = Fragment(small, 1000, nullptr, 8);
+    ASSERT_EQ(single.size(), 1);
+    single[0].back() ^= 0x01;
+    EXPECT_EQ(defragmentator.ProcessFragment(single[0].data(), single[0].size()), 0);
+    EXPECT_EQ(defragmentator.ChecksumErrors(), 2);
+    EXPECT_FALSE(cursor.TryRead());
+}
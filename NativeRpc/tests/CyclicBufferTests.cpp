@@ -376,4 +376,75 @@ TEST_F(CyclicBufferTest, RemainingWithSpecificStartIndex) {
 
     // Should show remaining from start point plus new items
     ASSERT_EQ(cursor.Remaining(), (INITIAL_WRITES - 1) + ADDITIONAL_WRITES);
-}
\ No newline at end of file
+}
+// Test that an item is reported live until the writer wraps over it
+TEST_F(CyclicBufferTest, IsLiveUntilOverwritten) {
+    const unsigned long TYPE = 1;
+    const size_t ITEM_SIZE = 100;
+    auto write = [this]() {
+        auto writer = buffer->WriteScope(ITEM_SIZE, TYPE);
+        memset(writer.Span.Start, 1, ITEM_SIZE);
+        writer.Span.Commit(ITEM_SIZE);
+    };
+
+    auto cursor = buffer->OpenCursor();
+    write();
+    ASSERT_TRUE(cursor.TryRead());
+    auto index = cursor.Data().Index;
+    ASSERT_TRUE(buffer->IsLive(index));
+    ASSERT_FALSE(buffer->IsLive(index + 1));
+
+    // 10 items fit in 1024 bytes, the 11th starts over at the beginning of the pool.
+    for (int i = 0; i < 9; i++)
+        write();
+    ASSERT_TRUE(buffer->IsLive(index));
+
+    write();
+    ASSERT_FALSE(buffer->IsLive(index));
+}
+
+// Test that the span a writer holds counts as written, however small the items committed since
+TEST_F(CyclicBufferTest, IsLiveTakesTheOpenSpanForWritten) {
+    const unsigned long TYPE = 1;
+    const size_t ITEM_SIZE = 100;
+    for (int i = 0; i < 10; i++) {
+        auto writer = buffer->WriteScope(ITEM_SIZE, TYPE);
+        writer.Span.Commit(ITEM_SIZE);
+    }
+    ASSERT_TRUE(buffer->IsLive(5));
+    {
+        // Does not fit the 24 bytes left, the span starts over at the beginning of the pool.
+        auto writer = buffer->WriteScope(900, TYPE);
+        EXPECT_FALSE(buffer->IsLive(5));
+        EXPECT_FALSE(buffer->IsLive(9));
+
+        writer.Span.Limit(550);
+        EXPECT_FALSE(buffer->IsLive(5));
+        EXPECT_TRUE(buffer->IsLive(6));
+        EXPECT_THROW(writer.Span.Commit(551), std::runtime_error);
+    }
+    // Nothing was committed.
+    EXPECT_TRUE(buffer->IsLive(0));
+}
+
+TEST_F(CyclicBufferTest, OldestLiveFollowsOverwrites) {
+    const unsigned long TYPE = 1;
+    const size_t ITEM_SIZE = 100;
+    ASSERT_EQ(buffer->OldestLive(), 0);
+
+    for (int i = 0; i < 5; i++) {
+        auto writer = buffer->WriteScope(ITEM_SIZE, TYPE);
+        writer.Span.Commit(ITEM_SIZE);
+    }
+    ASSERT_EQ(buffer->OldestLive(), 0);
+
+    for (int i = 0; i < 15; i++) {
+        auto writer = buffer->WriteScope(ITEM_SIZE, TYPE);
+        writer.Span.Commit(ITEM_SIZE);
+    }
+    // The 11th item wrapped over the first 10, see IsLiveUntilOverwritten.
+    auto oldest = buffer->OldestLive();
+    EXPECT_EQ(oldest, 10);
+    EXPECT_TRUE(buffer->IsLive(oldest));
+    EXPECT_FALSE(buffer->IsLive(oldest - 1));
+}
@@ -1,6 +1,11 @@
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+#include <random>
 
 #include "FastBitSet.h"
+#include "FragmentBitmap.h"
 
 
 // Test case for initialization
@@ -126,3 +131,155 @@ TEST(FastBitSetTest, SmallBitSet) {
     // Now complete
     EXPECT_TRUE(bitset.isComplete());
 }
+
+TEST(FragmentBitmapTest, SetGetAndComplete) {
+    FragmentBitmap<> bitmap(70);
+    EXPECT_FALSE(bitmap.isComplete());
+    EXPECT_TRUE(bitmap.setBit(69));
+    EXPECT_FALSE(bitmap.setBit(69));
+    EXPECT_EQ(bitmap.count(), 1);
+    EXPECT_TRUE(bitmap.getBit(69));
+    EXPECT_FALSE(bitmap.getBit(68));
+    EXPECT_THROW(bitmap.getBit(70), std::out_of_range);
+    EXPECT_THROW(bitmap.setBit(70), std::out_of_range);
+    EXPECT_THROW(bitmap.reset(0), std::invalid_argument);
+
+    for (size_t i = 0; i < bitmap.size(); ++i)
+        bitmap.setBit(i);
+    EXPECT_TRUE(bitmap.isComplete());
+    EXPECT_EQ(bitmap.findUnset(0), bitmap.size());
+}
+
+// Bitmaps larger than the inline capacity live on the heap, reset moves between both.
+TEST(FragmentBitmapTest, InlineAndHeapStorage) {
+    FragmentBitmap<128> bitmap(100);
+    for (size_t bits : { 1000, 3, 128, 129, 5000 }) {
+        bitmap.reset(bits);
+        EXPECT_EQ(bitmap.size(), bits);
+        EXPECT_EQ(bitmap.count(), 0);
+        for (size_t i = 0; i < bits; i += 2)
+            bitmap.setBit(i);
+        EXPECT_EQ(bitmap.findUnset(0), bits > 1 ? 1 : bits);
+        for (size_t i = 1; i < bits; i += 2)
+            bitmap.setBit(i);
+        EXPECT_TRUE(bitmap.isComplete()) << bits;
+    }
+
+    FragmentBitmap<0> heapOnly(10);
+    heapOnly.setBit(3);
+    auto copy = heapOnly;
+    EXPECT_TRUE(copy.getBit(3));
+    EXPECT_EQ(copy.findUnset(0), 0);
+}
+
+// Same layout as FastBitSet, so NACK bitmaps are built the same way.
+TEST(FragmentBitmapTest, UnsetBits) {
+    FragmentBitmap<> bitmap(1000);
+    for (size_t i = 0; i < bitmap.size(); ++i) {
+        if (i != 3 && i != 64 && i != 999)
+            bitmap.setBit(i);
+    }
+
+    EXPECT_EQ(bitmap.findUnset(0), 3);
+    EXPECT_EQ(bitmap.findUnset(4), 64);
+    EXPECT_EQ(bitmap.findUnset(65), 999);
+    bitmap.setBit(999);
+    EXPECT_EQ(bitmap.findUnset(65), bitmap.size());
+
+    uint64_t unset[16] = { 0 };
+    ASSERT_EQ(bitmap.copyUnset(0, unset, 2), 2);
+    EXPECT_EQ(unset[0], uint64_t(1) << 3);
+    EXPECT_EQ(unset[1], uint64_t(1));
+    ASSERT_EQ(bitmap.copyUnset(15, unset, 16), 1);
+    // Padding bits are never reported.
+    EXPECT_EQ(unset[0], uint64_t(0));
+}
+
+TEST(FragmentBitmapTest, MissingRanges) {
+    FragmentBitmap<> bitmap(5000);
+    std::vector<std::pair<size_t, size_t>> holes = { { 0, 2 }, { 63, 65 }, { 700, 1300 }, { 4990, 5000 } };
+    for (size_t i = 0; i < bitmap.size(); ++i)
+        if (std::none_of(holes.begin(), holes.end(), [i](auto& h) { return i >= h.first && i < h.second; }))
+            bitmap.setBit(i);
+
+    FragmentBitmap<>::Range ranges[8];
+    ASSERT_EQ(bitmap.missingRanges(0, bitmap.size(), ranges, 8), holes.size());
+    for (size_t i = 0; i < holes.size(); i++) {
+        EXPECT_EQ(ranges[i].First, holes[i].first);
+        EXPECT_EQ(ranges[i].End, holes[i].second);
+    }
+
+    // Limited by end and by the number of ranges.
+    ASSERT_EQ(bitmap.missingRanges(1, 1000, ranges, 8), 3);
+    EXPECT_EQ(ranges[0].First, 1);
+    EXPECT_EQ(ranges[2].First, 700);
+    EXPECT_EQ(ranges[2].End, 1000);
+    ASSERT_EQ(bitmap.missingRanges(0, bitmap.size(), ranges, 1), 1);
+    EXPECT_EQ(ranges[0].End, 2);
+}
+
+// The tree has no reset nor scan of its own: a frame gets a new one and missing fragments are looked up bit by bit.
+static void Reset(FastBitSet& bitset, size_t fragments) { bitset = FastBitSet(fragments); }
+static void Reset(FragmentBitmap<>& bitset, size_t fragments) { bitset.reset(fragments); }
+
+static size_t FindUnset(const FastBitSet& bitset, size_t from) {
+    for (size_t i = from; i < bitset.size(); i++)
+        if (!bitset.getBit(i))
+            return i;
+    return bitset.size();
+}
+static size_t FindUnset(const FragmentBitmap<>& bitset, size_t from) { return bitset.findUnset(from); }
+
+// Receiving a frame: every fragment is set once in shuffled order and completeness is checked after each one.
+template<typename TBitSet>
+static double ReceiveFramesNs(size_t fragments, size_t frames, const std::vector<size_t>& order) {
+    using namespace std::chrono;
+    TBitSet bitset(fragments);
+    size_t completed = 0;
+    auto start = steady_clock::now();
+    for (size_t f = 0; f < frames; f++) {
+        Reset(bitset, fragments);
+        for (size_t i : order) {
+            bitset.setBit(i);
+            completed += bitset.isComplete();
+        }
+    }
+    auto elapsed = duration<double, std::nano>(steady_clock::now() - start).count();
+    EXPECT_EQ(completed, frames);
+    return elapsed / (double(fragments) * frames);
+}
+
+// Scanning for the missing fragments of an almost complete frame, as done when a NACK is built.
+template<typename TBitSet>
+static double FindMissingNs(size_t fragments, size_t scans) {
+    using namespace std::chrono;
+    TBitSet bitset(fragments);
+    for (size_t i = 0; i < fragments; i++)
+        if (i != fragments - 7)
+            bitset.setBit(i);
+    size_t found = 0;
+    auto start = steady_clock::now();
+    for (size_t s = 0; s < scans; s++)
+        found += FindUnset(bitset, s % 4);
+    auto elapsed = duration<double, std::nano>(steady_clock::now() - start).count();
+    EXPECT_EQ(found, (fragments - 7) * scans);
+    return elapsed / scans;
+}
+
+TEST(FragmentBitmapPerfTest, FlatBitmapAgainstTree) {
+    for (size_t fragments : { 100, 1000, 5000 }) {
+        std::vector<size_t> order(fragments);
+        std::iota(order.begin(), order.end(), 0);
+        std::shuffle(order.begin(), order.end(), std::mt19937(42));
+        const size_t frames = 2000000 / fragments;
+
+        double tree = ReceiveFramesNs<FastBitSet>(fragments, frames, order);
+        double flat = ReceiveFramesNs<FragmentBitmap<>>(fragments, frames, order);
+        double treeScan = FindMissingNs<FastBitSet>(fragments, 20000);
+        double flatScan = FindMissingNs<FragmentBitmap<>>(fragments, 20000);
+
+        std::cout << fragments << " fragments:" << std::endl
+            << "  setBit + isComplete: tree " << tree << " ns, flat " << flat << " ns" << std::endl
+            << "  findUnset: tree " << treeScan << " ns, flat " << flatScan << " ns" << std::endl;
+    }
+}
@@ -0,0 +1,152 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "CyclicBuffer.hpp"
+#include "LatencyHistogram.h"
+#include "PublishClock.h"
+#include "SharedMemoryServer.h"
+#include "SharedMemoryClient.h"
+#include "UdpFrameDefragmentator.h"
+#include "UdpFrameProcessor.h"
+#include "TestChannel.h"
+
+TEST(LatencyTest, HistogramPercentiles) {
+    LatencyHistogram histogram;
+    EXPECT_EQ(histogram.Percentile(0.99), 0);
+    for (int i = 0; i < 98; i++)
+        histogram.Record(100);
+    histogram.Record(5000);
+    histogram.Record(1'000'000);
+
+    EXPECT_EQ(histogram.Count, 100);
+    EXPECT_EQ(histogram.Max, 1'000'000);
+    EXPECT_EQ(histogram.Percentile(0.5), 128);
+    EXPECT_EQ(histogram.Percentile(0.985), 8192);
+    EXPECT_EQ(histogram.Percentile(1.0), 1'000'000);
+    EXPECT_EQ(histogram.Mean(), (98 * 100 + 5000 + 1'000'000) / 100);
+
+    LatencyHistogram other;
+    other.Record(10);
+    histogram.Merge(other);
+    EXPECT_EQ(histogram.Count, 101);
+    EXPECT_EQ(histogram.Counts[0], 1);
+}
+
+TEST(LatencyTest, ClocksAdvance) {
+    for (auto clock : { TimestampClock::Monotonic, TimestampClock::Tsc }) {
+        auto from = PublishClock::Now(clock);
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        auto elapsed = PublishClock::Elapsed(clock, from, PublishClock::Now(clock));
+        EXPECT_GE(elapsed, 1'000'000);
+        EXPECT_LT(elapsed, 1'000'000'000);
+        EXPECT_EQ(PublishClock::Elapsed(clock, from + 1000, from), 0);
+    }
+}
+
+TEST(LatencyTest, EntryCarriesTimestamps) {
+    CyclicBuffer buffer(16, 64 * 1024);
+    auto cursor = buffer.OpenCursor();
+    auto before = PublishClock::SystemNow();
+    buffer.Write<ulong>(1, 1);
+    {
+        auto scope = buffer.WriteScope(sizeof(ulong), 2);
+        scope.SetTimestamp(TimestampClock::Tsc);
+        scope.Span.Commit(sizeof(ulong));
+    }
+    {
+        auto scope = buffer.WriteScope(sizeof(ulong), 3);
+        scope.SetTimestamp(TimestampClock::Monotonic, 12345);
+        scope.Span.Commit(sizeof(ulong));
+    }
+
+    ASSERT_TRUE(cursor.TryRead());
+    auto plain = cursor.Data();
+    EXPECT_FALSE(plain.HasTimestamp());
+    EXPECT_EQ(plain.Age(), 0);
+
+    ASSERT_TRUE(cursor.TryRead());
+    auto stamped = cursor.Data();
+    EXPECT_TRUE(stamped.HasTimestamp());
+    EXPECT_EQ(stamped.Clock(), TimestampClock::Tsc);
+    EXPECT_GE(stamped.Origin(), before);
+    EXPECT_LE(stamped.Origin(), PublishClock::SystemNow());
+
+    // A replicated message keeps the time of its original publish.
+    ASSERT_TRUE(cursor.TryRead());
+    auto replicated = cursor.Data();
+    EXPECT_EQ(replicated.Clock(), TimestampClock::Monotonic);
+    EXPECT_EQ(replicated.Origin(), 12345);
+    EXPECT_LE(replicated.Timestamp(), PublishClock::Now(TimestampClock::Monotonic));
+}
+
+TEST(LatencyTest, CursorRecordsLatencyOfStampedMessages) {
+    RemoveChannel("Latency");
+    {
+        SharedMemoryServer srv("Latency");
+        TopicService* topic = srv.CreateTopic("Topic", 16, 64 * 1024);
+        SharedMemoryClient client("Latency");
+        client.Connect();
+        auto cursor = client.Subscribe("Topic");
+
+        topic->Publish<ulong>(1, 0);
+        topic->SetTimestamps(TimestampClock::Monotonic);
+        EXPECT_EQ(topic->Timestamps(), TimestampClock::Monotonic);
+        for (ulong i = 1; i < 4; i++)
+            topic->Publish<ulong>(1, i);
+        {
+            auto scope = topic->Prepare(sizeof(ulong), 1);
+            scope.SetOrigin(PublishClock::SystemNow() - 5'000'000);
+            scope.Span().Commit(sizeof(ulong));
+        }
+
+        CyclicBuffer::Accessor accessor;
+        for (int i = 0; i < 5; i++)
+            ASSERT_TRUE(cursor->TryRead(accessor));
+        EXPECT_TRUE(accessor.HasTimestamp());
+
+        auto latency = cursor->Latency();
+        EXPECT_EQ(latency.Count, 4);
+        EXPECT_LT(latency.Max, 1'000'000'000);
+        auto endToEnd = cursor->EndToEndLatency();
+        EXPECT_EQ(endToEnd.Count, 4);
+        EXPECT_GE(endToEnd.Max, 5'000'000);
+    }
+    RemoveChannel("Latency");
+}
+
+TEST(LatencyTest, UdpFramesCarryOrigin) {
+    std::vector<uint8_t> frame(5000);
+    for (size_t i = 0; i < frame.size(); i++)
+        frame[i] = static_cast<uint8_t>(i);
+    CyclicBuffer buffer(16, 64 * 1024);
+    UdpFrameDefragmentator defragmentator(buffer, 1000);
+    auto cursor = buffer.OpenCursor();
+
+    // A frame without the time of its publish is committed without timestamps.
+    for (uint64_t frameId = 1; frameId <= 2; frameId++) {
+        UdpFrameIterator<> iterator(frame.data(), frame.size(), 1, frameId, 1000);
+        if (frameId == 2)
+            iterator.SetOrigin(987654321);
+        iterator.SetChecksums(true);
+        size_t committed = 0;
+        for (; iterator.CanRead(); ++iterator) {
+            auto buffers = *iterator;
+            std::vector<uint8_t> datagram(buffers[0].size() + buffers[1].size());
+            std::memcpy(datagram.data(), buffers[0].data(), buffers[0].size());
+            std::memcpy(datagram.data() + buffers[0].size(), buffers[1].data(), buffers[1].size());
+            committed += defragmentator.ProcessFragment(datagram.data(), datagram.size());
+        }
+        ASSERT_EQ(committed, 1);
+    }
+    EXPECT_EQ(defragmentator.ChecksumErrors(), 0);
+
+    ASSERT_TRUE(cursor.TryRead());
+    EXPECT_FALSE(cursor.Data().HasTimestamp());
+    ASSERT_TRUE(cursor.TryRead());
+    auto accessor = cursor.Data();
+    ASSERT_EQ(accessor.Size(), frame.size());
+    EXPECT_EQ(std::memcmp(accessor.Get(), frame.data(), frame.size()), 0);
+    EXPECT_EQ(accessor.Clock(), TimestampClock::Monotonic);
+    EXPECT_EQ(accessor.Origin(), 987654321);
+}
@@ -0,0 +1,150 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include "MessageSchema.h"
+#include "SharedMemoryServer.h"
+#include "SharedMemoryClient.h"
+#include "TestChannel.h"
+
+struct Point {
+	float X;
+	float Y;
+	static constexpr auto Fields() {
+		return std::make_tuple(SchemaField("X", &Point::X), SchemaField("Y", &Point::Y));
+	}
+};
+
+struct Frame {
+	static constexpr ulong TypeId = 10;
+	ulong FrameId;
+	Point Origin;
+	InlineArray<uint16_t> Pixels;
+	InlineString Label;
+	static constexpr auto Fields() {
+		return std::make_tuple(SchemaField("FrameId", &Frame::FrameId), SchemaField("Origin", &Frame::Origin),
+			SchemaField("Pixels", &Frame::Pixels), SchemaField("Label", &Frame::Label));
+	}
+};
+
+// Same layout as Frame, a field is named differently.
+struct RenamedFrame {
+	static constexpr ulong TypeId = 10;
+	ulong Id;
+	Point Origin;
+	InlineArray<uint16_t> Pixels;
+	InlineString Label;
+	static constexpr auto Fields() {
+		return std::make_tuple(SchemaField("Id", &RenamedFrame::Id), SchemaField("Origin", &RenamedFrame::Origin),
+			SchemaField("Pixels", &RenamedFrame::Pixels), SchemaField("Label", &RenamedFrame::Label));
+	}
+};
+
+struct Heartbeat {
+	static constexpr ulong TypeId = 11;
+	ulong Sequence;
+	std::array<int32_t, 4> Flags;
+	static constexpr auto Fields() {
+		return std::make_tuple(SchemaField("Sequence", &Heartbeat::Sequence), SchemaField("Flags", &Heartbeat::Flags));
+	}
+};
+
+static_assert(MessageSchema<Frame>::Hash != MessageSchema<RenamedFrame>::Hash);
+static_assert(MessageSchema<Frame>::Hash != MessageSchema<Heartbeat>::Hash);
+static_assert(MessageSchema<Frame>::HasInlineFields);
+static_assert(!MessageSchema<Heartbeat>::HasInlineFields);
+static_assert(!SchemaMessage<Point>);
+
+TEST(MessageSchemaTest, WritesVariableLengthFieldsInline) {
+	std::vector<byte> memory(1024);
+	std::vector<uint16_t> pixels = { 1, 2, 3, 4, 5 };
+	size_t size;
+	{
+		MessageWriter<Frame> writer(memory.data(), memory.size());
+		writer->FrameId = 7;
+		writer->Origin = { 1.5f, 2.5f };
+		writer.Assign(writer->Label, "left");
+		writer.Assign<uint16_t>(writer->Pixels, pixels);
+		size = writer.Size();
+		EXPECT_THROW(writer.Allocate(writer->Pixels, 1024), ZeroCopyRpcException);
+	}
+	EXPECT_EQ(size, sizeof(Frame) + 4 + pixels.size() * sizeof(uint16_t));
+
+	// Offsets are relative, the message reads the same wherever it is copied to.
+	std::vector<byte> copy(memory.begin(), memory.begin() + size);
+	auto frame = MessageSchema<Frame>::View(copy.data(), copy.size(), Frame::TypeId);
+	ASSERT_NE(frame, nullptr);
+	EXPECT_EQ(frame->FrameId, 7);
+	EXPECT_EQ(frame->Origin.Y, 2.5f);
+	EXPECT_EQ(frame->Label.View(), "left");
+	EXPECT_EQ(std::vector<uint16_t>(frame->Pixels.begin(), frame->Pixels.end()), pixels);
+	EXPECT_EQ(reinterpret_cast<size_t>(frame->Pixels.Data()) % alignof(uint16_t), reinterpret_cast<size_t>(copy.data()) % alignof(uint16_t));
+
+	EXPECT_EQ(MessageSchema<Frame>::View(copy.data(), copy.size(), Heartbeat::TypeId), nullptr);
+	EXPECT_EQ(MessageSchema<Frame>::View(copy.data(), size - 1, Frame::TypeId), nullptr);
+	reinterpret_cast<Frame*>(copy.data())->Label.Offset = 4096;
+	EXPECT_EQ(MessageSchema<Frame>::View(copy.data(), copy.size(), Frame::TypeId), nullptr);
+}
+
+TEST(MessageSchemaTest, TypedTopicChecksSchemaAtSubscribe) {
+	RemoveChannel("Schema", { "Frames" });
+	{
+		SharedMemoryServer srv("Schema");
+		TopicService* topic = srv.CreateTopic("Frames", 16, 64 * 1024);
+		topic->SetSchema<Frame>();
+		EXPECT_EQ(topic->SchemaHash(), MessageSchema<Frame>::Hash);
+
+		SharedMemoryClient client("Schema");
+		client.Connect();
+		EXPECT_EQ(client.SchemaHash("Frames"), MessageSchema<Frame>::Hash);
+		EXPECT_THROW(client.Subscribe<RenamedFrame>("Frames"), ZeroCopyRpcException);
+		auto cursor = client.Subscribe<Frame>("Frames");
+
+		std::vector<uint16_t> pixels(100);
+		for (size_t i = 0; i < pixels.size(); i++)
+			pixels[i] = static_cast<uint16_t>(i * 3);
+		{
+			auto scope = topic->Prepare<Frame>(pixels.size() * sizeof(uint16_t) + 16);
+			scope->FrameId = 42;
+			scope.Assign<uint16_t>(scope->Pixels, pixels);
+			scope.Assign(scope->Label, "camera");
+		}
+		EXPECT_THROW(topic->Prepare<Heartbeat>(), ZeroCopyRpcException);
+
+		CyclicBuffer::Accessor accessor;
+		auto& frame = cursor->Read<Frame>(accessor);
+		EXPECT_EQ(accessor.Type(), Frame::TypeId);
+		EXPECT_EQ(frame.FrameId, 42);
+		EXPECT_EQ(frame.Label.View(), "camera");
+		ASSERT_EQ(frame.Pixels.Size(), pixels.size());
+		EXPECT_EQ(frame.Pixels[99], 297);
+		// Read in place, from the topic buffer.
+		EXPECT_GT(reinterpret_cast<const byte*>(frame.Pixels.Data()), accessor.Get());
+		EXPECT_LT(reinterpret_cast<const byte*>(frame.Pixels.Data()), accessor.Get() + accessor.Size());
+		EXPECT_EQ(cursor->TryRead<Frame>(accessor), nullptr);
+	}
+	RemoveChannel("Schema", { "Frames" });
+}
+
+TEST(MessageSchemaTest, FixedMessagesArePublishedByValue) {
+	RemoveChannel("Schema", { "Frames" });
+	{
+		SharedMemoryServer srv("Schema");
+		TopicService* topic = srv.CreateTopic("Frames", 16, 64 * 1024);
+		SharedMemoryClient client("Schema");
+		client.Connect();
+		// A topic without a schema takes any typed subscriber.
+		auto cursor = client.Subscribe<Heartbeat>("Frames");
+		auto untyped = client.Subscribe("Frames");
+
+		topic->Publish<ulong>(1, 5ul);
+		topic->Publish(Heartbeat{ 3, { 1, 2, 3, 4 } });
+
+		CyclicBuffer::Accessor accessor;
+		auto& heartbeat = cursor->Read<Heartbeat>(accessor);
+		EXPECT_EQ(heartbeat.Sequence, 3);
+		EXPECT_EQ(heartbeat.Flags[3], 4);
+
+		EXPECT_THROW(untyped->Read<Heartbeat>(accessor), ZeroCopyRpcException);
+		EXPECT_NE(untyped->TryRead<Heartbeat>(accessor), nullptr);
+	}
+	RemoveChannel("Schema", { "Frames" });
+}
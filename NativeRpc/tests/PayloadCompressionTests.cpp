@@ -0,0 +1,181 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+#include "PayloadCompression.h"
+#include "UdpFrameDefragmentator.h"
+#include "UdpFrameProcessor.h"
+#include "ZeroCopyRpcException.h"
+
+// First codec this build has, None when it was built without any.
+static CompressionCodec AvailableCodec() {
+    for (auto codec : { CompressionCodec::Lz4, CompressionCodec::Zstd, CompressionCodec::Deflate })
+        if (IsCodecSupported(codec))
+            return codec;
+    return CompressionCodec::None;
+}
+
+// Telemetry-like payload: slowly changing 32-bit samples.
+static std::vector<uint8_t> Compressible(size_t size) {
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i + 4 <= size; i += 4) {
+        uint32_t sample = static_cast<uint32_t>(1000 + (i / 64) % 50);
+        std::memcpy(data.data() + i, &sample, sizeof(sample));
+    }
+    return data;
+}
+
+TEST(PayloadCompressionTest, CodecNamesRoundTrip) {
+    for (auto codec : { CompressionCodec::None, CompressionCodec::Lz4, CompressionCodec::Zstd, CompressionCodec::Deflate })
+        EXPECT_EQ(ParseCodec(CodecName(codec)), codec);
+    EXPECT_THROW(ParseCodec("snappy"), std::invalid_argument);
+    EXPECT_TRUE(IsCodecSupported(CompressionCodec::None));
+}
+
+TEST(PayloadCompressionTest, NegotiationFallsBackToAnAcceptedCodec) {
+    auto bit = [](CompressionCodec codec) { return 1u << static_cast<uint8_t>(codec); };
+    const uint32_t all = bit(CompressionCodec::None) | bit(CompressionCodec::Lz4) | bit(CompressionCodec::Zstd)
+        | bit(CompressionCodec::Deflate);
+    for (auto codec : { CompressionCodec::Lz4, CompressionCodec::Zstd, CompressionCodec::Deflate }) {
+        auto expected = IsCodecSupported(codec) ? codec : CompressionCodec::None;
+        for (auto preferred : { CompressionCodec::Lz4, CompressionCodec::Zstd, CompressionCodec::Deflate }) {
+            if (preferred != codec) {
+                EXPECT_EQ(NegotiateCodec(preferred, bit(CompressionCodec::None) | bit(codec)), expected);
+            }
+        }
+        // Bits of codecs this build lacks are ignored.
+        EXPECT_EQ(NegotiateCodec(codec, all), IsCodecSupported(codec) ? codec : AvailableCodec());
+    }
+    EXPECT_EQ(NegotiateCodec(AvailableCodec(), bit(CompressionCodec::None)), CompressionCodec::None);
+    EXPECT_EQ(NegotiateCodec(CompressionCodec::None, all), CompressionCodec::None);
+}
+
+TEST(PayloadCompressionTest, PoolRunsEveryJobOnce) {
+    CompressionPool pool(3);
+    std::vector<std::atomic<int>> calls(100);
+    std::vector<std::thread> callers;
+    // Frames of several topics are worked on side by side.
+    for (int t = 0; t < 4; t++)
+        callers.emplace_back([&]() {
+            for (int round = 0; round < 50; round++)
+                pool.Run(calls.size(), [&](size_t i) { calls[i]++; });
+        });
+    for (auto& caller : callers)
+        caller.join();
+    for (auto& count : calls)
+        EXPECT_EQ(count, 200);
+}
+
+TEST(PayloadCompressionTest, LargeFrameIsCompressedInChunks) {
+    auto codec = AvailableCodec();
+    if (codec == CompressionCodec::None)
+        GTEST_SKIP() << "Built without compression codecs.";
+
+    CompressionConfig config;
+    config.Codec = codec;
+    config.ChunkSize = 64 * 1024;
+    CompressionPool pool(3);
+    PayloadCompressor compressor(config, &pool);
+    PayloadDecompressor decompressor(&pool);
+
+    auto data = Compressible(1024 * 1024 + 123);
+    std::vector<uint8_t> wire;
+    ASSERT_EQ(compressor.Compress(data.data(), data.size(), wire), codec);
+    ASSERT_LT(wire.size(), data.size() / 3);
+    ASSERT_EQ(PayloadDecompressor::RawSize(wire.data(), wire.size()), data.size());
+    CompressedFrameHeader header;
+    std::memcpy(&header, wire.data(), sizeof(header));
+    EXPECT_EQ(header.Chunks, 17);
+
+    std::vector<uint8_t> restored(data.size());
+    decompressor.Decompress(codec, wire.data(), wire.size(), restored.data(), restored.size());
+    EXPECT_EQ(restored, data);
+
+    auto stats = compressor.Stats();
+    EXPECT_EQ(stats.Frames, 1);
+    EXPECT_EQ(stats.Compressed, 1);
+    EXPECT_EQ(stats.RawBytes, data.size());
+    EXPECT_EQ(stats.WireBytes, wire.size());
+    EXPECT_GT(stats.Ratio(), 3.0);
+    EXPECT_GT(stats.CpuTime.count(), 0);
+    EXPECT_EQ(decompressor.Stats().RawBytes, data.size());
+
+    // A frame whose chunk sizes do not add up is rejected before anything is written.
+    wire[sizeof(header)] ^= 0x01;
+    EXPECT_THROW(decompressor.Decompress(codec, wire.data(), wire.size(), restored.data(), restored.size()), ZeroCopyRpcException);
+    EXPECT_EQ(PayloadDecompressor::RawSize(wire.data(), wire.size()), 0);
+}
+
+TEST(PayloadCompressionTest, SmallAndIncompressibleFramesAreSentAsTheyAre) {
+    auto codec = AvailableCodec();
+    if (codec == CompressionCodec::None)
+        GTEST_SKIP() << "Built without compression codecs.";
+
+    CompressionConfig config;
+    config.Codec = codec;
+    PayloadCompressor compressor(config);
+    std::vector<uint8_t> wire;
+
+    auto small = Compressible(config.MinSize - 1);
+    EXPECT_EQ(compressor.Compress(small.data(), small.size(), wire), CompressionCodec::None);
+
+    std::vector<uint8_t> noise(64 * 1024);
+    std::mt19937 random(7);
+    for (auto& b : noise)
+        b = static_cast<uint8_t>(random());
+    EXPECT_EQ(compressor.Compress(noise.data(), noise.size(), wire), CompressionCodec::None);
+
+    auto stats = compressor.Stats();
+    EXPECT_EQ(stats.Frames, 2);
+    EXPECT_EQ(stats.Compressed, 0);
+    EXPECT_EQ(stats.WireBytes, stats.RawBytes);
+}
+
+TEST(PayloadCompressionTest, DefragmentatorDecompressesIntoRing) {
+    auto codec = AvailableCodec();
+    if (codec == CompressionCodec::None)
+        GTEST_SKIP() << "Built without compression codecs.";
+
+    CompressionConfig config;
+    config.Codec = codec;
+    config.ChunkSize = 16 * 1024;
+    PayloadCompressor compressor(config);
+    CyclicBuffer buffer(64, 1024 * 1024);
+    UdpFrameDefragmentator defragmentator(buffer, 1472);
+    auto cursor = buffer.OpenCursor();
+
+    // Several fragments per frame, the second frame arrives in reverse order.
+    for (uint64_t frameId = 1; frameId <= 2; frameId++) {
+        auto data = Compressible(200 * 1024);
+        data[100] = static_cast<uint8_t>(frameId);
+        std::vector<uint8_t> wire;
+        ASSERT_EQ(compressor.Compress(data.data(), data.size(), wire), codec);
+
+        UdpFrameIterator<> iterator(wire.data(), wire.size(), 5, frameId, 1472, 9);
+        iterator.SetCodec(static_cast<uint8_t>(codec));
+        std::vector<std::vector<uint8_t>> fragments;
+        for (; iterator.CanRead(); ++iterator) {
+            auto buffers = *iterator;
+            std::vector<uint8_t> datagram(buffers[0].size() + buffers[1].size());
+            std::memcpy(datagram.data(), buffers[0].data(), buffers[0].size());
+            std::memcpy(datagram.data() + buffers[0].size(), buffers[1].data(), buffers[1].size());
+            fragments.push_back(std::move(datagram));
+        }
+        ASSERT_GT(fragments.size(), 2);
+        if (frameId == 2)
+            std::reverse(fragments.begin(), fragments.end());
+
+        size_t committed = 0;
+        for (auto& fragment : fragments)
+            committed += defragmentator.ProcessFragment(fragment.data(), fragment.size());
+        EXPECT_EQ(committed, 1);
+
+        ASSERT_TRUE(cursor.TryRead());
+        auto accessor = cursor.Data();
+        EXPECT_EQ(accessor.Type(), 5);
+        ASSERT_EQ(accessor.Size(), data.size());
+        EXPECT_EQ(std::memcmp(accessor.Get(), data.data(), data.size()), 0);
+    }
+    EXPECT_EQ(defragmentator.DecompressionStats().Frames, 2);
+}
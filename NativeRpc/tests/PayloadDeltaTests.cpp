@@ -0,0 +1,166 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <vector>
+#include "PayloadDelta.h"
+#include "PayloadCompression.h"
+#include "UdpFrameDefragmentator.h"
+#include "UdpFrameProcessor.h"
+
+// Telemetry-like payload: a few samples change from one message to the next.
+static std::vector<uint8_t> Sample(size_t size, uint32_t tick) {
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i + 4 <= size; i += 4) {
+        uint32_t value = static_cast<uint32_t>(i * 7 + 3);
+        std::memcpy(data.data() + i, &value, sizeof(value));
+    }
+    for (size_t i = 0; i < 3; i++) {
+        size_t offset = (tick * 997 + i * 4099) % (size - 4) & ~size_t(3);
+        std::memcpy(data.data() + offset, &tick, sizeof(tick));
+    }
+    return data;
+}
+
+static bool IsKeyframe(const std::vector<uint8_t>& frame) {
+    DeltaFrameHeader header;
+    std::memcpy(&header, frame.data(), sizeof(header));
+    return header.Keyframe != 0;
+}
+
+TEST(PayloadDeltaTest, RoundTripSendsOnlyChangedBlocks) {
+    for (uint16_t blockSize : { 32, 64 }) {
+        DeltaConfig config{ true, 100, blockSize };
+        DeltaEncoder encoder(config);
+        DeltaDecoder decoder;
+        std::vector<uint8_t> frame;
+
+        // Odd size, the last block is shorter.
+        const size_t size = 64 * 1024 + 13;
+        for (uint32_t tick = 0; tick < 20; tick++) {
+            auto data = Sample(size, tick);
+            encoder.Encode(data.data(), data.size(), 3, frame);
+            EXPECT_EQ(IsKeyframe(frame), tick == 0);
+            if (tick != 0) {
+                EXPECT_LT(frame.size(), 1024);
+            }
+
+            ASSERT_EQ(DeltaDecoder::RawSize(frame.data(), frame.size()), size);
+            std::vector<uint8_t> restored(size);
+            ASSERT_TRUE(decoder.Apply(frame.data(), frame.size(), 3, restored.data()));
+            EXPECT_EQ(restored, data);
+        }
+        auto stats = encoder.Stats();
+        EXPECT_EQ(stats.Frames, 20);
+        EXPECT_EQ(stats.Keyframes, 1);
+        EXPECT_LT(stats.EncodedBytes, stats.RawBytes / 10);
+        EXPECT_EQ(decoder.Stats().Frames, 20);
+    }
+    EXPECT_THROW(DeltaEncoder(DeltaConfig{ true, 100, 48 }), std::invalid_argument);
+}
+
+TEST(PayloadDeltaTest, KeyframesAreSentPeriodicallyAndOnSizeChange) {
+    DeltaEncoder encoder(DeltaConfig{ true, 5, 64 });
+    std::vector<uint8_t> frame;
+    std::vector<bool> keyframes;
+    for (uint32_t tick = 0; tick < 12; tick++) {
+        auto data = Sample(tick < 8 ? 4096 : 8192, tick);
+        encoder.Encode(data.data(), data.size(), 1, frame);
+        keyframes.push_back(IsKeyframe(frame));
+    }
+    std::vector<bool> expected{ true, false, false, false, false, true, false, false, true, false, false, false };
+    EXPECT_EQ(keyframes, expected);
+
+    // Types are encoded against their own previous message.
+    auto other = Sample(4096, 0);
+    encoder.Encode(other.data(), other.size(), 2, frame);
+    EXPECT_TRUE(IsKeyframe(frame));
+
+    // A message that changes everywhere is sent whole.
+    auto data = Sample(8192, 12);
+    for (auto& b : data)
+        b ^= 0x5A;
+    encoder.Encode(data.data(), data.size(), 1, frame);
+    EXPECT_TRUE(IsKeyframe(frame));
+    EXPECT_EQ(frame.size(), sizeof(DeltaFrameHeader) + data.size());
+}
+
+TEST(PayloadDeltaTest, LostFrameDropsDeltasUntilKeyframe) {
+    DeltaEncoder encoder(DeltaConfig{ true, 4, 64 });
+    DeltaDecoder decoder;
+    std::vector<uint8_t> frame;
+    std::vector<uint8_t> restored(4096);
+    std::vector<bool> applied;
+    for (uint32_t tick = 0; tick < 9; tick++) {
+        auto data = Sample(restored.size(), tick);
+        encoder.Encode(data.data(), data.size(), 1, frame);
+        if (tick == 2)
+            continue;
+        bool ok = decoder.Apply(frame.data(), frame.size(), 1, restored.data());
+        applied.push_back(ok);
+        if (ok) {
+            EXPECT_EQ(restored, data);
+        }
+    }
+    // Frame 2 is lost, 3 is dropped, 4 is the keyframe.
+    std::vector<bool> expected{ true, true, false, true, true, true, true, true };
+    EXPECT_EQ(applied, expected);
+    EXPECT_EQ(decoder.Stats().Dropped, 1);
+
+    // A run past the end of the message is rejected.
+    auto data = Sample(restored.size(), 9);
+    encoder.Encode(data.data(), data.size(), 1, frame);
+    ASSERT_FALSE(IsKeyframe(frame));
+    DeltaRun run{ 1000, 1 };
+    std::memcpy(frame.data() + sizeof(DeltaFrameHeader), &run, sizeof(run));
+    EXPECT_EQ(DeltaDecoder::RawSize(frame.data(), frame.size()), 0);
+    EXPECT_FALSE(decoder.Apply(frame.data(), frame.size(), 1, restored.data()));
+}
+
+TEST(PayloadDeltaTest, DefragmentatorRebuildsDeltasIntoRing) {
+    CompressionCodec codec = CompressionCodec::None;
+    for (auto candidate : { CompressionCodec::Lz4, CompressionCodec::Zstd, CompressionCodec::Deflate })
+        if (codec == CompressionCodec::None && IsCodecSupported(candidate))
+            codec = candidate;
+
+    CompressionConfig compression;
+    compression.Codec = codec;
+    compression.MinSize = 256;
+    PayloadCompressor compressor(compression);
+    DeltaEncoder encoder(DeltaConfig{ true, 100, 64 });
+    CyclicBuffer buffer(64, 1024 * 1024);
+    UdpFrameDefragmentator defragmentator(buffer, 1472);
+    auto cursor = buffer.OpenCursor();
+
+    for (uint64_t frameId = 1; frameId <= 6; frameId++) {
+        auto data = Sample(32 * 1024, static_cast<uint32_t>(frameId));
+        std::vector<uint8_t> encoded, wire;
+        encoder.Encode(data.data(), data.size(), 5, encoded);
+        // Odd frames also go through the codec, when the build has one.
+        auto used = CompressionCodec::None;
+        if (frameId % 2 == 1 && codec != CompressionCodec::None)
+            used = compressor.Compress(encoded.data(), encoded.size(), wire);
+        if (used == CompressionCodec::None)
+            wire = encoded;
+
+        UdpFrameIterator<> iterator(wire.data(), wire.size(), 5, frameId, 1472, 9);
+        iterator.SetCodec(static_cast<uint8_t>(used));
+        iterator.SetEncoding(static_cast<uint8_t>(PayloadEncoding::Delta));
+        size_t committed = 0;
+        for (; iterator.CanRead(); ++iterator) {
+            auto buffers = *iterator;
+            std::vector<uint8_t> datagram(buffers[0].size() + buffers[1].size());
+            std::memcpy(datagram.data(), buffers[0].data(), buffers[0].size());
+            std::memcpy(datagram.data() + buffers[0].size(), buffers[1].data(), buffers[1].size());
+            committed += defragmentator.ProcessFragment(datagram.data(), datagram.size());
+        }
+        EXPECT_EQ(committed, 1);
+
+        ASSERT_TRUE(cursor.TryRead());
+        auto accessor = cursor.Data();
+        EXPECT_EQ(accessor.Type(), 5);
+        ASSERT_EQ(accessor.Size(), data.size());
+        EXPECT_EQ(std::memcmp(accessor.Get(), data.data(), data.size()), 0);
+    }
+    auto stats = defragmentator.DeltaStats();
+    EXPECT_EQ(stats.Frames, 6);
+    EXPECT_EQ(stats.Keyframes, 1);
+}
@@ -0,0 +1,90 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include "NamedSemaphore.h"
+#include "ProcessWatchdog.h"
+#include "SharedMemoryServer.h"
+#include "SharedMemoryClient.h"
+#include "TestChannel.h"
+#if defined(__linux__)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace std::chrono;
+
+#if defined(__linux__)
+TEST(ProcessWatchdogTest, ReportsExitedProcesses) {
+	// Forked before the watchdog starts its thread.
+	pid_t pid = fork();
+	if (pid == 0) {
+		pause();
+		_exit(0);
+	}
+	std::atomic<pid_t> exited{ 0 };
+	ProcessWatchdog watchdog([&](pid_t pid) { exited.store(pid); });
+	watchdog.Watch(pid);
+	watchdog.Watch(pid);
+	EXPECT_EQ(watchdog.Count(), 1);
+	std::this_thread::sleep_for(milliseconds(20));
+	EXPECT_EQ(exited.load(), 0);
+
+	auto killed = steady_clock::now();
+	kill(pid, SIGKILL);
+	EXPECT_TRUE(WaitUntil([&]() { return exited.load() == pid; }));
+	EXPECT_LT(steady_clock::now() - killed, milliseconds(100));
+	EXPECT_FALSE(watchdog.IsWatched(pid));
+	waitpid(pid, nullptr, 0);
+
+	// A process that is gone already is reported as well.
+	exited.store(0);
+	watchdog.Watch(pid);
+	EXPECT_TRUE(WaitUntil([&]() { return exited.load() == pid; }));
+	EXPECT_EQ(watchdog.Count(), 0);
+}
+
+TEST(ProcessWatchdogTest, ServerEvictsCrashedSubscriber) {
+	RemoveChannel("Watchdog");
+	ForkedChild child([]() {
+		// Subscribes and dies without cleaning up.
+		SharedMemoryClient client("Watchdog");
+		client.Connect();
+		auto cursor = client.Subscribe("Topic");
+		_exit(0);
+		return 0;
+	});
+	pid_t pid = child.Pid();
+	{
+		SharedMemoryServer srv("Watchdog");
+		TopicService* topic = srv.CreateTopic("Topic", 16, 64 * 1024);
+		child.Start();
+		EXPECT_EQ(child.Wait(), 0);
+
+		// Reclaimed without a publish.
+		EXPECT_TRUE(WaitUntil([&]() { return topic->SubscriberPids().empty(); }));
+		auto queueName = "Watchdog." + std::to_string(pid);
+		EXPECT_TRUE(WaitUntil([&]() {
+			try {
+				message_queue queue(open_only, queueName.c_str());
+				return false;
+			}
+			catch (const interprocess_exception&) {
+				return true;
+			}
+		}));
+		auto semName = "Watchdog.Topic." + std::to_string(pid) + ".0.sem";
+		EXPECT_THROW(NamedSemaphore(semName, NamedSemaphore::OpenMode::Open), std::exception);
+
+		// The slot came back as well.
+		shared_memory_object shm(open_only, "Watchdog.Topic.buffer", read_only);
+		mapped_region region(shm, read_only);
+		auto metadata = (TopicMetadata*)region.get_address();
+		auto subscribers = (SubscriptionSharedData*)metadata->SubscribersTableAddress(region.get_address());
+		EXPECT_FALSE(subscribers[0].Active.load());
+		EXPECT_FALSE(subscribers[0].PendingRemove.load());
+	}
+	RemoveChannel("Watchdog");
+}
+#endif
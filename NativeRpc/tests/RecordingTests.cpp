@@ -0,0 +1,319 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include "RecordingLog.h"
+#include "TopicRecorder.h"
+#include "TopicReplayer.h"
+#include "SharedMemoryServer.h"
+#include "UdpReplicationMessages.h"
+
+using namespace std::chrono;
+namespace fs = std::filesystem;
+
+struct RecordedEntry {
+    RecordingEntryHeader Header;
+    std::vector<uint8_t> Payload;
+    uint64_t Offset;
+};
+
+static std::vector<uint8_t> ReadFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), {});
+}
+
+static std::vector<RecordedEntry> ReadSegment(const RecordingConfig& config, uint64_t segment) {
+    auto log = ReadFile(config.SegmentPath(segment, "log"));
+    EXPECT_GE(log.size(), sizeof(RecordingSegmentHeader));
+    auto header = reinterpret_cast<const RecordingSegmentHeader*>(log.data());
+    EXPECT_TRUE(header->IsValid());
+    EXPECT_EQ(header->Segment, segment);
+    EXPECT_EQ(header->Used, log.size());
+
+    std::vector<RecordedEntry> entries;
+    size_t offset = sizeof(RecordingSegmentHeader);
+    while (offset + sizeof(RecordingEntryHeader) <= log.size()) {
+        auto entry = reinterpret_cast<const RecordingEntryHeader*>(log.data() + offset);
+        if (entry->Kind == RecordingEntryKind::None)
+            break;
+        auto payload = log.data() + offset + sizeof(RecordingEntryHeader);
+        entries.push_back({ *entry, std::vector<uint8_t>(payload, payload + entry->Size), offset });
+        offset += entry->Stride();
+    }
+    EXPECT_EQ(offset, log.size());
+    return entries;
+}
+
+static std::vector<RecordingIndexEntry> ReadIndex(const RecordingConfig& config, uint64_t segment) {
+    auto data = ReadFile(config.SegmentPath(segment, "idx"));
+    std::vector<RecordingIndexEntry> index(data.size() / sizeof(RecordingIndexEntry));
+    std::memcpy(index.data(), data.data(), index.size() * sizeof(RecordingIndexEntry));
+    return index;
+}
+
+class RecordingTest : public ::testing::Test {
+protected:
+    RecordingConfig config;
+
+    void SetUp() override {
+        config.Directory = (fs::temp_directory_path() / ("zq-recording-" + std::to_string(::getpid()))).string();
+        fs::remove_all(config.Directory);
+        config.SegmentSize = 4096;
+        config.IndexInterval = 1024;
+    }
+    void TearDown() override {
+        fs::remove_all(config.Directory);
+    }
+};
+
+TEST_F(RecordingTest, WriterRollsSegmentsAndIndexesThem) {
+    uint64_t segments;
+    {
+        RecordingLogWriter writer(config);
+        writer.AddTopic(7, "Boo");
+        uint8_t payload[100];
+        for (uint64_t i = 0; i < 100; i++) {
+            std::memset(payload, static_cast<int>(i), sizeof(payload));
+            writer.Append(7, i, 1000 + i, 3, payload, sizeof(payload));
+        }
+        // The last one was overwritten while it was copied.
+        writer.Rewind();
+        segments = writer.Segments();
+    }
+    ASSERT_GT(segments, 2);
+
+    uint64_t expected = 0;
+    for (uint64_t segment = 0; segment < segments; segment++) {
+        auto entries = ReadSegment(config, segment);
+        ASSERT_GE(entries.size(), 2);
+        // Every segment names its topics first.
+        EXPECT_EQ(entries[0].Header.Kind, RecordingEntryKind::Topic);
+        EXPECT_EQ(entries[0].Header.TopicId, 7);
+        EXPECT_EQ(std::string(entries[0].Payload.begin(), entries[0].Payload.end()), "Boo");
+
+        for (size_t i = 1; i < entries.size(); i++, expected++) {
+            auto& entry = entries[i];
+            ASSERT_EQ(entry.Header.Kind, RecordingEntryKind::Message);
+            EXPECT_EQ(entry.Header.Sequence, expected);
+            EXPECT_EQ(entry.Header.Timestamp, 1000 + expected);
+            EXPECT_EQ(entry.Header.Type, 3);
+            ASSERT_EQ(entry.Payload.size(), 100);
+            EXPECT_EQ(entry.Payload[99], expected);
+        }
+
+        // First message is indexed, then one every IndexInterval bytes, each pointing at its entry.
+        auto index = ReadIndex(config, segment);
+        ASSERT_GE(index.size(), 1);
+        EXPECT_EQ(index[0].Offset, entries[1].Offset);
+        for (auto& item : index) {
+            auto it = std::find_if(entries.begin(), entries.end(), [&](auto& e) { return e.Offset == item.Offset; });
+            ASSERT_NE(it, entries.end());
+            EXPECT_EQ(it->Header.Sequence, item.Sequence);
+            EXPECT_EQ(it->Header.Timestamp, item.Timestamp);
+        }
+        if (entries.back().Offset - entries[1].Offset >= config.IndexInterval) {
+            EXPECT_GE(index.size(), 2);
+        }
+    }
+    EXPECT_EQ(expected, 99);
+}
+
+TEST_F(RecordingTest, WriterGivesLargeMessageItsOwnSegment) {
+    {
+        RecordingLogWriter writer(config);
+        writer.AddTopic(1, "Boo");
+        std::vector<uint8_t> small(10, 1), large(3 * config.SegmentSize, 2);
+        writer.Append(1, 0, 0, 0, small.data(), small.size());
+        writer.Append(1, 1, 0, 0, large.data(), large.size());
+        writer.Append(1, 2, 0, 0, small.data(), small.size());
+        EXPECT_EQ(writer.Segments(), 3);
+    }
+    EXPECT_EQ(ReadSegment(config, 0).size(), 2);
+    auto large = ReadSegment(config, 1);
+    ASSERT_EQ(large.size(), 2);
+    EXPECT_EQ(large[1].Payload.size(), 3 * config.SegmentSize);
+
+    // A restarted writer continues after the existing segments.
+    RecordingLogWriter writer(config);
+    writer.Append(1, 3, 0, 0, "x", 1);
+    writer.Close();
+    EXPECT_EQ(ReadSegment(config, 3).size(), 1);
+}
+
+TEST_F(RecordingTest, ReaderReadsInOrderAndSeeksByTimestamp) {
+    {
+        RecordingLogWriter writer(config);
+        writer.AddTopic(7, "Boo");
+        uint8_t payload[100] = {};
+        for (uint64_t i = 0; i < 100; i++)
+            writer.Append(7, i, 1000 + i * 10, 3, payload, sizeof(payload));
+        ASSERT_GT(writer.Segments(), 2);
+    }
+
+    RecordingLogReader reader(config);
+    EXPECT_EQ(reader.TopicName(7), "Boo");
+    EXPECT_EQ(reader.TopicName(8), "");
+    const RecordingEntryHeader* entry;
+    const uint8_t* payload;
+    for (uint64_t i = 0; i < 100; i++) {
+        ASSERT_TRUE(reader.Next(entry, payload));
+        EXPECT_EQ(entry->Sequence, i);
+        EXPECT_EQ(payload, reinterpret_cast<const uint8_t*>(entry + 1));
+    }
+    EXPECT_FALSE(reader.Next(entry, payload));
+
+    // In the middle of a segment, between two timestamps, at the first message of a segment and before the start.
+    for (uint64_t seq : { 57, 33, 26, 0 }) {
+        reader.Seek(1000 + seq * 10 - 5);
+        ASSERT_TRUE(reader.Next(entry, payload)) << seq;
+        EXPECT_EQ(entry->Sequence, seq);
+    }
+    reader.Seek(1000 + 40 * 10);
+    ASSERT_TRUE(reader.Next(entry, payload));
+    EXPECT_EQ(entry->Sequence, 40);
+    reader.Seek(5000);
+    EXPECT_FALSE(reader.Next(entry, payload));
+}
+
+struct RecordedValue {
+    ulong value;
+};
+
+TEST_F(RecordingTest, RecorderAppendsHistoryAndLiveMessages) {
+    message_queue::remove("RecFoo");
+    TopicService::TryRemove("RecFoo", "RecBoo");
+    config.SegmentSize = 64 * 1024;
+
+    SharedMemoryServer srv("RecFoo");
+    TopicService* topic = srv.CreateTopic("RecBoo");
+    for (ulong i = 0; i < 5; i++)
+        topic->Publish<RecordedValue>(1, i);
+
+    RecorderStats stats;
+    {
+        TopicRecorder recorder("RecFoo", config);
+        recorder.RecordTopic("RecBoo", SubscribeStart::Oldest());
+        for (ulong i = 5; i < 10; i++)
+            topic->Publish<RecordedValue>(1, i);
+
+        auto deadline = steady_clock::now() + seconds(5);
+        while (recorder.Stats().Messages < 10 && steady_clock::now() < deadline)
+            std::this_thread::sleep_for(milliseconds(10));
+        recorder.Stop();
+        stats = recorder.Stats();
+    }
+    EXPECT_EQ(stats.Messages, 10);
+    EXPECT_EQ(stats.Dropped, 0);
+    EXPECT_EQ(stats.Segments, 1);
+
+    auto entries = ReadSegment(config, 0);
+    ASSERT_EQ(entries.size(), 11);
+    EXPECT_EQ(entries[0].Header.TopicId, UdpTopicId("RecBoo"));
+    for (ulong i = 0; i < 10; i++) {
+        auto& entry = entries[i + 1].Header;
+        EXPECT_EQ(entry.Sequence, i);
+        EXPECT_EQ(entry.Type, 1);
+        ASSERT_EQ(entry.Size, sizeof(RecordedValue));
+        EXPECT_EQ(reinterpret_cast<const RecordedValue*>(entries[i + 1].Payload.data())->value, i);
+    }
+}
+
+TEST_F(RecordingTest, RecorderKeepsRecordsOfTopicsInTimeOrder) {
+    const std::vector<std::string> TOPICS = { "RecA", "RecB", "RecC" };
+    message_queue::remove("RecFoo");
+    for (auto& name : TOPICS)
+        TopicService::TryRemove("RecFoo", name);
+    config.SegmentSize = 1024 * 1024;
+
+    SharedMemoryServer srv("RecFoo");
+    std::vector<TopicService*> topics;
+    for (auto& name : TOPICS)
+        topics.push_back(srv.CreateTopic(name));
+    {
+        TopicRecorder recorder("RecFoo", config);
+        for (auto& name : TOPICS)
+            recorder.RecordTopic(name);
+        std::vector<std::thread> publishers;
+        for (auto topic : topics)
+            publishers.emplace_back([topic]() {
+                for (ulong i = 0; i < 200; i++)
+                    topic->Publish<RecordedValue>(1, i);
+            });
+        for (auto& publisher : publishers)
+            publisher.join();
+
+        auto deadline = steady_clock::now() + seconds(5);
+        while (recorder.Stats().Messages < 600 && steady_clock::now() < deadline)
+            std::this_thread::sleep_for(milliseconds(10));
+        recorder.Stop();
+        EXPECT_EQ(recorder.Stats().Messages, 600);
+    }
+
+    uint64_t last = 0;
+    size_t messages = 0;
+    for (auto& entry : ReadSegment(config, 0)) {
+        if (entry.Header.Kind != RecordingEntryKind::Message)
+            continue;
+        EXPECT_GE(entry.Header.Timestamp, last);
+        last = entry.Header.Timestamp;
+        messages++;
+    }
+    EXPECT_EQ(messages, 600);
+}
+
+static double ReplayMilliseconds(SharedMemoryServer& srv, const RecordingConfig& recording, ReplayConfig config,
+    ReplayStats& stats) {
+    TopicReplayer replayer(srv, recording, config);
+    auto start = steady_clock::now();
+    stats = replayer.Run();
+    return duration<double, std::milli>(steady_clock::now() - start).count();
+}
+
+TEST_F(RecordingTest, ReplayerKeepsRecordedTiming) {
+    message_queue::remove("RepFoo");
+    TopicService::TryRemove("RepFoo", "RepBoo");
+    {
+        RecordingLogWriter writer(config);
+        writer.AddTopic(UdpTopicId("RepBoo"), "RepBoo");
+        writer.AddTopic(UdpTopicId("Other"), "Other");
+        // Five messages 20ms apart, interleaved with a topic that is not replayed.
+        for (ulong i = 0; i < 5; i++) {
+            RecordedValue value{ i };
+            writer.Append(UdpTopicId("RepBoo"), i, 1'000'000'000 + i * 20'000'000, 1, &value, sizeof(value));
+            writer.Append(UdpTopicId("Other"), i, 1'000'000'000 + i * 20'000'000, 1, &value, sizeof(value));
+        }
+    }
+
+    SharedMemoryServer srv("RepFoo");
+    ReplayConfig config;
+    config.Topics = { "RepBoo" };
+    ReplayStats stats;
+
+    double elapsed = ReplayMilliseconds(srv, this->config, config, stats);
+    EXPECT_GE(elapsed, 78.0);
+    EXPECT_LT(elapsed, 200.0);
+    EXPECT_EQ(stats.Messages, 5);
+    EXPECT_LT(stats.Lag, milliseconds(5));
+
+    config.Speed = 4;
+    elapsed = ReplayMilliseconds(srv, this->config, config, stats);
+    EXPECT_GE(elapsed, 19.0);
+    EXPECT_LT(elapsed, 60.0);
+
+    config.Speed = 0;
+    config.From = 1'000'000'000 + 3 * 20'000'000;
+    elapsed = ReplayMilliseconds(srv, this->config, config, stats);
+    EXPECT_LT(elapsed, 15.0);
+    EXPECT_EQ(stats.Messages, 2);
+
+    // 5 + 5 + 2 copies landed in the topic.
+    auto buffer = srv.CreateTopic("RepBoo")->GetBuffer();
+    ASSERT_EQ(buffer->NextIndex(), 12);
+    auto cursor = buffer->OpenCursor(0);
+    for (ulong expected : { 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 3, 4 }) {
+        ASSERT_TRUE(cursor.TryRead());
+        EXPECT_EQ(cursor.Data().As<RecordedValue>()->value, expected);
+    }
+}
@@ -1,10 +1,14 @@
 #include <gtest/gtest.h>
 #include "TcpReplicator.h"
+#include "UdpFrameProcessor.h"
+#include "UdpFrameDefragmentator.h"
+#include "UdpReplicator.h"
 #include <thread>
 #include <future>
 
 #include "StopWatch.h"
 #include "ThreadSpin.h"
+#include "TestChannel.h"
 
 struct TestMessage {
     int64_t Value;
@@ -156,4 +160,335 @@ TEST_F(ReplicationTest, HandlesSlaveDisconnection) {
     auto* received = reinterpret_cast<const TestMessage*>(data.Get());
     EXPECT_EQ(received->Value, 2);
     EXPECT_STREQ(received->Data, "after reconnect");
-}
\ No newline at end of file
+}
+
+// Every 7th data fragment is dropped on its way to a loopback socket; FEC must rebuild all frames.
+// A target that accepts only some codecs gets the configured one when it accepts it, another one both sides support
+// when it does not, and plain messages when it accepts none.
+TEST(TcpCodecNegotiationTest, SourceFallsBackToACodecTheTargetAccepts) {
+    auto bit = [](CompressionCodec codec) { return 1u << static_cast<uint8_t>(codec); };
+    std::vector<CompressionCodec> supported;
+    for (auto codec : { CompressionCodec::Lz4, CompressionCodec::Zstd, CompressionCodec::Deflate })
+        if (IsCodecSupported(codec))
+            supported.push_back(codec);
+    if (supported.empty())
+        GTEST_SKIP() << "Built without compression codecs.";
+
+    // With a single codec in the build, the target that refuses it gets plain messages.
+    const CompressionCodec configured = supported.front();
+    const CompressionCodec fallback = supported.size() > 1 ? supported[1] : CompressionCodec::None;
+    struct Case { const char* Topic; uint32_t Accepted; CompressionCodec Expected; };
+    std::vector<Case> cases = {
+        { "Preferred", SupportedCodecs(), configured },
+        { "Fallback", SupportedCodecs() & ~bit(configured), fallback },
+        { "Plain", bit(CompressionCodec::None), CompressionCodec::None },
+    };
+    RemoveChannel("codec_source", { "Preferred", "Fallback", "Plain" });
+
+    struct Samples { uint32_t Values[1024]; };
+    Samples samples;
+    for (uint32_t i = 0; i < 1024; i++)
+        samples.Values[i] = 1000 + i / 64;
+
+    asio::io_context io;
+    SharedMemoryServer server("codec_source");
+    CompressionConfig compression;
+    compression.Codec = configured;
+    {
+        TcpReplicationSource source(io, "codec_source", 5561, compression);
+        for (auto& c : cases) {
+            TopicService* topic = server.CreateTopic(c.Topic);
+            tcp::socket socket(io);
+            socket.connect(tcp::endpoint(asio::ip::address_v4::loopback(), 5561));
+            TcpReplicationHeader header;
+            header.TopicNameLength = static_cast<uint32_t>(strlen(c.Topic));
+            header.AcceptedCodecs = c.Accepted;
+            header.AcceptedEncodings = 1u << static_cast<uint8_t>(PayloadEncoding::Raw);
+            asio::write(socket, asio::buffer(&header, sizeof(header)));
+            asio::write(socket, asio::buffer(c.Topic, header.TopicNameLength));
+            ASSERT_TRUE(WaitUntil([&]() { return !topic->SubscriberPids().empty(); })) << c.Topic;
+
+            topic->Publish<Samples>(1, samples);
+            TcpReplicationMessage message;
+            asio::read(socket, asio::buffer(&message, sizeof(message)));
+            EXPECT_EQ(message.Codec, c.Expected) << c.Topic;
+            if (c.Expected == CompressionCodec::None)
+                EXPECT_EQ(message.Size, sizeof(Samples)) << c.Topic;
+            else
+                EXPECT_LT(message.Size, sizeof(Samples)) << c.Topic;
+            std::vector<uint8_t> payload(message.Size);
+            asio::read(socket, asio::buffer(payload));
+
+            // The replication thread lets go of the subscription once a write to the closed socket fails.
+            socket.close();
+            EXPECT_TRUE(WaitUntil([&]() {
+                topic->Publish<Samples>(1, samples);
+                return topic->SubscriberPids().empty();
+            })) << c.Topic;
+        }
+    }
+    RemoveChannel("codec_source", { "Preferred", "Fallback", "Plain" });
+}
+
+TEST(UdpFecReplicationTest, RecoversInjectedLossOnLoopback) {
+    asio::io_context io;
+    asio::ip::udp::socket receiver(io, asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0));
+    asio::ip::udp::socket sender(io, asio::ip::udp::endpoint(asio::ip::udp::v4(), 0));
+    receiver.set_option(socket_base::receive_buffer_size(8 * 1024 * 1024));
+    auto target = receiver.local_endpoint();
+
+    CyclicBuffer buffer(64, 4 * 1024 * 1024);
+    UdpFrameDefragmentator defragmentator(buffer, 1472);
+    auto cursor = buffer.OpenCursor();
+    UdpFecEncoder encoder(UdpFecConfig(6, 2));
+
+    const int FRAMES = 10;
+    std::vector<uint8_t> frame(100000);
+    size_t sent = 0;
+    for (int f = 0; f < FRAMES; f++) {
+        for (size_t i = 0; i < frame.size(); i++)
+            frame[i] = static_cast<uint8_t>(i + f);
+
+        UdpFrameIterator<> iterator(frame.data(), frame.size(), 1, f + 1, 1472);
+        encoder.Encode(frame.data(), frame.size(), iterator.FragmentSize());
+        iterator.Protect(encoder);
+        const size_t chunks = (frame.size() + iterator.FragmentSize() - 1) / iterator.FragmentSize();
+        for (size_t seq = 0; iterator.CanRead(); ++iterator, ++seq)
+            if (seq >= chunks || ++sent % 7 != 0)
+                sender.send_to(*iterator, target);
+
+        std::vector<uint8_t> datagram(1472);
+        bool completed = false;
+        while (!completed && receiver.available() > 0) {
+            size_t size = receiver.receive(asio::buffer(datagram));
+            completed = defragmentator.ProcessFragment(datagram.data(), size);
+        }
+        ASSERT_TRUE(completed) << "frame " << f;
+        ASSERT_TRUE(cursor.TryRead());
+        auto accessor = cursor.Data();
+        ASSERT_EQ(frame, std::vector<uint8_t>(accessor.Get(), accessor.Get() + accessor.Size()));
+        // Remaining parity of a completed frame is ignored.
+        while (receiver.available() > 0)
+            defragmentator.ProcessFragment(datagram.data(), receiver.receive(asio::buffer(datagram)));
+    }
+}
+
+// Two targets on one host join the same group; a single transmit of the source, sent out of the configured
+// interface, reaches both, with the configured TTL.
+TEST(UdpMulticastReplicationTest, OneTransmitFeedsEveryTarget) {
+    const std::string TOPIC = "mcast_topic";
+    const std::string SOURCE = "mcast_source";
+    const std::vector<std::string> CHANNELS = { "mcast_a", "mcast_b" };
+    std::string group = "239.255.42.99";
+    const uint16_t PORT = 6099;
+
+    asio::io_context io;
+    UdpMulticastConfig multicast;
+    multicast.Interface = "127.0.0.1";
+    multicast.Ttl = 3;
+    multicast.Loopback = true;
+    std::vector<std::shared_ptr<SharedMemoryServer>> servers;
+    std::vector<std::unique_ptr<UdpReplicationTarget>> targets;
+    for (auto& channel : CHANNELS) {
+        message_queue::remove(channel.c_str());
+        TopicService::TryRemove(channel, TOPIC);
+        servers.push_back(std::make_shared<SharedMemoryServer>(channel));
+        targets.push_back(std::make_unique<UdpReplicationTarget>(io, servers.back(), group, PORT, 9000, UdpNackConfig{}, multicast));
+        targets.back()->ReplicateTopic(TOPIC);
+    }
+#if defined(__linux__)
+    // Listens to the group alongside the targets, for the TTL the datagrams were sent with.
+    asio::ip::udp::socket listener(io, asio::ip::udp::v4());
+    listener.set_option(asio::socket_base::reuse_address(true));
+    listener.bind(asio::ip::udp::endpoint(asio::ip::address_v4::any(), PORT));
+    listener.set_option(asio::ip::multicast::join_group(asio::ip::make_address_v4(group), asio::ip::make_address_v4(multicast.Interface)));
+    int on = 1;
+    ::setsockopt(listener.native_handle(), IPPROTO_IP, IP_RECVTTL, &on, sizeof(on));
+#endif
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    std::vector<std::unique_ptr<SharedMemoryClient>> clients;
+    std::vector<std::unique_ptr<ISubscriptionCursor>> cursors;
+    for (auto& channel : CHANNELS) {
+        clients.push_back(std::make_unique<SharedMemoryClient>(channel));
+        clients.back()->Connect();
+        cursors.push_back(clients.back()->Subscribe(TOPIC));
+    }
+
+    message_queue::remove(SOURCE.c_str());
+    TopicService::TryRemove(SOURCE, TOPIC);
+    auto sourceServer = std::make_unique<SharedMemoryServer>(SOURCE);
+    TopicService* topic = sourceServer->CreateTopic(TOPIC);
+    auto source = std::make_unique<UdpReplicationSource>(io, SOURCE, false, 1500, UdpFecConfig{}, UdpRetransmitConfig{}, multicast);
+    source->ReplicateTopic(TOPIC, group, PORT);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    std::vector<uint8_t> frame(20000);
+    for (size_t i = 0; i < frame.size(); i++)
+        frame[i] = static_cast<uint8_t>(i);
+    {
+        auto scope = topic->Prepare(frame.size(), 1);
+        std::memcpy(scope.Span().Start, frame.data(), frame.size());
+        scope.Span().Commit(frame.size());
+    }
+
+    for (auto& cursor : cursors) {
+        CyclicBuffer::Accessor data;
+        ASSERT_TRUE(cursor->TryReadFor(data, std::chrono::milliseconds(1000)));
+        EXPECT_EQ(data.Type(), 1);
+        ASSERT_EQ(frame, std::vector<uint8_t>(data.Get(), data.Get() + data.Size()));
+    }
+#if defined(__linux__)
+    std::vector<uint8_t> datagram(1500);
+    iovec vector{ datagram.data(), datagram.size() };
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    msghdr message{};
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    ASSERT_GT(::recvmsg(listener.native_handle(), &message, MSG_DONTWAIT), 0);
+    int ttl = -1;
+    for (auto c = CMSG_FIRSTHDR(&message); c != nullptr; c = CMSG_NXTHDR(&message, c))
+        if (c->cmsg_level == IPPROTO_IP && c->cmsg_type == IP_TTL)
+            std::memcpy(&ttl, CMSG_DATA(c), sizeof(ttl));
+    EXPECT_EQ(ttl, multicast.Ttl);
+#endif
+
+    source.reset();
+    sourceServer.reset();
+    cursors.clear();
+    clients.clear();
+    targets.clear();
+}
+
+// Fragments of two topics are interleaved on one socket; the target routes them by topic id.
+TEST(UdpMultiTopicReplicationTest, TopicsShareOneSocket) {
+    const std::vector<std::string> TOPICS = { "udp_topic_a", "udp_topic_b" };
+    const std::string CHANNEL = "udp_multi_topic";
+    std::string host = "127.0.0.1";
+    const uint16_t PORT = 6098;
+
+    message_queue::remove(CHANNEL.c_str());
+    for (auto& topic : TOPICS)
+        TopicService::TryRemove(CHANNEL, topic);
+
+    asio::io_context io;
+    auto server = std::make_shared<SharedMemoryServer>(CHANNEL);
+    auto target = std::make_unique<UdpReplicationTarget>(io, server, host, PORT);
+    for (auto& topic : TOPICS)
+        target->ReplicateTopic(topic);
+
+    SharedMemoryClient client(CHANNEL);
+    client.Connect();
+    std::vector<std::unique_ptr<ISubscriptionCursor>> cursors;
+    for (auto& topic : TOPICS)
+        cursors.push_back(client.Subscribe(topic));
+
+    std::vector<std::vector<uint8_t>> frames;
+    std::vector<UdpFrameIterator<>> iterators;
+    for (size_t t = 0; t < TOPICS.size(); t++) {
+        frames.emplace_back(30000 + t * 1000);
+        for (size_t i = 0; i < frames[t].size(); i++)
+            frames[t][i] = static_cast<uint8_t>(i * (t + 1));
+    }
+    // Type no longer fits in 8 bits.
+    const uint64_t type = 0x1234567890ull;
+    for (size_t t = 0; t < TOPICS.size(); t++)
+        iterators.emplace_back(frames[t].data(), frames[t].size(), type + t, 1, 1472, UdpTopicId(TOPICS[t]));
+
+    asio::ip::udp::socket sender(io, asio::ip::udp::endpoint(asio::ip::udp::v4(), 0));
+    asio::ip::udp::endpoint endpoint(asio::ip::make_address(host), PORT);
+    while (iterators[0].CanRead() || iterators[1].CanRead())
+        for (auto& iterator : iterators)
+            if (iterator.CanRead()) {
+                sender.send_to(*iterator, endpoint);
+                ++iterator;
+            }
+
+    for (size_t t = 0; t < TOPICS.size(); t++) {
+        CyclicBuffer::Accessor data;
+        ASSERT_TRUE(cursors[t]->TryReadFor(data, std::chrono::milliseconds(1000)));
+        EXPECT_EQ(data.Type(), type + t);
+        ASSERT_EQ(frames[t], std::vector<uint8_t>(data.Get(), data.Get() + data.Size()));
+    }
+
+    cursors.clear();
+    target.reset();
+}
+
+// The test plays the target: it drops a frame's fragments, nacks some of them and expects just those again, and
+// nothing for a frame whose entry was reused in the ring meanwhile.
+TEST(UdpRetransmissionTest, NackedFragmentsAreSentAgainFromTheRing) {
+    const std::string TOPIC = "udp_retransmit_topic";
+    const std::string CHANNEL = "udp_retransmit";
+    message_queue::remove(CHANNEL.c_str());
+    TopicService::TryRemove(CHANNEL, TOPIC);
+
+    asio::io_context io;
+    asio::ip::udp::socket receiver(io, asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0));
+    receiver.set_option(socket_base::receive_buffer_size(8 * 1024 * 1024));
+    auto server = std::make_unique<SharedMemoryServer>(CHANNEL);
+    TopicService* topic = server->CreateTopic(TOPIC, 4, 1024 * 1024);
+    UdpRetransmitConfig retransmit;
+    retransmit.Window = 16;
+    auto source = std::make_unique<UdpReplicationSource>(io, CHANNEL, false, 1500, UdpFecConfig{}, retransmit);
+    source->ReplicateTopic(TOPIC, "127.0.0.1", receiver.local_endpoint().port());
+
+    auto publish = [&](uint8_t seed) {
+        auto scope = topic->Prepare(10000, 1);
+        for (size_t i = 0; i < 10000; i++)
+            scope.Span().Start[i] = static_cast<uint8_t>(i + seed);
+        scope.Span().Commit(10000);
+    };
+    std::vector<uint8_t> datagram(1500);
+    asio::ip::udp::endpoint sourceEndpoint;
+    auto receive = [&](std::chrono::milliseconds timeout) -> UdpReplicationMessageHeader* {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (receiver.available() == 0) {
+            if (std::chrono::steady_clock::now() >= deadline)
+                return nullptr;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        receiver.receive_from(asio::buffer(datagram), sourceEndpoint);
+        return reinterpret_cast<UdpReplicationMessageHeader*>(datagram.data());
+    };
+    auto nack = [&](uint64_t frameId) {
+        UdpNackMessage message{};
+        message.FrameId = frameId;
+        message.TopicId = UdpTopicId(TOPIC);
+        message.First = 0;
+        message.Words = 1;
+        message.Missing[0] = 0b1010;
+        receiver.send_to(asio::buffer(&message, message.Size()), sourceEndpoint);
+    };
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    publish(7);
+    auto header = receive(std::chrono::milliseconds(1000));
+    ASSERT_NE(header, nullptr);
+    uint64_t frameId = header->FrameId;
+    size_t fragmentSize = header->FragmentSize;
+    while (receive(std::chrono::milliseconds(50)) != nullptr) {}
+
+    nack(frameId);
+    for (uint32_t expected : { 1u, 3u }) {
+        header = receive(std::chrono::milliseconds(1000));
+        ASSERT_NE(header, nullptr);
+        EXPECT_EQ(header->FrameId, frameId);
+        ASSERT_EQ(header->Sequence, expected);
+        for (size_t i = 0; i < fragmentSize; i++)
+            ASSERT_EQ(datagram[HEADER_SIZE + i], static_cast<uint8_t>(expected * fragmentSize + i + 7)) << i;
+    }
+    EXPECT_EQ(receive(std::chrono::milliseconds(50)), nullptr);
+
+    // Four more frames reuse the entries of a ring of four.
+    for (uint8_t seed = 0; seed < 4; seed++)
+        publish(seed);
+    while (receive(std::chrono::milliseconds(50)) != nullptr) {}
+    nack(frameId);
+    EXPECT_EQ(receive(std::chrono::milliseconds(100)), nullptr);
+
+    source.reset();
+    server.reset();
+}
@@ -15,6 +15,10 @@
 #include "ThreadSpin.h"
 #include "BigFrame.hpp"
 #include "ZeroCopyRpcException.h"
+#if defined(__linux__)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 using namespace std::chrono;
 using namespace std;
@@ -190,6 +194,376 @@ TEST_F(SharedMemoryServerTest, LateSubscriptionScenario) {
 	EXPECT_FALSE(second);
 }
 
+TEST_F(SharedMemoryServerTest, SubscribeFromHistory) {
+	ClearPreviousStuff();
+
+	srv = new SharedMemoryServer("Foo");
+	TopicService* topic = srv->CreateTopic("Boo");
+	client = new SharedMemoryClient("Foo");
+	client->Connect();
+
+	for (ulong i = 0; i < 10; i++)
+		topic->Publish<Message>(1, i);
+
+	// History is readable right after subscribing, without waiting for the next publish.
+	auto last = client->Subscribe("Boo", SubscribeStart::Last(3));
+	auto at = client->Subscribe("Boo", SubscribeStart::At(5));
+	auto oldest = client->Subscribe("Boo", SubscribeStart::Oldest());
+	auto latest = client->Subscribe("Boo");
+
+	auto expect = [](ISubscriptionCursor& cursor, ulong from, ulong to) {
+		CyclicBuffer::Accessor accessor;
+		for (ulong i = from; i < to; i++) {
+			ASSERT_TRUE(cursor.TryRead(accessor)) << i;
+			EXPECT_EQ(accessor.As<Message>()->value, i);
+		}
+		EXPECT_FALSE(cursor.TryRead(accessor));
+	};
+	expect(*last, 7, 10);
+	expect(*at, 5, 10);
+	expect(*oldest, 0, 10);
+	expect(*latest, 0, 0);
+
+	// Then every cursor continues with live messages.
+	topic->Publish<Message>(1, 10ul);
+	for (auto* cursor : { last.get(), at.get(), oldest.get(), latest.get() })
+		expect(*cursor, 10, 11);
+}
+
+TEST_F(SharedMemoryServerTest, SubscribeWithTypeFilter) {
+	ClearPreviousStuff();
+
+	srv = new SharedMemoryServer("Foo");
+	TopicService* topic = srv->CreateTopic("Boo");
+	client = new SharedMemoryClient("Foo");
+	client->Connect();
+
+	// Types 1..5 in turn, values follow the index.
+	for (ulong i = 0; i < 20; i++)
+		topic->Publish<Message>(1 + i % 5, i);
+
+	auto filtered = client->Subscribe("Boo", SubscribeStart::Oldest(), TypeFilter::Of({ 2, 4 }));
+	auto all = client->Subscribe("Boo", SubscribeStart::Oldest());
+
+	CyclicBuffer::Accessor accessor;
+	for (ulong i = 0; i < 20; i++) {
+		ASSERT_TRUE(all->TryRead(accessor));
+		EXPECT_EQ(accessor.As<Message>()->value, i);
+		if (i % 5 != 1 && i % 5 != 3)
+			continue;
+		ASSERT_TRUE(filtered->TryRead(accessor)) << i;
+		EXPECT_EQ(accessor.As<Message>()->value, i);
+		EXPECT_EQ(accessor.Type(), 1 + i % 5);
+	}
+	EXPECT_FALSE(filtered->TryRead(accessor));
+
+	// Other types do not wake the filtered subscriber.
+	topic->Publish<Message>(3, 20ul);
+	topic->Publish<Message>(5, 21ul);
+	EXPECT_FALSE(filtered->TryReadFor(accessor, milliseconds(10)));
+	topic->Publish<Message>(4, 22ul);
+	ASSERT_TRUE(filtered->TryReadFor(accessor, milliseconds(10)));
+	EXPECT_EQ(accessor.As<Message>()->value, 22);
+	EXPECT_FALSE(filtered->TryRead(accessor));
+}
+
+TEST_F(SharedMemoryServerTest, ConflatingTopicReadsLatest) {
+	ClearPreviousStuff();
+
+	srv = new SharedMemoryServer("Foo");
+	TopicService* topic = srv->CreateTopic("Boo", 8, 64 * 1024, TopicMode::Conflate);
+	client = new SharedMemoryClient("Foo");
+	client->Connect();
+
+	for (ulong i = 0; i < 10; i++)
+		topic->Publish<Message>(1, i);
+
+	// The current value right away, then only changes.
+	auto current = client->Subscribe("Boo", SubscribeStart::Last(1));
+	auto changes = client->Subscribe("Boo");
+	auto filtered = client->Subscribe("Boo", SubscribeStart::Latest(), TypeFilter::Of({ 2 }));
+	CyclicBuffer::Accessor accessor;
+	ASSERT_TRUE(current->TryRead(accessor));
+	EXPECT_EQ(accessor.As<Message>()->value, 9);
+	EXPECT_FALSE(current->TryRead(accessor));
+	EXPECT_FALSE(changes->TryRead(accessor));
+
+	// A subscriber that lags many laps behind still gets the newest message and nothing else.
+	for (ulong i = 10; i < 1000; i++)
+		topic->Publish<Message>(i == 500 ? 2 : 1, i);
+	for (auto* cursor : { current.get(), changes.get() }) {
+		ASSERT_TRUE(cursor->TryRead(accessor));
+		EXPECT_EQ(accessor.As<Message>()->value, 999);
+		EXPECT_FALSE(cursor->TryReadFor(accessor, milliseconds(10)));
+	}
+	// The newest message of the filtered type is too far back, the next one wakes the subscriber.
+	EXPECT_FALSE(filtered->TryRead(accessor));
+	topic->Publish<Message>(2, 1000ul);
+	topic->Publish<Message>(1, 1001ul);
+	ASSERT_TRUE(filtered->TryReadFor(accessor, milliseconds(10)));
+	EXPECT_EQ(accessor.As<Message>()->value, 1000);
+	EXPECT_FALSE(filtered->TryRead(accessor));
+
+	ASSERT_TRUE(changes->TryRead(accessor));
+	EXPECT_EQ(accessor.As<Message>()->value, 1001);
+
+	// Read blocks until the next change.
+	std::thread publisher([topic]() {
+		std::this_thread::sleep_for(milliseconds(20));
+		topic->Publish<Message>(1, 1002ul);
+	});
+	accessor = changes->Read();
+	EXPECT_EQ(accessor.As<Message>()->value, 1002);
+	publisher.join();
+}
+
+TEST_F(SharedMemoryServerTest, ConflatingReaderLappedByTheWriter) {
+	ClearPreviousStuff();
+
+	srv = new SharedMemoryServer("Foo");
+	TopicService* topic = srv->CreateTopic("Boo", 8, 4096, TopicMode::Conflate);
+	client = new SharedMemoryClient("Foo");
+	client->Connect();
+	auto cursor = client->Subscribe("Boo");
+
+	auto publish = [&](uint8_t value) {
+		auto scope = topic->Prepare(1000, value);
+		std::memset(scope.Span().Start, value, 1000);
+		scope.Span().Commit(1000);
+	};
+	publish(1);
+	CyclicBuffer::Accessor accessor;
+	ASSERT_TRUE(cursor->TryRead(accessor));
+	EXPECT_TRUE(accessor.IsLive());
+	// Four messages fill the pool, the fifth is written over the one held.
+	for (uint8_t i = 2; i < 5; i++)
+		publish(i);
+	EXPECT_TRUE(accessor.IsLive());
+	publish(5);
+	EXPECT_FALSE(accessor.IsLive());
+
+	std::vector<uint8_t> data;
+	uint64_t type = 0;
+	ASSERT_TRUE(cursor->TryReadCopyFor(data, type, milliseconds(0)));
+	EXPECT_EQ(type, 5);
+	EXPECT_EQ(std::count(data.begin(), data.end(), 5), 1000);
+	EXPECT_FALSE(cursor->TryReadCopyFor(data, type, milliseconds(0)));
+
+	// Against a writer that keeps lapping the reader, every copy is of one message.
+	std::atomic<bool> done = false;
+	std::thread writer([&]() {
+		for (int i = 0; !done; i++)
+			publish(uint8_t(i % 250 + 1));
+	});
+	for (int i = 0; i < 2000; i++) {
+		ASSERT_TRUE(cursor->TryReadCopyFor(data, type, milliseconds(1000)));
+		ASSERT_EQ(data.size(), 1000);
+		ASSERT_EQ(std::count(data.begin(), data.end(), uint8_t(type)), 1000) << i;
+	}
+	done = true;
+	writer.join();
+}
+
+TEST_F(SharedMemoryServerTest, ClearedTopicKeepsModeAndSchema) {
+	ClearPreviousStuff();
+
+	srv = new SharedMemoryServer("Foo");
+	TopicService* topic = srv->CreateTopic("Boo", 8, 64 * 1024, TopicMode::Conflate);
+	topic->SetSchemaHash(42);
+	topic->Publish<Message>(1, 1ul);
+	// The region outlives the server while somebody is subscribed.
+	client = new SharedMemoryClient("Foo");
+	client->Connect();
+	auto cursor = client->Subscribe("Boo");
+	delete srv;
+	srv = nullptr;
+
+	EXPECT_TRUE(TopicService::ClearIfExists("Foo", "Boo", 8, 64 * 1024));
+	srv = new SharedMemoryServer("Foo");
+	topic = srv->CreateTopic("Boo", 8, 64 * 1024);
+	EXPECT_EQ(topic->Mode(), TopicMode::Conflate);
+	EXPECT_EQ(topic->SchemaHash(), 42);
+	EXPECT_EQ(topic->GetBuffer()->NextIndex(), 0);
+}
+
+TEST_F(SharedMemoryServerTest, RegionOfAnotherLayoutIsRecreated) {
+	ClearPreviousStuff();
+	{
+		// What a build without the layout version left: the metadata starts with the buffer size.
+		shared_memory_object shm(create_only, "Foo.Boo.buffer", read_write);
+		shm.truncate(4096);
+		mapped_region region(shm, read_write);
+		memset(region.get_address(), 0, region.get_size());
+		*(ulong*)region.get_address() = 64 * 1024;
+	}
+
+	srv = new SharedMemoryServer("Foo");
+	TopicService* topic = srv->CreateTopic("Boo", 8, 64 * 1024);
+	client = new SharedMemoryClient("Foo");
+	client->Connect();
+	auto cursor = client->Subscribe("Boo");
+	topic->Publish<Message>(1, 7ul);
+	CyclicBuffer::Accessor accessor;
+	ASSERT_TRUE(cursor->TryReadFor(accessor, milliseconds(100)));
+	EXPECT_EQ(accessor.As<Message>()->value, 7);
+
+	shared_memory_object shm(open_only, "Foo.Boo.buffer", read_only);
+	offset_t size;
+	shm.get_size(size);
+	EXPECT_GT(size, 64 * 1024);
+}
+
+TEST_F(SharedMemoryServerTest, LosslessTopicHoldsPublisherBack) {
+	ClearPreviousStuff();
+
+	srv = new SharedMemoryServer("Foo");
+	TopicService* topic = srv->CreateTopic("Boo", 8, 64 * 1024, TopicMode::Lossless);
+	topic->SetBackPressure(BackPressure::Fail);
+	client = new SharedMemoryClient("Foo");
+	client->Connect();
+	auto cursor = client->Subscribe("Boo");
+
+	// The ring keeps one entry spare, as IsLive does.
+	for (ulong i = 0; i < 7; i++)
+		topic->Publish<Message>(1, i);
+	EXPECT_THROW(topic->Publish<Message>(1, 7ul), ZeroCopyRpcException);
+
+	// The message of the last read is held until the next read.
+	CyclicBuffer::Accessor accessor;
+	for (ulong i = 0; i < 3; i++)
+		ASSERT_TRUE(cursor->TryRead(accessor));
+	topic->Publish<Message>(1, 7ul);
+	topic->Publish<Message>(1, 8ul);
+	EXPECT_THROW(topic->Publish<Message>(1, 9ul), ZeroCopyRpcException);
+
+	// A blocked publisher continues as soon as the subscriber reads.
+	topic->SetBackPressure(BackPressure::Block, seconds(5));
+	auto start = steady_clock::now();
+	std::thread reader([&]() {
+		std::this_thread::sleep_for(milliseconds(50));
+		CyclicBuffer::Accessor a;
+		ASSERT_TRUE(cursor->TryRead(a));
+		EXPECT_EQ(a.As<Message>()->value, 3);
+	});
+	topic->Publish<Message>(1, 9ul);
+	EXPECT_GE(steady_clock::now() - start, milliseconds(40));
+	reader.join();
+
+	// Nothing was lost.
+	for (ulong i = 4; i < 10; i++) {
+		ASSERT_TRUE(cursor->TryRead(accessor));
+		EXPECT_EQ(accessor.As<Message>()->value, i);
+	}
+	EXPECT_FALSE(cursor->TryRead(accessor));
+}
+
+TEST_F(SharedMemoryServerTest, LosslessSpanEndsWhereTheSpaceDoes) {
+	ClearPreviousStuff();
+
+	srv = new SharedMemoryServer("Foo");
+	TopicService* topic = srv->CreateTopic("Boo", 8, 4096, TopicMode::Lossless);
+	topic->SetBackPressure(BackPressure::Fail);
+	client = new SharedMemoryClient("Foo");
+	client->Connect();
+	auto cursor = client->Subscribe("Boo");
+
+	auto publish = [&](uint8_t value, size_t size) {
+		auto scope = topic->Prepare(size, 1);
+		std::memset(scope.Span().Start, value, size);
+		scope.Span().Commit(size);
+	};
+	for (uint8_t i = 0; i < 3; i++)
+		publish(i, 1200);
+	// Holds message 1, the pool wraps for the next one and the space before message 1 is free.
+	CyclicBuffer::Accessor accessor;
+	ASSERT_TRUE(cursor->TryRead(accessor));
+	ASSERT_TRUE(cursor->TryRead(accessor));
+	{
+		auto scope = topic->Prepare(600, 1);
+		EXPECT_EQ(scope.Span().Size, 600);
+		EXPECT_THROW(scope.Span().Commit(2000), std::runtime_error);
+	}
+
+	for (uint8_t i = 1; i < 3; i++) {
+		if (i > 1) {
+			ASSERT_TRUE(cursor->TryRead(accessor));
+		}
+		ASSERT_EQ(accessor.Size(), 1200);
+		EXPECT_EQ(std::count(accessor.Get(), accessor.Get() + accessor.Size(), i), 1200) << int(i);
+	}
+	EXPECT_FALSE(cursor->TryRead(accessor));
+}
+
+TEST_F(SharedMemoryServerTest, LosslessTopicSkipsFilteredAndDeadSubscribers) {
+	ClearPreviousStuff();
+
+	srv = new SharedMemoryServer("Foo");
+	TopicService* topic = srv->CreateTopic("Boo", 8, 64 * 1024, TopicMode::Lossless);
+	topic->SetBackPressure(BackPressure::Fail);
+	client = new SharedMemoryClient("Foo");
+	client->Connect();
+
+	// Types it does not read do not hold the publisher back.
+	auto filtered = client->Subscribe("Boo", SubscribeStart::Latest(), TypeFilter::Of({ 2 }));
+	for (ulong i = 0; i < 20; i++)
+		topic->Publish<Message>(1, i);
+	topic->Publish<Message>(2, 20ul);
+	CyclicBuffer::Accessor accessor;
+	ASSERT_TRUE(filtered->TryRead(accessor));
+	EXPECT_EQ(accessor.As<Message>()->value, 20);
+	EXPECT_FALSE(filtered->TryRead(accessor));
+
+	// Once it fell more than a lap behind, the entries it would step over hold newer messages.
+	for (ulong i = 21; i < 31; i++)
+		topic->Publish<Message>(1, i);
+	topic->Publish<Message>(2, 31ul);
+	for (ulong i = 32; i < 37; i++)
+		topic->Publish<Message>(1, i);
+	ASSERT_TRUE(filtered->TryRead(accessor));
+	EXPECT_EQ(accessor.As<Message>()->value, 31);
+	EXPECT_FALSE(filtered->TryRead(accessor));
+	filtered.reset();
+
+#if defined(__linux__)
+	// A subscriber whose process ended is evicted instead of stalling the topic.
+	pid_t pid = fork();
+	if (pid == 0)
+		_exit(0);
+	waitpid(pid, nullptr, 0);
+	topic->Subscribe(pid);
+	for (ulong i = 0; i < 20; i++)
+		topic->Publish<Message>(1, i);
+	EXPECT_EQ(topic->SlowestConsumer(), topic->GetBuffer()->NextIndex());
+#endif
+}
+
+TEST_F(SharedMemoryServerTest, SubscribeFromOverwrittenHistory) {
+	ClearPreviousStuff();
+
+	srv = new SharedMemoryServer("Foo");
+	TopicService* topic = srv->CreateTopic("Boo", 8, 64 * 1024);
+	client = new SharedMemoryClient("Foo");
+	client->Connect();
+
+	for (ulong i = 0; i < 20; i++)
+		topic->Publish<Message>(1, i);
+
+	// Only messages that were not overwritten are replayed.
+	auto oldest = client->Subscribe("Boo", SubscribeStart::Oldest());
+	auto at = client->Subscribe("Boo", SubscribeStart::At(2));
+	auto last = client->Subscribe("Boo", SubscribeStart::Last(100));
+	for (auto* cursor : { oldest.get(), at.get(), last.get() }) {
+		CyclicBuffer::Accessor accessor;
+		ASSERT_TRUE(cursor->TryRead(accessor));
+		EXPECT_EQ(accessor.As<Message>()->value, 13);
+		ulong count = 1;
+		while (cursor->TryRead(accessor))
+			count++;
+		EXPECT_EQ(accessor.As<Message>()->value, 19);
+		EXPECT_EQ(count, 7);
+	}
+}
+
 //typedef BigFrame<32768> MyBigFrame;
 typedef BigFrame<1920*1080*3/2> MyBigFrame;
 
@@ -0,0 +1,92 @@
+#pragma once
+#include <chrono>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include "SharedMemoryServer.h"
+#if defined(__linux__)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// Removes what a test left of a channel: its queue, its topic registry and the regions of the topics.
+inline void RemoveChannel(const std::string& channel, std::initializer_list<const char*> topics = { "Topic" })
+{
+	SharedMemoryServer::RemoveChannel(channel);
+	for (auto topic : topics)
+		TopicService::TryRemove(channel, topic);
+}
+
+// Polls the condition every millisecond, false when it did not hold within the timeout.
+template<typename F>
+bool WaitUntil(F&& condition, std::chrono::milliseconds timeout = std::chrono::milliseconds(2000))
+{
+	auto deadline = std::chrono::steady_clock::now() + timeout;
+	while (!condition()) {
+		if (std::chrono::steady_clock::now() >= deadline)
+			return false;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return true;
+}
+
+#if defined(__linux__)
+// A process forked before the test starts any thread. It runs its body once Start is called, when what it works with is
+// set up, and exits with the status the body returns; a body that should die without cleaning up calls _exit itself.
+class ForkedChild {
+public:
+	template<typename F>
+	explicit ForkedChild(F&& body)
+	{
+		if (pipe(_ready) != 0)
+			throw std::runtime_error("Cannot create the pipe of the child.");
+		_pid = fork();
+		if (_pid < 0)
+			throw std::runtime_error("Cannot fork the child.");
+		if (_pid == 0) {
+			close(_ready[1]);
+			char start;
+			if (read(_ready[0], &start, 1) != 1)
+				_exit(1);
+			try {
+				_exit(body());
+			}
+			catch (...) {
+				_exit(2);
+			}
+		}
+		close(_ready[0]);
+	}
+	~ForkedChild()
+	{
+		// A child that was not started sees the pipe closed and exits.
+		Wait();
+	}
+	pid_t Pid() const { return _pid; }
+	void Start()
+	{
+		if (write(_ready[1], "s", 1) != 1)
+			throw std::runtime_error("Cannot start the child.");
+	}
+	// Exit status of the child.
+	int Wait()
+	{
+		if (_ready[1] >= 0) {
+			close(_ready[1]);
+			_ready[1] = -1;
+		}
+		if (!_exited) {
+			waitpid(_pid, &_status, 0);
+			_exited = true;
+		}
+		return WEXITSTATUS(_status);
+	}
+
+private:
+	int _ready[2];
+	pid_t _pid = 0;
+	bool _exited = false;
+	int _status = 0;
+};
+#endif
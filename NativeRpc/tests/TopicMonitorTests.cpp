@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstring>
+#include "SharedMemoryServer.h"
+#include "SharedMemoryClient.h"
+#include "ProcessUtils.h"
+#include "TopicMonitor.h"
+#include "TestChannel.h"
+
+TEST(TopicMonitorTest, SamplesPublisherAndSubscribers) {
+	RemoveChannel("Metrics");
+	{
+		SharedMemoryServer srv("Metrics");
+		TopicService* topic = srv.CreateTopic("Topic", 8, 64 * 1024);
+		SharedMemoryClient client("Metrics");
+		client.Connect();
+		auto reader = client.Subscribe("Topic");
+		auto idle = client.Subscribe("Topic");
+		TopicMonitor monitor("Metrics", "Topic");
+		auto before = monitor.Sample();
+		EXPECT_EQ(before.Published, 0);
+		ASSERT_EQ(before.Subscribers.size(), 2);
+
+		for (ulong i = 0; i < 6; i++)
+			topic->Publish<ulong>(1, i);
+		CyclicBuffer::Accessor accessor;
+		for (int i = 0; i < 4; i++)
+			ASSERT_TRUE(reader->TryRead(accessor));
+
+		auto sample = monitor.Sample();
+		EXPECT_EQ(sample.Published, 6);
+		EXPECT_EQ(sample.Bytes, 6 * sizeof(ulong));
+		EXPECT_EQ(sample.MaxMessageSize, sizeof(ulong));
+		EXPECT_EQ(sample.NextIndex, 6);
+		ASSERT_EQ(sample.Subscribers.size(), 2);
+		auto& read = sample.Subscribers[0];
+		EXPECT_EQ(read.Pid, getCurrentProcessId());
+		EXPECT_TRUE(read.Running);
+		EXPECT_EQ(read.Delivered, 4);
+		EXPECT_EQ(read.Lag, 2);
+		EXPECT_EQ(read.Overruns, 0);
+		EXPECT_EQ(sample.Subscribers[1].Delivered, 0);
+		EXPECT_EQ(sample.Subscribers[1].Lag, 6);
+
+		// One notification per message.
+		ulong notified = 0;
+		for (auto count : sample.NotifyLatency)
+			notified += count;
+		EXPECT_EQ(notified, 6);
+		EXPECT_GT(TopicMonitor::NotifyLatencyPercentile(before, sample, 0.99), 0);
+		EXPECT_EQ(TopicMonitor::NotifyLatencyPercentile(sample, sample, 0.99), 0);
+
+		// The subscriber that fell a lap behind reads messages whose entries were reused.
+		for (ulong i = 6; i < 20; i++)
+			topic->Publish<ulong>(1, i);
+		while (idle->TryRead(accessor))
+		{
+		}
+		sample = monitor.Sample();
+		EXPECT_EQ(sample.Subscribers[1].Delivered, 20);
+		EXPECT_EQ(sample.Subscribers[1].Overruns, 12);
+		EXPECT_EQ(sample.Subscribers[1].Lag, 0);
+
+		// Messages that do not fit the rest of the pool start it over.
+		for (int i = 0; i < 20; i++) {
+			auto scope = topic->Prepare(10000, 2);
+			std::memset(scope.Span().Start, i, 10000);
+			scope.Span().Commit(10000);
+		}
+		sample = monitor.Sample();
+		EXPECT_EQ(sample.Published, 40);
+		EXPECT_EQ(sample.MaxMessageSize, 10000);
+		EXPECT_GE(sample.Wraps, 2);
+
+#if defined(__linux__)
+		auto topics = TopicMonitor::Topics("Metrics");
+		EXPECT_NE(std::ranges::find(topics, "Topic"), topics.end());
+#endif
+	}
+	RemoveChannel("Metrics");
+}
@@ -0,0 +1,87 @@
+#include <gtest/gtest.h>
+#include "SharedMemoryServer.h"
+#include "ProcessUtils.h"
+#include "TopicRegistry.h"
+#include "TestChannel.h"
+
+TEST(TopicRegistryTest, ListsTopicsOfTheServer) {
+	RemoveChannel("Registry", { "cam.left", "cam.right", "imu" });
+	{
+		SharedMemoryServer srv("Registry");
+		TopicRegistry registry("Registry");
+		EXPECT_TRUE(registry.Topics().empty());
+		auto generation = registry.Generation();
+
+		auto before = std::chrono::system_clock::now();
+		srv.CreateTopic("cam.right", 16, 64 * 1024);
+		srv.CreateTopic("cam.left", 32, 128 * 1024, TopicMode::Conflate);
+		srv.CreateTopic("imu", 8, 4 * 1024);
+		EXPECT_GT(registry.Generation(), generation);
+
+		auto topics = registry.Topics();
+		ASSERT_EQ(topics.size(), 3);
+		auto& left = topics[0];
+		EXPECT_EQ(left.Name, "cam.left");
+		EXPECT_EQ(left.Mode, TopicMode::Conflate);
+		EXPECT_EQ(left.MessageCount, 32);
+		EXPECT_EQ(left.BufferSize, 128 * 1024);
+		EXPECT_GT(left.MaxMessageSize, 0);
+		EXPECT_EQ(left.Publisher, getCurrentProcessId());
+		EXPECT_GE(left.Created + std::chrono::seconds(1), before);
+		EXPECT_EQ(topics[1].Name, "cam.right");
+		EXPECT_EQ(topics[2].Name, "imu");
+
+		// A topic created twice is listed once.
+		generation = registry.Generation();
+		srv.CreateTopic("imu", 8, 4 * 1024);
+		EXPECT_EQ(registry.Generation(), generation);
+		EXPECT_EQ(registry.Topics().size(), 3);
+
+		EXPECT_TRUE(srv.RemoveTopic("cam.right"));
+		EXPECT_GT(registry.Generation(), generation);
+		EXPECT_FALSE(registry.Find("cam.right").has_value());
+		ASSERT_TRUE(registry.Find("cam.left").has_value());
+
+		auto expanded = TopicRegistry::Expand("Registry", { "cam.*", "gps" });
+		EXPECT_EQ(expanded, std::vector<std::string>({ "cam.left", "gps" }));
+	}
+	// The server that stops takes the topics it removed off the list.
+	TopicRegistry registry("Registry");
+	EXPECT_TRUE(registry.Topics().empty());
+	RemoveChannel("Registry", { "cam.left", "cam.right", "imu" });
+}
+
+TEST(TopicRegistryTest, ListsWhatAReusedRegionWasCreatedWith) {
+	RemoveChannel("Registry", { "cam.left", "cam.right", "imu" });
+	{
+		TopicService existing("Registry", "imu", 8, 4 * 1024, TopicMode::Conflate);
+		SharedMemoryServer srv("Registry");
+		TopicService* topic = srv.CreateTopic("imu", 16, 64 * 1024);
+		EXPECT_EQ(topic->Mode(), TopicMode::Conflate);
+
+		TopicRegistry registry("Registry");
+		auto info = registry.Find("imu");
+		ASSERT_TRUE(info.has_value());
+		EXPECT_EQ(info->Mode, TopicMode::Conflate);
+		EXPECT_EQ(info->MessageCount, 8);
+		EXPECT_EQ(info->BufferSize, 4 * 1024);
+		EXPECT_EQ(info->MaxMessageSize, topic->MaxMessageSize());
+		EXPECT_EQ(topic->MaxMessageSize(), 4 * 1024 / 8 * 3 / 2);
+	}
+	RemoveChannel("Registry", { "cam.left", "cam.right", "imu" });
+}
+
+TEST(TopicRegistryTest, MatchesGlobs) {
+	EXPECT_TRUE(TopicRegistry::Matches("*", ""));
+	EXPECT_TRUE(TopicRegistry::Matches("cam.*", "cam.left"));
+	EXPECT_TRUE(TopicRegistry::Matches("cam.?eft", "cam.left"));
+	EXPECT_TRUE(TopicRegistry::Matches("*.left", "cam.left"));
+	EXPECT_TRUE(TopicRegistry::Matches("c*m*t", "cam.left"));
+	EXPECT_TRUE(TopicRegistry::Matches("imu", "imu"));
+	EXPECT_FALSE(TopicRegistry::Matches("cam.*", "camera"));
+	EXPECT_FALSE(TopicRegistry::Matches("cam.?", "cam.left"));
+	EXPECT_FALSE(TopicRegistry::Matches("imu", "imu2"));
+	EXPECT_FALSE(TopicRegistry::Matches("*x", "cam.left"));
+	EXPECT_FALSE(TopicRegistry::IsPattern("cam.left"));
+	EXPECT_TRUE(TopicRegistry::IsPattern("cam.*"));
+}
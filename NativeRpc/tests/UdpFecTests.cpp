@@ -0,0 +1,110 @@
+#include <gtest/gtest.h>
+#include "UdpFec.h"
+#include "UdpFrameProcessor.h"
+#include "UdpFrameDefragmentator.h"
+#include "CyclicBuffer.hpp"
+
+// Fragments of a frame as the sender would put them on the wire.
+static std::vector<std::vector<uint8_t>> Fragment(const std::vector<uint8_t>& frame, size_t mtu, UdpFecEncoder& encoder) {
+    UdpFrameIterator<> iterator(frame.data(), frame.size(), 1, 123456789, mtu);
+    encoder.Encode(frame.data(), frame.size(), iterator.FragmentSize());
+    iterator.Protect(encoder);
+
+    std::vector<std::vector<uint8_t>> datagrams;
+    while (iterator.CanRead()) {
+        auto buffers = *iterator;
+        std::vector<uint8_t> datagram(buffers[0].size() + buffers[1].size());
+        std::memcpy(datagram.data(), buffers[0].data(), buffers[0].size());
+        std::memcpy(datagram.data() + buffers[0].size(), buffers[1].data(), buffers[1].size());
+        datagrams.push_back(std::move(datagram));
+        ++iterator;
+    }
+    return datagrams;
+}
+
+static std::vector<uint8_t> Pattern(size_t size) {
+    std::vector<uint8_t> frame(size);
+    for (size_t i = 0; i < size; i++)
+        frame[i] = static_cast<uint8_t>(i * 31 + (i >> 8));
+    return frame;
+}
+
+TEST(UdpFecTest, XorBlockMatchesScalar) {
+    for (size_t size : { 0, 1, 7, 8, 15, 16, 31, 32, 33, 1000, 1472 }) {
+        auto a = Pattern(size);
+        std::vector<uint8_t> b(size);
+        for (size_t i = 0; i < size; i++)
+            b[i] = static_cast<uint8_t>(255 - i);
+        auto expected = a;
+        for (size_t i = 0; i < size; i++)
+            expected[i] ^= b[i];
+
+        XorBlock(a.data(), b.data(), size);
+        EXPECT_EQ(a, expected) << "size " << size;
+    }
+}
+
+TEST(UdpFecTest, ParityFragmentsFollowData) {
+    auto frame = Pattern(10000);
+    UdpFecEncoder encoder(UdpFecConfig(4, 2));
+    auto datagrams = Fragment(frame, 1000, encoder);
+
+    const size_t fragmentSize = 1000 - HEADER_SIZE;
+    const size_t chunks = (frame.size() + fragmentSize - 1) / fragmentSize;
+    ASSERT_EQ(encoder.ParityCount(), (chunks + 3) / 4 * 2);
+    ASSERT_EQ(datagrams.size(), chunks + encoder.ParityCount());
+    for (size_t i = 0; i < datagrams.size(); i++) {
+        auto* header = (UdpReplicationMessageHeader*)datagrams[i].data();
+        EXPECT_EQ(header->Sequence, i);
+        EXPECT_EQ(header->FecData, 4);
+        EXPECT_EQ(header->FecParity, 2);
+        if (i >= chunks) {
+            EXPECT_EQ(datagrams[i].size(), 1000);
+        }
+    }
+}
+
+TEST(UdpFecTest, RecoversBurstLossInEveryGroup) {
+    CyclicBuffer buffer(16, 1024 * 1024);
+    UdpFrameDefragmentator defragmentator(buffer, 1000);
+    auto cursor = buffer.OpenCursor();
+
+    auto frame = Pattern(50000 - 123);
+    UdpFecEncoder encoder(UdpFecConfig(8, 2));
+    auto datagrams = Fragment(frame, 1000, encoder);
+    const size_t chunks = datagrams.size() - encoder.ParityCount();
+
+    bool completed = false;
+    for (size_t i = 0; i < datagrams.size(); i++) {
+        // Two consecutive fragments of every group are lost, including the short last one.
+        if (i < chunks && (i % 8 == 3 || i % 8 == 4 || i == chunks - 1))
+            continue;
+        completed |= defragmentator.ProcessFragment(datagrams[i].data(), datagrams[i].size());
+    }
+
+    ASSERT_TRUE(completed);
+    ASSERT_TRUE(cursor.TryRead());
+    auto accessor = cursor.Data();
+    ASSERT_EQ(frame, std::vector<uint8_t>(accessor.Get(), accessor.Get() + accessor.Size()));
+}
+
+TEST(UdpFecTest, TooManyLossesDropFrame) {
+    CyclicBuffer buffer(16, 1024 * 1024);
+    UdpFrameDefragmentator defragmentator(buffer, 1000);
+    auto cursor = buffer.OpenCursor();
+
+    auto frame = Pattern(20000);
+    UdpFecEncoder encoder(UdpFecConfig(8, 1));
+    auto datagrams = Fragment(frame, 1000, encoder);
+
+    bool completed = false;
+    for (size_t i = 0; i < datagrams.size(); i++) {
+        // Single parity cannot rebuild two fragments of the same group.
+        if (i == 1 || i == 2)
+            continue;
+        completed |= defragmentator.ProcessFragment(datagrams[i].data(), datagrams[i].size());
+    }
+
+    ASSERT_FALSE(completed);
+    ASSERT_FALSE(cursor.TryRead());
+}
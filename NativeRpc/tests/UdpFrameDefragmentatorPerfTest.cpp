@@ -171,4 +171,49 @@ TEST_F(UdpFrameDefragmentatorPerfTest, Test1MB_OutOfOrder) {
     boost::uuids::uuid receivedHash;
     memcpy(&receivedHash, accessor.Get(), sizeof(boost::uuids::uuid));
     ASSERT_EQ(frame.Hash, receivedHash);
-}
\ No newline at end of file
+}
+// Fragments of as many frames as the reorder window holds are shuffled together, as with multi-path delivery.
+TEST_F(UdpFrameDefragmentatorPerfTest, Test1MB_ShuffledAcrossFrames) {
+    using namespace std::chrono;
+    SetUp(1500);
+    constexpr size_t Frames = UdpFrameDefragmentator::DefaultWindow;
+    constexpr size_t Size = 1048576;
+
+    std::vector<std::unique_ptr<BigFrame<Size>>> frames;
+    std::vector<std::vector<byte>> fragments;
+    for (size_t i = 0; i < Frames; i++) {
+        frames.push_back(std::make_unique<BigFrame<Size>>());
+        auto frameFragments = FragmentBigFrame<Size>(*frames.back(), 1000 + i, 1);
+        std::move(frameFragments.begin(), frameFragments.end(), std::back_inserter(fragments));
+    }
+
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::shuffle(fragments.begin(), fragments.end(), gen);
+
+    auto cursor = cyclicBuffer.OpenCursor();
+    size_t committed = 0;
+    auto start = high_resolution_clock::now();
+    for (const auto& fragment : fragments)
+        committed += defragmentator->ProcessFragment(fragment.data(), fragment.size());
+    auto end = high_resolution_clock::now();
+    double totalMilliseconds = duration<double, std::milli>(end - start).count();
+
+    ASSERT_EQ(committed, Frames);
+    // Frames are committed in the order they were sent.
+    for (auto& frame : frames) {
+        ASSERT_TRUE(cursor.TryRead());
+        auto accessor = cursor.Data();
+        ASSERT_EQ(Size + sizeof(uuid), accessor.Size());
+        uuid receivedHash;
+        memcpy(&receivedHash, accessor.Get(), sizeof(uuid));
+        ASSERT_EQ(frame->Hash, receivedHash);
+        ASSERT_EQ(0, memcmp(frame->Data, accessor.Get() + sizeof(uuid), Size));
+    }
+
+    std::cout << "1MB x " << Frames << " Shuffled Across Frames Stats:" << std::endl
+        << "  MTU: " << mtu << " bytes" << std::endl
+        << "  Fragments: " << fragments.size() << std::endl
+        << "  Total time: " << duration_cast<microseconds>(end - start) << std::endl
+        << "  Throughput: " << (Frames * Size / 1024.0 / 1024.0) / (totalMilliseconds / 1000.0) << " MB/s" << std::endl;
+}
@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 #include "UdpFrameDefragmentator.h" // Assuming this is the header file for your class
 #include "CyclicBuffer.hpp"
+#include <thread>
 
 class UdpFrameDefragmentatorTest : public ::testing::Test {
 protected:
@@ -101,4 +102,208 @@ TEST_F(UdpFrameDefragmentatorTest, MultipleFragmentFrame) {
     auto reassembledVector = std::vector<byte>(reassembledData, reassembledData + reassembledDataSize);
     ASSERT_EQ(expectedData, reassembledVector);
     ASSERT_EQ(expectedData.size(), accessor.Size());
-}
\ No newline at end of file
+}
+TEST_F(UdpFrameDefragmentatorTest, PlacementReceivesInPlace) {
+    uint64_t created = 1234567890;
+    std::vector<byte> expected = { 'H', 'e', 'l', 'l', 'o', ',', ' ', 'W', 'o', 'r', 'l', 'd' };
+    uint32_t totalSize = expected.size();
+
+    uint64_t placementFrameId = 0;
+    uint32_t sequence = 0;
+    size_t capacity = 0;
+    // Nothing is known before the first fragment.
+    ASSERT_EQ(defragmentator->Placement(0, placementFrameId, sequence, capacity), nullptr);
+
+    auto cursor = cyclicBuffer.OpenCursor();
+    auto first = CreateFragment(created, totalSize, 0, 0, std::vector<byte>(expected.begin(), expected.begin() + 4));
+    ASSERT_FALSE(defragmentator->ProcessFragment(first.data(), first.size()));
+
+    // Next two fragments are expected, write them where the defragmentator wants them.
+    for (size_t ahead = 0; ahead < 2; ahead++) {
+        auto* place = defragmentator->Placement(ahead, placementFrameId, sequence, capacity);
+        ASSERT_NE(place, nullptr);
+        ASSERT_EQ(placementFrameId, created);
+        ASSERT_EQ(sequence, ahead + 1);
+        ASSERT_EQ(capacity, 4);
+        std::memcpy(place, expected.data() + sequence * 4, capacity);
+    }
+    ASSERT_EQ(defragmentator->Placement(2, placementFrameId, sequence, capacity), nullptr);
+
+    auto* second = defragmentator->Placement(0, placementFrameId, sequence, capacity);
+    auto* third = defragmentator->Placement(1, placementFrameId, sequence, capacity);
+    ASSERT_FALSE(defragmentator->ProcessFragment(UdpReplicationMessageHeader(created, totalSize, 1, 0), second, 4));
+    ASSERT_TRUE(defragmentator->ProcessFragment(UdpReplicationMessageHeader(created, totalSize, 2, 0), third, 4));
+
+    ASSERT_TRUE(cursor.TryRead());
+    auto accessor = cursor.Data();
+    ASSERT_EQ(expected, std::vector<byte>(accessor.Get(), accessor.Get() + accessor.Size()));
+}
+TEST_F(UdpFrameDefragmentatorTest, FragmentSizeFromHeader) {
+    // Sender uses a larger MTU than the one the defragmentator was created with.
+    uint64_t created = 1234567890;
+    std::vector<byte> expected = { 'H', 'e', 'l', 'l', 'o', ',', ' ', 'W', 'o', 'r', 'l', 'd' };
+    uint32_t totalSize = expected.size();
+    const uint16_t fragmentSize = 8;
+
+    auto cursor = cyclicBuffer.OpenCursor();
+    UdpReplicationMessageHeader second(created, totalSize, 1, 0, fragmentSize);
+    UdpReplicationMessageHeader first(created, totalSize, 0, 0, fragmentSize);
+    // Fragment that does not fit its place is dropped.
+    ASSERT_FALSE(defragmentator->ProcessFragment(second, expected.data() + fragmentSize, 2));
+    ASSERT_FALSE(defragmentator->ProcessFragment(second, expected.data() + fragmentSize, totalSize - fragmentSize));
+    ASSERT_TRUE(defragmentator->ProcessFragment(first, expected.data(), fragmentSize));
+
+    ASSERT_TRUE(cursor.TryRead());
+    auto accessor = cursor.Data();
+    ASSERT_EQ(expected, std::vector<byte>(accessor.Get(), accessor.Get() + accessor.Size()));
+}
+TEST_F(UdpFrameDefragmentatorTest, CollectNackReportsGaps) {
+    uint64_t created = 1234567890;
+    std::vector<byte> expected = { 'H', 'e', 'l', 'l', 'o', ',', ' ', 'W', 'o', 'r', 'l', 'd', '!', '!', '!', '!' };
+    uint32_t totalSize = expected.size();
+    auto fragment = [&](uint16_t sequence) {
+        return CreateFragment(created, totalSize, sequence, 0, std::vector<byte>(expected.begin() + sequence * 4, expected.begin() + sequence * 4 + 4));
+    };
+    const uint64_t interval = 1000000;
+    auto now = [] { return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(); };
+
+    UdpNackMessage nack{};
+    ASSERT_FALSE(defragmentator->CollectNack(nack, now() + interval, interval, 3, true));
+
+    auto cursor = cyclicBuffer.OpenCursor();
+    auto first = fragment(0);
+    auto third = fragment(2);
+    defragmentator->ProcessFragment(first.data(), first.size());
+    defragmentator->ProcessFragment(third.data(), third.size());
+
+    // Too early, the gap might be reordering.
+    ASSERT_FALSE(defragmentator->CollectNack(nack, now(), interval, 3, false));
+
+    // Only the gap is reported while the frame is streaming.
+    auto later = now() + interval;
+    ASSERT_TRUE(defragmentator->CollectNack(nack, later, interval, 3, false));
+    EXPECT_EQ(nack.FrameId, created);
+    EXPECT_EQ(nack.First, 0);
+    EXPECT_EQ(nack.Words, 1);
+    EXPECT_EQ(nack.Missing[0], 0b0010u);
+    ASSERT_FALSE(defragmentator->CollectNack(nack, later, interval, 3, true));
+
+    // Tail is reported when the stream is idle.
+    ASSERT_TRUE(defragmentator->CollectNack(nack, later + interval, interval, 3, true));
+    EXPECT_EQ(nack.Missing[0], 0b1010u);
+
+    auto second = fragment(1);
+    auto fourth = fragment(3);
+    defragmentator->ProcessFragment(second.data(), second.size());
+    ASSERT_TRUE(defragmentator->ProcessFragment(fourth.data(), fourth.size()));
+    ASSERT_FALSE(defragmentator->CollectNack(nack, later + 2 * interval, interval, 3, true));
+
+    ASSERT_TRUE(cursor.TryRead());
+    auto accessor = cursor.Data();
+    ASSERT_EQ(expected, std::vector<byte>(accessor.Get(), accessor.Get() + accessor.Size()));
+}
+TEST(UdpFrameDefragmentatorWideTest, SequenceBeyond16Bits) {
+    CyclicBuffer buffer(4, 2 * 1024 * 1024);
+    UdpFrameDefragmentator defragmentator(buffer, 8 + sizeof(UdpReplicationMessageHeader));
+    auto cursor = buffer.OpenCursor();
+
+    const uint32_t fragments = 70000;
+    const uint16_t fragmentSize = 8;
+    std::vector<uint8_t> frame(fragments * fragmentSize);
+    for (size_t i = 0; i < frame.size(); i++)
+        frame[i] = static_cast<uint8_t>(i / fragmentSize);
+
+    bool completed = false;
+    for (uint32_t seq = 0; seq < fragments; seq++) {
+        UdpReplicationMessageHeader header(1, static_cast<uint32_t>(frame.size()), seq, 0, fragmentSize);
+        EXPECT_EQ(header.FragmentCount, fragments);
+        completed = defragmentator.ProcessFragment(header, frame.data() + seq * fragmentSize, fragmentSize);
+    }
+
+    ASSERT_TRUE(completed);
+    ASSERT_TRUE(cursor.TryRead());
+    auto accessor = cursor.Data();
+    ASSERT_EQ(frame, std::vector<uint8_t>(accessor.Get(), accessor.Get() + accessor.Size()));
+}
+TEST_F(UdpFrameDefragmentatorTest, RejectsForeignHeaders) {
+    std::vector<byte> expected = { 'H', 'e', 'l', 'l', 'o', ',', ' ', 'W' };
+    auto cursor = cyclicBuffer.OpenCursor();
+
+    UdpReplicationMessageHeader header(1, 8, 0, 0, 4);
+    header.Version = UdpReplicationMessageHeader::CurrentVersion + 1;
+    ASSERT_FALSE(defragmentator->ProcessFragment(header, expected.data(), 4));
+
+    // Fragment count that does not match size and fragment size.
+    header = UdpReplicationMessageHeader(1, 8, 0, 0, 4);
+    header.FragmentCount = 3;
+    ASSERT_FALSE(defragmentator->ProcessFragment(header, expected.data(), 4));
+    ASSERT_FALSE(cursor.TryRead());
+}
+TEST_F(UdpFrameDefragmentatorTest, InterleavedFramesCommitInOrder) {
+    std::vector<std::vector<byte>> frames = {
+        { 'f', 'r', 'a', 'm', 'e', '-', '0', '!' },
+        { 'f', 'r', 'a', 'm', 'e', '-', '1', '!' },
+        { 'f', 'r', 'a', 'm', 'e', '-', '2', '!' } };
+    auto fragment = [&](uint64_t id, uint16_t sequence) {
+        auto& frame = frames[id - 10];
+        return CreateFragment(id, frame.size(), sequence, 0, std::vector<byte>(frame.begin() + sequence * 4, frame.begin() + sequence * 4 + 4));
+    };
+    auto cursor = cyclicBuffer.OpenCursor();
+
+    // First fragments of every frame arrive before any frame is complete, the newest frame completes first.
+    for (uint64_t id : { 10, 11, 12 }) {
+        auto first = fragment(id, 0);
+        ASSERT_EQ(defragmentator->ProcessFragment(first.data(), first.size()), 0);
+    }
+    auto last = fragment(12, 1);
+    ASSERT_EQ(defragmentator->ProcessFragment(last.data(), last.size()), 0);
+    last = fragment(11, 1);
+    ASSERT_EQ(defragmentator->ProcessFragment(last.data(), last.size()), 0);
+    ASSERT_FALSE(cursor.TryRead());
+    last = fragment(10, 1);
+    ASSERT_EQ(defragmentator->ProcessFragment(last.data(), last.size()), 3);
+
+    for (auto& expected : frames) {
+        ASSERT_TRUE(cursor.TryRead());
+        auto accessor = cursor.Data();
+        ASSERT_EQ(expected, std::vector<byte>(accessor.Get(), accessor.Get() + accessor.Size()));
+    }
+    ASSERT_FALSE(cursor.TryRead());
+}
+TEST(UdpFrameDefragmentatorWindowTest, LostFrameIsGivenUp) {
+    CyclicBuffer buffer(16, 65536);
+    UdpFrameDefragmentator defragmentator(buffer, 4 + sizeof(UdpReplicationMessageHeader), 2, std::chrono::milliseconds(20));
+    auto cursor = buffer.OpenCursor();
+    std::vector<byte> data = { 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h' };
+    auto fragment = [&](uint64_t id, uint16_t sequence) {
+        return CreateFragment(id, data.size(), sequence, 0, std::vector<byte>(data.begin() + sequence * 4, data.begin() + sequence * 4 + 4));
+    };
+
+    // Frame 2 misses its second fragment, frame 3 waits for it.
+    auto f = fragment(2, 0);
+    defragmentator.ProcessFragment(f.data(), f.size());
+    f = fragment(3, 0);
+    defragmentator.ProcessFragment(f.data(), f.size());
+    f = fragment(3, 1);
+    ASSERT_EQ(defragmentator.ProcessFragment(f.data(), f.size()), 0);
+    ASSERT_EQ(defragmentator.Expire(), 0);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    ASSERT_EQ(defragmentator.Expire(), 1);
+    ASSERT_TRUE(cursor.TryRead());
+    ASSERT_FALSE(cursor.TryRead());
+
+    // Window of two: frame 6 arrives while 4 and 5 are incomplete, 4 is given up and 5 stays in flight.
+    f = fragment(4, 0);
+    defragmentator.ProcessFragment(f.data(), f.size());
+    f = fragment(5, 0);
+    defragmentator.ProcessFragment(f.data(), f.size());
+    f = fragment(6, 0);
+    ASSERT_EQ(defragmentator.ProcessFragment(f.data(), f.size()), 0);
+    f = fragment(4, 1);
+    ASSERT_EQ(defragmentator.ProcessFragment(f.data(), f.size()), 0);
+    f = fragment(5, 1);
+    ASSERT_EQ(defragmentator.ProcessFragment(f.data(), f.size()), 1);
+    f = fragment(6, 1);
+    ASSERT_EQ(defragmentator.ProcessFragment(f.data(), f.size()), 1);
+}
@@ -19,11 +19,26 @@ TEST(UdpFrameIteratorTest, Dereference) {
     const UdpReplicationMessageHeader* header = static_cast<const UdpReplicationMessageHeader*>(fragment[0].data());
     EXPECT_EQ(header->Size, sizeof(buffer));
     EXPECT_EQ(header->Type, type);
-    EXPECT_EQ(header->Created, created);
+    EXPECT_EQ(header->FrameId, created);
     EXPECT_EQ(header->Sequence, 0);
     // Verify payload
     EXPECT_EQ(fragment[1].size(), std::min(TEST_UDP_MTU - sizeof(UdpReplicationMessageHeader), sizeof(buffer)));
 }
+TEST(UdpFrameIteratorTest, WideHeader) {
+    std::vector<uint8_t> buffer(5000);
+    const uint64_t type = 0xABCDEF0123ull;
+    UdpFrameIterator<TEST_UDP_MTU> iterator(buffer.data(), buffer.size(), type, 42, TEST_UDP_MTU, 7);
+    const size_t fragments = (buffer.size() + iterator.FragmentSize() - 1) / iterator.FragmentSize();
+    for (uint32_t sequence = 0; iterator.CanRead(); ++iterator, ++sequence) {
+        auto header = static_cast<const UdpReplicationMessageHeader*>((*iterator)[0].data());
+        EXPECT_EQ(header->Version, UdpReplicationMessageHeader::CurrentVersion);
+        EXPECT_EQ(header->Type, type);
+        EXPECT_EQ(header->TopicId, 7u);
+        EXPECT_EQ(header->FrameId, 42u);
+        EXPECT_EQ(header->Sequence, sequence);
+        EXPECT_EQ(header->FragmentCount, fragments);
+    }
+}
 TEST(UdpFrameIteratorTest, Increment) {
     uint8_t buffer[3000] = { 0 }; // Larger than MTU
     uint8_t type = 1;
@@ -69,3 +84,90 @@ TEST(UdpFrameIteratorTest, OutOfRangeAccess) {
     EXPECT_THROW(*iterator, std::out_of_range);
     EXPECT_THROW(++iterator, std::out_of_range);
 }
+TEST(UdpFrameIteratorTest, RuntimeMtu) {
+    std::vector<uint8_t> buffer(20000);
+    constexpr size_t jumbo = 9000 - IPV4_UDP_HEADERS_SIZE;
+    constexpr size_t payload = jumbo - sizeof(UdpReplicationMessageHeader);
+    UdpFrameIterator<> iterator(buffer.data(), buffer.size(), 1, 123456789, jumbo);
+    EXPECT_EQ(iterator.Mtu(), jumbo);
+    EXPECT_EQ(iterator.FragmentSize(), payload);
+
+    size_t fragments = 0;
+    size_t bytes = 0;
+    while (iterator.CanRead()) {
+        auto fragment = *iterator;
+        const UdpReplicationMessageHeader* header = static_cast<const UdpReplicationMessageHeader*>(fragment[0].data());
+        // Receiver computes offsets from the sender's fragment size.
+        EXPECT_EQ(header->FragmentSize, payload);
+        EXPECT_EQ(fragment[1].data(), buffer.data() + header->Sequence * payload);
+        bytes += fragment[1].size();
+        ++fragments;
+        ++iterator;
+    }
+    EXPECT_EQ(fragments, 3);
+    EXPECT_EQ(bytes, buffer.size());
+}
+TEST(UdpFrameIteratorTest, InvalidMtu) {
+    uint8_t buffer[1024] = { 0 };
+    EXPECT_THROW(UdpFrameIterator<>(buffer, sizeof(buffer), 1, 1, sizeof(UdpReplicationMessageHeader)), std::invalid_argument);
+    EXPECT_THROW(UdpFrameIterator<>(buffer, sizeof(buffer), 1, 1, MAX_UDP_DATAGRAM_SIZE + 1), std::invalid_argument);
+}
+#if defined(__linux__)
+TEST(UdpFrameIteratorTest, FillBatchOneDatagramPerFragment) {
+    std::vector<uint8_t> buffer(10000);
+    sockaddr_in target{};
+    UdpFrameIterator<TEST_UDP_MTU> iterator(buffer.data(), buffer.size(), 1, 123456789);
+    auto batch = std::make_unique<UdpFrameBatch>();
+
+    auto fragments = iterator.Fill(*batch, (sockaddr*)&target, sizeof(target));
+
+    constexpr size_t payload = TEST_UDP_MTU - sizeof(UdpReplicationMessageHeader);
+    EXPECT_EQ(fragments, (buffer.size() + payload - 1) / payload);
+    EXPECT_EQ(batch->MessageCount, fragments);
+    EXPECT_FALSE(iterator.CanRead());
+    for (size_t i = 0; i < batch->MessageCount; i++) {
+        auto& msg = batch->Messages[i].msg_hdr;
+        ASSERT_EQ(msg.msg_iovlen, 2);
+        auto* header = (UdpReplicationMessageHeader*)msg.msg_iov[0].iov_base;
+        EXPECT_EQ(header->Sequence, i);
+        EXPECT_EQ(header->Size, buffer.size());
+        // payload points into the source buffer, no copy.
+        EXPECT_EQ(msg.msg_iov[1].iov_base, buffer.data() + i * payload);
+        EXPECT_EQ(msg.msg_iov[1].iov_len, std::min(payload, buffer.size() - i * payload));
+        EXPECT_EQ(msg.msg_control, nullptr);
+    }
+}
+
+TEST(UdpFrameIteratorTest, FillBatchWithSegmentationOffload) {
+    std::vector<uint8_t> buffer(100000);
+    sockaddr_in target{};
+    UdpFrameIterator<TEST_UDP_MTU> iterator(buffer.data(), buffer.size(), 1, 123456789);
+    auto batch = std::make_unique<UdpFrameBatch>();
+
+    auto fragments = iterator.Fill(*batch, (sockaddr*)&target, sizeof(target), UdpFrameBatch::MaxSegments);
+
+    constexpr size_t payload = TEST_UDP_MTU - sizeof(UdpReplicationMessageHeader);
+    constexpr size_t segments = UdpFrameBatch::MaxSegmentedSize / TEST_UDP_MTU;
+    EXPECT_EQ(fragments, (buffer.size() + payload - 1) / payload);
+    EXPECT_EQ(batch->MessageCount, (fragments + segments - 1) / segments);
+
+    uint16_t expectedSequence = 0;
+    for (size_t i = 0; i < batch->MessageCount; i++) {
+        auto& msg = batch->Messages[i].msg_hdr;
+        size_t bytes = 0;
+        for (size_t v = 0; v < msg.msg_iovlen; v += 2) {
+            auto* header = (UdpReplicationMessageHeader*)msg.msg_iov[v].iov_base;
+            EXPECT_EQ(header->Sequence, expectedSequence++);
+            bytes += msg.msg_iov[v].iov_len + msg.msg_iov[v + 1].iov_len;
+        }
+        EXPECT_LE(bytes, UdpFrameBatch::MaxSegmentedSize);
+        if (msg.msg_iovlen > 2) {
+            auto* cm = CMSG_FIRSTHDR(&msg);
+            ASSERT_NE(cm, nullptr);
+            EXPECT_EQ(cm->cmsg_type, UDP_SEGMENT);
+            EXPECT_EQ(*(uint16_t*)CMSG_DATA(cm), TEST_UDP_MTU);
+        }
+    }
+    EXPECT_EQ(expectedSequence, fragments);
+}
+#endif
@@ -0,0 +1,60 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include "UdpPacing.h"
+
+using namespace std::chrono;
+
+static double PaceMilliseconds(UdpPacer& pacer, size_t frame, size_t chunk) {
+    auto start = steady_clock::now();
+    pacer.BeginFrame(frame);
+    for (size_t sent = 0; sent < frame; sent += chunk)
+        pacer.Pace(chunk);
+    pacer.EndFrame();
+    return duration<double, std::milli>(steady_clock::now() - start).count();
+}
+
+TEST(UdpPacerTest, PacesToConfiguredRate) {
+    UdpPacingConfig config;
+    config.BytesPerSecond = 50 * 1024 * 1024;
+    UdpPacer pacer(config);
+
+    // First burst is free, the rest of 1MB leaves at 50MB/s.
+    double elapsed = PaceMilliseconds(pacer, 1024 * 1024, 16 * 1024);
+    EXPECT_GE(elapsed, 15.0);
+    EXPECT_LT(elapsed, 60.0);
+
+    auto stats = pacer.Stats();
+    EXPECT_EQ(stats.Frames, 1);
+    EXPECT_EQ(stats.Bytes, 1024 * 1024);
+    EXPECT_GT(stats.QueueingDelay.count(), 0);
+    EXPECT_LT(stats.AchievedBytesPerSecond, 60.0 * 1024 * 1024);
+}
+
+TEST(UdpPacerTest, FrameBudgetSpreadsEveryFrame) {
+    UdpPacingConfig config;
+    config.FrameBudget = milliseconds(20);
+    config.BurstBytes = 8 * 1024;
+    UdpPacer pacer(config);
+
+    for (size_t frame : { 256 * 1024, 1024 * 1024 }) {
+        double elapsed = PaceMilliseconds(pacer, frame, 8 * 1024);
+        EXPECT_GE(elapsed, 15.0) << frame;
+        EXPECT_LT(elapsed, 60.0) << frame;
+    }
+    EXPECT_EQ(pacer.Stats().Frames, 2);
+}
+
+TEST(UdpPacerTest, IdleTimeEarnsOneBurst) {
+    UdpPacingConfig config;
+    config.BytesPerSecond = 10 * 1024 * 1024;
+    UdpPacer pacer(config);
+    std::this_thread::sleep_for(milliseconds(50));
+
+    // 50ms of idle time at 10MB/s is worth 500KB, yet only one 64KB burst may leave at once.
+    double elapsed = PaceMilliseconds(pacer, 256 * 1024, 16 * 1024);
+    EXPECT_GE(elapsed, 12.0);
+}
+
+TEST(UdpPacerTest, RequiresRateOrBudget) {
+    EXPECT_THROW(UdpPacer(UdpPacingConfig{}), std::invalid_argument);
+}